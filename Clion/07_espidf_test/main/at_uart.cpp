@@ -0,0 +1,168 @@
+#include "at_uart.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define AT_RX_BUFFER 4096   // driver ring buffer. Long replies (like AT+COPN) land here
+#define AT_EVENT_QUEUE 20
+#define AT_PATTERN_QUEUE 32 // line ends the driver remembers before we read them
+
+static const char* TAG = "at";
+
+static uart_port_t _port;
+static QueueHandle_t _events = NULL;
+static QueueHandle_t _lines = NULL;
+static at_uart_stats_t _stats;
+
+// Read one line, up to and including the pattern at 'pos', into a queue item
+static void read_line(int pos)
+{
+    static at_line_t line; // only used by the reader task
+    int length = pos + 1;  // include the '\n'
+    int keep = length < AT_LINE_MAX ? length : AT_LINE_MAX - 1;
+
+    int got = uart_read_bytes(_port, (uint8_t*)line.text, keep, pdMS_TO_TICKS(20));
+    if (got < 0) got = 0;
+    if (length > keep) { // too long for a line: throw away the rest of it
+        uint8_t scratch[64];
+        int extra = length - keep;
+        while (extra > 0) {
+            int n = uart_read_bytes(_port, scratch, extra < (int)sizeof(scratch) ? extra : sizeof(scratch), pdMS_TO_TICKS(20));
+            if (n <= 0) break;
+            extra -= n;
+        }
+        _stats.long_lines++;
+    }
+    _stats.rx_bytes += length;
+
+    while (got > 0 && (line.text[got - 1] == '\n' || line.text[got - 1] == '\r')) got--;
+    line.text[got] = 0;
+    if (got == 0) return; // blank line between replies
+
+    line.at_us = esp_timer_get_time();
+    _stats.lines++;
+    if (xQueueSend(_lines, &line, 0) != pdTRUE) _stats.line_drops++;
+}
+
+// UART driver events. Only pattern (line end) events read data, so anything
+// without a line end (like the '>' prompt) is not seen
+static void at_event_task(void* arg)
+{
+    uart_event_t event;
+    for (;;) {
+        if (xQueueReceive(_events, &event, portMAX_DELAY) != pdTRUE) continue;
+
+        switch (event.type) {
+            case UART_PATTERN_DET: {
+                int pos = uart_pattern_pop_pos(_port);
+                if (pos < 0) { // pattern queue overflowed, so positions are lost
+                    uart_flush_input(_port);
+                    _stats.overflows++;
+                } else {
+                    read_line(pos);
+                }
+                break;
+            }
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                ESP_LOGW(TAG, "RX overflow; flushing");
+                uart_flush_input(_port);
+                uart_pattern_queue_reset(_port, AT_PATTERN_QUEUE);
+                xQueueReset(_events);
+                _stats.overflows++;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+esp_err_t at_uart_start(uart_port_t port, int baud, int tx_pin, int rx_pin)
+{
+    uart_config_t config = {};
+    config.baud_rate = baud;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    _port = port;
+    memset(&_stats, 0, sizeof(_stats));
+
+    ESP_ERROR_CHECK(uart_driver_install(port, AT_RX_BUFFER, 0, AT_EVENT_QUEUE, &_events, 0));
+    ESP_ERROR_CHECK(uart_param_config(port, &config));
+    ESP_ERROR_CHECK(uart_set_pin(port, tx_pin, rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    // One '\n' makes a line. No gap timing needed, as the modem sends lines whole
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(port, '\n', 1, 1, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(port, AT_PATTERN_QUEUE));
+
+    _lines = xQueueCreate(AT_LINE_QUEUE, sizeof(at_line_t));
+    if (_lines == NULL) return ESP_ERR_NO_MEM;
+
+    if (xTaskCreatePinnedToCore(at_event_task, "at_uart", 3072, NULL, 12, NULL, 0) != pdPASS) return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+void at_flush_lines(void)
+{
+    xQueueReset(_lines);
+}
+
+static void at_write(const uint8_t* data, size_t length)
+{
+    uart_write_bytes(_port, data, length);
+    _stats.tx_bytes += length;
+}
+
+// Wait for the next line, counting down 'deadline_us'
+static bool next_line(at_line_t* line, int64_t deadline_us)
+{
+    int64_t left_us = deadline_us - esp_timer_get_time();
+    if (left_us <= 0) return false;
+    return xQueueReceive(_lines, line, pdMS_TO_TICKS(left_us / 1000 + 1)) == pdTRUE;
+}
+
+esp_err_t at_command(const char* cmd, const char* want, char* out, size_t out_len, uint32_t timeout_ms)
+{
+    static at_line_t line; // one caller (the modem task)
+    at_flush_lines();
+    at_write((const uint8_t*)cmd, strlen(cmd));
+    at_write((const uint8_t*)"\r", 1);
+
+    size_t want_len = want == NULL ? 0 : strlen(want);
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (next_line(&line, deadline)) {
+        ESP_LOGD(TAG, "> %s", line.text);
+        if (strcmp(line.text, "OK") == 0) return ESP_OK;
+        if (strstr(line.text, "ERROR") != NULL) return ESP_FAIL;
+        if (want_len > 0 && out != NULL && strncmp(line.text, want, want_len) == 0) {
+            strncpy(out, line.text, out_len - 1);
+            out[out_len - 1] = 0;
+        }
+    }
+    ESP_LOGW(TAG, "No reply to %s", cmd);
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t at_wait_for(const char* text, uint32_t timeout_ms)
+{
+    static at_line_t line;
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (next_line(&line, deadline)) {
+        if (strstr(line.text, text) != NULL) return ESP_OK;
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+at_uart_stats_t at_uart_stats(void)
+{
+    return _stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/uart.h"
+#include "esp_err.h"
+
+// AT command link to the SIMCOM modem, on the ESP-IDF UART driver.
+//
+// The driver's pattern detection marks every '\n', and an event task reads
+// whole lines from the RX ring buffer as they complete. Lines go into a
+// FreeRTOS queue, so callers block on a line instead of polling with delays.
+// (Pattern detection only matches runs of one character, so we detect '\n'
+// and strip the '\r' ourselves.)
+
+#define AT_LINE_MAX 160
+#define AT_LINE_QUEUE 24
+
+typedef struct {
+    int64_t at_us;            // esp_timer time the line completed
+    char text[AT_LINE_MAX];   // without the line ending
+} at_line_t;
+
+typedef struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t lines;
+    uint32_t line_drops;      // line queue full
+    uint32_t overflows;       // UART FIFO or ring buffer overflows
+    uint32_t long_lines;      // lines cut at AT_LINE_MAX
+} at_uart_stats_t;
+
+// Install the UART driver with an event queue and start the line reader task
+esp_err_t at_uart_start(uart_port_t port, int baud, int tx_pin, int rx_pin);
+
+// Send a command (adds "\r"), and wait for "OK" or "ERROR".
+// Any line starting with 'want' (like "+CGPSINFO:") is copied into 'out'.
+esp_err_t at_command(const char* cmd, const char* want, char* out, size_t out_len, uint32_t timeout_ms);
+
+// Wait for a line containing 'text' (like "PB DONE"). Lines before it are discarded.
+esp_err_t at_wait_for(const char* text, uint32_t timeout_ms);
+
+// Drop any lines waiting in the queue
+void at_flush_lines(void);
+
+at_uart_stats_t at_uart_stats(void);
@@ -0,0 +1,162 @@
+#include "ewc_uart.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define EWC_RX_BUFFER 1024
+#define EWC_UART_EVENTS 16
+#define EWC_RX_TIMEOUT_SYMBOLS 3
+
+static const char* TAG = "ewc";
+
+static uart_port_t _port;
+static gpio_num_t _cts_pin;
+static QueueHandle_t _uart_events = NULL;
+static QueueHandle_t _ewc_events = NULL;
+static EwcFramer _framer;
+static int64_t _last_byte_us = 0;
+static volatile bool _cts_active = false;
+static ewc_uart_stats_t _stats;
+
+static void IRAM_ATTR on_cts_edge(void* arg)
+{
+    bool active = gpio_get_level(_cts_pin) == 0; // active low
+    if (active == _cts_active) return;           // bounce
+    _cts_active = active;
+
+    ewc_event_t event;
+    event.type = active ? EWC_EVENT_CTS_ON : EWC_EVENT_CTS_OFF;
+    event.frame.length = 0;
+
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(_ewc_events, &event, &woken) != pdTRUE) _stats.queue_drops++;
+    if (woken) portYIELD_FROM_ISR();
+}
+
+// Frame the bytes waiting in the driver's ring buffer
+static void read_waiting(void)
+{
+    static ewc_event_t event; // only used by the event task
+    uint8_t buf[64];
+    size_t waiting = 0;
+    uart_get_buffered_data_len(_port, &waiting);
+
+    while (waiting > 0) {
+        int count = uart_read_bytes(_port, buf, waiting < sizeof(buf) ? waiting : sizeof(buf), 0);
+        if (count <= 0) break;
+        waiting -= count;
+
+        int64_t now = esp_timer_get_time();
+        if (ewcFramerHasPartial(&_framer) && now - _last_byte_us > EWC_FRAME_GAP_US) {
+            ewcFramerReset(&_framer);
+            _stats.gap_resets++;
+        }
+        _last_byte_us = now;
+        _stats.rx_bytes += count;
+
+        for (int i = 0; i < count; i++) {
+            if (!ewcFramerPush(&_framer, buf[i], &event.frame)) continue;
+
+            event.type = EWC_EVENT_FRAME;
+            event.frame.receivedMs = (uint32_t)(now / 1000);
+            if (xQueueSend(_ewc_events, &event, 0) == pdTRUE) _stats.frames++;
+            else _stats.queue_drops++;
+        }
+    }
+    _stats.overflows = _framer.overflows;
+}
+
+static void ewc_event_task(void* arg)
+{
+    uart_event_t event;
+    for (;;) {
+        if (xQueueReceive(_uart_events, &event, portMAX_DELAY) != pdTRUE) continue;
+
+        switch (event.type) {
+            case UART_DATA:
+                read_waiting();
+                break;
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                ESP_LOGW(TAG, "RX overflow; flushing");
+                uart_flush_input(_port);
+                xQueueReset(_uart_events);
+                ewcFramerReset(&_framer);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+esp_err_t ewc_uart_start(uart_port_t port, int baud, int tx_pin, int rx_pin, gpio_num_t cts_pin, int queue_depth)
+{
+    uart_config_t config = {};
+    config.baud_rate = baud;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE; // CTS is handled in software, so we see its edges
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    _port = port;
+    _cts_pin = cts_pin;
+    memset(&_stats, 0, sizeof(_stats));
+    memset(&_framer, 0, sizeof(_framer));
+    ewcFramerReset(&_framer);
+
+    _ewc_events = xQueueCreate(queue_depth, sizeof(ewc_event_t));
+    if (_ewc_events == NULL) return ESP_ERR_NO_MEM;
+
+    ESP_ERROR_CHECK(uart_driver_install(port, EWC_RX_BUFFER, 0, EWC_UART_EVENTS, &_uart_events, 0));
+    ESP_ERROR_CHECK(uart_param_config(port, &config));
+    ESP_ERROR_CHECK(uart_set_pin(port, tx_pin, rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(port, EWC_RX_TIMEOUT_SYMBOLS));
+
+    gpio_config_t cts = {};
+    cts.pin_bit_mask = 1ULL << cts_pin;
+    cts.mode = GPIO_MODE_INPUT;
+    cts.pull_up_en = GPIO_PULLUP_ENABLE;
+    cts.intr_type = GPIO_INTR_ANYEDGE;
+    ESP_ERROR_CHECK(gpio_config(&cts));
+    _cts_active = gpio_get_level(cts_pin) == 0;
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err; // already installed is fine
+    ESP_ERROR_CHECK(gpio_isr_handler_add(cts_pin, on_cts_edge, NULL));
+
+    if (xTaskCreatePinnedToCore(ewc_event_task, "ewc_uart", 3072, NULL, 12, NULL, 1) != pdPASS) return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+bool ewc_uart_wait(ewc_event_t* event, uint32_t timeout_ms)
+{
+    if (_ewc_events == NULL) return false;
+    TickType_t ticks = timeout_ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    return xQueueReceive(_ewc_events, event, ticks) == pdTRUE;
+}
+
+bool ewc_cts_active(void)
+{
+    return _cts_active;
+}
+
+bool ewc_uart_send(const uint8_t* data, size_t length)
+{
+    if (!_cts_active) return false;
+    uart_write_bytes(_port, data, length);
+    _stats.tx_bytes += length;
+    return true;
+}
+
+ewc_uart_stats_t ewc_uart_stats(void)
+{
+    return _stats;
+}
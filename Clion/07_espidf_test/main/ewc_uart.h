@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "EwcFramer.h"
+
+// EWC link on the ESP-IDF UART driver: the same framing and events as the
+// Arduino EwcLink library (PlatformIo/common/EwcLink), without Arduino.
+//
+// The UART's RX timeout interrupt is set to a few characters, so the driver
+// posts a UART_DATA event soon after each burst. The event task frames the
+// bytes and queues complete frames; CTS edges come from a GPIO interrupt
+// into the same queue.
+
+#define EWC_FRAME_GAP_US 20000 // a pause this long between bytes drops any partial frame
+
+typedef enum {
+    EWC_EVENT_FRAME = 0,
+    EWC_EVENT_CTS_ON = 1,
+    EWC_EVENT_CTS_OFF = 2
+} ewc_event_type_t;
+
+typedef struct {
+    uint8_t type;   // ewc_event_type_t
+    EwcFrame frame; // valid for EWC_EVENT_FRAME. receivedMs is esp_timer ms
+} ewc_event_t;
+
+typedef struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t frames;
+    uint32_t queue_drops;
+    uint32_t gap_resets;
+    uint32_t overflows;
+} ewc_uart_stats_t;
+
+// CTS is active low
+esp_err_t ewc_uart_start(uart_port_t port, int baud, int tx_pin, int rx_pin, gpio_num_t cts_pin, int queue_depth);
+
+bool ewc_uart_wait(ewc_event_t* event, uint32_t timeout_ms);
+
+bool ewc_cts_active(void);
+
+// Fails without sending if CTS is not active
+bool ewc_uart_send(const uint8_t* data, size_t length);
+
+ewc_uart_stats_t ewc_uart_stats(void);
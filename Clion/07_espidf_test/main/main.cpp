@@ -0,0 +1,186 @@
+/*
+ * SPDX-FileCopyrightText: 2010-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: CC0-1.0
+ */
+
+// ESP-IDF version of the modem, GNSS and EWC code from the PlatformIo sketches.
+// UARTs use the IDF driver with event queues, and timing uses esp_timer.
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_chip_info.h"
+#include "esp_flash.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "at_uart.h"
+#include "ewc_uart.h"
+#include "modem.h"
+#include "LocationScheduler.h"
+
+// Pins and rates match 06_udp_duplex
+#define MODEM_UART UART_NUM_1
+#define MODEM_BAUD 115200
+#define PIN_MODEM_TX 26
+#define PIN_MODEM_RX 27
+#define PIN_MODEM_ENABLE GPIO_NUM_12
+#define PIN_MODEM_POWER GPIO_NUM_4
+#define PIN_MODEM_RESET GPIO_NUM_5
+
+#define EWC_UART UART_NUM_2
+#define EWC_BAUD 9600
+#define PIN_EWC_TX 21
+#define PIN_EWC_RX 22
+#define PIN_EWC_CTS GPIO_NUM_5 // shares the modem RESET pin on the current wiring
+#define EWC_QUEUE_DEPTH 16
+
+#define STATS_PERIOD_US (10 * 1000000LL)
+#define TEST_RUN_US (30 * 60 * 1000000LL) // take fixes for this long, then power GNSS and the modem down
+
+static const char* TAG = "main";
+
+static TaskHandle_t _modem_task = NULL;
+static esp_timer_handle_t _fix_timer = NULL;
+static int64_t _app_start_us = 0;
+
+static void print_chip_info(void)
+{
+    esp_chip_info_t chip_info;
+    uint32_t flash_size;
+    esp_chip_info(&chip_info);
+    printf("This is %s chip with %d CPU core(s), %s%s%s%s, ",
+           CONFIG_IDF_TARGET,
+           chip_info.cores,
+           (chip_info.features & CHIP_FEATURE_WIFI_BGN) ? "WiFi/" : "",
+           (chip_info.features & CHIP_FEATURE_BT) ? "BT" : "",
+           (chip_info.features & CHIP_FEATURE_BLE) ? "BLE" : "",
+           (chip_info.features & CHIP_FEATURE_IEEE802154) ? ", 802.15.4 (Zigbee/Thread)" : "");
+
+    unsigned major_rev = chip_info.revision / 100;
+    unsigned minor_rev = chip_info.revision % 100;
+    printf("silicon revision v%d.%d, ", major_rev, minor_rev);
+    if(esp_flash_get_size(NULL, &flash_size) != ESP_OK) {
+        printf("Get flash size failed\n");
+        return;
+    }
+
+    printf("%" PRIu32 "MB %s flash\n", flash_size / (uint32_t)(1024 * 1024),
+            (chip_info.features & CHIP_FEATURE_EMB_FLASH) ? "embedded" : "external");
+
+    printf("Minimum free heap size: %" PRIu32 " bytes\n", esp_get_minimum_free_heap_size());
+}
+
+// esp_timer callback: time for the next GNSS fix
+static void on_fix_timer(void* arg)
+{
+    xTaskNotifyGive(_modem_task);
+}
+
+// esp_timer callback: UART throughput and error counts, to compare with the Arduino stats lines
+static void on_stats_timer(void* arg)
+{
+    static at_uart_stats_t last_at;
+    static ewc_uart_stats_t last_ewc;
+    at_uart_stats_t at = at_uart_stats();
+    ewc_uart_stats_t ewc = ewc_uart_stats();
+    uint32_t seconds = STATS_PERIOD_US / 1000000LL;
+
+    printf("UART,at,rx=%" PRIu32 "B/s,tx=%" PRIu32 "B/s,lines=%" PRIu32 ",drops=%" PRIu32 ",overflows=%" PRIu32 "\n",
+           (at.rx_bytes - last_at.rx_bytes) / seconds, (at.tx_bytes - last_at.tx_bytes) / seconds,
+           at.lines, at.line_drops, at.overflows);
+    printf("UART,ewc,rx=%" PRIu32 "B/s,tx=%" PRIu32 "B/s,frames=%" PRIu32 ",drops=%" PRIu32 ",gaps=%" PRIu32 "\n",
+           (ewc.rx_bytes - last_ewc.rx_bytes) / seconds, (ewc.tx_bytes - last_ewc.tx_bytes) / seconds,
+           ewc.frames, ewc.queue_drops, ewc.gap_resets);
+    last_at = at;
+    last_ewc = ewc;
+}
+
+// Modem and GNSS. Sleeps between fixes until the fix timer fires, for TEST_RUN_US
+static void modem_task(void* arg)
+{
+    modem_pins_t pins = {PIN_MODEM_ENABLE, PIN_MODEM_POWER, PIN_MODEM_RESET};
+    if (PIN_MODEM_RESET == PIN_EWC_CTS) pins.reset_pin = GPIO_NUM_NC; // the power key alone is enough to boot
+
+    if (modem_power_on(&pins) != ESP_OK) {
+        vTaskDelete(NULL);
+        return;
+    }
+    printf("READY,modem_us=%" PRId64 "\n", esp_timer_get_time() - _app_start_us);
+
+    if (gnss_start() != ESP_OK) ESP_LOGW(TAG, "GNSS did not report ready. Will keep trying for a fix.");
+
+    LocConfig loc = locDefaultConfig();
+    locInit(&loc);
+
+    int64_t end_us = esp_timer_get_time() + TEST_RUN_US;
+    while (esp_timer_get_time() < end_us) {
+        GpsFix fix;
+        uint32_t next_s = loc.minIntervalS;
+        if (gnss_read(&fix)) {
+            uint32_t now_s = (uint32_t)(esp_timer_get_time() / 1000000LL);
+            LocDecision decision = locUpdate(&fix, now_s);
+            ESP_LOGI(TAG, "Fix %" PRId32 ",%" PRId32 " speed=%" PRId32 "cm/s report=%d next=%" PRIu32 "s",
+                     fix.latE6, fix.lonE6, fix.speedCmS, decision.report, decision.nextFixS);
+            if (decision.report) locReported(&fix, now_s);
+            next_s = decision.nextFixS;
+        }
+
+        esp_timer_start_once(_fix_timer, (uint64_t)next_s * 1000000ULL);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    ESP_LOGI(TAG, "Test finished. Powering down GNSS and the modem.");
+    gnss_stop();
+    modem_power_off();
+    vTaskDelete(NULL);
+}
+
+// EWC frames and CTS edges
+static void ewc_task(void* arg)
+{
+    ewc_event_t event;
+    for (;;) {
+        if (!ewc_uart_wait(&event, portMAX_DELAY)) continue;
+
+        switch (event.type) {
+            case EWC_EVENT_CTS_ON: ESP_LOGI(TAG, "CTS on"); break;
+            case EWC_EVENT_CTS_OFF: ESP_LOGI(TAG, "CTS off"); break;
+            case EWC_EVENT_FRAME:
+                ESP_LOG_BUFFER_HEX(TAG, event.frame.data, event.frame.length);
+                break;
+        }
+    }
+}
+
+extern "C" void app_main(void)
+{
+    _app_start_us = esp_timer_get_time(); // esp_timer starts at reset, so this is the boot time
+    printf("BOOT,app_main_us=%" PRId64 "\n", _app_start_us);
+    printf("ESP-IDF port of the modem, GNSS and EWC code.\n");
+    print_chip_info();
+
+    ESP_ERROR_CHECK(at_uart_start(MODEM_UART, MODEM_BAUD, PIN_MODEM_TX, PIN_MODEM_RX));
+    ESP_ERROR_CHECK(ewc_uart_start(EWC_UART, EWC_BAUD, PIN_EWC_TX, PIN_EWC_RX, PIN_EWC_CTS, EWC_QUEUE_DEPTH));
+
+    esp_timer_create_args_t fix_timer = {};
+    fix_timer.callback = on_fix_timer;
+    fix_timer.name = "gnss_fix";
+    ESP_ERROR_CHECK(esp_timer_create(&fix_timer, &_fix_timer));
+
+    esp_timer_create_args_t stats_timer = {};
+    stats_timer.callback = on_stats_timer;
+    stats_timer.name = "uart_stats";
+    esp_timer_handle_t stats;
+    ESP_ERROR_CHECK(esp_timer_create(&stats_timer, &stats));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(stats, STATS_PERIOD_US));
+
+    xTaskCreatePinnedToCore(ewc_task, "ewc", 4096, NULL, 10, NULL, 1);
+    xTaskCreatePinnedToCore(modem_task, "modem", 6144, NULL, 5, &_modem_task, 0);
+
+    printf("READY,app_us=%" PRId64 "\n", esp_timer_get_time() - _app_start_us);
+}
@@ -0,0 +1,64 @@
+#include "modem.h"
+#include "at_uart.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+static const char* TAG = "modem";
+
+static void pulse(gpio_num_t pin, uint32_t low_ms, uint32_t high_ms)
+{
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+    gpio_set_level(pin, 0);
+    vTaskDelay(pdMS_TO_TICKS(low_ms));
+    gpio_set_level(pin, 1);
+    vTaskDelay(pdMS_TO_TICKS(high_ms));
+    gpio_set_level(pin, 0);
+}
+
+esp_err_t modem_power_on(const modem_pins_t* pins)
+{
+    gpio_set_direction(pins->enable_pin, GPIO_MODE_OUTPUT);
+    gpio_set_level(pins->enable_pin, 1);
+
+    if (pins->reset_pin != GPIO_NUM_NC) pulse(pins->reset_pin, 100, 3000);
+    pulse(pins->power_pin, 100, 1000);
+
+    // The modem says "PB DONE" when it has booted. Lines arrive through the
+    // UART event task, so nothing is polled while we wait.
+    if (at_wait_for("PB DONE", 17000) != ESP_OK) ESP_LOGW(TAG, "Did not see PB DONE");
+
+    for (int i = 0; i < 10; i++) {
+        if (at_command("ATZ", NULL, NULL, 0, 1000) == ESP_OK) {
+            ESP_LOGI(TAG, "Modem is active and ready");
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Modem did not answer");
+    return ESP_ERR_TIMEOUT;
+}
+
+void modem_power_off(void)
+{
+    at_command("AT+CPOF", NULL, NULL, 0, 5000);
+}
+
+esp_err_t gnss_start(void)
+{
+    esp_err_t err = at_command("AT+CGNSSPWR=1", NULL, NULL, 0, 2000);
+    if (err != ESP_OK) return err;
+    return at_wait_for("+CGNSSPWR: READY!", 12000);
+}
+
+void gnss_stop(void)
+{
+    at_command("AT+CGNSSPWR=0", NULL, NULL, 0, 2000);
+}
+
+bool gnss_read(GpsFix* fix)
+{
+    char reply[AT_LINE_MAX] = {0};
+    if (at_command("AT+CGPSINFO", "+CGPSINFO:", reply, sizeof(reply), 2000) != ESP_OK) return false;
+    return locParseCgpsInfo(reply, fix);
+}
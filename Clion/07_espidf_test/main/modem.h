@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "LocationScheduler.h"
+
+// SIMCOM A7670 power control and GNSS, over at_uart.
+// Same sequences as the Arduino sketches (06 modemTurnOn, 04 activateGPS).
+
+typedef struct {
+    gpio_num_t enable_pin;
+    gpio_num_t power_pin;
+    gpio_num_t reset_pin; // GPIO_NUM_NC to skip the reset pulse
+} modem_pins_t;
+
+// Enable, reset and power up the modem, then wait for it to answer "AT"
+esp_err_t modem_power_on(const modem_pins_t* pins);
+
+void modem_power_off(void);
+
+// Power up GNSS and wait for it to report ready
+esp_err_t gnss_start(void);
+
+void gnss_stop(void);
+
+// Read the current fix. Returns false if there is no fix yet
+bool gnss_read(GpsFix* fix);
@@ -8,13 +8,44 @@
 #include "time.h"
 #include <sys/time.h>
 
+// Wake cycle timing and battery use (in PlatformIo/common)
+#include <PhaseProfiler.h>
+// Best-source time keeping across deep sleep (in PlatformIo/common)
+#include <ClockManager.h>
+// GNSS fix rate and upload decisions (in PlatformIo/common)
+#include <LocationScheduler.h>
+// AT command texts and typed reply parsers (in PlatformIo/common)
+#include <AtCatalogue.h>
+// Hung-modem detection and tiered recovery (in PlatformIo/common)
+#include <ModemSupervisor.h>
+// Resumable firmware update from a binary delta (in PlatformIo/common)
+#include <DeltaOta.h>
+#include <esp_ota_ops.h>
+// Double-buffered capture to the SD card (in PlatformIo/common)
+#include <SdLogger.h>
+// Skips modem settings that are already applied (in PlatformIo/common)
+#include <ModemConfig.h>
+// Deferred logging, so console output doesn't hold up the AT exchanges (in PlatformIo/common)
+#include <BinLog.h>
+
 // Message we will send to the server
 const char* messageString = "This is a message from the T-SIM micro-controller. It is 🤓 Awesome !";
 
 #define SerialAT Serial1
+//#define SIM_APN "hologram" // set the PDP context APN. Left to the SIM default, as setting it has failed before
 
 #define uS_TO_S 1000000ULL  // Conversion factor for micro seconds to seconds
 #define TIME_TO_SLEEP 60    // Time ESP32 will go to sleep (in seconds)
+#define GNSS_OFF_AFTER_S 900 // Power down GNSS if the next fix is at least this far away (seconds)
+
+// Firmware updates. At start-up, ask for '<OTA_URL_BASE>/<running build id>.delta' (made by PlatformIo/tools/delta_make)
+#define OTA_ENABLED 0
+#define OTA_URL_BASE "http://tech.ewater.services/Experiments/ota"
+#define OTA_WINDOW_BYTES 65536 // delta bytes per HTTP range request
+#define OTA_READ_BYTES 1024    // bytes per AT+HTTPREAD
+
+// Every GNSS fix is recorded on the SD card, if one is fitted. Read it with PlatformIo/tools/sdlog_dump
+#define SD_LOG_ENABLED 1
 
 // USB Serial between PC and ESP32
 #define USB_BAUD 9600
@@ -36,28 +67,28 @@ const char* messageString = "This is a message from the T-SIM micro-controller.
 #define SD_SCLK 14
 #define SD_CS 13
 
-// Output to serial console, the reason a core reset.
+// Log the reason a core reset.
 // Upload program gives (1: "POWERON_RESET")
 // Wake from sleep gives (5: "DEEPSLEEP_RESET")
 void print_reset_reason(RESET_REASON reason){
   switch ( reason)
   {
-    case 1 : Serial.println ("POWERON_RESET");break;          /**<1, Vbat power on reset*/
-    case 3 : Serial.println ("SW_RESET");break;               /**<3, Software reset digital core*/
-    case 4 : Serial.println ("OWDT_RESET");break;             /**<4, Legacy watch dog reset digital core*/
-    case 5 : Serial.println ("DEEPSLEEP_RESET");break;        /**<5, Deep Sleep reset digital core*/
-    case 6 : Serial.println ("SDIO_RESET");break;             /**<6, Reset by SLC module, reset digital core*/
-    case 7 : Serial.println ("TG0WDT_SYS_RESET");break;       /**<7, Timer Group0 Watch dog reset digital core*/
-    case 8 : Serial.println ("TG1WDT_SYS_RESET");break;       /**<8, Timer Group1 Watch dog reset digital core*/
-    case 9 : Serial.println ("RTCWDT_SYS_RESET");break;       /**<9, RTC Watch dog Reset digital core*/
-    case 10 : Serial.println ("INTRUSION_RESET");break;       /**<10, Instrusion tested to reset CPU*/
-    case 11 : Serial.println ("TGWDT_CPU_RESET");break;       /**<11, Time Group reset CPU*/
-    case 12 : Serial.println ("SW_CPU_RESET");break;          /**<12, Software reset CPU*/
-    case 13 : Serial.println ("RTCWDT_CPU_RESET");break;      /**<13, RTC Watch dog Reset CPU*/
-    case 14 : Serial.println ("EXT_CPU_RESET");break;         /**<14, for APP CPU, reseted by PRO CPU*/
-    case 15 : Serial.println ("RTCWDT_BROWN_OUT_RESET");break;/**<15, Reset when the vdd voltage is not stable*/
-    case 16 : Serial.println ("RTCWDT_RTC_RESET");break;      /**<16, RTC Watch dog reset digital core and rtc module*/
-    default : Serial.println ("NO_MEAN");
+    case 1 : LOG_I("POWERON_RESET");break;          /**<1, Vbat power on reset*/
+    case 3 : LOG_I("SW_RESET");break;               /**<3, Software reset digital core*/
+    case 4 : LOG_I("OWDT_RESET");break;             /**<4, Legacy watch dog reset digital core*/
+    case 5 : LOG_I("DEEPSLEEP_RESET");break;        /**<5, Deep Sleep reset digital core*/
+    case 6 : LOG_I("SDIO_RESET");break;             /**<6, Reset by SLC module, reset digital core*/
+    case 7 : LOG_I("TG0WDT_SYS_RESET");break;       /**<7, Timer Group0 Watch dog reset digital core*/
+    case 8 : LOG_I("TG1WDT_SYS_RESET");break;       /**<8, Timer Group1 Watch dog reset digital core*/
+    case 9 : LOG_I("RTCWDT_SYS_RESET");break;       /**<9, RTC Watch dog Reset digital core*/
+    case 10 : LOG_I("INTRUSION_RESET");break;       /**<10, Instrusion tested to reset CPU*/
+    case 11 : LOG_I("TGWDT_CPU_RESET");break;       /**<11, Time Group reset CPU*/
+    case 12 : LOG_I("SW_CPU_RESET");break;          /**<12, Software reset CPU*/
+    case 13 : LOG_I("RTCWDT_CPU_RESET");break;      /**<13, RTC Watch dog Reset CPU*/
+    case 14 : LOG_I("EXT_CPU_RESET");break;         /**<14, for APP CPU, reseted by PRO CPU*/
+    case 15 : LOG_I("RTCWDT_BROWN_OUT_RESET");break;/**<15, Reset when the vdd voltage is not stable*/
+    case 16 : LOG_I("RTCWDT_RTC_RESET");break;      /**<16, RTC Watch dog reset digital core and rtc module*/
+    default : LOG_I("NO_MEAN");
   }
 }
 
@@ -66,22 +97,36 @@ void atWait(){
   delay(500);
 }
 
+int alive = false;          // set-up finished. The supervisor only recovers the modem after this
+int modemStateLost = false; // supervisor reset the modem; GNSS must be powered up again
+int modemUartUp = false;    // SIMCOM UART and supervisor started (not on a deep-sleep wake)
+
+// Ask the supervisor to bring back a modem that has stopped answering.
+// Returns true if it answers again.
+int recoverModem(){
+  RecoveryTier tier = modemRecover(RECOVERY_RESYNC);
+  supervisorPrintStats();
+  if (tier >= RECOVERY_CFUN) modemStateLost = true;
+  return tier != RECOVERY_FAILED;
+}
+
 // Send an 'AT' command to the SIMCOM module.
-// This will re-try on timeout
+// This will re-try on timeout. Once set-up is done, a timeout is checked with a
+// quick probe, so a stuck modem is recovered in seconds instead of burning all the retries.
 int sendCommand(const char* cmd) {
-  int i = 10;
-  while (i) {
+  int attempts = alive ? 3 : 10; // before set-up is done, the modem may still be booting
+  for (int attempt = 0; attempt < attempts; attempt++) {
     SerialAT.print(cmd);
     SerialAT.print("\r");
 
-    if (i == 10) delay(500);  // extra delay 1st time
+    if (attempt == 0) delay(500);  // extra delay 1st time
 
     for (int j=0; j<5; j++){ // wait for reply
       delay(500);
+      supervisorFeed();
       if (SerialAT.available()) {
         String r = SerialAT.readString();
-        Serial.print("> ");
-        Serial.println(r);
+        LOG_D("> %s", r);
         if (r.indexOf("OK") >= 0) {
           return true;
         }
@@ -90,7 +135,12 @@ int sendCommand(const char* cmd) {
         }
       }
     }
-    i--; // No 'OK', so try again
+
+    // No 'OK'. If the modem doesn't answer a bare 'AT' either, it's stuck
+    if (alive && !modemProbe() && !recoverModem()) {
+      alive = false; // loop() will try again from the top
+      return false;
+    }
   }
   delay(500);
   return false;
@@ -104,20 +154,18 @@ int waitForMessage(const char* terminate, int waitPeriod){
 
     if (SerialAT.available()) {
         String r = SerialAT.readString();
-        Serial.print("> ");
-        Serial.println(r);
-        Serial.println("<");
+        LOG_D("> %s", r);
         if (r.indexOf(needle) >= 0) {
-          Serial.printf("Found message '%s'; Continuing!\r\n", terminate);
+          LOG_D("Found message '%s' after %dms", terminate, waited);
           return true;
         }
       }
 
-    Serial.print(".");
     delay(250);
+    supervisorFeed();
     waited+=250;
   }
-  Serial.printf("Did not see message '%s'\r\n", terminate);
+  LOG_W("Did not see message '%s'", terminate);
   return false;
 }
 
@@ -125,10 +173,10 @@ int waitForMessage(const char* terminate, int waitPeriod){
 int sendCommandF(const char* format, int i){
   char* commandStr;
   if(0 > asprintf(&commandStr, format, i)) {
-    Serial.println("Failed to generate command");
+    LOG_E("Failed to generate command");
     return false;
   }
-  Serial.println(&commandStr[0]);
+  LOG_D("%s", commandStr);
 
   int result = sendCommand(&commandStr[0]);
   free(commandStr);
@@ -145,24 +193,23 @@ void sendData(const char* data) {
 void sendDataF(const char* format, int i){
   char* commandStr;
   if(0 > asprintf(&commandStr, format, i)) {
-    Serial.println("Failed to generate command");
+    LOG_E("Failed to generate command");
     return;
   }
-  Serial.println(&commandStr[0]);
+  LOG_D("%s", commandStr);
 
   sendData(&commandStr[0]);
   free(commandStr);
 }
 
 // Try to read data coming from the modem.
-// Anything read will be output to serial
+// Anything read is logged at debug level
 const char* tryReadModem() {
   for (int j = 0; j < 5; j++) {  // wait for reply
     delay(500);
     if (SerialAT.available()) {
       String r = SerialAT.readString();
-      Serial.print("> ");
-      Serial.print(r); // commands end in newlines
+      LOG_D("> %s", r);
       return r.c_str();
     }
   }
@@ -170,7 +217,7 @@ const char* tryReadModem() {
 }
 
 // Try to read data coming from the modem.
-// Anything read will be output to serial
+// Nothing is logged
 const char* tryReadModemQuiet() {
   for (int j = 0; j < 5; j++) {  // wait for reply
     delay(500);
@@ -182,6 +229,24 @@ const char* tryReadModemQuiet() {
   return NULL;
 }
 
+// Wait for the information reply of a catalogue command that has already been sent,
+// for up to the command's timeout class. Anything read is logged at debug level
+template <class C>
+at::Status readReply(typename C::Reply& out){
+  String r = "";
+  at::Status status = at::Status::NoReply;
+  for (uint32_t waited = 0; waited < at::timeoutMs<C>() && status == at::Status::NoReply; waited += 250){
+    delay(250);
+    supervisorFeed();
+    if (!SerialAT.available()) continue;
+    String more = SerialAT.readString();
+    LOG_D("> %s", more);
+    r += more;
+    status = at::parse<C>(r.c_str(), r.length(), out);
+  }
+  return status;
+}
+
 // Send an 'AT' command to the SIMCOM module,
 // and return any result as a string
 const char* readCommand(const char* cmd){
@@ -197,10 +262,125 @@ const char* readCommandQuiet(const char* cmd){
   return tryReadModemQuiet();
 }
 
+// Ask the modem for its supply voltage, and pass it to the profiler.
+// Returns millivolts, or zero if the reply could not be read
+int readSupplyVoltage(){
+  SerialAT.print(at::command<at::BatteryCharge>());
+  SerialAT.print("\r");
+  at::BatteryCharge::Reply reply; // +CBC: 3.912V
+  if (readReply<at::BatteryCharge>(reply) != at::Status::Ok) return 0;
+  int mv = reply.volts.value;
+  LOG_I("Supply voltage: %dmV", mv);
+  profileSetModemMv(mv);
+  return mv;
+}
+
+// Ask the modem for its CPU temperature.
+// Returns false if the reply could not be read
+int readModuleTemperature(int* celsius){
+  SerialAT.print(at::command<at::ModuleTemperature>());
+  SerialAT.print("\r");
+  at::ModuleTemperature::Reply reply; // +CPMUTEMP: 31
+  if (readReply<at::ModuleTemperature>(reply) != at::Status::Ok) return false;
+  *celsius = reply.celsius;
+  return true;
+}
+
+// Read the SIMCOM real-time-clock, and offer it to the clock manager.
+// Returns true if the modem time was used
+int readModemClock(){
+  SerialAT.print("AT+CCLK?\r");
+  for (int j=0; j<5; j++){ // wait for reply
+    delay(500);
+    if (SerialAT.available()) {
+      String r = SerialAT.readString();
+      LOG_D("> %s", r);
+      return clockSyncFromCclk(r.c_str());
+    }
+  }
+  return false;
+}
+
+// Send one modem setting for the config cache, and wait for OK or ERROR.
+// No retries: a setting that gets no answer is sent again on the next boot
+ConfigSendResult sendSetting(const char* cmd){
+  SerialAT.print(cmd);
+  SerialAT.print("\r");
+  String r = "";
+  for (int j=0; j<10; j++){ // wait for reply
+    delay(500);
+    supervisorFeed();
+    if (!SerialAT.available()) continue;
+    r += SerialAT.readString();
+    if (r.indexOf("OK") >= 0) break;
+    if (r.indexOf("ERROR") >= 0) break;
+  }
+  LOG_D("> %s", r);
+  if (r.indexOf("OK") >= 0) return CONFIG_SEND_OK;
+  if (r.indexOf("ERROR") >= 0) return CONFIG_SEND_ERROR;
+  return CONFIG_SEND_NO_REPLY;
+}
+
+// Read the modem IMEI and SIM ICCID in one round-trip (commands chained with ';')
+int readModemIdentity(ModemIdentity* identity){
+  char cmd[32];
+  snprintf(cmd, sizeof(cmd), "%s;%s", at::command<at::Imei>(), at::command<at::Iccid>() + 2); // "AT+SIMEI?;+CICCID"
+  SerialAT.print(cmd);
+  SerialAT.print("\r");
+
+  String r = "";
+  at::Imei::Reply imei;
+  at::Iccid::Reply iccid;
+  at::Status status = at::Status::NoReply;
+  for (uint32_t waited = 0; waited < at::timeoutMs<at::Iccid>() && status == at::Status::NoReply; waited += 250){
+    delay(250);
+    supervisorFeed();
+    if (!SerialAT.available()) continue;
+    r += SerialAT.readString();
+    status = at::parse<at::Iccid>(r.c_str(), r.length(), iccid); // ICCID comes last. ERROR stops the chain
+  }
+  if (status != at::Status::Ok || at::parse<at::Imei>(r.c_str(), r.length(), imei) != at::Status::Ok){
+    LOG_W("Could not read modem identity (status %d) %s", (int)status, r);
+    return false;
+  }
+
+  memset(identity, 0, sizeof(ModemIdentity));
+  snprintf(identity->imei, sizeof(identity->imei), "%s", imei.imei.value);
+  snprintf(identity->iccid, sizeof(identity->iccid), "%s", iccid.iccid.value);
+  return true;
+}
+
+// Send the modem settings we want, skipping the ones the NVS cache says this modem and SIM already have.
+// Each round-trip skipped saves a second or more of modem-on time.
+void applyModemSettings(){
+  char networkTime[16];
+  at::format<at::NetworkTime>(networkTime, sizeof(networkTime), {1}); // keep the modem RTC set from the network
+  // NITZ only comes with a network registration. To pick it up straight away: AT+COPS=2, AT+CTZU=1, AT+COPS=0
+#ifdef SIM_APN
+  char apn[48];
+  at::format<at::PdpContext>(apn, sizeof(apn), {1, {"IP"}, {SIM_APN}});
+#endif
+
+  const ModemSetting settings[] = {
+    {"ctzu", networkTime, true},
+#ifdef SIM_APN
+    {"apn", apn, true},
+#endif
+  };
+
+  ModemIdentity identity;
+  if (!readModemIdentity(&identity)) return; // can't trust the cache; the modem keeps what it had
+
+  ConfigReport report = configApply(&identity, 1, settings, sizeof(settings) / sizeof(settings[0]), sendSetting);
+  char line[112];
+  if (configFormatReport(line, sizeof(line), &report) > 0) LOG_I("%s", line);
+}
+
 // Enable, power-up and reset the modem
 // The modem is ready if this function returns 'true'
 int modemTurnOn() {
-  Serial.println(F("Resetting Modem...\r\n"));
+  LOG_I("Resetting Modem...");
+  profileStart(PHASE_MODEM_POWER);
 
   // Set the A7670 enable line (?)
   pinMode(MODEM_ENABLE, OUTPUT);
@@ -222,56 +402,39 @@ int modemTurnOn() {
   delay(1000);
   digitalWrite(MODEM_POWER, LOW);
 
-  Serial.println(F("Modem power-up starting\r\n"));
+  LOG_I("Modem power-up starting");
   delay(5000); // give it a while to boot
+  profileEnd(PHASE_MODEM_POWER, true);
 
-
+  profileStart(PHASE_PB_DONE);
   int reply = waitForMessage("PB DONE", 12000);
+  profileEnd(PHASE_PB_DONE, reply);
   if (reply==false){
-    Serial.println(F("** DID NOT SEE PB DONE message **"));
+    LOG_W("** DID NOT SEE PB DONE message **");
   }
 
   // test with an 'AT' command
-  Serial.println(F("Testing Modem Response..."));
+  LOG_I("Testing Modem Response...");
   reply = sendCommand("ATZ"); // Load user settings
 
   if (reply == false) {
-    Serial.println(F("** Failed to connect to the modem! Check the baud and try again.**"));
+    LOG_E("** Failed to connect to the modem! Check the baud and try again.**");
     return false;
   }
   atWait();
 
-/* // This doesn't seem to be effective.
-  reply = sendCommand("AT+CTZU=1"); // Enable updating internal clock from NITZ
-  if (reply == true) {
-    reply = sendCommand("AT&W"); // store settings
-    if (reply == true){
-      Serial.println("Wrote NITZ setting");
-
-
-      // Note, we can do this to force off the network and pick up the date change
-      //AT+COPS=2
-      //> OK
-      //AT+CTZU=1
-      //> OK
-      //AT+COPS=0
-      //> OK
-      //+CTZU: "15/05/06,17:25:42",-12,0
-      //
-    }
-  }
-*/
+  applyModemSettings(); // AT+CTZU=1 and AT&W, only when this modem and SIM don't have them yet
 
   atWait();
-  sendCommand("AT+CCLK?"); // get clock setting from modem
+  readModemClock(); // get clock setting from modem
   atWait();
-  Serial.println(F("Modem is active and ready"));
+  LOG_I("Modem is active and ready");
   return true;
 }
 
 // Send a power-off command to the SIMCOM modem
 void modemTurnOff(){
-  Serial.println("Powering off the SIMCOM unit");
+  LOG_I("Powering off the SIMCOM unit");
   sendCommand("AT+CPOF"); // try to power-off the SIMCOM module.
   atWait();
 }
@@ -281,149 +444,227 @@ void modemTurnOff(){
 // current firmware. It is NOT the available operators at the nearest tower.
 void queryOperatorNames(){
   int reply = sendCommand("AT+COPN");
-  if (reply == false) Serial.println("Failed to read operator list");
-}
-
-#define isInt(c) (c >= 0 && c <= 9)
-#define notNull(c) (c != 0)
-
-// Unpack the reply string from a HTTP action and output the status code and data length
-int readHttpActionResult(const char* replyStr, int* statusCode, int* dataLength) {
-  char* c = (char*)replyStr;
-  int sc = 0; // status code
-  int dl = 0; // data length
-  bool inNum = false;
-
-  while (notNull(*c)){
-    int i = (int)(*c - '0');
-    c++;
-    if (isInt(i)){
-      if (!inNum){
-        inNum = true;
-        sc = dl;
-        dl = 0;
-      }
-      dl = (dl*10)+i;
-    } else {
-      inNum = false;
-    }
-  }
-
-  *statusCode = sc;
-  *dataLength = dl;
-
-  return true;
+  if (reply == false) LOG_W("Failed to read operator list");
 }
 
-void makeHttpCall(char* message) {
+// Send a message to the home server as a HTTP POST.
+// Returns true if the server accepted it
+int makeHttpCall(const char* message) {
   // Start the SIMCOM HTTP(S) Service
-  int reply = sendCommand("AT+HTTPINIT");
-  if (reply==false) {Serial.println(F("Failed to start HTTP service"));return;}
+  int reply = sendCommand(at::command<at::HttpInit>());
+  if (reply==false) {LOG_W("Failed to start HTTP service");return false;}
 
   // Set parameters for a HTTP call
-  reply = sendCommand("AT+HTTPPARA=\"URL\",\"https://tech.ewater.services/Experiments/CellTouch\"");
-  if (reply==false) {Serial.println(F("Failed to set URL"));return;}
-  reply = sendCommand("AT+HTTPPARA=\"CONTENT\",\"text/plain\"");
-  if (reply==false) {Serial.println(F("Failed to set content type"));return;}
-  reply = sendCommand("AT+HTTPPARA=\"ACCEPT\",\"*/*\"");
-  if (reply==false) {Serial.println(F("Failed to set accept type"));return;}
+  char cmd[96];
+  at::format<at::HttpPara>(cmd, sizeof(cmd), {{"URL"}, {"https://tech.ewater.services/Experiments/CellTouch"}});
+  reply = sendCommand(cmd);
+  if (reply==false) {LOG_W("Failed to set URL");return false;}
+  at::format<at::HttpPara>(cmd, sizeof(cmd), {{"CONTENT"}, {"text/plain"}});
+  reply = sendCommand(cmd);
+  if (reply==false) {LOG_W("Failed to set content type");return false;}
+  at::format<at::HttpPara>(cmd, sizeof(cmd), {{"ACCEPT"}, {"*/*"}});
+  reply = sendCommand(cmd);
+  if (reply==false) {LOG_W("Failed to set accept type");return false;}
 
   int messageBytes = strlen(message);
-  if (messageBytes <= 0 || messageBytes > 1048576){ Serial.printf("Invalid outgoing data length: %d\r\n", messageBytes); return; }
+  if (messageBytes <= 0 || messageBytes > 1048576){ LOG_W("Invalid outgoing data length: %d", messageBytes); return false; }
 
   // Upload the body data to SIMCOM module
   // TODO: count the length of the string.
   // "AT+HTTPDATA=<size>,<time>" -> DOWNLOAD\n<WRITE DATA TO SIMCOM>\nOK
-  sendDataF("AT+HTTPDATA=%d,10", messageBytes); // bytes, time in seconds
+  profileStart(PHASE_SEND);
+  at::format<at::HttpData>(cmd, sizeof(cmd), {messageBytes, 10}); // bytes, time in seconds
+  LOG_D("%s", cmd);
+  sendData(cmd);
   tryReadModem(); // skip over "DOWNLOAD"
   reply = sendCommand(message); // once we've written enough data, SIMCOM should end the download session by sending "OK"
-  if (reply==false) {Serial.println(F("Failed to upload POST body"));return;}
+  profileEnd(PHASE_SEND, reply);
+  if (reply==false) {LOG_W("Failed to upload POST body");return false;}
 
   atWait();
 
   // Send the request. Note, there are 6xx and 7xx errors the SIMCOM can output. See the datasheet page 322
   // this returns status code and {<method>,<statuscode>,<datalen>}. Example, for a successful get request: +HTTPACTION: 0,200,104220
-  sendData("AT+HTTPACTION=1"); // 0=GET;1=POST;2=HEAD;3=DELETE;4=PUT
-
-  const char* replyStr = tryReadModem(); // +HTTPACTION: 1,200,68
+  profileStart(PHASE_ACK);
+  at::format<at::HttpAction>(cmd, sizeof(cmd), {1}); // 0=GET;1=POST;2=HEAD;3=DELETE;4=PUT
+  sendData(cmd);
 
-  if (replyStr == NULL) { Serial.println(F("Failed to upload POST body")); return; }
-  int statusCode = 0;
-  int dataLength = 0;
-  reply = readHttpActionResult(replyStr, &statusCode, &dataLength);
+  at::HttpAction::Reply action; // +HTTPACTION: 1,200,68
+  at::Status status = readReply<at::HttpAction>(action);
+  profileEnd(PHASE_ACK, status == at::Status::Ok);
   atWait();
-  if (reply==false) {Serial.println(F("Failed to read action result"));return;}
+  if (status != at::Status::Ok) {LOG_W("Failed to read action result (status %d)", (int)status);return false;}
+  int statusCode = action.status;
+  int dataLength = action.length;
 
-  if (statusCode < 200 || statusCode > 299){Serial.printf("Non-success status code: %d\r\n", statusCode); return; }
-  if (dataLength <= 0 || dataLength > 1048576){ Serial.printf("Invalid data length: %d\r\n", dataLength); return; }
+  if (statusCode < 200 || statusCode > 299){LOG_W("Non-success status code: %d", statusCode); return false; }
+  if (dataLength <= 0 || dataLength > 1048576){ LOG_W("Invalid data length: %d", dataLength); return false; }
   atWait();
-  Serial.println("###### SUCCESS! Check the server side to confirm message sent ######");
+  LOG_I("###### SUCCESS! Check the server side to confirm message sent ######");
   atWait();
-  Serial.println("###### Reading response message... ######");
+  LOG_I("###### Reading response message... ######");
 
 
-  char* commandStr;
-  if(0 > asprintf(&commandStr, "AT+HTTPREAD=%d", dataLength)) {
-    Serial.println("Failed to generate read command");
-    return;
-  }
-  Serial.println(&commandStr[0]);
+  at::format<at::HttpRead>(cmd, sizeof(cmd), {dataLength});
+  LOG_D("%s", cmd);
 
   // "AT+HTTPREAD=<byte_size>" -> OK\n\n<data>\n+HTTPREAD: 0
-  reply = sendCommand(&commandStr[0]);
-  if (reply==false) {Serial.println(F("Failed to read body"));return;}
-  free(commandStr);
+  reply = sendCommand(cmd);
+  if (reply==false) {LOG_W("Failed to read body");return true;}
   // Reply should be dumped in the console now...?
 
   // Close the SIMCOM HTTP(S) Service
-  reply = sendCommand("AT+HTTPTERM");
-  if (reply==false) {Serial.println(F("Http client shut-down failed"));return;}
-}
-
-// Read a string, populating an array of ints with each number found.
-// Return count of numbers found, or zero in case of errors
-// If maxCount is exceeded, the first numbers found are bumped off the back of the list
-// so this will return the last maxCount numbers found.
-int readNumberSet(const char* src, int maxCount, int* target){
-  char* c = (char*)src; // current character
-  int idx = 0; // output index
-  int tmp = 0; // number being read
-  bool inNum = false;
-
-  while (notNull(*c)){
-    int i = (int)(*c - '0');
-    c++;
-    if (isInt(i)){
-      if (!inNum){ // starting a new number
-        inNum = true;
-        tmp = 0;
-      }
-      tmp = (tmp*10)+i;
-    } else {
-      if (inNum){ // tmp is complete, write to output
-        if (idx >= maxCount){ // push everything back
-          for (int i=1; i < maxCount; i++) target[i-1] = target[i];
-          idx = maxCount - 1;
-        }
-        target[idx] = tmp;
-        idx++;
-      }
-      inNum = false;
+  reply = sendCommand(at::command<at::HttpTerm>());
+  if (reply==false) {LOG_W("Http client shut-down failed");}
+  return true;
+}
+
+// Read one line from the modem, without the line end. Blank lines are skipped.
+// Returns false if no full line came in time
+int readModemLine(char* line, int size, uint32_t timeoutMs){
+  int n = 0;
+  uint32_t start = millis();
+  while (millis() - start < timeoutMs){
+    if (!SerialAT.available()) { delay(1); continue; }
+    char c = SerialAT.read();
+    if (c == '\r') continue;
+    if (c == '\n') {
+      if (n == 0) continue;
+      line[n] = 0;
+      return true;
     }
+    if (n < size - 1) line[n++] = c;
   }
+  line[n] = 0;
+  return false;
+}
 
-  if (inNum){ // finish last number
-    if (idx >= maxCount) { // push everything back
-      for (int i = 1; i < maxCount; i++) target[i - 1] = target[i];
-      idx = maxCount - 1;
-    }
-    target[idx] = tmp;
-    idx++;
+// Read part of the last HTTP response body, as raw bytes.
+// "AT+HTTPREAD=<start>,<length>" -> OK\n+HTTPREAD: <n>\n<n bytes>\n+HTTPREAD: 0
+// Returns bytes read, or -1 on error
+int readHttpBody(uint32_t start, int length, uint8_t* buf){
+  char cmd[48];
+  at::format<at::HttpReadAt>(cmd, sizeof(cmd), {(int32_t)start, length});
+  SerialAT.print(cmd);
+  SerialAT.print("\r");
+
+  int got = 0;
+  char line[48];
+  while (readModemLine(line, sizeof(line), at::timeoutMs<at::HttpReadAt>())){
+    if (strncmp(line, "ERROR", 5) == 0 || strncmp(line, "+CME ERROR", 10) == 0) return -1;
+    if (strncmp(line, "+HTTPREAD: ", 11) != 0) continue; // echo, OK
+    int n = atoi(line + 11);
+    if (n == 0) return got; // end of this read
+    if (n < 0 || n > length - got) return -1;
+    if ((int)SerialAT.readBytes(buf + got, n) != n) return -1;
+    got += n;
   }
+  return -1;
+}
+
+// GET a byte range of the URL already set. The body waits in the modem for readHttpBody().
+// Returns the HTTP status, or zero if there was no answer. Sets 'length' to the body size
+int requestRange(uint32_t from, uint32_t to, int* length){
+  char range[48], cmd[96];
+  snprintf(range, sizeof(range), "Range: bytes=%lu-%lu", (unsigned long)from, (unsigned long)to);
+  at::format<at::HttpPara>(cmd, sizeof(cmd), {{"USERDATA"}, {range}});
+  if (!sendCommand(cmd)) return 0;
 
-  return idx;
+  at::format<at::HttpAction>(cmd, sizeof(cmd), {0}); // GET
+  sendData(cmd);
+  at::HttpAction::Reply action; // +HTTPACTION: 0,206,65536
+  if (readReply<at::HttpAction>(action) != at::Status::Ok) return 0;
+  *length = action.length;
+  return action.status;
 }
 
+// Read the body of the last request, in modem-sized pieces, into the OTA patcher.
+// Returns false if a read failed
+int feedHttpBody(int length, OtaStatus* result, uint32_t* fetched){
+  static uint8_t piece[OTA_READ_BYTES];
+  for (int start = 0; start < length && *result == OTA_MORE; start += OTA_READ_BYTES){
+    int n = min(OTA_READ_BYTES, length - start);
+    if (readHttpBody(start, n, piece) != n) return false;
+    *fetched += n;
+    supervisorFeed();
+    *result = otaFeed(piece, n);
+  }
+  return true;
+}
+
+// Name of the delta from the running image: the first 8 bytes of its build id, as hex
+void otaDeltaName(char* buf, int bufLength){
+#if ESP_IDF_VERSION_MAJOR >= 5
+  const esp_app_desc_t* app = esp_app_get_description();
+#else
+  const esp_app_desc_t* app = esp_ota_get_app_description();
+#endif
+  int n = 0;
+  for (int i = 0; i < 8; i++) n += snprintf(buf + n, bufLength - n, "%02x", app->app_elf_sha256[i]);
+  snprintf(buf + n, bufLength - n, ".delta");
+}
+
+// Download and apply the delta from the running image to new firmware, if the server has one.
+// The delta is fetched with HTTP range requests and patched straight into the inactive OTA
+// partition as it arrives. If the download stops, the next call carries on from the last
+// complete chunk. Returns OTA_PATCHED if a new image is ready to boot.
+OtaStatus fetchUpdate(){
+  char name[24], url[128], cmd[160];
+  otaDeltaName(name, sizeof(name));
+  snprintf(url, sizeof(url), "%s/%s", OTA_URL_BASE, name);
+  at::format<at::HttpPara>(cmd, sizeof(cmd), {{"URL"}, {url}});
+  if (!sendCommand(cmd)) {LOG_W("Failed to set OTA URL"); return OTA_MORE;}
+
+  // Header first: it says which image the delta is for, and where each chunk starts
+  static uint8_t headerBytes[DELTA_MAX_HEADER_BYTES];
+  int length = 0;
+  int status = requestRange(0, DELTA_MAX_HEADER_BYTES - 1, &length);
+  if (status == 404) {LOG_I("No firmware update for %s", name); return OTA_MORE;}
+  if (status != 206 && status != 200) {LOG_W("OTA header request failed: %d", status); return OTA_MORE;}
+  length = min(length, DELTA_MAX_HEADER_BYTES);
+  if (readHttpBody(0, length, headerBytes) != length) {LOG_W("Failed to read OTA header"); return OTA_MORE;}
+
+  DeltaHeader header;
+  if (deltaParseHeader(headerBytes, length, &header) <= 0) return OTA_BAD_DELTA;
+  uint32_t offset;
+  OtaStatus result = otaStart(&header, &offset);
+  if (result != OTA_MORE) return result;
+
+  int startChunk = otaChunksDone();
+  uint32_t total = deltaChunkOffset(&header, header.chunkCount);
+  uint32_t fetched = 0;
+  uint32_t startMs = millis();
+  LOG_I("Firmware update %s: %u bytes, chunk %d of %d", name, total, startChunk, header.chunkCount);
+
+  while (result == OTA_MORE && offset < total){
+    uint32_t end = min(offset + OTA_WINDOW_BYTES, total);
+    status = requestRange(offset, end - 1, &length);
+    if (status != 206 || length != (int)(end - offset)) {LOG_W("OTA range request failed: %d", status); break;}
+    if (!feedHttpBody(length, &result, &fetched)) {LOG_W("Failed to read OTA data"); break;}
+    offset = end;
+  }
+  if (result == OTA_MORE) otaAbort(); // the checkpoint stays, for next time
+
+  // OTA,<result>,<first chunk>,<chunks done>,<chunks>,<bytes fetched>,<ms>
+  LOG_I("OTA,%d,%d,%d,%d,%u,%u", (int)result, startChunk, otaChunksDone(), header.chunkCount, fetched, millis() - startMs);
+  return result;
+}
+
+// Check for a firmware update, and make it the boot image if one was patched.
+// Returns true if the ESP32 should restart into new firmware
+int checkForFirmwareUpdate(){
+  int reply = sendCommand(at::command<at::HttpInit>());
+  if (reply==false) {LOG_W("Failed to start HTTP service");return false;}
+
+  OtaStatus result = fetchUpdate();
+  reply = sendCommand(at::command<at::HttpTerm>());
+  if (reply==false) {LOG_W("Http client shut-down failed");}
+
+  if (result < 0) {LOG_E("Firmware update failed: %d", (int)result); return false;}
+  if (result != OTA_PATCHED) return false;
+  if (!otaFinish()) {LOG_W("New firmware did not pass the boot checks"); return false;}
+  return true;
+}
 
 // Turn on and configure the GPS/GNSS system
 // It will take around 4 minutes to get a fix if you have attained a fix in the last 4 hours or so
@@ -435,15 +676,16 @@ int readNumberSet(const char* src, int maxCount, int* target){
 int activateGPS(){
   delay(1000);
 
-  // turn on power
+  // turn on power. The fix span is closed in the main loop, when we read a valid position.
+  profileStart(PHASE_GNSS_FIX);
   int reply = sendCommand("AT+CGNSSPWR=1");
-  if (reply==false) {Serial.println(F("Fail: GPS/GNSS power on")); return false; }
+  if (reply==false) {LOG_W("Fail: GPS/GNSS power on"); return false; }
   delay(1000);
 
   // wait for the ready signal
   reply = waitForMessage("+CGNSSPWR: READY!", 12000);
-  if (reply==false) {Serial.println(F("GNSS module did not reply within wait period")); return false; }
-  Serial.println(F("GNSS module is powered on"));
+  if (reply==false) {LOG_W("GNSS module did not reply within wait period"); return false; }
+  LOG_I("GNSS module is powered on");
 
   //delay(2000);
   //reply = sendCommand("AT+CGNSSTST=1"); // Send data from UART3 to NMEA ... ?
@@ -453,51 +695,97 @@ int activateGPS(){
   return true;
 }
 
-// Read the ESP32 real-time-clock, and write the
-// result the the serial connection.
-void readRtc(){
+// Turn off the GPS/GNSS system to save power.
+// The next fix will be a warm or hot start, depending on how long it is off.
+int deactivateGPS(){
+  int reply = sendCommand("AT+CGNSSPWR=0");
+  if (reply==false) {LOG_W("Fail: GPS/GNSS power off"); return false; }
+  LOG_I("GNSS module is powered off");
+  return true;
+}
+
+// Read the current position from the GNSS module.
+// Returns true if the module has a valid fix
+int readGpsFix(GpsFix* fix){
+  SerialAT.println("AT+CGPSINFO");
+  for (int j = 0; j < 5; j++) {  // wait for reply
+    delay(500);
+    if (SerialAT.available()) {
+      String r = SerialAT.readString();
+      return locParseCgpsInfo(r.c_str(), fix);
+    }
+  }
+  return false;
+}
+
+// Write micro-degrees as a decimal string, like "-3.031289"
+void formatDegrees(char* buf, int bufLength, int32_t e6){
+  const char* sign = e6 < 0 ? "-" : "";
+  if (e6 < 0) e6 = -e6;
+  snprintf(buf, bufLength, "%s%d.%06d", sign, (int)(e6 / 1000000), (int)(e6 % 1000000));
+}
+
+// Read the ESP32 real-time-clock, and log it after 'label'.
+// The clock is set by the clock manager from the best time source we have seen.
+void readRtc(const char* label){
   struct tm local = {0};
-  getLocalTime(&local);
+  getLocalTime(&local, 0);
   int year = local.tm_year+1900;
   int month = local.tm_mon + 1;
 
-  Serial.printf("%d-%02d-%02d T %02d:%02d:%02d\r\n",year, month, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec);
+  ClockStamp now = clockNow();
+  LOG_I("%s %d-%02d-%02d T %02d:%02d:%02d (source %d, +/-%ums, drift %dppb)", label, year, month, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec,
+        now.source, now.uncertaintyMs, clockDriftPpb());
 }
 
-void setRtcTimeRaw(unsigned long epoch, int ms) {
-  struct timeval tv;
-  if (epoch > 2082758399){
-	  tv.tv_sec = epoch - 2082758399;  // epoch time (seconds)
-  } else {
-	  tv.tv_sec = epoch;  // epoch time (seconds)
-  }
-  tv.tv_usec = ms;    // microseconds
-  settimeofday(&tv, NULL);
-}
+// Set up GNSS and read the modem's health, once the modem answers.
+// Sets 'alive' if everything is ready for the main loop
+int startModemServices(){
+  // We could now make HTTP calls
+  readRtc("Modem ready at");
+
+  // Test one:
+  //makeHttpCall();
+
+  // Wake up the GPS system. It takes ages when it works at all.
+  int reply = activateGPS();
+  if (reply == false) {LOG_E("Failed to start GPS sub-system. Reboot modem"); return false; }
+
+  // Request CPU temperature reading
+  atWait();
+  int celsius = 0;
+  if (!readModuleTemperature(&celsius)) {LOG_W("Failed to read SIMCOM CPU temperature");}
+  else {LOG_I("SIMCOM CPU temperature: %dC", celsius);}
 
-// set the internal RTC time
-// sc second (0-59); mn minute (0-59); hr hour of day (0-23); dy day of month (1-31);
-// mt month (1-12); yr year ie 2021; ms microseconds (optional, pass zero if not known)
-void setRtcTime(int sc, int mn, int hr, int dy, int mt, int yr, int ms) {
-  // seconds, minute, hour, day, month, year $ microseconds(optional)
-  // ie setTime(20, 34, 8, 1, 4, 2021) = 8:34:20 1/4/2021
-  struct tm t = {0};        // Initalize to all 0's
-  t.tm_year = yr - 1900;    // This is year-1900, so 121 = 2021
-  t.tm_mon = mt - 1;
-  t.tm_mday = dy;
-  t.tm_hour = hr;
-  t.tm_min = mn;
-  t.tm_sec = sc;
-  time_t timeSinceEpoch = mktime(&t);
-  setRtcTimeRaw(timeSinceEpoch, ms);
+  // Request supply voltage
+  atWait();
+  int supplyMv = readSupplyVoltage();
+  if (supplyMv <= 0) {LOG_W("Failed to read SIMCOM supply voltage");}
+
+  alive = true;
+  modemStateLost = false;
+  readRtc("Set-up complete. Going to main loop at");
+  return true;
 }
 
-int alive = false;
+// Places we want to hear about entering or leaving. Crossing any boundary triggers an upload.
+const Geofence geofences[] = {
+  GEOFENCE_CIRCLE(51824760, -3031290, 200), // test site
+};
+LocConfig locConfig;
 
 void setup() {
-  // Connect to USB serial port if available
+  profilerInit(BAT_ADC); // first, so the boot span is accurate
+  clockInit();
+  locConfig = locDefaultConfig();
+  locConfig.fences = geofences;
+  locConfig.fenceCount = sizeof(geofences) / sizeof(geofences[0]);
+  locInit(&locConfig);
+
+  // Connect to USB serial port if available. Log records go there from a low-priority task on core 0
   Serial.begin(USB_BAUD);
   delay(100);
+  binlogBegin(&Serial, BINLOG_OUTPUT_TEXT, 0);
 
   // Output reset types
   RESET_REASON core0 = rtc_get_reset_reason(0);
@@ -507,46 +795,37 @@ void setup() {
 
   // if we woke up from deep sleep, don't do anything.
   if (core0 == DEEPSLEEP_RESET || core1 == DEEPSLEEP_RESET){
-    Serial.println("Woke from deep-sleep. Not starting modem");
+    LOG_I("Woke from deep-sleep. Not starting modem");
+    readRtc("Clock:"); // still valid, without the modem or GNSS
     return; // jump to main loop, where we will re-enter deep sleep.
   }
 
-  // Print the ESP32 time. Will this be zero after power failure?
-  readRtc();
+  // Print the ESP32 time. This is zero after power failure, until we get a time source
+  readRtc("Clock:");
+
+  if (SD_LOG_ENABLED && !sdLogBegin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS, 0)) {LOG_W("No SD card. Fixes are not recorded."); }
 
   // Connect serial to the SIMCOM module
+  SerialAT.setRxBufferSize(2 * OTA_READ_BYTES); // room for a whole AT+HTTPREAD piece
   SerialAT.begin(115200, SERIAL_8N1, PIN_RX, PIN_TX);  // ESP32 <-> SIMCOM
   delay(1000);
 
+  // Watch the modem, and this task. Recovery uses the same pins as modemTurnOn()
+  SupervisorConfig supervisor = {&SerialAT, MODEM_POWER, RESET, MODEM_ENABLE, SUPERVISOR_WATCHDOG_S};
+  supervisorBegin(&supervisor);
+  modemUartUp = true;
+
   // turn the modem on
   int reply = modemTurnOn();
-  if (reply == false) {Serial.println(F("Failed to start SIMCOM modem")); return; }
+  if (reply == false) {LOG_E("Failed to start SIMCOM modem"); return; }
   delay(1000);
 
-  // We could now make HTTP calls
-  Serial.print("Modem ready at ");
-  readRtc();
-
-  // Test one:
-  //makeHttpCall();
-
-  // Wake up the GPS system. It takes ages when it works at all.
-  reply = activateGPS();
-  if (reply == false) {Serial.println(F("Failed to start GPS sub-system. Reboot modem")); return; }
-
-  // Request CPU temperature reading
-  atWait();
-  reply = sendCommand("AT+CPMUTEMP");
-  if (reply==false) {Serial.println(F("Failed to read SIMCOM CPU temperature"));}
-
-  // Request supply voltage
-  atWait();
-  reply = sendCommand("AT+CBC");
-  if (reply==false) {Serial.println(F("Failed to read SIMCOM supply voltage"));}
-
-  Serial.print("Set-up complete. Going to main loop ");
-  alive = true;
-  readRtc();
+  if (startModemServices() && OTA_ENABLED && checkForFirmwareUpdate()){
+    LOG_I("New firmware ready. Restarting");
+    sdLogEnd();
+    delay(500);
+    ESP.restart();
+  }
 }
 
 int i = 0;
@@ -554,23 +833,45 @@ int gotLock = false;      // do we currently have a GPS lock? Get reset if lock
 int everHadLock = false;  // have we ever had a lock since power-up?
 int gpsData[40];          // we get up to 16 data points, but might read those as two ints
 int firstLockMin=0, firstLockSec=0;
+int gnssPowered = true;   // activateGPS() is called in setup
+uint32_t nextFixAtS = 0;  // monotonic time of next GPS read, from the location scheduler
 
 void loop() {
+    // Each pass takes a few seconds, even while waiting out a long fix interval or for a
+    // first fix, so feeding here keeps the supervisor's watchdog for a loop that really hangs
+    supervisorFeed();
+
     if (!alive){
-      Serial.println("System did not start correctly. Will reset NOW.");
+      // Try the cheap fixes before rebooting everything
+      if (modemUartUp){
+        LOG_W("System did not start correctly. Recovering modem.");
+        if (modemRecover(RECOVERY_NONE) != RECOVERY_FAILED) {
+          supervisorPrintStats();
+          gnssPowered = true; // startModemServices() powers it up
+          if (startModemServices()) return;
+        }
+      }
+      LOG_E("Modem did not recover. Will reset NOW.");
+      sdLogEnd();
       delay(500);
       ESP.restart();
       return;
     }
 
+    // The supervisor had to reset the modem, so GNSS is off
+    if (modemStateLost) {
+      modemStateLost = false;
+      gnssPowered = false;
+    }
+
     atWait();
     i++;
     int mins = (i*4) / 60;
     int hrs  = mins / 60;
     mins = mins % 60;
     int secs = (i*4) % 60;
-    Serial.printf("Time since GPS power-up = %02d:%02d:%02d\r\n",hrs, mins,secs);
-    if (gotLock){Serial.printf("First lock after = %d:%02d\r\n",firstLockMin,firstLockSec);}
+    LOG_I("Time since GPS power-up = %02d:%02d:%02d",hrs, mins,secs);
+    if (gotLock){LOG_I("First lock after = %d:%02d",firstLockMin,firstLockSec);}
 
     delay(2000);
   // Read the GNSS position
@@ -613,91 +914,68 @@ void loop() {
 */
     delay(1000);
 
-    const char* gps = readCommandQuiet("AT+CGPSINFO");
-    if (gps==NULL) {Serial.println(F("Failed to read GPS location")); }
-    else {
-      int got = readNumberSet(gps, 36, gpsData); // NOTE: this reads 12.34 as two integers: 12, and 34
-      if (got < 6){
-        gotLock = false;
-        Serial.printf("No GPS data (%d)\n", got);
-      } else {
-        Serial.printf("Found %d datapoints in GPS: ", got);
-        for (int j = 0; j < got && j < 40; j++){
-          Serial.printf("%d, ", gpsData[j]);
-        }
-
-// TODO: pull this out to a function
-        long lat_a = gpsData[0];
-        long lat_b = gpsData[1];
-        long lon_a = gpsData[2];
-        long lon_b = gpsData[3];
-
-        long date = gpsData[4];  // like 080223
-        long time = gpsData[5];  // like 150151
+    // Wait until the location scheduler wants another fix
+    uint32_t nowS = (uint32_t)(clockNow().monoUs / uS_TO_S);
+    if (nowS < nextFixAtS) {
+      LOG_I("Next GPS fix in %us", nextFixAtS - nowS);
+      return;
+    }
+    if (!gnssPowered) {
+      gnssPowered = activateGPS();
+      if (!gnssPowered) return;
+    }
 
-        if (date == 0){
-          Serial.println("Invalid date from GPS. Ignoring.");
-          return;
+    GpsFix fix;
+    if (!readGpsFix(&fix)) {
+      gotLock = false;
+      LOG_I("No GPS data");
+      if (!modemProbe() && !recoverModem()) alive = false; // no fix is normal; no modem is not
+    } else {
+      profileEnd(PHASE_GNSS_FIX, true); // time to fix: closes the span activateGPS() opened. Later fixes with GNSS still on are ignored
+      sdLogWrite(SDLOG_SOURCE_GNSS, &fix, sizeof(fix)); // dropped if there is no card
+
+      // Offer GPS time to the clock manager. This sets the ESP32 RTC if GPS is the best source we have
+      if (clockSyncFromGps(fix.date, fix.time)) {LOG_I("Updated ESP32 time from GPS");}
+
+      char lat[16], lon[16];
+      formatDegrees(lat, sizeof(lat), fix.latE6);
+      formatDegrees(lon, sizeof(lon), fix.lonE6);
+      LOG_I("GPS:  https://www.openstreetmap.org/#map=19/%s/%s", lat, lon);
+
+      if (!everHadLock) { // first lock since start-up
+        // Set SIMCOM clock based on the best time we have (now GPS)
+        // Format is "yy/MM/dd,hh:mm:ss±zz", no optional parts. Like `AT+CCLK="14/01/01,02:14:36+08"`
+        char setTimeCmd[40];
+        if (clockFormatCclk(setTimeCmd, sizeof(setTimeCmd)) <= 0) {
+          LOG_W("Failed to generate SIMCOM clock command");
+        } else {
+          LOG_D("%s", setTimeCmd);
+          int reply = sendCommand(setTimeCmd);
+          if (reply == false) {LOG_W("Failed to set SIMCOM clock from GPS time");}
+          else {LOG_I("Updated SIMCOM time from GPS");}
         }
+        firstLockMin=mins; firstLockSec=secs;
+      }
 
-        long hours24 = time / 10000;
-        long minutes = (time / 100) % 100;
-        long seconds = time % 100;
-
-        long year = (date % 100); // 00..99
-        long month= (date / 100) % 100;
-        long day  = (date / 10000) % 100;
-
-        // Set time like this: `AT+CCLK="14/01/01,02:14:36+08"`
-        // Format is "yy/MM/dd,hh:mm:ss±zz", no optional parts
-
-        // Set ESP32 RTC based on GPS time
-        setRtcTime(seconds, minutes, hours24, day, month, year+2000, 0);
-
-
-        long lat_deg = lat_a / 100;
-        long lon_deg = lon_a / 100;
-
-        lat_b += (lat_a % 100) * 100000;
-        lon_b += (lon_a % 100) * 100000;
-        lat_b /= 60;
-        lon_b /= 60;
-
-        lon_deg = -lon_deg; // TODO: detect W or E. Do the inversion for W only?
+      // Only send fixes that tell the server something new
+      LocDecision decision = locUpdate(&fix, nowS);
+      LOG_I("Moving=%d; distance=%dm; fences=%x; next fix in %us",
+            decision.moving, decision.distanceM, decision.fenceMask, decision.nextFixS);
+
+      if (decision.report != LOC_REASON_NONE) {
+        char httpMsgStr[200];
+        snprintf(httpMsgStr, sizeof(httpMsgStr), "T-SIM GPS report (reason %d). Time=%06ld; Date=%06ld; Speed=%dcm/s; Location=https://www.openstreetmap.org/#map=19/%s/%s",
+                 decision.report, fix.time, fix.date, fix.speedCmS, lat, lon);
+        LOG_I("GPS report (reason %d). Time=%06ld; Date=%06ld; Speed=%dcm/s", decision.report, fix.time, fix.date, fix.speedCmS);
+        if (makeHttpCall(httpMsgStr)) locReported(&fix, nowS); // if this fails, the same change will be reported next time
+      }
 
-        Serial.printf("\r\nGPS:  https://www.openstreetmap.org/#map=19/%d.%05d/%d.%05d", lat_deg, lat_b, lon_deg, lon_b);
-        Serial.println();
+      // Slow or stationary: save power by turning GNSS off until the next fix
+      nextFixAtS = nowS + decision.nextFixS;
+      if (decision.nextFixS >= GNSS_OFF_AFTER_S && deactivateGPS()) gnssPowered = false;
 
-        if (!everHadLock) { // if this is the first lock since start-up, send it back to home server
-          // Set SIMCOM clock based on GPS time
-          char *setTimeCmd;
-          if (0 > asprintf(&setTimeCmd, "AT+CCLK=\"%02d/%02d/%02d,%02d:%02d:%02d+00\"",
-                          year, month, day, hours24, minutes, seconds)) {
-            Serial.println("Failed to generate SIMCOM clock command");
-          } else {
-            Serial.println(&setTimeCmd[0]);
-            int reply = sendCommand(setTimeCmd);
-            if (reply == false) {Serial.println(F("Failed to set SIMCOM clock from GPS time"));}
-            else {Serial.println(F("Updated SIMCOM time from GPS"));}
-            free(setTimeCmd);
-          }
-
-          // Send our acquisition to remote server
-          firstLockMin=mins; firstLockSec=secs;
-          char *httpMsgStr;
-          // Found 11 datapoints in GPS: 5149, 48561, 301, 87739, 80223, 125658, 0, 114, 0, 0, 579, 
-          if (0 > asprintf(&httpMsgStr, "T-SIM got a GPS lock. Time=%02d:%02d:%02d; Date=20%02d-%02d-%02d; Location=https://www.openstreetmap.org/#map=19/%d.%05d/%d.%05d",
-                          hours24, minutes, seconds, year, month, day, lat_deg, lat_b, lon_deg, lon_b)) {
-            Serial.println("Failed to generate HTTP message");
-          } else {
-            Serial.println(&httpMsgStr[0]);
-            makeHttpCall(httpMsgStr); // enable to really send the message
-            free(httpMsgStr);
-          }
-        }
-        gotLock = true;
-        everHadLock = true;
-      }
+      gotLock = true;
+      everHadLock = true;
     }
 
     delay(1000);
@@ -706,6 +984,7 @@ void loop() {
   // Test is complete Set ESP32 to sleep mode
   Serial.print("Z");
   esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S);
+  profileMark(PHASE_SLEEP_ENTRY);
   Serial.print("z");
   delay(200);
   esp_deep_sleep_start(); // never returns. We will get reset with DEEPSLEEP_RESET
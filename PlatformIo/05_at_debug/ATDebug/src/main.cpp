@@ -29,10 +29,25 @@
 #define SD_SCLK     14
 #define SD_CS       13
 
+// Transcript capture: every chunk in each direction, stamped with micros() (see AtTranscript.h)
+#define CAPTURE_OFF 0
+#define CAPTURE_SD  1   // to /at_NNN.atr on the SD card
+#define CAPTURE_USB 2   // binary on the USB port instead of the modem's text; capture it on the PC
+#define CAPTURE_MODE CAPTURE_SD
+#define CAPTURE_FRAME (4 + AT_TRANSCRIPT_MAX_CHUNK) // u32 time, then the bytes
+#define CAPTURE_BUFFER 4096     // transcript bytes gathered before a write
+#define CAPTURE_FLUSH_MS 1000   // SD file is flushed at least this often while there is traffic
+
 
 
 #include <TinyGsmClient.h>
 #include "Arduino.h"
+// Lock-free ring buffers (in PlatformIo/common)
+#include <SpscRing.h>
+// Binary AT transcript format (in PlatformIo/common)
+#include <AtTranscript.h>
+#include <SPI.h>
+#include <SD.h>
 
 #ifdef DUMP_AT_COMMANDS  // if enabled it requires the streamDebugger lib
 #include <StreamDebugger.h>
@@ -45,6 +60,156 @@ TinyGsm modem(SerialAT);
 
 bool reply = false;
 
+// Passthrough buffers. Filled by the UART receive events, emptied by loop().
+// The console is much slower than the modem, so that side gets the big buffer.
+SpscByteRing<4096> modemToUsb;
+SpscByteRing<256> usbToModem;
+uint32_t reportedDrops = 0;
+
+// Captured chunks, one ring per direction as each has its own receive event.
+// loop() merges them in time order into the transcript.
+SpscFrameRing<8192, CAPTURE_FRAME> modemCapture;
+SpscFrameRing<2048, CAPTURE_FRAME> usbCapture;
+AtTranscriptWriter captureWriter;
+uint8_t captureBuffer[CAPTURE_BUFFER];
+int captureUsed = 0;
+uint32_t captureFlushedMs = 0;
+uint32_t reportedCaptureDrops = 0;
+File captureFile;
+bool capturing = false;
+
+// Keep a copy of a chunk, with the time it was picked up from the UART
+template <uint32_t C>
+void captureChunk(SpscFrameRing<C, CAPTURE_FRAME>& capture, uint32_t timeUs, const uint8_t* data, int count)
+{
+    if (!capturing) return;
+    uint8_t* frame = capture.beginFrame(4 + count);
+    if (frame == nullptr) return; // counted as dropped
+    memcpy(frame, &timeUs, 4);
+    memcpy(frame + 4, data, count);
+    capture.commitFrame(4 + count);
+}
+
+// Move waiting bytes from a serial port straight into a ring, and capture them.
+// If the ring is full, the bytes are thrown away and counted as dropped (the capture still has them).
+// Times are when the receive event ran: within the UART's RX timeout (one character while capturing) of the last byte.
+template <uint32_t N, uint32_t C>
+void fillFrom(HardwareSerial& port, SpscByteRing<N>& ring, SpscFrameRing<C, CAPTURE_FRAME>& capture)
+{
+    for (;;) {
+        int waiting = port.available();
+        if (waiting <= 0) return;
+        if (waiting > AT_TRANSCRIPT_MAX_CHUNK) waiting = AT_TRANSCRIPT_MAX_CHUNK; // one capture frame at a time
+        uint32_t now = micros();
+
+        SpscSpan span = ring.writeSpan();
+        if (span.length == 0) {
+            uint8_t scratch[64];
+            int n = port.read(scratch, waiting < (int)sizeof(scratch) ? waiting : sizeof(scratch));
+            if (n <= 0) return;
+            captureChunk(capture, now, scratch, n);
+            ring.write(scratch, n); // no room, so this just counts the drop
+            continue;
+        }
+
+        int n = port.read(span.data, waiting < (int)span.length ? waiting : span.length);
+        if (n <= 0) return;
+        captureChunk(capture, now, span.data, n);
+        ring.commitWrite(n);
+    }
+}
+
+// Write everything waiting in a ring to a serial port, straight from the ring's storage
+template <uint32_t N>
+void drainTo(SpscByteRing<N>& ring, HardwareSerial& port)
+{
+    SpscSpan span = ring.readSpan();
+    while (span.length > 0) {
+        port.write(span.data, span.length);
+        ring.commitRead(span.length);
+        span = ring.readSpan();
+    }
+}
+
+// UART receive events. These run in the UART driver's event task, which is the only producer for each ring
+void onModemReceive() { fillFrom(SerialAT, modemToUsb, modemCapture); }
+void onUsbReceive() { fillFrom(Serial, usbToModem, usbCapture); }
+
+// Write out the gathered transcript bytes
+void captureFlush()
+{
+    if (captureUsed > 0) {
+        if (CAPTURE_MODE == CAPTURE_USB) Serial.write(captureBuffer, captureUsed);
+        else captureFile.write(captureBuffer, captureUsed);
+        captureUsed = 0;
+    }
+    if (CAPTURE_MODE == CAPTURE_SD) captureFile.flush();
+    captureFlushedMs = millis();
+}
+
+// Time stamped on a captured chunk
+uint32_t frameTime(SpscSpan span)
+{
+    uint32_t t;
+    memcpy(&t, span.data, 4);
+    return t;
+}
+
+// Move captured chunks into the transcript, oldest first across both directions
+void captureDrain()
+{
+    for (;;) {
+        SpscSpan fromModem = modemCapture.peek();
+        SpscSpan toModem = usbCapture.peek();
+        if (fromModem.data == nullptr && toModem.data == nullptr) break;
+
+        bool modemFirst = fromModem.data != nullptr
+            && (toModem.data == nullptr || (int32_t)(frameTime(fromModem) - frameTime(toModem)) <= 0);
+        SpscSpan chunk = modemFirst ? fromModem : toModem;
+        int count = chunk.length - 4;
+
+        if (captureUsed + atTranscriptSpaceFor(count) > CAPTURE_BUFFER) captureFlush();
+        captureUsed += atTranscriptWrite(&captureWriter, captureBuffer + captureUsed, CAPTURE_BUFFER - captureUsed,
+                                         modemFirst ? AT_FROM_MODEM : AT_TO_MODEM, frameTime(chunk), chunk.data + 4, count);
+        if (modemFirst) modemCapture.pop();
+        else usbCapture.pop();
+    }
+
+    if (captureUsed > 0 && millis() - captureFlushedMs >= CAPTURE_FLUSH_MS) captureFlush();
+}
+
+// Open the capture file (or stream) and write the transcript header
+bool captureBegin()
+{
+    if (CAPTURE_MODE == CAPTURE_OFF) return false;
+
+    if (CAPTURE_MODE == CAPTURE_SD) {
+        SPI.begin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS);
+        if (!SD.begin(SD_CS)) {
+            Serial.println(F("No SD card. Transcript capture is off."));
+            return false;
+        }
+        char name[16];
+        for (int i = 0; i < 1000; i++) {
+            snprintf(name, sizeof(name), "/at_%03d.atr", i);
+            if (!SD.exists(name)) break;
+        }
+        captureFile = SD.open(name, FILE_WRITE);
+        if (!captureFile) {
+            Serial.printf("Could not create %s. Transcript capture is off.\r\n", name);
+            return false;
+        }
+        Serial.printf("Capturing AT transcript to %s\r\n", name);
+    } else {
+        Serial.println(F("Binary AT transcript follows. Modem replies are not shown."));
+        Serial.flush();
+    }
+
+    captureUsed = atTranscriptBegin(&captureWriter, captureBuffer, CAPTURE_BUFFER, micros());
+    captureFlush();
+    return true;
+}
+
 void modem_on()
 {
 
@@ -123,16 +288,34 @@ void setup()
         Serial.println(F(" Failed to connect to the modem! Check the baud and try again."));
         Serial.println(F("***********************************************************\n"));
     }
+
+    capturing = captureBegin();
+    if (capturing) SerialAT.setRxTimeout(1); // receive event after one quiet character time, for tighter times
+
+    // From here on, bytes are moved by receive events rather than polling
+    SerialAT.onReceive(onModemReceive, false);
+    Serial.onReceive(onUsbReceive, false);
 }
 
 void loop()
 {
     while (true) {
-        if (SerialAT.available()) {
-            Serial.write(SerialAT.read());
+        if (CAPTURE_MODE == CAPTURE_USB && capturing) modemToUsb.commitRead(modemToUsb.available()); // the console carries the transcript
+        else drainTo(modemToUsb, Serial);
+        drainTo(usbToModem, SerialAT);
+
+        if (capturing) {
+            captureDrain();
+            uint32_t drops = modemCapture.dropped() + usbCapture.dropped();
+            if (drops != reportedCaptureDrops && CAPTURE_MODE == CAPTURE_SD) {
+                reportedCaptureDrops = drops;
+                Serial.printf("\r\n[capture too slow: %u chunks dropped so far]\r\n", (unsigned)drops);
+            }
         }
-        if (Serial.available()) {
-            SerialAT.write(Serial.read());
+
+        if (modemToUsb.dropped() != reportedDrops && !(CAPTURE_MODE == CAPTURE_USB && capturing)) {
+            reportedDrops = modemToUsb.dropped();
+            Serial.printf("\r\n[console too slow: %u modem bytes dropped so far]\r\n", (unsigned)reportedDrops);
         }
         delay(1);
     }
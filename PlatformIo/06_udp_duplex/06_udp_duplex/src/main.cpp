@@ -3,8 +3,30 @@
 // Basic Arduino stuff (Long-term TODO: remove this and do the low level stuff ourself)
 #include <Arduino.h>
 
-
-#define SerialAT Serial1
+// Wake cycle timing and battery use (in PlatformIo/common)
+#include <PhaseProfiler.h>
+// Battery- and signal-aware wake/send decisions (in PlatformIo/common)
+#include <DutyScheduler.h>
+// Interrupt-driven EWC UART framing (in PlatformIo/common)
+#include <EwcLink.h>
+// Typed EWC message layouts (in PlatformIo/common)
+#include <EwcCodec.h>
+// Pinned FreeRTOS tasks joined by lock-free queues (in PlatformIo/common)
+#include <TaskPipeline.h>
+// Batches EWC frames to the server, and measures frame-in to server-ack latency (in PlatformIo/common)
+#include <EwcBridge.h>
+// Deferred logging, so tasks don't wait on the 9600 baud console (in PlatformIo/common)
+#include <BinLog.h>
+// AT command texts and typed reply parsers (in PlatformIo/common)
+#include <AtCatalogue.h>
+// Server commands brought back on the reply to an uplink (in PlatformIo/common)
+#include <Downlink.h>
+// Double-buffered capture to the SD card (in PlatformIo/common)
+#include <SdLogger.h>
+
+
+#define SerialATPort Serial1 // the modem UART. Traffic goes through SerialAT, which also logs it to the SD card
+#define SerialAT _atTrace
 #define SerialEWC Serial2
 
 #define S_TO_uS 1000000ULL  // Conversion factor for seconds to micro seconds
@@ -26,11 +48,23 @@
 #define PIN_RI 33
 #define RESET 5
 
+// Remote server for test messages and profile uploads
+#define SERVER_IP "85.9.248.158"
+#define SERVER_PORT_TEST 420
+#define SERVER_PORT_PROFILE 422
+#define SERVER_PORT_BRIDGE 423
+#define UDP_LINK 3 // SIMCOM socket line used for all UDP traffic
+#define BRIDGE_ACK_TIMEOUT_MS 5000 // longer than this is well over the latency target anyway
+#define BRIDGE_PROMPT_TIMEOUT_MS 1000
+#define IPD_IDLE_MS 20 // no bytes for this long after '+IPD' means the datagram is all in
+#define BRIDGE_REPLY_MAX 256
+
 // UART comms between ESP32 and EWC
 #define EWC_BAUD 9600
 #define PIN_EWC_CTS 5
 #define PIN_EWC_TX 21
 #define PIN_EWC_RX 22
+#define EWC_QUEUE_DEPTH 16 // frames and CTS edges waiting for the EWC task
 
 // SD card pins
 #define SD_MISO 2
@@ -38,6 +72,10 @@
 #define SD_SCLK 14
 #define SD_CS 13
 
+SdLogStream _atTrace(SerialATPort, SDLOG_SOURCE_AT_TX, SDLOG_SOURCE_AT_RX);
+SdLogPrint _binlogToSd(SDLOG_SOURCE_BINLOG);
+bool _sdLogging = false;
+
 // Output to serial console, the reason a core reset.
 // Upload program gives (1: "POWERON_RESET")
 // Wake from sleep gives (5: "DEEPSLEEP_RESET")
@@ -82,8 +120,7 @@ int sendCommand(const char* cmd) {
       delay(500);
       if (SerialAT.available()) {
         String r = SerialAT.readString();
-        Serial.print("> ");
-        Serial.println(r);
+        LOG_D("> %s", r);
         if (r.indexOf("OK") >= 0) {
           return true;
         }
@@ -99,12 +136,13 @@ int sendCommand(const char* cmd) {
 }
 
 // Wait for a message to arrive on the AT interface,
-// and return any extra data waiting after the message
-const char* waitForMessageAndRead(const char* terminate, int waitPeriod, bool echo){
+// and copy any extra data waiting after the message into 'reply'.
+// Returns false if the message does not arrive within 'waitPeriod' ms
+bool waitForMessageAndRead(const char* terminate, int waitPeriod, bool echo, char* reply, int replyLength){
   int waited = 0;
   int index = -1;
   int len = strlen(terminate);
-  if (len < 1) return NULL;
+  if (len < 1 || replyLength < 1) return false;
 
   String needle = String(terminate);
 
@@ -112,25 +150,22 @@ const char* waitForMessageAndRead(const char* terminate, int waitPeriod, bool ec
 
     if (SerialAT.available()) {
         String r = SerialAT.readString();
-        if (echo){
-          Serial.print("\n>>>\n");
-          Serial.println(r);
-          Serial.println("<<<");
-        }
+        if (echo) LOG_D(">>> %s <<<", r);
 
         index = r.indexOf(needle);
         if (index >= 0) {
-          Serial.printf("Found message '%s'; Continuing!\r\n", terminate);
-          return r.substring(index+len).c_str();
+          LOG_D("Found message '%s' after %dms", terminate, waited);
+          strncpy(reply, r.c_str() + index + len, replyLength - 1); // 'r' goes when we return
+          reply[replyLength - 1] = 0;
+          return true;
         }
       }
 
-    Serial.print(".");
     delay(250);
     waited+=250;
   }
-  Serial.printf("Did not see message '%s'\r\n", terminate);
-  return NULL;
+  LOG_W("Did not see message '%s'", terminate);
+  return false;
 }
 
 // Wait for a message to arrive on the AT interface
@@ -141,20 +176,17 @@ int waitForMessage(const char* terminate, int waitPeriod){
 
     if (SerialAT.available()) {
         String r = SerialAT.readString();
-        Serial.print("> ");
-        Serial.println(r);
-        Serial.println("<");
+        LOG_D("> %s", r);
         if (r.indexOf(needle) >= 0) {
-          Serial.printf("Found message '%s'; Continuing!\r\n", terminate);
+          LOG_D("Found message '%s' after %dms", terminate, waited);
           return true;
         }
       }
 
-    Serial.print(".");
     delay(250);
     waited+=250;
   }
-  Serial.printf("Did not see message '%s'\r\n", terminate);
+  LOG_W("Did not see message '%s'", terminate);
   return false;
 }
 
@@ -162,10 +194,10 @@ int waitForMessage(const char* terminate, int waitPeriod){
 int sendCommandF(const char* format, int i){
   char* commandStr;
   if(0 > asprintf(&commandStr, format, i)) {
-    Serial.println("Failed to generate command");
+    LOG_E("Failed to generate command");
     return false;
   }
-  Serial.println(&commandStr[0]);
+  LOG_D("%s", commandStr);
 
   int result = sendCommand(&commandStr[0]);
   free(commandStr);
@@ -182,10 +214,10 @@ void sendData(const char* data) {
 void sendDataF(const char* format, int i){
   char* commandStr;
   if(0 > asprintf(&commandStr, format, i)) {
-    Serial.println("Failed to generate command");
+    LOG_E("Failed to generate command");
     return;
   }
-  Serial.println(&commandStr[0]);
+  LOG_D("%s", commandStr);
 
   sendData(&commandStr[0]);
   free(commandStr);
@@ -198,8 +230,7 @@ const char* tryReadModem() {
     delay(500);
     if (SerialAT.available()) {
       String r = SerialAT.readString();
-      Serial.print("> ");
-      Serial.print(r); // commands end in newlines
+      LOG_D("> %s", r);
       return r.c_str();
     }
   }
@@ -234,10 +265,61 @@ const char* readCommandQuiet(const char* cmd){
   return tryReadModemQuiet();
 }
 
+// Send a catalogue command with no arguments, and read its information reply.
+// Waits up to the command's timeout class for the reply line.
+template <class C>
+at::Status queryModem(typename C::Reply& out){
+  SerialAT.print(at::command<C>());
+  SerialAT.print("\r");
+  String r = "";
+  at::Status status = at::Status::NoReply;
+  for (uint32_t waited = 0; waited < at::timeoutMs<C>(); waited += 100){
+    delay(100);
+    if (!SerialAT.available()) continue;
+    r += SerialAT.readString();
+    status = at::parse<C>(r.c_str(), r.length(), out);
+    if (status != at::Status::NoReply) break;
+  }
+  if (status != at::Status::Ok) LOG_W("%s: no reply (status %d) %s", C::desc.name, (int)status, r);
+  return status;
+}
+
+int _supplyMv = 0; // last 'AT+CBC' reading
+
+// Ask the modem for its supply voltage, and pass it to the profiler.
+// Returns millivolts, or zero if the reply could not be read
+int readSupplyVoltage(){
+  at::BatteryCharge::Reply reply;
+  if (queryModem<at::BatteryCharge>(reply) != at::Status::Ok) return 0;
+  int mv = reply.volts.value;
+  LOG_I("Supply voltage: %dmV", mv);
+  profileSetModemMv(mv);
+  _supplyMv = mv;
+  return mv;
+}
+
+// Ask the modem for signal strength.
+// Returns RSSI (0..31), or DUTY_CSQ_UNKNOWN
+int readSignalQuality(){
+  at::SignalQuality::Reply reply;
+  if (queryModem<at::SignalQuality>(reply) != at::Status::Ok) return DUTY_CSQ_UNKNOWN;
+  if (reply.rssi < 0 || reply.rssi > 31) return DUTY_CSQ_UNKNOWN;
+  return reply.rssi;
+}
+
+// Ask the modem for its CPU temperature.
+// Returns degrees C, or DUTY_TEMP_UNKNOWN
+int readModuleTemperature(){
+  at::ModuleTemperature::Reply reply;
+  if (queryModem<at::ModuleTemperature>(reply) != at::Status::Ok) return DUTY_TEMP_UNKNOWN;
+  return reply.celsius;
+}
+
 // Enable, power-up and reset the modem.
 // The modem is ready if this function returns 'true'
 int modemTurnOn() {
-  Serial.println(F("Resetting Modem...\r\n"));
+  LOG_I("Resetting Modem...");
+  profileStart(PHASE_MODEM_POWER);
 
   // Set the A7670 enable line (?)
   pinMode(MODEM_ENABLE, OUTPUT);
@@ -259,32 +341,35 @@ int modemTurnOn() {
   delay(1000);
   digitalWrite(MODEM_POWER, LOW);
 
-  Serial.println(F("Modem power-up starting\r\n"));
+  LOG_I("Modem power-up starting");
   delay(5000); // give it a while to boot
+  profileEnd(PHASE_MODEM_POWER, true);
 
-
+  profileStart(PHASE_PB_DONE);
   int reply = waitForMessage("PB DONE", 12000);
+  profileEnd(PHASE_PB_DONE, reply);
   if (reply==false){
-    Serial.println(F("** DID NOT SEE PB DONE message **"));
+    LOG_W("** DID NOT SEE PB DONE message **");
   }
 
   // test with an 'AT' command
-  Serial.println(F("Testing Modem Response..."));
+  LOG_I("Testing Modem Response...");
   reply = sendCommand("ATZ"); // Load user settings
 
   if (reply == false) {
-    Serial.println(F("** Failed to connect to the modem! Check the baud and try again.**"));
+    LOG_E("** Failed to connect to the modem! Check the baud and try again.**");
     return false;
   }
 
   atWait();
-  Serial.println(F("Modem is active and ready"));
+  readSupplyVoltage(); // tag the rest of the profile with modem supply voltage
+  LOG_I("Modem is active and ready");
   return true;
 }
 
 // Send a power-off command to the SIMCOM modem
 void modemTurnOff(){
-  Serial.println("Powering off the SIMCOM unit");
+  LOG_I("Powering off the SIMCOM unit");
   sendCommand("AT+CPOF"); // try to power-off the SIMCOM module.
   atWait();
 }
@@ -294,18 +379,44 @@ void modemTurnOff(){
 // current firmware. It is NOT the available operators at the nearest tower.
 void queryOperatorNames(){
   int reply = sendCommand("AT+COPN");
-  if (reply == false) Serial.println("Failed to read operator list");
+  if (reply == false) LOG_W("Failed to read operator list");
+}
+
+// Poll the modem until it reports packet domain attach ("+CGATT: 1")
+int modemWaitForAttach(int waitPeriod){
+  int waited = 0;
+  while (waited < waitPeriod){
+    SerialAT.print("AT+CGATT?\r");
+    delay(500);
+    waited += 500;
+    if (SerialAT.available()) {
+      String r = SerialAT.readString();
+      if (r.indexOf("+CGATT: 1") >= 0) return true;
+    }
+    delay(500);
+    waited += 500;
+  }
+  return false;
 }
 
 // Start socket services for sending raw UDP data
 int modemEnableData(){
-  int reply = sendCommand("AT+NETOPEN");
-  if (reply == false) { Serial.println("Failed to open network session"); return false; }
-
-  reply = sendCommand("AT+CIPOPEN=3,\"UDP\",,,42069"); // Open a UDP session on line 3, local port 42069
+  profileStart(PHASE_NET_ATTACH);
+  int reply = modemWaitForAttach(30000);
+  profileEnd(PHASE_NET_ATTACH, reply);
+  if (reply == false) LOG_W("Network not attached yet. Trying anyway."); // NETOPEN will tell us
+
+  profileStart(PHASE_NET_OPEN);
+  reply = sendCommand(at::command<at::NetOpen>());
+  if (reply == false) { profileEnd(PHASE_NET_OPEN, false); LOG_W("Failed to open network session"); return false; }
+
+  char cmd[48];
+  at::format<at::IpOpen>(cmd, sizeof(cmd), {UDP_LINK, {"UDP"}, {}, {}, 42069}); // Open a UDP session on line 3, local port 42069
+  reply = sendCommand(cmd);
+  profileEnd(PHASE_NET_OPEN, reply);
   if (reply == false) {
-    Serial.println("Failed to open UDP session");
-    sendCommand("AT+NETCLOSE"); // try to close data session
+    LOG_W("Failed to open UDP session");
+    sendCommand(at::command<at::NetClose>()); // try to close data session
     return false;
   }
 
@@ -314,29 +425,46 @@ int modemEnableData(){
 
 // Stop socket services for sending raw UDP data
 int modemDisableData(){
-  int reply = sendCommand("AT+CIPCLOSE=3"); // Close any session on line 3
-  if (reply == false) Serial.println("Failed to close network session"); // still try to close network service
+  char cmd[24];
+  at::format<at::IpClose>(cmd, sizeof(cmd), {UDP_LINK}); // Close any session on line 3
+  int reply = sendCommand(cmd);
+  if (reply == false) LOG_W("Failed to close network session"); // still try to close network service
 
-  reply = sendCommand("AT+NETCLOSE");
-  if (reply == false) { Serial.println("Failed to close network session"); return false; }
+  reply = sendCommand(at::command<at::NetClose>());
+  if (reply == false) { LOG_W("Failed to close network session"); return false; }
 
   return true;
 }
 
-// Send a basic test message to a network device
+void applyDownlink(uint16_t id, const char* body);
+
+// Send a basic test message to a network device.
+// The message acknowledges downlink commands applied so far, and the reply brings any new ones.
 int modemSendUdp(){
-  // AT+CIPSEND=<link_num>,<length>,<serverIP>,<serverPort>
-  sendData("AT+CIPSEND=3,29,\"85.9.248.158\",420");
+  char message[48] = "Hello, Server! This is T-SIM.";
+  int length = strlen(message);
+  length += downlinkFormatAck(message + length, sizeof(message) - length);
+
+  char cmd[64];
+  at::format<at::IpSend>(cmd, sizeof(cmd), {UDP_LINK, length, {SERVER_IP}, SERVER_PORT_TEST});
+  profileStart(PHASE_SEND);
+  sendData(cmd);
   atWait();
-  sendData("Hello, Server! This is T-SIM.\n");
+  sendData(message);
+  profileEnd(PHASE_SEND, true);
   delay(1000); // wait for remote server
 
-  const char* msg = waitForMessageAndRead("+IPD", 12000, /*echo*/false); // wait for server to reply with data
-  if (msg == NULL){
-    Serial.println("Timeout waiting for server to reply.");
+  profileStart(PHASE_ACK);
+  char msg[DOWNLINK_REPLY_MAX];
+  bool replied = waitForMessageAndRead("+IPD", 12000, /*echo*/false, msg, sizeof(msg)); // wait for server to reply with data
+  profileEnd(PHASE_ACK, replied);
+  if (!replied){
+    LOG_W("Timeout waiting for server to reply.");
     return false;
   } else {
-    Serial.printf("Reply from server >>>\n%s\n<<<\n", msg); // output. Should be byte length, \n\n, reply data
+    LOG_I("Reply from server: %s", msg); // byte length, \r\n, reply data
+    int applied = downlinkApply(msg, applyDownlink);
+    if (applied > 0) LOG_I("Applied %d downlink commands, up to %u", applied, downlinkLastApplied());
   }
 
   return true;
@@ -357,16 +485,459 @@ int modemSendUdp(){
   //delay();
 }
 
+// Upload waiting profile records to the server, if enough have built up.
+// Records are kept in RTC memory until the server acknowledges them.
+int modemSendProfile(){
+  if (!profileUploadDue()) return true;
+
+  uint8_t summary[PROFILE_HEADER_BYTES + PROFILE_RING_SIZE * PROFILE_RECORD_BYTES];
+  int length = profileWriteSummary(summary, sizeof(summary));
+  if (length <= 0) return true;
+
+  char cmd[64];
+  at::format<at::IpSend>(cmd, sizeof(cmd), {UDP_LINK, length, {SERVER_IP}, SERVER_PORT_PROFILE});
+  sendData(cmd);
+  atWait();
+  SerialAT.write(summary, length); // binary, so no line ending
+  delay(1000); // wait for remote server
+
+  char msg[64];
+  if (!waitForMessageAndRead("+IPD", 12000, /*echo*/false, msg, sizeof(msg))){
+    LOG_W("Server did not acknowledge profile upload. Will retry next cycle.");
+    return false;
+  }
+
+  profileMarkUploaded(profileRecordsInSummary(length));
+  LOG_I("Uploaded %d profile records", profileRecordsInSummary(length));
+  return true;
+}
+
+// Wait for a '+IPD' message on the AT interface, and copy it (with the data after it) into 'reply'.
+// Returns false if nothing arrives within 'waitPeriod' ms.
+// Reads a byte at a time as they arrive, so it returns IPD_IDLE_MS after the datagram
+// instead of waiting out the Stream timeout.
+int modemReadIpd(char* reply, int replyLength, int waitPeriod){
+  int used = 0;
+  bool found = false;
+  uint32_t start = millis();
+  uint32_t lastByteMs = start;
+  while (found ? millis() - lastByteMs < IPD_IDLE_MS : millis() - start < (uint32_t)waitPeriod){
+    if (!SerialAT.available()) { delay(1); continue; }
+    char c = SerialAT.read();
+    lastByteMs = millis();
+    if (used < replyLength - 1) reply[used++] = c;
+    if (found) continue;
+
+    if (used >= 4 && memcmp(reply + used - 4, "+IPD", 4) == 0){
+      memcpy(reply, "+IPD", 4);
+      used = 4;
+      found = true;
+    } else if (c == '\n' || used == replyLength - 1){
+      used = 0; // not the '+IPD' line
+    }
+  }
+  reply[used] = 0;
+  return found;
+}
+
+// Wait for the '>' prompt that asks for the data of AT+CIPSEND
+bool modemWaitPrompt(uint32_t waitPeriod){
+  uint32_t start = millis();
+  while (millis() - start < waitPeriod){
+    if (!SerialAT.available()) { delay(1); continue; }
+    if (SerialAT.read() == '>') return true;
+  }
+  return false;
+}
+
+bool _modemDataUp = false; // modem on, with a UDP session open for the bridge
+
+// Power up the modem and open a UDP session, unless that's already done
+int modemBridgeOpen(){
+  if (_modemDataUp) return true;
+  if (!modemTurnOn()) return false;
+  if (!modemEnableData()) { modemTurnOff(); return false; }
+  _modemDataUp = true;
+  return true;
+}
+
+// Close the bridge's UDP session and power down the modem
+void modemBridgeClose(){
+  if (!_modemDataUp) return;
+  modemDisableData();
+  modemTurnOff();
+  _modemDataUp = false;
+}
+
+// Send a bridge datagram, and copy the server's reply into 'reply'.
+// On failure the session is closed, so the next send starts from a clean modem.
+int modemSendBridge(const uint8_t* data, int length, char* reply, int replyLength){
+  if (!modemBridgeOpen()) return false;
+
+  char cmd[64];
+  at::format<at::IpSend>(cmd, sizeof(cmd), {UDP_LINK, length, {SERVER_IP}, SERVER_PORT_BRIDGE});
+  SerialAT.print(cmd);
+  SerialAT.print("\r");
+  if (!modemWaitPrompt(BRIDGE_PROMPT_TIMEOUT_MS)) { // don't use atWait() here; every ms counts against the latency target
+    LOG_W("Bridge: modem did not prompt for data");
+    modemBridgeClose();
+    return false;
+  }
+  SerialAT.write(data, length); // binary, so no line ending
+
+  if (!modemReadIpd(reply, replyLength, BRIDGE_ACK_TIMEOUT_MS)){
+    LOG_W("Bridge: no reply from server");
+    modemBridgeClose();
+    return false;
+  }
+  return true;
+}
+
+// Record the end of the wake cycle, then go into deep sleep.
+// Never returns. We will get reset with DEEPSLEEP_RESET
+void enterDeepSleep(uint64_t seconds){
+  Serial.print("Sleeping... Z");
+  esp_sleep_enable_timer_wakeup(seconds * S_TO_uS);
+  profileMark(PHASE_SLEEP_ENTRY);
+  Serial.print("z");
+  delay(200);
+  Serial.print("z");
+  delay(200);
+  esp_deep_sleep_start();
+}
+
+DutyConfig _dutyConfig;
+DutyDecision _dutyPlan; // sleepS is used when we go back to sleep
+
+// Settings changed by downlink commands. Kept in RTC memory, so they last until power-on reset.
+RTC_DATA_ATTR uint32_t _downlinkSleepS = 0; // 0: use the default
+bool _restartAfterCycle = false;            // a downlink asked for a restart
+
+// Apply one command from the server's downlink mailbox. Runs before we go back to sleep.
+//   "SET sleep <seconds>"  base sleep between wakes (kept within the duty scheduler limits)
+//   "RESTART"              restart at the end of this cycle
+// Anything else is logged and skipped; it is still acknowledged, so the server stops sending it.
+void applyDownlink(uint16_t id, const char* body){
+  unsigned long value = 0;
+  if (sscanf(body, "SET sleep %lu", &value) == 1){
+    value = constrain(value, _dutyConfig.minSleepS, _dutyConfig.maxSleepS);
+    _downlinkSleepS = value;
+    _dutyConfig.baseSleepS = value;
+    _dutyPlan.sleepS = value;
+    LOG_I("Downlink %u: sleep set to %lu s", id, value);
+  } else if (strcmp(body, "RESTART") == 0){
+    _restartAfterCycle = true;
+    LOG_I("Downlink %u: restarting after this cycle", id);
+  } else {
+    LOG_W("Downlink %u: unknown command '%s'", id, body);
+  }
+}
+
+#define CYCLE_MESSAGES 2 // most a cycle sends: the test message and the profile upload
+
+// Messages waiting for the modem: the test message, profile records if they are due,
+// and the bridge jobs queued behind this cycle
+int queuedMessageCount(int waitingJobs){
+  return 1 + (profileUploadDue() ? 1 : 0) + waitingJobs;
+}
+
+// Make a duty cycle decision, and log it so it can be replayed on the host (see PlatformIo/tools/duty_replay.cpp)
+DutyDecision planDuty(DutyInputs* duty){
+  DutyDecision plan = dutyDecide(duty, &_dutyConfig);
+  char line[80];
+  if (dutyFormatLog(line, sizeof(line), duty, &plan) > 0) LOG_I("%s", line);
+  return plan;
+}
+
+// One wake cycle of the modem: decide if it's worth powering on,
+// then send what the duty scheduler allows.
+// waitingJobs and jobCapacity describe the modem job queue this cycle was taken from.
+void runModemCycle(int waitingJobs, int jobCapacity){
+  DutyInputs duty;
+  duty.batteryMv = analogReadMilliVolts(BAT_ADC) * 2; // 1:1 divider on the T-SIM board
+  duty.supplyMv = 0;
+  duty.temperatureC = DUTY_TEMP_UNKNOWN;
+  duty.csq = DUTY_CSQ_UNKNOWN;
+  duty.queueDepth = queuedMessageCount(waitingJobs);
+  duty.queueCapacity = CYCLE_MESSAGES + jobCapacity;
+  duty.urgent = 0;
+
+  // Don't spend energy on the modem if we wouldn't send anyway
+  _dutyPlan = planDuty(&duty);
+  if (!_dutyPlan.send) {LOG_I("Duty scheduler: not sending on this wake"); return; }
+
+  int reply = modemTurnOn();
+  if (reply == false) {LOG_E("Failed to start SIMCOM modem"); return; }
+
+  // Now we can see the signal and modem state, decide again
+  duty.supplyMv = _supplyMv;
+  duty.csq = readSignalQuality();
+  duty.temperatureC = readModuleTemperature();
+  _dutyPlan = planDuty(&duty);
+  if (!_dutyPlan.send) {LOG_I("Duty scheduler: deferring send"); modemTurnOff(); return; }
+
+  atWait();
+  LOG_I("Modem ready, Attempting UDP exchange");
+  atWait();
+  reply = modemEnableData();
+  if (reply == true){
+    LOG_I("Data connection up. Trying to send test message");
+    reply = modemSendUdp();
+    if (reply == false) LOG_W("Problem sending message");
+    if (_dutyPlan.batch > 1) { // profile upload is the second message in the queue
+      reply = modemSendProfile();
+      if (reply == false) LOG_W("Problem sending profile");
+    }
+    reply = modemDisableData();
+    if (reply == false) LOG_W("Problem disabling data connection");
+    else LOG_I("Data connection down.");
+  } else {
+    LOG_W("Failed to enable data");
+  }
+  modemTurnOff();
+}
+
+// ---------------------------------------------------------------------------
+// Tasks. Slow AT work runs on its own core, so it can never hold up the EWC link.
+//
+//   EWC link  --frames-->  telemetry  --jobs-->  modem
+//   (APP core, prio 5)     (APP core, prio 3)    (PRO core, prio 2)
+
+#define EWC_TASK_STACK 4096
+#define TELEMETRY_TASK_STACK 4096
+#define MODEM_TASK_STACK 8192    // String replies and the profile summary live on this stack
+#define STATS_PERIOD_MS 30000    // how often loop() prints task and queue stats
+#define MODEM_ENABLED 0          // modem RESET and EWC CTS share pin 5 on the current wiring, so only one can be used
+#define SD_LOG_ENABLED 1         // capture EWC frames, AT traffic and log records to the SD card, if one is fitted
+#define SD_LOG_BENCH_MS 0        // if not zero, measure the card for this long at start-up
+#define MODEM_IDLE_OFF_MS 120000 // power the modem down after this long with no bridge traffic
+#define EWC_MAX_COMMANDS 4       // server commands taken from one reply
+
+enum ModemJobType {
+  MODEM_JOB_CYCLE = 0, // power up, send what the duty scheduler allows, power down
+  MODEM_JOB_BRIDGE = 1 // send a bridge datagram, and bring back the reply
+};
+
+typedef struct {
+  uint8_t type; // ModemJobType
+  uint16_t length; // MODEM_JOB_BRIDGE: datagram length
+  uint8_t data[BRIDGE_MAX_DATAGRAM];
+} ModemJob;
+
+typedef struct {
+  uint8_t ok;      // server replied
+  uint32_t doneMs; // millis() when the reply arrived
+  char reply[BRIDGE_REPLY_MAX];
+} ModemResult;
+
+void ewcTaskMain(void* arg);
+void telemetryTaskMain(void* arg);
+void modemTaskMain(void* arg);
+
+PipelineTask _ewcTask = {"ewc", ewcTaskMain, EWC_TASK_STACK, 5, PIPELINE_CORE_APP};
+PipelineTask _telemetryTask = {"telemetry", telemetryTaskMain, TELEMETRY_TASK_STACK, 3, PIPELINE_CORE_APP};
+PipelineTask _modemTask = {"modem", modemTaskMain, MODEM_TASK_STACK, 2, PIPELINE_CORE_PRO};
+PipelineTask* _allTasks[] = {&_ewcTask, &_telemetryTask, &_modemTask};
+
+SpscQueue<EwcFrame, 32> _ewcToTelemetry; // producer: EWC task, consumer: telemetry task
+SpscQueue<ModemJob, 4> _telemetryToModem; // producer: telemetry task, consumer: modem task
+SpscQueue<ModemResult, 4> _modemToTelemetry; // producer: modem task, consumer: telemetry task
+SpscQueue<EwcFrame, 8> _telemetryToEwc; // server commands. producer: telemetry task, consumer: EWC task
 
-bool _ctsFlag;
 bool _haveTriggeredCommand;
-char ewcMsgBuf[128];
+EwcFrame _ewcHeld;        // server command waiting for CTS
+bool _ewcHolding = false;
+uint32_t _ewcCommandsSent = 0;
+
+// Log a frame as hex. Hex is written by the log task, not here.
+void printEwcFrame(const EwcFrame* frame){
+  // Name the message if we know its layout
+  const ewc::MessageDesc* desc = ewc::identify(frame->data, frame->length, frame->lead, ewc::Direction::FromEwc);
+  if (desc == nullptr){
+    LOG_I("%s (unknown)", binlogHex(frame->data, frame->length));
+    return;
+  }
+  ewc::Status status = ewc::validate(*desc, frame->data, frame->length);
+  LOG_I("%s %s status=%d", binlogHex(frame->data, frame->length), desc->name, (int)status);
+}
+
+// Send server commands while the EWC is ready for them.
+// If CTS is not active, the command is held until the next CTS_ON.
+void ewcSendCommands(){
+  for (;;){
+    if (!_ewcHolding){
+      if (!_telemetryToEwc.pop(_ewcHeld)) return;
+      _ewcHolding = true;
+    }
+    if (!ewcLinkSend(_ewcHeld.data, _ewcHeld.length)) return; // CTS not active
+    _ewcHolding = false;
+    _ewcCommandsSent++;
+  }
+}
+
+// Highest priority: move EWC events off the link queue as soon as they arrive.
+// Does no printing or other slow work, so the link queue never backs up.
+void ewcTaskMain(void* arg){
+  PipelineTask* self = (PipelineTask*)arg;
+  EwcEvent event;
+
+  for (;;){
+    // Sleep until the EWC link has something for us. The UART and CTS are interrupt driven, so the CPU idles here.
+    pipelineIdleBegin(self);
+    bool ok = ewcLinkWait(&event, portMAX_DELAY);
+    pipelineIdleEnd(self);
+    if (!ok) continue;
+
+    switch (event.type){
+      case EWC_EVENT_CTS_ON:
+        if (!_haveTriggeredCommand){ // do this just once
+          uint8_t msg[EWC_MAX_FRAME];
+          // Request EWC clock. Response should be 8054...03xx
+          //int length = ewc::encode(ewc::ClockRequest{}, msg, sizeof(msg));
+
+          ewc::TopUp topUp = {0, 0xd43d46a5, 0x0000, 0xffff}; // super-tap top-up for slot 0
+          int length = ewc::encode(topUp, msg, sizeof(msg));
+          _haveTriggeredCommand = length > 0 && ewcLinkSend(msg, length);
+        }
+        ewcSendCommands();
+        break;
+
+      case EWC_EVENT_WAKE: // the telemetry task has queued server commands
+        ewcSendCommands();
+        break;
+
+      case EWC_EVENT_CTS_OFF:
+        break;
+
+      case EWC_EVENT_FRAME:
+        sdLogWrite(SDLOG_SOURCE_EWC, event.frame.data, event.frame.length); // just a copy; the card is written by its own task
+        _ewcToTelemetry.push(event.frame); // a full queue is counted, and shows in the stats
+        pipelineWake(&_telemetryTask);
+        break;
+    }
+  }
+}
+
+// Handle results from the modem: record latency on an ack, and pass server commands to the EWC task
+void telemetryHandleResult(const ModemResult* result){
+  EwcFrame commands[EWC_MAX_COMMANDS];
+  int count = result->ok ? bridgeHandleReply(result->reply, result->doneMs, commands, EWC_MAX_COMMANDS) : -1;
+  if (count < 0){
+    LOG_W("Bridge: datagram not acknowledged. Will send again.");
+    bridgeSendFailed();
+    return;
+  }
+
+  for (int i = 0; i < count; i++){
+    if (!_telemetryToEwc.push(commands[i])) LOG_W("Bridge: EWC command queue full. Command dropped.");
+  }
+  if (count > 0) ewcLinkWake();
+}
+
+// Handle EWC frames, and decide when the modem should run.
+// Never waits on the modem: jobs are queued, and skipped if the modem is still busy.
+void telemetryTaskMain(void* arg){
+  PipelineTask* self = (PipelineTask*)arg;
+  uint32_t nextCycleMs = millis();
+  static ModemJob job;       // too big for this task's stack
+  static ModemResult result;
+
+  BridgeConfig bridgeConfig = bridgeDefaultConfig();
+  bridgeConfig.bootId = esp_random();
+  bridgeInit(&bridgeConfig);
+
+  for (;;){
+    pipelineWait(self, 250); // short, so routine batches go close to their age limit
+
+    EwcFrame frame;
+    while (_ewcToTelemetry.pop(frame)){
+      printEwcFrame(&frame);
+      bridgeAdd(&frame);
+    }
+
+    while (_modemToTelemetry.pop(result)){
+      telemetryHandleResult(&result);
+    }
+
+    uint32_t now = millis();
+    // Only build a datagram when the modem queue has room for it. Building one marks it
+    // sent (and counts a retry if it is a resend), so a full queue would look like a lost ack.
+    if (MODEM_ENABLED && !_telemetryToModem.full() && bridgeSendDue(now)){
+      job.type = MODEM_JOB_BRIDGE;
+      job.length = bridgeBuildDatagram(job.data, sizeof(job.data), now);
+      if (job.length > 0 && _telemetryToModem.push(job)) pipelineWake(&_modemTask); // this task is the only producer, so there is still room
+    }
+
+    if (bridgeReportDue(now)){
+      char line[160];
+      if (bridgeFormatReport(line, sizeof(line), now) > 0) LOG_I("%s", line);
+    }
+
+    if (MODEM_ENABLED && (int32_t)(now - nextCycleMs) >= 0){
+      job.type = MODEM_JOB_CYCLE;
+      job.length = 0;
+      if (_telemetryToModem.push(job)) pipelineWake(&_modemTask);
+      nextCycleMs += _dutyPlan.sleepS * 1000UL;
+    }
+  }
+}
+
+// All AT traffic happens here. This task may block for tens of seconds at a time.
+void modemTaskMain(void* arg){
+  PipelineTask* self = (PipelineTask*)arg;
+  static ModemJob job;       // copies of queue items, kept off the stack
+  static ModemResult result;
+
+  for (;;){
+    bool woken = pipelineWait(self, _modemDataUp ? MODEM_IDLE_OFF_MS : portMAX_DELAY);
+    if (!woken && _modemDataUp){
+      LOG_I("Bridge idle. Powering down modem.");
+      modemBridgeClose();
+      continue;
+    }
+
+    while (_telemetryToModem.pop(job)){
+      switch (job.type){
+        case MODEM_JOB_CYCLE:
+          modemBridgeClose(); // the cycle does its own power-up
+          runModemCycle(_telemetryToModem.count(), _telemetryToModem.capacity());
+          if (_restartAfterCycle){
+            if (_sdLogging) sdLogEnd(); // write what's buffered and trim the file first
+            ESP.restart();
+          }
+          //enterDeepSleep(_dutyPlan.sleepS); // never returns. We will get reset with DEEPSLEEP_RESET
+          break;
+
+        case MODEM_JOB_BRIDGE:
+          result.ok = modemSendBridge(job.data, job.length, result.reply, sizeof(result.reply));
+          result.doneMs = millis();
+          if (!result.ok) result.reply[0] = 0;
+          _modemToTelemetry.push(result); // can't be full: one datagram is in flight at a time
+          pipelineWake(&_telemetryTask);
+          break;
+      }
+    }
+  }
+}
 
 void setup() {
+  profilerInit(BAT_ADC); // first, so the boot span is accurate
+
  // Connect to USB serial port if available
   Serial.begin(USB_BAUD);
   delay(100);
   Serial.println("Lilygo is up. Program is 06 UDP duplex test.");
+  // Log records go through a low priority task. With an SD card they are captured as binary,
+  // for tools/sdlog_dump and tools/binlog_decode; otherwise they are printed to the console.
+  _sdLogging = SD_LOG_ENABLED && sdLogBegin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS, PIPELINE_CORE_PRO);
+  if (_sdLogging){
+    binlogBegin(&_binlogToSd, BINLOG_OUTPUT_BINARY, PIPELINE_CORE_PRO);
+    sdLogPrintStats();
+    if (SD_LOG_BENCH_MS > 0) sdLogBench(SD_LOG_BENCH_MS);
+  } else {
+    if (SD_LOG_ENABLED) Serial.println("No SD card. Logging to the console.");
+    binlogBegin(&Serial, BINLOG_OUTPUT_TEXT, PIPELINE_CORE_PRO);
+  }
 
   // Output reset types
   RESET_REASON core0 = rtc_get_reset_reason(0);
@@ -381,92 +952,47 @@ void setup() {
   }*/
 
   // Connect serial to the SIMCOM module
-  /*SerialAT.begin(UART_BAUD, SERIAL_8N1, PIN_RX, PIN_TX);  // ESP32 <-> SIMCOM
-  delay(100);
-*/
+  if (MODEM_ENABLED){
+    SerialATPort.begin(UART_BAUD, SERIAL_8N1, PIN_RX, PIN_TX);  // ESP32 <-> SIMCOM
+    delay(100);
+  }
 
   // Connect serial to the EWC module
-  pinMode(PIN_EWC_TX, OUTPUT);
-  pinMode(PIN_EWC_RX, INPUT);
-  pinMode(PIN_EWC_CTS, INPUT);
-  SerialEWC.begin(EWC_BAUD, SERIAL_8N1, PIN_EWC_RX, PIN_EWC_TX);  // ESP32 <-> EWC
-
-  Serial.print("LEFT THE BIG LOOP");
-  delay(250);
-
-  //SerialEWC.println("Hello, EWC");
-
-  // turn the modem on
-  /*
-  int reply = modemTurnOn();
-  if (reply == false) {Serial.println(F("Failed to start SIMCOM modem")); return; }
-  
-  atWait();
-  Serial.println("Modem ready, Attempting UDP exchange");
-  atWait();
-  reply = modemEnableData();
-  if (reply == true){
-    Serial.println("Data connection up. Trying to send test message");
-    reply = modemSendUdp();
-    if (reply == false) Serial.println("Problem sending message");
-    reply = modemDisableData();
-    if (reply == false) Serial.println("Problem disabling data connection");
-    else Serial.println("Data connection down.");
-  } else {
-    Serial.println("Failed to enable data");
+  if (!ewcLinkBegin(&SerialEWC, EWC_BAUD, PIN_EWC_RX, PIN_EWC_TX, PIN_EWC_CTS, EWC_QUEUE_DEPTH)) {  // ESP32 <-> EWC
+    Serial.println("Failed to start EWC link");
   }
-*/
-  //SerialEWC.println("Hello, EWC");
-/*
-  atWait();
-  Serial.println("Set-up complete. Going to main loop ");
-  */
- _haveTriggeredCommand = false;
+
+  // Duty cycle defaults; sleep is based on the one hour cycle
+  _dutyConfig = dutyDefaultConfig();
+  _dutyConfig.baseSleepS = ONE_HOUR_S;
+  _dutyConfig.minSleepS = ONE_MINUTE_S;
+  _dutyPlan.sleepS = ONE_HOUR_S;
+  downlinkInit();
+  if (_downlinkSleepS > 0) {_dutyConfig.baseSleepS = _downlinkSleepS; _dutyPlan.sleepS = _downlinkSleepS; }
+  _haveTriggeredCommand = false;
+
+  // Tasks get their own PipelineTask as the argument
+  pipelineStart(&_ewcTask, &_ewcTask);
+  pipelineStart(&_telemetryTask, &_telemetryTask);
+  pipelineStart(&_modemTask, &_modemTask);
+
+  Serial.println("Set-up complete. Tasks running.");
 }
 
+// The work is all done in tasks. The Arduino loop just reports how they are doing.
 void loop() {
-  // Drop directly into deep sleep
-
-  bool newCtsFlag = !digitalRead(PIN_EWC_CTS);
-  if (newCtsFlag && !_ctsFlag){
-    Serial.print(" CTS on;");
-    _ctsFlag = true;
-    if (!_haveTriggeredCommand){ // do this just once
-      _haveTriggeredCommand = true;
-      // Request EWC clock. Response should be 8054...03xx
-      //SerialEWC.write(0x54);
-      //SerialEWC.write(0x03);
-      //SerialEWC.write(0x57);
-
-      int sttuMsg[12] = {0x4c, 0x00, 0xd4, 0x3d, 0x46, 0xa5, 0x00, 0x00, 0xff, 0xff, 0x03, 0x45}; // super-tap top-up for slot 0
-      for (int i = 0; i < 12; i++){
-        SerialEWC.write(sttuMsg[i]);
-      }
-    }
-  } else if (!newCtsFlag && _ctsFlag){
-    Serial.print(" CTS off;");
-    _ctsFlag = false;
-  }
-
-  int available = SerialEWC.available();
-  if (available > 0){
-    int actual = SerialEWC.readBytes(ewcMsgBuf, available);
-    //Serial.printf("%d of %d: ", actual, available);
-    for (int i = 0; i < actual; i++){
-      Serial.printf("%02X", (unsigned char)ewcMsgBuf[i]);
-    }
-  }
-
-  //SerialEWC.println("Hello, EWC");
-/*
-  Serial.print("Turning off modem...");
-  modemTurnOff();
-  atWait();*/
-  //Serial.print("Sleeping... Z");
-  //esp_sleep_enable_timer_wakeup(ONE_HOUR_S * S_TO_uS);
-  //Serial.print("z");
-  //delay(200);
-  //Serial.print("z");
-  //delay(200);
-  //esp_deep_sleep_start(); // never returns. We will get reset with DEEPSLEEP_RESET
-}
\ No newline at end of file
+  delay(STATS_PERIOD_MS);
+
+  pipelinePrintStats(_allTasks, sizeof(_allTasks) / sizeof(_allTasks[0]));
+  Serial.printf("QUEUE,ewc->telemetry,%u/%u,peak=%u,rejected=%u\r\n", (unsigned)_ewcToTelemetry.count(), (unsigned)_ewcToTelemetry.capacity(),
+    (unsigned)_ewcToTelemetry.highWater(), (unsigned)_ewcToTelemetry.rejected());
+  Serial.printf("QUEUE,telemetry->modem,%u/%u,peak=%u,rejected=%u\r\n", (unsigned)_telemetryToModem.count(), (unsigned)_telemetryToModem.capacity(),
+    (unsigned)_telemetryToModem.highWater(), (unsigned)_telemetryToModem.rejected());
+  Serial.printf("QUEUE,telemetry->ewc,%u/%u,peak=%u,rejected=%u\r\n", (unsigned)_telemetryToEwc.count(), (unsigned)_telemetryToEwc.capacity(),
+    (unsigned)_telemetryToEwc.highWater(), (unsigned)_telemetryToEwc.rejected());
+
+  EwcLinkStats link = ewcLinkStats();
+  Serial.printf("EWC,frames=%u,drops=%u,gaps=%u,overflows=%u,bytes=%u,commands=%u\r\n", (unsigned)link.frames, (unsigned)link.queueDrops,
+    (unsigned)link.gapResets, (unsigned)link.overflows, (unsigned)link.bytes, (unsigned)_ewcCommandsSent);
+  if (_sdLogging) sdLogPrintStats();
+}
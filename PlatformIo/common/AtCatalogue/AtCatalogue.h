@@ -0,0 +1,655 @@
+#ifndef AT_CATALOGUE_H
+#define AT_CATALOGUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Catalogue of the SIMCOM AT commands we use.
+//
+// Each command is a constexpr table entry (see 'Command table' below) giving the
+// command text, its arguments, the prefix of its information reply, the reply
+// fields, how long to wait for it, and what it does to the modem. Each command
+// also has a struct with typed Args and Reply members that list their fields
+// with visit(), like the EwcCodec messages. A static_assert checks those against
+// the table, so the text of a command and the code that reads its reply can't
+// drift apart.
+//
+//   char cmd[32];
+//   at::format<at::HttpAction>(cmd, sizeof(cmd), {1});             // "AT+HTTPACTION=1"
+//   at::HttpAction::Reply action;
+//   if (at::parse<at::HttpAction>(reply, length, action) == at::Status::Ok)
+//     ... action.status == 200, action.length == 68 ...                // from "+HTTPACTION: 1,200,68"
+//
+// Commands are named by type, so a command that isn't in the catalogue doesn't
+// compile. Formatting and parsing work on caller buffers and never allocate.
+// Parsing compares each reply line against the known prefix once, then reads
+// the fields in order. It doesn't search the reply for strings.
+//
+// Needs C++17. Has no hardware dependencies, so it builds on the host.
+
+namespace at {
+
+enum class FieldType : uint8_t {
+  Int,    // signed decimal
+  Milli,  // decimal with up to 3 places, like "3.912V", read as thousandths (3912). Units are ignored
+  Text,   // a string, quoted or not. Reply fields only
+  Quoted, // a string argument, written in quotes
+  Blank   // an argument left empty, like the middle of "AT+CIPOPEN=3,"UDP",,,42069"
+};
+
+// How long a command can take to finish. Use timeoutMs() to get a wait time
+enum class Timeout : uint8_t {
+  Quick,    // answered by the modem itself
+  Network,  // needs a reply from the network (attach, sockets, HTTP)
+  Power     // radio or GNSS power changes
+};
+
+constexpr uint32_t timeoutMs(Timeout t) {
+  return t == Timeout::Quick ? 2500 : t == Timeout::Network ? 30000 : 15000;
+}
+
+// What a command does, beyond answering. Bit flags
+namespace effect {
+constexpr uint8_t None = 0;
+constexpr uint8_t Prompt = 1 << 0;        // modem waits for data after a '>' or 'DOWNLOAD' prompt
+constexpr uint8_t LateReply = 1 << 1;     // information reply comes after the 'OK', once the work is done
+constexpr uint8_t OpensSession = 1 << 2;  // starts a network, socket or HTTP session that must be closed
+constexpr uint8_t ClosesSession = 1 << 3;
+constexpr uint8_t RadioOff = 1 << 4;      // modem stops answering
+constexpr uint8_t Persists = 1 << 5;      // changes settings saved in the modem
+}
+
+struct Field {
+  const char* name;
+  FieldType type;
+};
+
+struct CommandDesc {
+  const char* name;
+  const char* text;     // command without arguments, like "AT+HTTPACTION"
+  const Field* args;    // written after '=', comma separated
+  uint8_t argCount;
+  const char* prefix;   // start of the information reply line, or nullptr if there is only OK/ERROR
+  const Field* fields;  // comma separated values after the prefix
+  uint8_t fieldCount;
+  Timeout timeout;
+  uint8_t effects;
+};
+
+// Result of a parse. Values are logged, so only append.
+enum class Status : uint8_t {
+  Ok = 0,
+  NoReply,   // no line with the command's prefix
+  Error,     // modem said ERROR (or +CME ERROR) first
+  BadField,  // a field was missing or not a number
+  NoSpace    // output buffer too small (format only)
+};
+
+// ---------------------------------------------------------------------------
+// Command table. Replies are from the A7670 AT command manual and our captures.
+
+inline constexpr Field linkArgs[] = {{"link", FieldType::Int}};
+inline constexpr Field errorFields[] = {{"error", FieldType::Int}};
+inline constexpr Field linkErrorFields[] = {{"link", FieldType::Int}, {"error", FieldType::Int}};
+
+inline constexpr Field csqFields[] = {{"rssi", FieldType::Int}, {"ber", FieldType::Int}};
+inline constexpr Field cbcFields[] = {{"volts", FieldType::Milli}};
+inline constexpr Field temperatureFields[] = {{"celsius", FieldType::Int}};
+inline constexpr Field clockFields[] = {{"time", FieldType::Text}};
+inline constexpr Field attachFields[] = {{"attached", FieldType::Int}};
+inline constexpr Field onOffArgs[] = {{"on", FieldType::Int}};
+inline constexpr Field imeiFields[] = {{"imei", FieldType::Text}};
+inline constexpr Field iccidFields[] = {{"iccid", FieldType::Text}};
+inline constexpr Field pdpContextArgs[] = {{"cid", FieldType::Int}, {"type", FieldType::Quoted}, {"apn", FieldType::Quoted}};
+
+inline constexpr Field ipOpenArgs[] = {
+  {"link", FieldType::Int},
+  {"protocol", FieldType::Quoted},
+  {"remoteIp", FieldType::Blank},
+  {"remotePort", FieldType::Blank},
+  {"localPort", FieldType::Int},
+};
+inline constexpr Field ipSendArgs[] = {
+  {"link", FieldType::Int},
+  {"length", FieldType::Int},
+  {"ip", FieldType::Quoted},
+  {"port", FieldType::Int},
+};
+inline constexpr Field ipSendFields[] = {{"link", FieldType::Int}, {"requested", FieldType::Int}, {"sent", FieldType::Int}};
+
+inline constexpr Field httpParaArgs[] = {{"name", FieldType::Quoted}, {"value", FieldType::Quoted}};
+inline constexpr Field httpDataArgs[] = {{"length", FieldType::Int}, {"timeS", FieldType::Int}};
+inline constexpr Field httpActionArgs[] = {{"method", FieldType::Int}};
+inline constexpr Field httpActionFields[] = {{"method", FieldType::Int}, {"status", FieldType::Int}, {"length", FieldType::Int}};
+inline constexpr Field httpReadArgs[] = {{"length", FieldType::Int}};
+inline constexpr Field httpReadAtArgs[] = {{"start", FieldType::Int}, {"length", FieldType::Int}};
+
+//                                               name                 text             args            n  prefix           fields              n  timeout            effects
+inline constexpr CommandDesc attentionDesc     = {"Attention",        "AT",            nullptr,        0, nullptr,         nullptr,            0, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc signalQualityDesc = {"SignalQuality",    "AT+CSQ",        nullptr,        0, "+CSQ: ",        csqFields,          2, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc batteryDesc       = {"BatteryCharge",    "AT+CBC",        nullptr,        0, "+CBC: ",        cbcFields,          1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc temperatureDesc   = {"ModuleTemperature","AT+CPMUTEMP",   nullptr,        0, "+CPMUTEMP: ",   temperatureFields,  1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc clockReadDesc     = {"ClockRead",        "AT+CCLK?",      nullptr,        0, "+CCLK: ",       clockFields,        1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc attachedDesc      = {"Attached",         "AT+CGATT?",     nullptr,        0, "+CGATT: ",      attachFields,       1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc netOpenDesc       = {"NetOpen",          "AT+NETOPEN",    nullptr,        0, "+NETOPEN: ",    errorFields,        1, Timeout::Network, effect::LateReply | effect::OpensSession};
+inline constexpr CommandDesc netCloseDesc      = {"NetClose",         "AT+NETCLOSE",   nullptr,        0, "+NETCLOSE: ",   errorFields,        1, Timeout::Network, effect::LateReply | effect::ClosesSession};
+inline constexpr CommandDesc ipOpenDesc        = {"IpOpen",           "AT+CIPOPEN",    ipOpenArgs,     5, "+CIPOPEN: ",    linkErrorFields,    2, Timeout::Network, effect::LateReply | effect::OpensSession};
+inline constexpr CommandDesc ipCloseDesc       = {"IpClose",          "AT+CIPCLOSE",   linkArgs,       1, "+CIPCLOSE: ",   linkErrorFields,    2, Timeout::Network, effect::LateReply | effect::ClosesSession};
+inline constexpr CommandDesc ipSendDesc        = {"IpSend",           "AT+CIPSEND",    ipSendArgs,     4, "+CIPSEND: ",    ipSendFields,       3, Timeout::Network, effect::Prompt | effect::LateReply};
+inline constexpr CommandDesc httpInitDesc      = {"HttpInit",         "AT+HTTPINIT",   nullptr,        0, nullptr,         nullptr,            0, Timeout::Quick,   effect::OpensSession};
+inline constexpr CommandDesc httpParaDesc      = {"HttpPara",         "AT+HTTPPARA",   httpParaArgs,   2, nullptr,         nullptr,            0, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc httpDataDesc      = {"HttpData",         "AT+HTTPDATA",   httpDataArgs,   2, nullptr,         nullptr,            0, Timeout::Quick,   effect::Prompt};
+inline constexpr CommandDesc httpActionDesc    = {"HttpAction",       "AT+HTTPACTION", httpActionArgs, 1, "+HTTPACTION: ", httpActionFields,   3, Timeout::Network, effect::LateReply};
+inline constexpr CommandDesc httpReadDesc      = {"HttpRead",         "AT+HTTPREAD",   httpReadArgs,   1, nullptr,         nullptr,            0, Timeout::Network, effect::None};
+inline constexpr CommandDesc httpReadAtDesc    = {"HttpReadAt",       "AT+HTTPREAD",   httpReadAtArgs, 2, nullptr,         nullptr,            0, Timeout::Network, effect::None};
+inline constexpr CommandDesc httpTermDesc      = {"HttpTerm",         "AT+HTTPTERM",   nullptr,        0, nullptr,         nullptr,            0, Timeout::Quick,   effect::ClosesSession};
+inline constexpr CommandDesc gnssPowerDesc     = {"GnssPower",        "AT+CGNSSPWR",   onOffArgs,      1, nullptr,         nullptr,            0, Timeout::Power,   effect::None};
+inline constexpr CommandDesc powerOffDesc      = {"PowerOff",         "AT+CPOF",       nullptr,        0, nullptr,         nullptr,            0, Timeout::Power,   effect::RadioOff};
+inline constexpr CommandDesc saveSettingsDesc  = {"SaveSettings",     "AT&W",          nullptr,        0, nullptr,         nullptr,            0, Timeout::Quick,   effect::Persists};
+inline constexpr CommandDesc imeiDesc          = {"Imei",             "AT+SIMEI?",     nullptr,        0, "+SIMEI: ",      imeiFields,         1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc iccidDesc         = {"Iccid",            "AT+CICCID",     nullptr,        0, "+ICCID: ",      iccidFields,        1, Timeout::Quick,   effect::None};
+inline constexpr CommandDesc networkTimeDesc   = {"NetworkTime",      "AT+CTZU",       onOffArgs,      1, nullptr,         nullptr,            0, Timeout::Quick,   effect::Persists};
+inline constexpr CommandDesc pdpContextDesc    = {"PdpContext",       "AT+CGDCONT",    pdpContextArgs, 3, nullptr,         nullptr,            0, Timeout::Quick,   effect::Persists};
+
+inline constexpr const CommandDesc* commandTable[] = {
+  &attentionDesc, &signalQualityDesc, &batteryDesc, &temperatureDesc, &clockReadDesc, &attachedDesc,
+  &netOpenDesc, &netCloseDesc, &ipOpenDesc, &ipCloseDesc, &ipSendDesc,
+  &httpInitDesc, &httpParaDesc, &httpDataDesc, &httpActionDesc, &httpReadDesc, &httpReadAtDesc, &httpTermDesc,
+  &gnssPowerDesc, &powerOffDesc, &saveSettingsDesc, &imeiDesc, &iccidDesc, &networkTimeDesc, &pdpContextDesc,
+};
+inline constexpr int commandCount = sizeof(commandTable) / sizeof(commandTable[0]);
+
+// ---------------------------------------------------------------------------
+// Field types for the typed structs
+
+// Thousandths, from a FieldType::Milli reply field
+struct Milli {
+  int32_t value;
+};
+
+// A FieldType::Text reply field, without quotes. Cut to fit, always terminated
+template <int N>
+struct Text {
+  char value[N];
+};
+
+// A FieldType::Quoted argument. Not copied, so it must stay valid until formatted
+struct Quoted {
+  const char* value;
+};
+
+// A FieldType::Blank argument
+struct Blank {};
+
+struct NoFields {
+  template <class V, class M> static constexpr void visit(V&, M&) {}
+};
+
+// ---------------------------------------------------------------------------
+// Typed commands. visit() must list members in table order.
+
+struct Attention {
+  static constexpr const CommandDesc& desc = attentionDesc;
+  using Args = NoFields;
+  using Reply = NoFields;
+};
+
+struct SignalQuality {
+  static constexpr const CommandDesc& desc = signalQualityDesc;
+  using Args = NoFields;
+  struct Reply {
+    int32_t rssi; // 0..31, or 99 if not known
+    int32_t ber;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.rssi); v(m.ber); }
+  };
+};
+
+struct BatteryCharge {
+  static constexpr const CommandDesc& desc = batteryDesc;
+  using Args = NoFields;
+  struct Reply {
+    Milli volts; // volts.value is millivolts
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.volts); }
+  };
+};
+
+struct ModuleTemperature {
+  static constexpr const CommandDesc& desc = temperatureDesc;
+  using Args = NoFields;
+  struct Reply {
+    int32_t celsius;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.celsius); }
+  };
+};
+
+struct ClockRead {
+  static constexpr const CommandDesc& desc = clockReadDesc;
+  using Args = NoFields;
+  struct Reply {
+    Text<24> time; // "yy/MM/dd,hh:mm:ss±zz"
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.time); }
+  };
+};
+
+struct Attached {
+  static constexpr const CommandDesc& desc = attachedDesc;
+  using Args = NoFields;
+  struct Reply {
+    int32_t attached; // 1 if attached to the packet domain
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.attached); }
+  };
+};
+
+// Reply for commands that only report an error code (0 is success)
+struct ErrorReply {
+  int32_t error;
+  template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.error); }
+};
+
+struct LinkArgs {
+  int32_t link;
+  template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.link); }
+};
+
+struct LinkErrorReply {
+  int32_t link;
+  int32_t error;
+  template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.link); v(m.error); }
+};
+
+struct NetOpen {
+  static constexpr const CommandDesc& desc = netOpenDesc;
+  using Args = NoFields;
+  using Reply = ErrorReply;
+};
+
+struct NetClose {
+  static constexpr const CommandDesc& desc = netCloseDesc;
+  using Args = NoFields;
+  using Reply = ErrorReply;
+};
+
+struct IpOpen {
+  static constexpr const CommandDesc& desc = ipOpenDesc;
+  struct Args {
+    int32_t link;
+    Quoted protocol; // "UDP" or "TCP"
+    Blank remoteIp;
+    Blank remotePort;
+    int32_t localPort;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.link); v(m.protocol); v(m.remoteIp); v(m.remotePort); v(m.localPort); }
+  };
+  using Reply = LinkErrorReply;
+};
+
+struct IpClose {
+  static constexpr const CommandDesc& desc = ipCloseDesc;
+  using Args = LinkArgs;
+  using Reply = LinkErrorReply;
+};
+
+struct IpSend {
+  static constexpr const CommandDesc& desc = ipSendDesc;
+  struct Args {
+    int32_t link;
+    int32_t length;
+    Quoted ip;
+    int32_t port;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.link); v(m.length); v(m.ip); v(m.port); }
+  };
+  struct Reply {
+    int32_t link;
+    int32_t requested;
+    int32_t sent;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.link); v(m.requested); v(m.sent); }
+  };
+};
+
+struct HttpInit {
+  static constexpr const CommandDesc& desc = httpInitDesc;
+  using Args = NoFields;
+  using Reply = NoFields;
+};
+
+struct HttpPara {
+  static constexpr const CommandDesc& desc = httpParaDesc;
+  struct Args {
+    Quoted name; // "URL", "CONTENT", "ACCEPT", ...
+    Quoted value;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.name); v(m.value); }
+  };
+  using Reply = NoFields;
+};
+
+struct HttpData {
+  static constexpr const CommandDesc& desc = httpDataDesc;
+  struct Args {
+    int32_t length; // bytes of body to follow the 'DOWNLOAD' prompt
+    int32_t timeS;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.length); v(m.timeS); }
+  };
+  using Reply = NoFields;
+};
+
+struct HttpAction {
+  static constexpr const CommandDesc& desc = httpActionDesc;
+  struct Args {
+    int32_t method; // 0=GET;1=POST;2=HEAD;3=DELETE;4=PUT
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.method); }
+  };
+  struct Reply {
+    int32_t method;
+    int32_t status; // HTTP status, or SIMCOM 6xx/7xx error
+    int32_t length; // body bytes waiting for AT+HTTPREAD
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.method); v(m.status); v(m.length); }
+  };
+};
+
+struct HttpRead {
+  static constexpr const CommandDesc& desc = httpReadDesc;
+  struct Args {
+    int32_t length;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.length); }
+  };
+  using Reply = NoFields;
+};
+
+// Part of the body, from 'start'. Replies '+HTTPREAD: <n>' then n raw bytes, then '+HTTPREAD: 0'
+struct HttpReadAt {
+  static constexpr const CommandDesc& desc = httpReadAtDesc;
+  struct Args {
+    int32_t start;
+    int32_t length;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.start); v(m.length); }
+  };
+  using Reply = NoFields;
+};
+
+struct HttpTerm {
+  static constexpr const CommandDesc& desc = httpTermDesc;
+  using Args = NoFields;
+  using Reply = NoFields;
+};
+
+struct GnssPower {
+  static constexpr const CommandDesc& desc = gnssPowerDesc;
+  struct Args {
+    int32_t on;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.on); }
+  };
+  using Reply = NoFields;
+};
+
+struct PowerOff {
+  static constexpr const CommandDesc& desc = powerOffDesc;
+  using Args = NoFields;
+  using Reply = NoFields;
+};
+
+struct SaveSettings {
+  static constexpr const CommandDesc& desc = saveSettingsDesc;
+  using Args = NoFields;
+  using Reply = NoFields;
+};
+
+struct Imei {
+  static constexpr const CommandDesc& desc = imeiDesc;
+  using Args = NoFields;
+  struct Reply {
+    Text<20> imei;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.imei); }
+  };
+};
+
+struct Iccid {
+  static constexpr const CommandDesc& desc = iccidDesc;
+  using Args = NoFields;
+  struct Reply {
+    Text<24> iccid; // SIM card serial number
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.iccid); }
+  };
+};
+
+// Update the modem clock from network time (NITZ). Kept by AT&W
+struct NetworkTime {
+  static constexpr const CommandDesc& desc = networkTimeDesc;
+  struct Args {
+    int32_t on;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.on); }
+  };
+  using Reply = NoFields;
+};
+
+// Define a PDP context (APN). Kept in the modem's own storage
+struct PdpContext {
+  static constexpr const CommandDesc& desc = pdpContextDesc;
+  struct Args {
+    int32_t cid;
+    Quoted type; // "IP"
+    Quoted apn;
+    template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.cid); v(m.type); v(m.apn); }
+  };
+  using Reply = NoFields;
+};
+
+// ---------------------------------------------------------------------------
+// Compile-time check of typed commands against the table
+
+namespace detail {
+
+template <class T> struct TypeOf;
+template <> struct TypeOf<int32_t> { static constexpr FieldType value = FieldType::Int; };
+template <> struct TypeOf<Milli> { static constexpr FieldType value = FieldType::Milli; };
+template <int N> struct TypeOf<Text<N>> { static constexpr FieldType value = FieldType::Text; };
+template <> struct TypeOf<Quoted> { static constexpr FieldType value = FieldType::Quoted; };
+template <> struct TypeOf<Blank> { static constexpr FieldType value = FieldType::Blank; };
+
+struct LayoutCheck {
+  const Field* fields;
+  int count;
+  int index;
+  bool ok;
+  template <class F> constexpr void operator()(const F&) {
+    if (index >= count || fields[index].type != TypeOf<F>::value) ok = false;
+    index++;
+  }
+};
+
+template <class S> constexpr bool fieldsMatch(const Field* fields, int count) {
+  S m{};
+  LayoutCheck check{fields, count, 0, true};
+  S::visit(check, m);
+  return check.ok && check.index == count;
+}
+
+template <class C> constexpr bool layoutMatches() {
+  return fieldsMatch<typename C::Args>(C::desc.args, C::desc.argCount)
+      && fieldsMatch<typename C::Reply>(C::desc.fields, C::desc.fieldCount);
+}
+
+constexpr int length(const char* s) {
+  int n = 0;
+  while (s[n] != 0) n++;
+  return n;
+}
+
+struct Writer {
+  char* p;
+  char* end; // last usable byte (kept for the terminator)
+  bool ok;
+  bool first;
+  void put(char c) { if (p < end) *p++ = c; else ok = false; }
+  void put(const char* s) { while (*s) put(*s++); }
+  void separate() { put(first ? '=' : ','); first = false; }
+  void operator()(const int32_t& v) {
+    separate();
+    char digits[12];
+    int n = 0;
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    do { digits[n++] = '0' + u % 10; u /= 10; } while (u > 0);
+    if (v < 0) put('-');
+    while (n > 0) put(digits[--n]);
+  }
+  void operator()(const Quoted& v) { separate(); put('"'); put(v.value == nullptr ? "" : v.value); put('"'); }
+  void operator()(const Blank&) { separate(); }
+};
+
+// Reads comma separated fields from one reply line
+struct Reader {
+  const char* p;
+  const char* end; // end of the line
+  bool ok;
+
+  void skipSpaces() { while (p < end && *p == ' ') p++; }
+  void nextField() { // skip anything left in this field (like units), and the comma
+    while (p < end && *p != ',') p++;
+    if (p < end) p++;
+  }
+  bool digit() const { return p < end && *p >= '0' && *p <= '9'; }
+
+  void operator()(int32_t& v) {
+    skipSpaces();
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    if (!digit()) ok = false;
+    int32_t n = 0;
+    while (digit()) n = n * 10 + (*p++ - '0');
+    v = negative ? -n : n;
+    nextField();
+  }
+  void operator()(Milli& v) {
+    skipSpaces();
+    if (!digit()) ok = false;
+    int32_t n = 0;
+    while (digit()) n = n * 10 + (*p++ - '0');
+    int places = 0;
+    if (p < end && *p == '.') {
+      p++;
+      while (digit()) { if (places < 3) { n = n * 10 + (*p - '0'); places++; } p++; }
+    }
+    while (places++ < 3) n *= 10;
+    v.value = n;
+    nextField();
+  }
+  template <int N> void operator()(Text<N>& v) {
+    skipSpaces();
+    int n = 0;
+    if (p < end && *p == '"') { // quoted: may contain commas
+      p++;
+      while (p < end && *p != '"') { if (n < N - 1) v.value[n++] = *p; p++; }
+      if (p < end) p++; else ok = false;
+    } else {
+      while (p < end && *p != ',') { if (n < N - 1) v.value[n++] = *p; p++; }
+    }
+    v.value[n] = 0;
+    nextField();
+  }
+};
+
+// Does the line at p start with s?
+inline bool startsWith(const char* p, const char* end, const char* s) {
+  while (*s) {
+    if (p >= end || *p != *s) return false;
+    p++; s++;
+  }
+  return true;
+}
+
+} // namespace detail
+
+static_assert(detail::layoutMatches<Attention>(), "Attention does not match its table entry");
+static_assert(detail::layoutMatches<SignalQuality>(), "SignalQuality does not match its table entry");
+static_assert(detail::layoutMatches<BatteryCharge>(), "BatteryCharge does not match its table entry");
+static_assert(detail::layoutMatches<ModuleTemperature>(), "ModuleTemperature does not match its table entry");
+static_assert(detail::layoutMatches<ClockRead>(), "ClockRead does not match its table entry");
+static_assert(detail::layoutMatches<Attached>(), "Attached does not match its table entry");
+static_assert(detail::layoutMatches<NetOpen>(), "NetOpen does not match its table entry");
+static_assert(detail::layoutMatches<NetClose>(), "NetClose does not match its table entry");
+static_assert(detail::layoutMatches<IpOpen>(), "IpOpen does not match its table entry");
+static_assert(detail::layoutMatches<IpClose>(), "IpClose does not match its table entry");
+static_assert(detail::layoutMatches<IpSend>(), "IpSend does not match its table entry");
+static_assert(detail::layoutMatches<HttpInit>(), "HttpInit does not match its table entry");
+static_assert(detail::layoutMatches<HttpPara>(), "HttpPara does not match its table entry");
+static_assert(detail::layoutMatches<HttpData>(), "HttpData does not match its table entry");
+static_assert(detail::layoutMatches<HttpAction>(), "HttpAction does not match its table entry");
+static_assert(detail::layoutMatches<HttpRead>(), "HttpRead does not match its table entry");
+static_assert(detail::layoutMatches<HttpReadAt>(), "HttpReadAt does not match its table entry");
+static_assert(detail::layoutMatches<HttpTerm>(), "HttpTerm does not match its table entry");
+static_assert(detail::layoutMatches<GnssPower>(), "GnssPower does not match its table entry");
+static_assert(detail::layoutMatches<PowerOff>(), "PowerOff does not match its table entry");
+static_assert(detail::layoutMatches<SaveSettings>(), "SaveSettings does not match its table entry");
+static_assert(detail::layoutMatches<Imei>(), "Imei does not match its table entry");
+static_assert(detail::layoutMatches<Iccid>(), "Iccid does not match its table entry");
+static_assert(detail::layoutMatches<NetworkTime>(), "NetworkTime does not match its table entry");
+static_assert(detail::layoutMatches<PdpContext>(), "PdpContext does not match its table entry");
+
+// ---------------------------------------------------------------------------
+// Format and parse
+
+// Text of a command with no arguments, like "AT+CSQ"
+template <class C>
+constexpr const char* command() {
+  static_assert(C::desc.argCount == 0, "This command needs arguments. Use at::format()");
+  return C::desc.text;
+}
+
+// Write a command with its arguments into buf, terminated but without a line ending.
+// Returns the length written, or -1 if buf is too small.
+template <class C>
+int format(char* buf, int bufLength, const typename C::Args& args) {
+  if (bufLength < 1) return -1;
+  detail::Writer w{buf, buf + bufLength - 1, true, true};
+  w.put(C::desc.text);
+  C::Args::visit(w, args);
+  *w.p = 0;
+  return w.ok ? (int)(w.p - buf) : -1;
+}
+
+// Read the information reply of a command out of everything the modem sent
+// (echo, blank lines, OK and so on are skipped). Lines are checked against the
+// command's prefix once each; the first match is read.
+template <class C>
+Status parse(const char* reply, int length, typename C::Reply& out) {
+  static_assert(C::desc.prefix != nullptr, "This command only replies OK or ERROR");
+  if (reply == nullptr) return Status::NoReply;
+  constexpr int prefixLength = detail::length(C::desc.prefix);
+  const char* end = reply + length;
+  const char* line = reply;
+  while (line < end) {
+    const char* lineEnd = line;
+    while (lineEnd < end && *lineEnd != '\r' && *lineEnd != '\n') lineEnd++;
+
+    if (detail::startsWith(line, lineEnd, C::desc.prefix)) {
+      detail::Reader r{line + prefixLength, lineEnd, true};
+      C::Reply::visit(r, out);
+      return r.ok ? Status::Ok : Status::BadField;
+    }
+    if (detail::startsWith(line, lineEnd, "ERROR") || detail::startsWith(line, lineEnd, "+CME ERROR")) return Status::Error;
+
+    line = lineEnd + 1;
+  }
+  return Status::NoReply;
+}
+
+// parse() for a terminated string
+template <class C>
+Status parse(const char* reply, typename C::Reply& out) {
+  if (reply == nullptr) return Status::NoReply;
+  const char* end = reply;
+  while (*end) end++;
+  return parse<C>(reply, (int)(end - reply), out);
+}
+
+template <class C>
+constexpr uint32_t timeoutMs() {
+  return timeoutMs(C::desc.timeout);
+}
+
+template <class C>
+constexpr bool has(uint8_t effects) {
+  return (C::desc.effects & effects) == effects;
+}
+
+} // namespace at
+
+#endif
@@ -0,0 +1,44 @@
+#include "NumberSet.h"
+
+#define isInt(c) (c >= 0 && c <= 9)
+#define notNull(c) (c != 0)
+
+int readNumberSet(const char* src, int maxCount, int* target){
+  char* c = (char*)src; // current character
+  int idx = 0; // output index
+  int tmp = 0; // number being read
+  bool inNum = false;
+
+  while (notNull(*c)){
+    int i = (int)(*c - '0');
+    c++;
+    if (isInt(i)){
+      if (!inNum){ // starting a new number
+        inNum = true;
+        tmp = 0;
+      }
+      tmp = (tmp*10)+i;
+    } else {
+      if (inNum){ // tmp is complete, write to output
+        if (idx >= maxCount){ // push everything back
+          for (int i=1; i < maxCount; i++) target[i-1] = target[i];
+          idx = maxCount - 1;
+        }
+        target[idx] = tmp;
+        idx++;
+      }
+      inNum = false;
+    }
+  }
+
+  if (inNum){ // finish last number
+    if (idx >= maxCount) { // push everything back
+      for (int i = 1; i < maxCount; i++) target[i - 1] = target[i];
+      idx = maxCount - 1;
+    }
+    target[idx] = tmp;
+    idx++;
+  }
+
+  return idx;
+}
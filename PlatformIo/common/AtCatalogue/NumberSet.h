@@ -0,0 +1,17 @@
+#ifndef NUMBER_SET_H
+#define NUMBER_SET_H
+
+// readNumberSet(), the reply reader from before AtCatalogue. Nothing on the device uses it
+// now: it is kept as the baseline that tools/parser_bench.cpp times at::parse against,
+// and that the test_at_parse host test checks at::parse against.
+//
+// Every run of digits in the string is a number: "12.34" is read as 12 and 34, and
+// signs are ignored. Has no hardware dependencies, so it builds on the host.
+
+// Read a string, populating an array of ints with each number found.
+// Return count of numbers found, or zero in case of errors
+// If maxCount is exceeded, the first numbers found are bumped off the back of the list
+// so this will return the last maxCount numbers found.
+int readNumberSet(const char* src, int maxCount, int* target);
+
+#endif
@@ -0,0 +1,80 @@
+#include "AtTranscript.h"
+
+#include <string.h>
+
+static const uint8_t _magic[4] = {'A', 'T', 'T', 'R'};
+
+int atTranscriptBegin(AtTranscriptWriter* w, uint8_t* buf, int length, uint32_t startUs){
+  if (length < AT_TRANSCRIPT_HEADER_BYTES) return 0;
+  memcpy(buf, _magic, 4);
+  buf[4] = AT_TRANSCRIPT_VERSION;
+  buf[5] = 0;
+  buf[6] = 0;
+  buf[7] = 0;
+  w->lastUs = startUs;
+  return AT_TRANSCRIPT_HEADER_BYTES;
+}
+
+int atTranscriptSpaceFor(int count){
+  int records = (count + AT_TRANSCRIPT_MAX_CHUNK - 1) / AT_TRANSCRIPT_MAX_CHUNK;
+  return count + records * AT_TRANSCRIPT_MAX_OVERHEAD;
+}
+
+int atTranscriptWrite(AtTranscriptWriter* w, uint8_t* buf, int length, uint8_t direction, uint32_t timeUs, const uint8_t* data, int count){
+  if (count <= 0 || length < atTranscriptSpaceFor(count)) return 0;
+
+  uint8_t* p = buf;
+  if ((int32_t)(timeUs - w->lastUs) < 0) timeUs = w->lastUs; // the other direction's chunk was written first
+  uint32_t delta = timeUs - w->lastUs; // wraps with micros()
+  while (count > 0){
+    int n = count > AT_TRANSCRIPT_MAX_CHUNK ? AT_TRANSCRIPT_MAX_CHUNK : count;
+    *p++ = (uint8_t)((direction ? 0x80 : 0) | (n - 1));
+    do {
+      uint8_t b = delta & 0x7F;
+      delta >>= 7;
+      *p++ = delta ? (b | 0x80) : b;
+    } while (delta);
+    memcpy(p, data, n);
+    p += n;
+    data += n;
+    count -= n;
+    delta = 0; // the rest of the chunk arrived at the same time
+  }
+  w->lastUs = timeUs;
+  return (int)(p - buf);
+}
+
+bool atTranscriptOpen(AtTranscriptReader* r, const uint8_t* data, int length){
+  if (length < AT_TRANSCRIPT_HEADER_BYTES || memcmp(data, _magic, 4) != 0 || data[4] != AT_TRANSCRIPT_VERSION) return false;
+  r->p = data + AT_TRANSCRIPT_HEADER_BYTES;
+  r->end = data + length;
+  r->timeUs = 0;
+  return true;
+}
+
+bool atTranscriptNext(AtTranscriptReader* r, AtTranscriptRecord* out){
+  const uint8_t* p = r->p;
+  if (p >= r->end) return false;
+
+  uint8_t tag = *p++;
+  uint64_t delta = 0;
+  int shift = 0;
+  for (;;){
+    if (p >= r->end || shift > 28) return false;
+    uint8_t b = *p++;
+    delta |= (uint64_t)(b & 0x7F) << shift;
+    shift += 7;
+    if ((b & 0x80) == 0) break;
+  }
+
+  int length = (tag & 0x7F) + 1;
+  if (r->end - p < length) return false;
+
+  r->timeUs += delta;
+  out->direction = (tag & 0x80) ? AT_FROM_MODEM : AT_TO_MODEM;
+  out->length = (uint8_t)length;
+  out->timeUs = r->timeUs;
+  out->data = p;
+  r->p = p + length;
+  return true;
+}
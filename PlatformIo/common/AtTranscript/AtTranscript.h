@@ -0,0 +1,65 @@
+#ifndef AT_TRANSCRIPT_H
+#define AT_TRANSCRIPT_H
+
+#include <stdint.h>
+
+// Compact binary transcript of the bytes between a host and the modem, with the
+// time each chunk arrived. Written by the ATDebug bridge (05_at_debug) and read
+// by the host replay driver (PlatformIo/tools/at_replay.cpp). No hardware dependencies.
+//
+// A transcript is a header, then records:
+//   header: "ATTR", u8 version, u8 spare, u16 spare
+//   record: u8 tag, time since the previous record in us (LEB128 varint), data
+//           tag bit 7 = direction (1 = from the modem), bits 0-6 = data length - 1
+// A chunk is what one UART receive handed over; longer chunks are split into
+// records of up to AT_TRANSCRIPT_MAX_CHUNK bytes with the same time. The first
+// record's time is from the start of the capture.
+// A typical record costs 2 or 3 bytes on top of its data.
+
+#define AT_TRANSCRIPT_VERSION 1
+#define AT_TRANSCRIPT_HEADER_BYTES 8
+#define AT_TRANSCRIPT_MAX_CHUNK 128
+#define AT_TRANSCRIPT_MAX_OVERHEAD 6 // tag and the longest varint of a u32
+
+enum AtDirection {
+  AT_TO_MODEM = 0,
+  AT_FROM_MODEM = 1
+};
+
+typedef struct {
+  uint32_t lastUs; // time of the last record written
+} AtTranscriptWriter;
+
+typedef struct {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint64_t timeUs; // time of the last record read, since the start of the capture
+} AtTranscriptReader;
+
+typedef struct {
+  uint8_t direction; // AtDirection
+  uint8_t length;
+  uint64_t timeUs;   // since the start of the capture
+  const uint8_t* data;
+} AtTranscriptRecord;
+
+// Write the header into buf, and start timing from 'startUs'.
+// Returns the length, or zero if buf is too small.
+int atTranscriptBegin(AtTranscriptWriter* w, uint8_t* buf, int length, uint32_t startUs);
+
+// Write a chunk, received at 'timeUs', as one or more records. Times are micros()
+// and may wrap. A time before the last record's (chunks from the two directions
+// written out of order) is written as the last record's time.
+// Returns the bytes written, or zero if buf is too small for all of it.
+int atTranscriptWrite(AtTranscriptWriter* w, uint8_t* buf, int length, uint8_t direction, uint32_t timeUs, const uint8_t* data, int count);
+
+// Bytes atTranscriptWrite() needs at most for a chunk of 'count' bytes
+int atTranscriptSpaceFor(int count);
+
+// Check the header and get ready to read records. Returns false if this isn't a transcript.
+bool atTranscriptOpen(AtTranscriptReader* r, const uint8_t* data, int length);
+
+// Read the next record. Returns false at the end, or if the rest is cut short.
+bool atTranscriptNext(AtTranscriptReader* r, AtTranscriptRecord* out);
+
+#endif
@@ -0,0 +1,165 @@
+#include "BinLog.h"
+#include "SpscRing.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define BINLOG_KNOWN_IDS 128 // format strings remembered for announcing and text output
+
+// Records from every task go into one ring. The ring is single-producer, so
+// producers take a spinlock for the few microseconds it takes to copy a record in.
+static SpscFrameRing<BINLOG_RING_BYTES, BINLOG_MAX_RECORD> _ring;
+static portMUX_TYPE _producerLock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t _reservedLength = 0;
+
+// Format strings by ID. Written by producers (under the lock), read by the drain task.
+static uint32_t _knownIds[BINLOG_KNOWN_IDS];
+static const char* _knownFormats[BINLOG_KNOWN_IDS];
+static uint32_t _announcedIds[BINLOG_KNOWN_IDS]; // drain task only. ID last announced in each slot
+
+static Print* _out = NULL;
+static BinlogOutput _mode = BINLOG_OUTPUT_TEXT;
+static TaskHandle_t _drainTask = NULL;
+static uint32_t _written = 0;
+static uint32_t _reportedDrops = 0;
+
+uint8_t* binlogReserve(uint32_t maxLength){
+  portENTER_CRITICAL(&_producerLock);
+  uint8_t* p = _ring.beginFrame(maxLength);
+  if (p == NULL) { portEXIT_CRITICAL(&_producerLock); return NULL; }
+  _reservedLength = maxLength;
+  return p; // still locked until binlogCommit()
+}
+
+void binlogCommit(uint32_t length){
+  if (length > _reservedLength) length = _reservedLength;
+  _ring.commitFrame(length);
+  portEXIT_CRITICAL(&_producerLock);
+
+  // Wake the drain task early if the ring is filling up
+  if (_drainTask != NULL && _ring.count() > 32) xTaskNotifyGive(_drainTask);
+}
+
+void binlogCountDrop(){
+  portENTER_CRITICAL(&_producerLock); // the ring's counters belong to the producer side
+  _ring.countDrop();
+  portEXIT_CRITICAL(&_producerLock);
+}
+
+void binlogRemember(uint32_t id, const char* format){
+  uint32_t slot = id % BINLOG_KNOWN_IDS;
+  if (_knownIds[slot] == id && _knownFormats[slot] == format) return; // the usual case: no lock needed
+
+  portENTER_CRITICAL(&_producerLock);
+  _knownIds[slot] = id;
+  _knownFormats[slot] = format;
+  portEXIT_CRITICAL(&_producerLock);
+}
+
+// Format string for an ID, or NULL if it has been pushed out by another
+static const char* lookupFormat(uint32_t id, int* slotOut){
+  uint32_t slot = id % BINLOG_KNOWN_IDS;
+  portENTER_CRITICAL(&_producerLock);
+  const char* format = _knownIds[slot] == id ? _knownFormats[slot] : NULL;
+  portEXIT_CRITICAL(&_producerLock);
+  *slotOut = (int)slot;
+  return format;
+}
+
+static uint32_t get32(const uint8_t* p){ uint32_t v; memcpy(&v, p, 4); return v; }
+
+// Write one framed binary item. The frame is put together first and written in
+// one go, so an output that stores each write as a record (SdLogPrint) stores one.
+static void writeFramed(uint8_t type, const uint8_t* head, int headLength, const uint8_t* body, int bodyLength){
+  uint8_t frame[4 + 255 + 1];
+  frame[0] = BINLOG_SYNC1;
+  frame[1] = BINLOG_SYNC2;
+  frame[2] = type;
+  frame[3] = (uint8_t)(headLength + bodyLength);
+  memcpy(frame + 4, head, headLength);
+  if (bodyLength > 0) memcpy(frame + 4 + headLength, body, bodyLength);
+  uint8_t x = 0;
+  for (int i = 4; i < 4 + frame[3]; i++) x ^= frame[i];
+  frame[4 + frame[3]] = x;
+  _out->write(frame, 4 + frame[3] + 1);
+}
+
+// Output one record from the ring
+static void drainRecord(const uint8_t* record, uint32_t length){
+  if (length < BINLOG_HEADER_BYTES) return;
+  uint32_t id = get32(record);
+  int slot;
+  const char* format = lookupFormat(id, &slot);
+
+  if (_mode == BINLOG_OUTPUT_BINARY){
+    if (format != NULL && _announcedIds[slot] != id){
+      int n = strlen(format);
+      if (n > 250) n = 250;
+      writeFramed(BINLOG_WIRE_FORMAT, record, 4, (const uint8_t*)format, n);
+      _announcedIds[slot] = id;
+    }
+    writeFramed(BINLOG_WIRE_RECORD, record, length, NULL, 0);
+    return;
+  }
+
+  if (id == BINLOG_ID_DROPPED) format = "[%u log records dropped]";
+  char line[200];
+  uint32_t us = get32(record + 4);
+  int used = snprintf(line, sizeof(line), "[%5lu.%06lu] %c ", (unsigned long)(us / 1000000), (unsigned long)(us % 1000000), binlogLevelChar(record[8]));
+  if (format != NULL) {
+    used += binlogFormat(line + used, sizeof(line) - used, format, record + BINLOG_HEADER_BYTES, length - BINLOG_HEADER_BYTES);
+  } else {
+    used += snprintf(line + used, sizeof(line) - used, "(format %08lx)", (unsigned long)id);
+  }
+  if (used > (int)sizeof(line) - 3) used = sizeof(line) - 3;
+  line[used++] = '\r';
+  line[used++] = '\n';
+  _out->write((const uint8_t*)line, used);
+}
+
+// Report drops as a record of their own, so they show up in order
+static void drainDropReport(){
+  uint32_t dropped = _ring.dropped();
+  if (dropped == _reportedDrops) return;
+  uint32_t lost = dropped - _reportedDrops;
+  _reportedDrops = dropped;
+
+  uint8_t record[BINLOG_HEADER_BYTES + 5];
+  uint8_t* p = record;
+  binlog_detail::put32(p, BINLOG_ID_DROPPED);
+  binlog_detail::put32(p, (uint32_t)micros());
+  *p++ = BINLOG_WARN;
+  binlog_detail::put(p, (unsigned int)lost);
+
+  drainRecord(record, sizeof(record));
+}
+
+static void drainTaskMain(void* arg){
+  for (;;){
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BINLOG_DRAIN_PERIOD_MS));
+
+    SpscSpan record = _ring.peek();
+    while (record.data != NULL){
+      drainRecord(record.data, record.length);
+      _ring.pop();
+      _written++;
+      record = _ring.peek();
+    }
+    drainDropReport();
+  }
+}
+
+bool binlogBegin(Print* out, BinlogOutput mode, int core){
+  _out = out;
+  _mode = mode;
+  memset(_announcedIds, 0, sizeof(_announcedIds));
+  return xTaskCreatePinnedToCore(drainTaskMain, "binlog", BINLOG_TASK_STACK, NULL, BINLOG_TASK_PRIORITY, &_drainTask, core) == pdPASS;
+}
+
+uint32_t binlogDropped(){
+  return _ring.dropped();
+}
+
+uint32_t binlogWritten(){
+  return _written;
+}
@@ -0,0 +1,153 @@
+#ifndef BIN_LOG_H
+#define BIN_LOG_H
+
+#include <Arduino.h>
+#include <type_traits>
+#include "BinLogFormat.h"
+
+// Deferred binary logging.
+//
+// LOG_E/LOG_W/LOG_I/LOG_D take a printf-style format and arguments, and copy
+// them into a RAM ring as a compact record: the format's ID (hashed at compile
+// time), a timestamp, and the raw argument values. No formatting happens and
+// nothing touches the console, so a log call costs a few microseconds. If the
+// ring is full the record is dropped and counted; a log call never waits.
+//
+// A low-priority task drains the ring to a Print (USB Serial, or an SD File),
+// either as readable text (formatted in the drain task) or as framed binary for
+// PlatformIo/tools/binlog_decode.cpp.
+//
+// Levels above BINLOG_LEVEL compile to nothing. Set it in build_flags, like
+//   -DBINLOG_LEVEL=BINLOG_INFO
+//
+// Arguments: integers up to 64 bits, float/double (stored as float), char,
+// C strings and Arduino Strings (cut at BINLOG_MAX_STRING), and binlogHex()
+// for raw bytes shown as hex. Needs C++17.
+
+#ifndef BINLOG_LEVEL
+#define BINLOG_LEVEL BINLOG_DEBUG
+#endif
+
+#define BINLOG_RING_BYTES 8192     // RAM for waiting records
+#define BINLOG_DRAIN_PERIOD_MS 50   // drain task wakes at least this often
+#define BINLOG_TASK_STACK 3072
+#define BINLOG_TASK_PRIORITY 1      // just above idle
+
+enum BinlogOutput {
+  BINLOG_OUTPUT_TEXT = 0,   // "[   12.345678] I message"
+  BINLOG_OUTPUT_BINARY = 1  // framed records, see BinLogFormat.h
+};
+
+// Raw bytes, logged as hex
+struct BinlogHex {
+  const uint8_t* data;
+  uint8_t length;
+};
+inline BinlogHex binlogHex(const uint8_t* data, int length) {
+  return BinlogHex{data, (uint8_t)(length > BINLOG_MAX_STRING ? BINLOG_MAX_STRING : length)};
+}
+
+// Start the drain task, writing to 'out'. Records logged before this are kept (if they fit).
+bool binlogBegin(Print* out, BinlogOutput mode, int core);
+
+// Counters
+uint32_t binlogDropped();
+uint32_t binlogWritten();
+
+// ---- Internals used by the macros ----
+
+// Reserve space for a record; returns NULL (and counts a drop) if the ring is full
+uint8_t* binlogReserve(uint32_t maxLength);
+// Publish a reserved record
+void binlogCommit(uint32_t length);
+// Count a record that could not be logged at all, so it shows in the drop report
+void binlogCountDrop();
+// Remember the format string for an ID, so the drain task can announce it or format it
+void binlogRemember(uint32_t id, const char* format);
+
+namespace binlog_detail {
+
+inline void put32(uint8_t*& p, uint32_t v) { memcpy(p, &v, 4); p += 4; } // ESP32 and hosts are little-endian
+inline void put64(uint8_t*& p, uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+// Encoded size of each argument: type byte and value
+template <class T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+constexpr uint32_t encodedSize(T) { return sizeof(T) > 4 && !std::is_floating_point_v<T> ? 9 : 5; }
+inline uint32_t encodedSize(const char* s) { size_t n = s == nullptr ? 6 : strlen(s); return 2 + (n > BINLOG_MAX_STRING ? BINLOG_MAX_STRING : n); } // NULL is logged as "(null)"
+inline uint32_t encodedSize(const String& s) { return encodedSize(s.c_str()); }
+inline uint32_t encodedSize(const BinlogHex& h) { return 2 + h.length; }
+
+inline void put(uint8_t*& p, int v) { *p++ = 'i'; put32(p, (uint32_t)v); }
+inline void put(uint8_t*& p, long v) {
+  if constexpr (sizeof(long) > 4) { *p++ = 'I'; put64(p, (uint64_t)v); } else { *p++ = 'i'; put32(p, (uint32_t)v); }
+}
+inline void put(uint8_t*& p, short v) { *p++ = 'i'; put32(p, (uint32_t)(int)v); }
+inline void put(uint8_t*& p, signed char v) { *p++ = 'i'; put32(p, (uint32_t)(int)v); }
+inline void put(uint8_t*& p, unsigned int v) { *p++ = 'u'; put32(p, v); }
+inline void put(uint8_t*& p, unsigned long v) {
+  if constexpr (sizeof(long) > 4) { *p++ = 'U'; put64(p, v); } else { *p++ = 'u'; put32(p, (uint32_t)v); }
+}
+inline void put(uint8_t*& p, unsigned short v) { *p++ = 'u'; put32(p, v); }
+inline void put(uint8_t*& p, unsigned char v) { *p++ = 'u'; put32(p, v); }
+inline void put(uint8_t*& p, bool v) { *p++ = 'u'; put32(p, v ? 1 : 0); }
+inline void put(uint8_t*& p, char v) { *p++ = 'c'; put32(p, (uint32_t)(uint8_t)v); }
+inline void put(uint8_t*& p, long long v) { *p++ = 'I'; put64(p, (uint64_t)v); }
+inline void put(uint8_t*& p, unsigned long long v) { *p++ = 'U'; put64(p, v); }
+inline void put(uint8_t*& p, double v) { float f = (float)v; uint32_t bits; memcpy(&bits, &f, 4); *p++ = 'f'; put32(p, bits); }
+inline void put(uint8_t*& p, const char* s) {
+  if (s == nullptr) s = "(null)";
+  size_t n = strlen(s);
+  if (n > BINLOG_MAX_STRING) n = BINLOG_MAX_STRING;
+  *p++ = 's'; *p++ = (uint8_t)n; memcpy(p, s, n); p += n;
+}
+inline void put(uint8_t*& p, const String& s) { put(p, s.c_str()); }
+inline void put(uint8_t*& p, const BinlogHex& h) { *p++ = 'b'; *p++ = h.length; memcpy(p, h.data, h.length); p += h.length; }
+
+template <class... Args>
+void write(uint32_t id, const char* format, uint8_t level, const Args&... args) {
+  uint32_t length = BINLOG_HEADER_BYTES + (0 + ... + encodedSize(args));
+  if (length > BINLOG_MAX_RECORD) { binlogCountDrop(); return; } // too many arguments to fit. Split the message
+  binlogRemember(id, format); // before the record, so the drain task always has the format
+  uint8_t* start = binlogReserve(length);
+  if (start == nullptr) return;
+
+  uint8_t* p = start;
+  put32(p, id);
+  put32(p, (uint32_t)micros());
+  *p++ = level;
+  (put(p, args), ...);
+  binlogCommit((uint32_t)(p - start));
+}
+
+} // namespace binlog_detail
+
+#define BINLOG_WRITE(level, format, ...) do { \
+    constexpr uint32_t _binlogId = binlogHash(format); \
+    binlog_detail::write(_binlogId, format, level, ##__VA_ARGS__); \
+  } while (0)
+
+#if BINLOG_LEVEL >= BINLOG_ERROR
+#define LOG_E(format, ...) BINLOG_WRITE(BINLOG_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_E(format, ...) do {} while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_WARN
+#define LOG_W(format, ...) BINLOG_WRITE(BINLOG_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_W(format, ...) do {} while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_INFO
+#define LOG_I(format, ...) BINLOG_WRITE(BINLOG_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_I(format, ...) do {} while (0)
+#endif
+
+#if BINLOG_LEVEL >= BINLOG_DEBUG
+#define LOG_D(format, ...) BINLOG_WRITE(BINLOG_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_D(format, ...) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+#include "BinLogFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+char binlogLevelChar(uint8_t level){
+  switch (level){
+    case BINLOG_ERROR: return 'E';
+    case BINLOG_WARN: return 'W';
+    case BINLOG_INFO: return 'I';
+    case BINLOG_DEBUG: return 'D';
+    default: return '?';
+  }
+}
+
+static uint32_t get32(const uint8_t* p){ return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint64_t get64(const uint8_t* p){ return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+
+// Append with snprintf, keeping 'used' within the buffer
+#define APPEND(...) do { \
+    int written = snprintf(out + used, outLength - used, __VA_ARGS__); \
+    if (written > 0) used += written; \
+    if (used >= outLength) used = outLength - 1; \
+  } while (0)
+
+int binlogFormat(char* out, int outLength, const char* format, const uint8_t* args, int argsLength){
+  if (outLength < 1) return 0;
+  int used = 0;
+  int a = 0; // read position in args
+  out[0] = 0;
+
+  const char* p = format;
+  while (*p && used < outLength - 1){
+    if (*p != '%'){ out[used++] = *p++; out[used] = 0; continue; }
+    if (p[1] == '%'){ out[used++] = '%'; out[used] = 0; p += 2; continue; }
+
+    // Copy the conversion spec (flags, width, precision, length) without the length modifiers
+    char spec[16];
+    int s = 0;
+    const char* q = p + 1;
+    spec[s++] = '%';
+    while (*q && strchr("-+ #0123456789.", *q) && s < 10) spec[s++] = *q++;
+    while (*q && strchr("hlzjt", *q)) q++;
+    char conv = *q ? *q++ : 's';
+    p = q;
+
+    if (a >= argsLength){ APPEND("<?>"); continue; }
+    char type = (char)args[a++];
+    int fixedSize = (type == 'I' || type == 'U') ? 8 : 4;
+    if (strchr("iucfIU", type) && a + fixedSize > argsLength){ APPEND("<?>"); a = argsLength; continue; }
+
+    switch (type){
+      case 'i': case 'u': case 'c': {
+        uint32_t v = get32(args + a); a += 4;
+        if (conv == 's') conv = type == 'u' ? 'u' : 'd';
+        if (conv == 'f') { spec[s++] = 'l'; spec[s++] = 'd'; spec[s] = 0; APPEND(spec, (long)(int32_t)v); break; }
+        spec[s++] = 'l'; spec[s++] = conv; spec[s] = 0;
+        if (conv == 'c') APPEND("%c", (char)v);
+        else if (conv == 'd' || conv == 'i') APPEND(spec, (long)(int32_t)v);
+        else APPEND(spec, (unsigned long)v);
+        break;
+      }
+      case 'I': case 'U': {
+        uint64_t v = get64(args + a); a += 8;
+        if (conv == 's' || conv == 'c' || conv == 'f') conv = type == 'U' ? 'u' : 'd';
+        spec[s++] = 'l'; spec[s++] = 'l'; spec[s++] = conv; spec[s] = 0;
+        if (conv == 'd' || conv == 'i') APPEND(spec, (long long)(int64_t)v);
+        else APPEND(spec, (unsigned long long)v);
+        break;
+      }
+      case 'f': {
+        uint32_t bits = get32(args + a); a += 4;
+        float v;
+        memcpy(&v, &bits, 4);
+        if (!strchr("feEgGaA", conv)) conv = 'f';
+        spec[s++] = conv; spec[s] = 0;
+        APPEND(spec, (double)v);
+        break;
+      }
+      case 's': {
+        int n = args[a++];
+        if (a + n > argsLength) n = argsLength - a;
+        APPEND("%.*s", n, (const char*)(args + a));
+        a += n;
+        break;
+      }
+      case 'b': {
+        int n = args[a++];
+        if (a + n > argsLength) n = argsLength - a;
+        for (int i = 0; i < n; i++) APPEND("%02X", args[a + i]);
+        a += n;
+        break;
+      }
+      default:
+        APPEND("<bad arg>");
+        a = argsLength; // can't know where the next one starts
+        break;
+    }
+  }
+  return used;
+}
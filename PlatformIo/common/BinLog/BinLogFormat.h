@@ -0,0 +1,52 @@
+#ifndef BIN_LOG_FORMAT_H
+#define BIN_LOG_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Record layout for BinLog, shared by the firmware and the host decoder
+// (PlatformIo/tools/binlog_decode.cpp). No hardware dependencies.
+//
+// A record is the format string's ID (FNV-1a hash of the string), a timestamp,
+// a level, and the arguments, each tagged with its type:
+//   'i' int32, 'u' uint32, 'I' int64, 'U' uint64, 'f' float, 'c' char  (fixed size, little-endian)
+//   's' string, 'b' bytes (shown as hex)                                 (u8 length, then bytes)
+//
+// On the wire (binary output), each record or format announcement is framed as:
+//   A5 5A <type> <length> <payload...> <xor of payload>
+// type 0 = record:       u32 id, u32 time in us, u8 level, args
+// type 1 = announcement: u32 id, format string (not terminated)
+// The first record with each ID is preceded by its announcement, so the decoder
+// learns the format strings from the capture itself.
+
+#define BINLOG_SYNC1 0xA5
+#define BINLOG_SYNC2 0x5A
+#define BINLOG_WIRE_RECORD 0
+#define BINLOG_WIRE_FORMAT 1
+#define BINLOG_WIRE_OVERHEAD 5 // sync, type, length, checksum
+
+#define BINLOG_HEADER_BYTES 9  // id, time, level
+#define BINLOG_MAX_RECORD 160
+#define BINLOG_MAX_STRING 96   // longer string and byte arguments are cut
+
+#define BINLOG_ERROR 1
+#define BINLOG_WARN 2
+#define BINLOG_INFO 3
+#define BINLOG_DEBUG 4
+
+#define BINLOG_ID_DROPPED 0 // reserved: "log records dropped" marker, one u32 argument
+
+// Format string ID. Evaluated at compile time in the logging macros.
+constexpr uint32_t binlogHash(const char* s, uint32_t h = 2166136261u) {
+  return *s == 0 ? h : binlogHash(s + 1, (h ^ (uint8_t)*s) * 16777619u);
+}
+
+// Write the text of a record's arguments using a printf-style format.
+// Conversions are matched to arguments in order; an argument's own type decides
+// how it is shown if it doesn't fit the conversion. Returns the length written.
+int binlogFormat(char* out, int outLength, const char* format, const uint8_t* args, int argsLength);
+
+// One letter for a level, like 'I'
+char binlogLevelChar(uint8_t level);
+
+#endif
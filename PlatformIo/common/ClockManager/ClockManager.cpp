@@ -0,0 +1,207 @@
+#include "ClockManager.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef ARDUINO
+#include <esp_attr.h>
+#else
+#define RTC_DATA_ATTR // host builds have no RTC memory
+#endif
+
+#define CLOCK_MAGIC 0xC10C
+#define CLOCK_DRIFT_LIMIT_PPB 100000000 // 10%; anything more is a bad sync, not drift
+
+// Two-digit years we believe. An unset modem clock reads "70/01/01" or "80/01/06"
+// depending on firmware, so there is a bound on both sides.
+#define CLOCK_MIN_YY 23                  // before this code existed
+#define CLOCK_BUILD_YY ((__DATE__[9] - '0') * 10 + (__DATE__[10] - '0')) // __DATE__ is "Mmm dd yyyy"
+#define CLOCK_MAX_YY (CLOCK_BUILD_YY + 20) // a device may run for years after its build, but not into the 70s
+
+// All state survives deep sleep. Times are in microseconds of system time (gettimeofday)
+RTC_DATA_ATTR static uint16_t _clkMagic;
+RTC_DATA_ATTR static uint8_t _clkSource;         // source of the last accepted sync
+RTC_DATA_ATTR static uint8_t _clkDriftKnown;     // do we have at least one drift measurement?
+RTC_DATA_ATTR static uint32_t _clkSyncUncertaintyMs;
+RTC_DATA_ATTR static int64_t _clkSyncSysUs;      // system time just after the last sync
+RTC_DATA_ATTR static int64_t _clkJumpUs;         // sum of all corrections, so we can give a monotonic time
+RTC_DATA_ATTR static int32_t _clkDriftPpb;
+
+static int64_t readSystemUs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void writeSystemUs(int64_t us) {
+  struct timeval tv;
+  tv.tv_sec = (time_t)(us / 1000000LL);
+  tv.tv_usec = (suseconds_t)(us % 1000000LL);
+  settimeofday(&tv, NULL);
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (month 1-12)
+static int64_t daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yoe = year - era * 400;
+  int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// Inverse of daysFromCivil
+static void civilFromDays(int64_t days, int* year, int* month, int* day) {
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int64_t doe = days - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  *day = (int)(doy - (153 * mp + 2) / 5 + 1);
+  *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  *year = (int)(yoe + era * 400 + (*month <= 2));
+}
+
+int64_t clockUtcMs(int year, int month, int day, int hour, int minute, int second) {
+  int64_t days = daysFromCivil(year, month, day);
+  return ((days * 24 + hour) * 60 + minute) * 60000LL + second * 1000LL;
+}
+
+// Correct system time for the drift we have measured since the last sync
+static int64_t estimateUtcUs(int64_t sysUs) {
+  int64_t elapsed = sysUs - _clkSyncSysUs;
+  return sysUs - (elapsed / 1000) * _clkDriftPpb / 1000000LL;
+}
+
+static uint32_t currentUncertaintyMs(int64_t sysUs) {
+  if (_clkSource == CLOCK_NONE) return 0xFFFFFFFF;
+  int64_t elapsedMs = (sysUs - _clkSyncSysUs) / 1000;
+  if (elapsedMs < 0) elapsedMs = -elapsedMs;
+  int64_t wander = _clkDriftKnown ? CLOCK_DRIFT_RESIDUAL_PPB : CLOCK_DRIFT_UNKNOWN_PPB;
+  int64_t unc = _clkSyncUncertaintyMs + elapsedMs * wander / 1000000000LL;
+  return unc > 0xFFFFFFF0 ? 0xFFFFFFF0 : (uint32_t)unc;
+}
+
+void clockInit() {
+  if (_clkMagic == CLOCK_MAGIC) return; // woke from deep sleep, state is good
+
+  // Power-on: system time restarts at zero, and nothing we knew is valid
+  _clkMagic = CLOCK_MAGIC;
+  _clkSource = CLOCK_NONE;
+  _clkDriftKnown = 0;
+  _clkSyncUncertaintyMs = 0;
+  _clkSyncSysUs = 0;
+  _clkJumpUs = 0;
+  _clkDriftPpb = 0;
+}
+
+ClockStamp clockNow() {
+  int64_t sys = readSystemUs();
+  ClockStamp stamp;
+  stamp.monoUs = (uint64_t)(sys - _clkJumpUs);
+  stamp.source = _clkSource;
+  if (_clkSource == CLOCK_NONE) {
+    stamp.utcMs = 0;
+    stamp.uncertaintyMs = 0xFFFFFFFF;
+  } else {
+    stamp.utcMs = estimateUtcUs(sys) / 1000;
+    stamp.uncertaintyMs = currentUncertaintyMs(sys);
+  }
+  return stamp;
+}
+
+bool clockUtcValid() {
+  return _clkSource != CLOCK_NONE;
+}
+
+// Compare the new sync with where the last one said we should be, and update the drift estimate
+static void updateDrift(int64_t sysUs, int64_t utcUs, uint32_t uncertaintyMs) {
+  int64_t trueElapsed = utcUs - _clkSyncSysUs;
+  if (trueElapsed < CLOCK_DRIFT_MIN_SPAN_S * 1000000LL) return;
+
+  // Skip if the sync uncertainties are bigger than the drift we could measure
+  int64_t noisePpb = (int64_t)(_clkSyncUncertaintyMs + uncertaintyMs) * 1000000000LL / (trueElapsed / 1000);
+  if (noisePpb >= CLOCK_DRIFT_UNKNOWN_PPB) return;
+
+  int64_t error = (sysUs - _clkSyncSysUs) - trueElapsed; // positive if we ran fast
+  int64_t measured = error * 1000000LL / (trueElapsed / 1000);
+  if (measured > CLOCK_DRIFT_LIMIT_PPB || measured < -CLOCK_DRIFT_LIMIT_PPB) return;
+
+  if (!_clkDriftKnown) {
+    _clkDriftPpb = (int32_t)measured;
+    _clkDriftKnown = 1;
+  } else {
+    _clkDriftPpb += (int32_t)((measured - _clkDriftPpb) / 4); // smooth out sync noise
+  }
+}
+
+bool clockSync(int64_t utcMs, uint32_t uncertaintyMs, ClockSource source) {
+  if (utcMs <= 0 || source == CLOCK_NONE) return false;
+
+  int64_t sys = readSystemUs();
+  if (uncertaintyMs > currentUncertaintyMs(sys)) return false; // what we have is better
+
+  int64_t utcUs = utcMs * 1000LL;
+  if (_clkSource != CLOCK_NONE) updateDrift(sys, utcUs, uncertaintyMs);
+
+  writeSystemUs(utcUs);
+  _clkJumpUs += utcUs - sys;
+  _clkSyncSysUs = utcUs;
+  _clkSyncUncertaintyMs = uncertaintyMs;
+  _clkSource = (uint8_t)source;
+  return true;
+}
+
+bool clockSyncFromCclk(const char* reply) {
+  if (reply == NULL) return false;
+  const char* c = strstr(reply, "+CCLK:");
+  if (c == NULL) return false;
+  c = strchr(c, '"');
+  if (c == NULL) return false;
+
+  // "yy/MM/dd,hh:mm:ss±zz", where zz is the local offset in quarter hours
+  int yy, mo, dd, hh, mi, ss, zz;
+  char sign;
+  if (sscanf(c + 1, "%d/%d/%d,%d:%d:%d%c%d", &yy, &mo, &dd, &hh, &mi, &ss, &sign, &zz) != 8) return false;
+  if (yy < CLOCK_MIN_YY || yy > CLOCK_MAX_YY || mo < 1 || mo > 12 || dd < 1 || dd > 31) return false; // modem clock was never set
+  if (hh > 23 || mi > 59 || ss > 60) return false;
+  if (sign == '-') zz = -zz;
+
+  int64_t utc = clockUtcMs(2000 + yy, mo, dd, hh, mi, ss) - zz * 15 * 60000LL;
+  return clockSync(utc, CLOCK_UNCERTAINTY_MODEM_MS, CLOCK_MODEM);
+}
+
+bool clockSyncFromGps(long date, long time) {
+  if (date <= 0) return false;
+
+  int day = (int)(date / 10000) % 100;
+  int month = (int)(date / 100) % 100;
+  int yy = (int)(date % 100);
+  int hours = (int)(time / 10000);
+  int minutes = (int)(time / 100) % 100;
+  int seconds = (int)(time % 100);
+  if (yy < CLOCK_MIN_YY || yy > CLOCK_MAX_YY) return false;
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hours > 23 || minutes > 59 || seconds > 60) return false;
+
+  return clockSync(clockUtcMs(2000 + yy, month, day, hours, minutes, seconds), CLOCK_UNCERTAINTY_GNSS_MS, CLOCK_GNSS);
+}
+
+int clockFormatCclk(char* buf, int bufLength) {
+  if (!clockUtcValid()) return 0;
+
+  int64_t utcS = clockNow().utcMs / 1000;
+  int year, month, day;
+  civilFromDays(utcS / 86400, &year, &month, &day);
+  int secOfDay = (int)(utcS % 86400);
+
+  int length = snprintf(buf, bufLength, "AT+CCLK=\"%02d/%02d/%02d,%02d:%02d:%02d+00\"",
+                        year % 100, month, day, secOfDay / 3600, (secOfDay / 60) % 60, secOfDay % 60);
+  if (length < 0 || length >= bufLength) return 0;
+  return length;
+}
+
+int32_t clockDriftPpb() {
+  return _clkDriftPpb;
+}
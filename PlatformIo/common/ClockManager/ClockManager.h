@@ -0,0 +1,77 @@
+#ifndef CLOCK_MANAGER_H
+#define CLOCK_MANAGER_H
+
+#include <stdint.h>
+
+// Clock service that fuses the time sources we have (GNSS, modem RTC)
+// into the ESP32 system clock, and estimates how far the ESP32 RTC drifts
+// across deep sleep. Once synced, clockNow() gives a timestamp without waking
+// the modem or GNSS.
+//
+// The ESP32 system time keeps running through deep sleep (it is backed by the
+// RTC timer), so all state here is kept in RTC memory and only the corrections
+// need to be stored.
+
+// Time sources, in rough order of accuracy. Values are stored in telemetry records, so only append.
+enum ClockSource {
+  CLOCK_NONE = 0,  // never synced since power-on
+  CLOCK_MODEM = 1, // SIMCOM RTC, from 'AT+CCLK?'
+  CLOCK_NITZ = 2,  // reserved: network time. 'AT+CCLK?' can't tell it from a clock we set, so nothing syncs from it
+  CLOCK_GNSS = 3   // GNSS date and time ('AT+CGPSINFO')
+};
+
+// Starting uncertainty of each source, in ms. Includes the delay of reading it over the AT interface.
+#define CLOCK_UNCERTAINTY_MODEM_MS 5000
+#define CLOCK_UNCERTAINTY_GNSS_MS 1000
+
+// How fast the ESP32 clock is assumed to wander from true time, in parts per billion.
+// Before we have a drift estimate we assume the worst of the internal RC oscillator.
+#define CLOCK_DRIFT_UNKNOWN_PPB 2000000
+#define CLOCK_DRIFT_RESIDUAL_PPB 200000
+
+// Minimum time between syncs before we use them to update the drift estimate
+#define CLOCK_DRIFT_MIN_SPAN_S 600
+
+// Cheap timestamp for telemetry records
+typedef struct {
+  uint64_t monoUs;        // monotonic microseconds. Never jumps when the clock is synced, but resets on power-on
+  int64_t utcMs;          // best estimate of UTC, in ms since 1970-01-01. Zero if never synced
+  uint32_t uncertaintyMs; // how far utcMs could be from true time
+  uint8_t source;         // ClockSource of the last accepted sync
+} ClockStamp;
+
+// Call once at boot. Resets state after a power-on (when RTC memory is lost)
+void clockInit();
+
+// Read the current time. Does not touch the modem or GNSS
+ClockStamp clockNow();
+
+// True if we have a UTC time from any source
+bool clockUtcValid();
+
+// Offer a new time to the clock. The sync is used if it is better than our current
+// estimate (taking drift since the last sync into account). Returns true if used.
+bool clockSync(int64_t utcMs, uint32_t uncertaintyMs, ClockSource source);
+
+// Sync from an 'AT+CCLK?' reply like '+CCLK: "24/03/01,12:34:56+04"'.
+// The modem RTC may have been set by the network ('AT+CTZU=1') or by us from GNSS
+// time, and the reply doesn't say which, so it is always a CLOCK_MODEM sync.
+// Returns true if the time was readable and used.
+bool clockSyncFromCclk(const char* reply);
+
+// Sync from GNSS date (ddmmyy) and time (hhmmss) as read from 'AT+CGPSINFO'.
+// Returns true if the time was valid and used.
+bool clockSyncFromGps(long date, long time);
+
+// Write an 'AT+CCLK="yy/MM/dd,hh:mm:ss+00"' command for the current UTC time into buf.
+// Returns the length written, or zero if the clock is not valid or buf is too small.
+int clockFormatCclk(char* buf, int bufLength);
+
+// Current drift estimate of the ESP32 clock, in parts per billion (positive = ESP32 runs fast)
+int32_t clockDriftPpb();
+
+// Convert a UTC calendar date and time to ms since 1970-01-01.
+// Month is 1-12, day is 1-31
+int64_t clockUtcMs(int year, int month, int day, int hour, int minute, int second);
+
+#endif
@@ -0,0 +1,220 @@
+#include "DeltaOta.h"
+
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#define OTA_CHECKPOINT_MAGIC 0x4F544131 // "OTA1"
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+#define sha256Starts(ctx) mbedtls_sha256_starts(ctx, 0)
+#define sha256Update mbedtls_sha256_update
+#define sha256Finish mbedtls_sha256_finish
+#else
+#define sha256Starts(ctx) mbedtls_sha256_starts_ret(ctx, 0)
+#define sha256Update mbedtls_sha256_update_ret
+#define sha256Finish mbedtls_sha256_finish_ret
+#endif
+
+// Resume point, for one source and target pair
+typedef struct {
+  uint32_t magic;
+  uint8_t source[8];     // start of the source SHA-256
+  uint8_t target[8];     // start of the target SHA-256
+  uint32_t partition;    // flash address of the partition being written
+  uint16_t nextChunk;
+} OtaCheckpoint;
+
+static const esp_partition_t* _running = NULL;
+static const esp_partition_t* _target = NULL;
+static DeltaHeader _header;
+static OtaCheckpoint _checkpoint;
+static uint8_t _sector[OTA_SECTOR_BYTES];
+static uint32_t _sectorStart;  // target offset of _sector[0]
+static int _sectorFill;
+static bool _flashFailed;
+static bool _patching = false;
+static bool _patched = false;
+
+// ---------------------------------------------------------------------------
+// Flash access for the patcher
+
+static bool flushSector() {
+  if (_sectorFill == 0) return true;
+  if (esp_partition_erase_range(_target, _sectorStart, OTA_SECTOR_BYTES) != ESP_OK
+      || esp_partition_write(_target, _sectorStart, _sector, _sectorFill) != ESP_OK) {
+    _flashFailed = true;
+    return false;
+  }
+  _sectorStart += OTA_SECTOR_BYTES;
+  _sectorFill = 0;
+  return true;
+}
+
+static bool readSource(void*, uint32_t offset, uint8_t* buf, int length) {
+  if (esp_partition_read(_running, offset, buf, length) == ESP_OK) return true;
+  _flashFailed = true;
+  return false;
+}
+
+// The patcher writes in order, so the target fills one sector at a time
+static bool writeTarget(void*, uint32_t offset, const uint8_t* data, int length) {
+  if (offset != _sectorStart + _sectorFill) return false;
+  while (length > 0) {
+    int n = min(length, OTA_SECTOR_BYTES - _sectorFill);
+    memcpy(_sector + _sectorFill, data, n);
+    _sectorFill += n;
+    data += n;
+    length -= n;
+    if (_sectorFill == OTA_SECTOR_BYTES && !flushSector()) return false;
+  }
+  return true;
+}
+
+// SHA-256 of the first 'length' bytes of a partition, read through the sector buffer
+static bool hashPartition(const esp_partition_t* partition, uint32_t length, uint8_t* out) {
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  sha256Starts(&ctx);
+  bool ok = true;
+  for (uint32_t offset = 0; offset < length && ok; offset += OTA_SECTOR_BYTES) {
+    uint32_t n = min((uint32_t)OTA_SECTOR_BYTES, length - offset);
+    ok = esp_partition_read(partition, offset, _sector, n) == ESP_OK;
+    if (ok) sha256Update(&ctx, _sector, n);
+  }
+  sha256Finish(&ctx, out);
+  mbedtls_sha256_free(&ctx);
+  return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Checkpoint
+
+static void loadCheckpoint(OtaCheckpoint* out) {
+  memset(out, 0, sizeof(OtaCheckpoint));
+  Preferences prefs;
+  if (!prefs.begin(OTA_NVS_NAMESPACE, /*readOnly*/true)) return;
+  size_t length = prefs.getBytes("resume", out, sizeof(OtaCheckpoint));
+  prefs.end();
+  if (length != sizeof(OtaCheckpoint) || out->magic != OTA_CHECKPOINT_MAGIC) memset(out, 0, sizeof(OtaCheckpoint));
+}
+
+static void saveCheckpoint() {
+  Preferences prefs;
+  if (!prefs.begin(OTA_NVS_NAMESPACE, /*readOnly*/false)) return;
+  prefs.putBytes("resume", &_checkpoint, sizeof(OtaCheckpoint));
+  prefs.end();
+}
+
+void otaClearCheckpoint() {
+  Preferences prefs;
+  if (!prefs.begin(OTA_NVS_NAMESPACE, /*readOnly*/false)) return;
+  prefs.remove("resume");
+  prefs.end();
+}
+
+// ---------------------------------------------------------------------------
+
+OtaStatus otaStart(const DeltaHeader* header, uint32_t* resumeOffset) {
+  otaAbort();
+  _patched = false;
+  _running = esp_ota_get_running_partition();
+  _target = esp_ota_get_next_update_partition(NULL);
+  if (_running == NULL || _target == NULL || header->targetSize > _target->size) return OTA_NO_ROOM;
+  if (header->sourceSize > _running->size) return OTA_WRONG_SOURCE;
+
+  uint8_t hash[32];
+  if (!hashPartition(_running, header->sourceSize, hash)) return OTA_FLASH_ERROR;
+  if (memcmp(hash, header->sourceSha256, 32) != 0) return OTA_WRONG_SOURCE;
+
+  // Carry on from the checkpoint if it's for this delta and partition
+  OtaCheckpoint saved;
+  loadCheckpoint(&saved);
+  _checkpoint.magic = OTA_CHECKPOINT_MAGIC;
+  memcpy(_checkpoint.source, header->sourceSha256, sizeof(_checkpoint.source));
+  memcpy(_checkpoint.target, header->targetSha256, sizeof(_checkpoint.target));
+  _checkpoint.partition = _target->address;
+  _checkpoint.nextChunk = 0;
+  if (memcmp(&saved, &_checkpoint, offsetof(OtaCheckpoint, nextChunk)) == 0 && saved.nextChunk <= header->chunkCount) {
+    _checkpoint.nextChunk = saved.nextChunk;
+  }
+
+  _header = *header;
+  _sectorStart = deltaChunkTarget(header, _checkpoint.nextChunk);
+  _sectorFill = 0;
+  _flashFailed = false;
+
+  DeltaIo io = {readSource, writeTarget, NULL};
+  DeltaStatus status = deltaBegin(header, &io, _checkpoint.nextChunk);
+  if (status == DELTA_NO_MEMORY) return OTA_NO_MEMORY;
+  if (status < 0) return OTA_BAD_DELTA;
+  _patching = true;
+  *resumeOffset = deltaChunkOffset(header, _checkpoint.nextChunk);
+
+  if (status == DELTA_DONE) return otaFeed(NULL, 0); // every chunk was written before; just check
+  return OTA_MORE;
+}
+
+// Everything written: check the whole target against the delta's hash
+static OtaStatus verifyTarget() {
+  _patching = false;
+  uint8_t hash[32];
+  if (!hashPartition(_target, _header.targetSize, hash)) return OTA_FLASH_ERROR;
+  if (memcmp(hash, _header.targetSha256, 32) != 0) {
+    otaClearCheckpoint(); // a resume would find the same thing
+    return OTA_HASH_MISMATCH;
+  }
+  _patched = true;
+  return OTA_PATCHED;
+}
+
+OtaStatus otaFeed(const uint8_t* data, int length) {
+  if (_patched) return OTA_PATCHED;
+  if (!_patching) return OTA_BAD_DELTA;
+  if (_checkpoint.nextChunk == _header.chunkCount) return verifyTarget();
+
+  while (length > 0) {
+    int used;
+    DeltaStatus status = deltaFeed(data, length, &used);
+    data += used;
+    length -= used;
+
+    if (status == DELTA_CHUNK_END || status == DELTA_DONE) {
+      if (!flushSector()) status = DELTA_IO_ERROR;
+      else {
+        _checkpoint.nextChunk++;
+        saveCheckpoint();
+      }
+    }
+
+    if (status == DELTA_DONE) return verifyTarget();
+    if (status < 0) {
+      otaAbort();
+      if (status == DELTA_NO_MEMORY) return OTA_NO_MEMORY;
+      return _flashFailed ? OTA_FLASH_ERROR : OTA_BAD_DELTA;
+    }
+  }
+  return OTA_MORE;
+}
+
+int otaChunksDone() {
+  return _checkpoint.nextChunk;
+}
+
+int otaChunkCount() {
+  return _header.chunkCount;
+}
+
+bool otaFinish() {
+  if (!_patched) return false;
+  if (esp_ota_set_boot_partition(_target) != ESP_OK) return false; // also checks the image
+  otaClearCheckpoint();
+  _patched = false;
+  return true;
+}
+
+void otaAbort() {
+  deltaEnd();
+  _patching = false;
+}
@@ -0,0 +1,59 @@
+#ifndef DELTA_OTA_H
+#define DELTA_OTA_H
+
+#include <Arduino.h>
+#include "DeltaPatch.h"
+
+// Firmware update from a binary delta (see DeltaPatch.h), written straight into the
+// inactive OTA partition as it is downloaded.
+//
+// The running image is the patch source and is never touched. Target sectors are
+// erased and written one at a time through a 4 KB buffer, so RAM use is that plus
+// the patcher's inflate state, whatever the image size.
+//
+// A checkpoint in NVS records the last completed chunk, for this source and target
+// pair. If the download stops (lost connection, reset, flat battery) the next
+// otaStart() with the same delta returns where to carry on. Only the delta from that
+// chunk on needs fetching again.
+//
+// This does not use esp_ota_begin(), because that erases the whole partition and
+// can't resume. Nothing changes what boots until otaFinish(), after the target's
+// SHA-256 has been checked.
+
+#define OTA_NVS_NAMESPACE "deltaota"
+#define OTA_SECTOR_BYTES 4096
+
+enum OtaStatus {
+  OTA_MORE = 0,              // feed more
+  OTA_PATCHED = 1,           // target written and its hash checked; call otaFinish()
+  OTA_WRONG_SOURCE = -1,     // the delta isn't for the running image
+  OTA_NO_ROOM = -2,          // no inactive OTA partition, or it's too small
+  OTA_FLASH_ERROR = -3,
+  OTA_BAD_DELTA = -4,
+  OTA_HASH_MISMATCH = -5,    // patched, but the target isn't what the delta promised
+  OTA_NO_MEMORY = -6
+};
+
+// Check a delta fits the running image, and get ready to patch.
+// On OTA_MORE, 'resumeOffset' is where in the delta file to start feeding from
+// (just past the header, or the start of the first chunk not yet written).
+OtaStatus otaStart(const DeltaHeader* header, uint32_t* resumeOffset);
+
+// Feed delta bytes, in order from the resume offset. All are used.
+// A checkpoint is saved each time a chunk completes.
+OtaStatus otaFeed(const uint8_t* data, int length);
+
+// Chunks written (including any done before a resume), and the total
+int otaChunksDone();
+int otaChunkCount();
+
+// Boot the new image on the next restart. Only after OTA_PATCHED.
+bool otaFinish();
+
+// Stop patching and free memory. The checkpoint is kept, for a later resume.
+void otaAbort();
+
+// Forget any checkpoint
+void otaClearCheckpoint();
+
+#endif
@@ -0,0 +1,267 @@
+#include "DeltaPatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO) || defined(ESP_PLATFORM) // Arduino or ESP-IDF
+#include <rom/miniz.h>
+#define DELTA_USE_TINFL 1
+#else
+#include <zlib.h>
+#define DELTA_USE_TINFL 0
+#endif
+
+#define DELTA_SOURCE_PIECE 256 // source bytes read at a time for an ADD
+
+// Parser states for the op stream
+enum OpState {
+  OP_TYPE = 0,
+  OP_LENGTH,
+  OP_MOVE,
+  OP_DATA
+};
+
+typedef struct {
+#if DELTA_USE_TINFL
+  tinfl_decompressor inflator;
+  uint8_t dict[TINFL_LZ_DICT_SIZE]; // inflate output, used as a ring
+  uint32_t dictOffset;
+#else
+  z_stream zs;
+  uint8_t out[4096];
+#endif
+} InflateState;
+
+static InflateState* _inflate = NULL;
+static DeltaHeader _header;
+static DeltaIo _io;
+static int _chunk;
+static uint32_t _chunkIn;      // compressed bytes of this chunk fed so far
+static uint32_t _targetPos;    // target bytes written
+static uint32_t _chunkEnd;     // target position where this chunk ends
+static uint32_t _sourcePos;
+static uint8_t _opState;
+static uint8_t _opType;
+static uint32_t _opRemaining;
+static uint32_t _varint;
+static int _varintShift;
+static bool _failed;
+
+static uint32_t readU32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int deltaParseHeader(const uint8_t* data, int length, DeltaHeader* out) {
+  if (length < DELTA_FIXED_HEADER_BYTES) return 0;
+  if (memcmp(data, "DOTA", 4) != 0 || data[4] != DELTA_VERSION) return -1;
+
+  out->chunkShift = data[5];
+  out->chunkCount = (uint16_t)(data[6] | (data[7] << 8));
+  out->sourceSize = readU32(data + 8);
+  memcpy(out->sourceSha256, data + 12, 32);
+  out->targetSize = readU32(data + 44);
+  memcpy(out->targetSha256, data + 48, 32);
+  if (out->chunkShift < 12 || out->chunkShift > 24 || out->chunkCount == 0 || out->chunkCount > DELTA_MAX_CHUNKS) return -1;
+  if (((uint64_t)out->chunkCount - 1) << out->chunkShift >= out->targetSize) return -1;
+  if ((uint64_t)out->chunkCount << out->chunkShift < out->targetSize) return -1;
+
+  int headerBytes = DELTA_FIXED_HEADER_BYTES + 4 * out->chunkCount;
+  if (length < headerBytes) return 0;
+  for (int i = 0; i < out->chunkCount; i++) out->chunkLength[i] = readU32(data + DELTA_FIXED_HEADER_BYTES + 4 * i);
+  out->headerBytes = headerBytes;
+  return headerBytes;
+}
+
+uint32_t deltaChunkOffset(const DeltaHeader* header, int chunk) {
+  uint32_t offset = header->headerBytes;
+  for (int i = 0; i < chunk && i < header->chunkCount; i++) offset += header->chunkLength[i];
+  return offset;
+}
+
+uint32_t deltaChunkTarget(const DeltaHeader* header, int chunk) {
+  uint64_t t = (uint64_t)chunk << header->chunkShift;
+  return t > header->targetSize ? header->targetSize : (uint32_t)t;
+}
+
+int deltaCurrentChunk() {
+  return _chunk;
+}
+
+static bool inflateStart() {
+#if DELTA_USE_TINFL
+  tinfl_init(&_inflate->inflator);
+  _inflate->dictOffset = 0;
+  return true;
+#else
+  inflateEnd(&_inflate->zs);
+  memset(&_inflate->zs, 0, sizeof(_inflate->zs));
+  return inflateInit2(&_inflate->zs, -15) == Z_OK; // raw deflate
+#endif
+}
+
+static void startChunk() {
+  _chunkIn = 0;
+  _targetPos = deltaChunkTarget(&_header, _chunk);
+  _chunkEnd = deltaChunkTarget(&_header, _chunk + 1);
+  _sourcePos = 0;
+  _opState = OP_TYPE;
+  if (!inflateStart()) _failed = true;
+}
+
+void deltaEnd() {
+  if (_inflate == NULL) return;
+#if !DELTA_USE_TINFL
+  inflateEnd(&_inflate->zs);
+#endif
+  free(_inflate);
+  _inflate = NULL;
+}
+
+DeltaStatus deltaBegin(const DeltaHeader* header, const DeltaIo* io, int firstChunk) {
+  deltaEnd();
+  if (firstChunk < 0 || firstChunk > header->chunkCount) return DELTA_BAD_DATA;
+
+  _inflate = (InflateState*)calloc(1, sizeof(InflateState));
+  if (_inflate == NULL) return DELTA_NO_MEMORY;
+
+  _header = *header;
+  _io = *io;
+  _chunk = firstChunk;
+  _failed = false;
+  if (_chunk == _header.chunkCount) return DELTA_DONE;
+  startChunk();
+  return _failed ? DELTA_NO_MEMORY : DELTA_MORE;
+}
+
+// Target bytes from an ADD: source plus the difference
+static bool applyAdd(const uint8_t* diff, int length) {
+  uint8_t piece[DELTA_SOURCE_PIECE];
+  while (length > 0) {
+    int n = length < DELTA_SOURCE_PIECE ? length : DELTA_SOURCE_PIECE;
+    if (_sourcePos + n > _header.sourceSize) { _failed = true; return false; }
+    if (!_io.readSource(_io.ctx, _sourcePos, piece, n)) return false;
+    for (int i = 0; i < n; i++) piece[i] += diff[i];
+    if (!_io.writeTarget(_io.ctx, _targetPos, piece, n)) return false;
+    _sourcePos += n;
+    _targetPos += n;
+    diff += n;
+    length -= n;
+  }
+  return true;
+}
+
+// Run inflated op bytes. Returns false on bad ops or a failed callback (_failed says which).
+static bool runOps(const uint8_t* p, int length) {
+  const uint8_t* end = p + length;
+  while (p < end) {
+    switch (_opState) {
+      case OP_TYPE:
+        _opType = *p++;
+        if (_opType != DELTA_OP_INSERT && _opType != DELTA_OP_ADD) { _failed = true; return false; }
+        _varint = 0;
+        _varintShift = 0;
+        _opState = OP_LENGTH;
+        break;
+
+      case OP_LENGTH:
+      case OP_MOVE: {
+        uint8_t b = *p++;
+        if (_varintShift > 28) { _failed = true; return false; }
+        _varint |= (uint32_t)(b & 0x7F) << _varintShift;
+        _varintShift += 7;
+        if (b & 0x80) break;
+
+        if (_opState == OP_LENGTH) {
+          _opRemaining = _varint;
+          if (_opRemaining == 0 || _opRemaining > _chunkEnd - _targetPos) { _failed = true; return false; }
+          _varint = 0;
+          _varintShift = 0;
+          _opState = _opType == DELTA_OP_ADD ? OP_MOVE : OP_DATA;
+        } else {
+          int32_t move = (int32_t)(_varint >> 1) ^ -(int32_t)(_varint & 1); // zigzag
+          _sourcePos += (uint32_t)move;
+          if (_sourcePos > _header.sourceSize || _opRemaining > _header.sourceSize - _sourcePos) { _failed = true; return false; }
+          _opState = OP_DATA;
+        }
+        break;
+      }
+
+      case OP_DATA: {
+        int n = (int)(end - p) < (int)_opRemaining ? (int)(end - p) : (int)_opRemaining;
+        bool ok = _opType == DELTA_OP_ADD ? applyAdd(p, n) : _io.writeTarget(_io.ctx, _targetPos, p, n);
+        if (!ok) return false;
+        if (_opType == DELTA_OP_INSERT) _targetPos += n;
+        p += n;
+        _opRemaining -= n;
+        if (_opRemaining == 0) _opState = OP_TYPE;
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// Inflate compressed bytes of the current chunk and run the ops. 'last' is set on the chunk's final bytes.
+// Returns true if the inflate stream and ops are good so far, and (when 'last') both ended together.
+static bool inflateChunk(const uint8_t* data, int length, bool last) {
+#if DELTA_USE_TINFL
+  for (;;) {
+    size_t inBytes = length;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - _inflate->dictOffset;
+    uint8_t* out = _inflate->dict + _inflate->dictOffset;
+    tinfl_status status = tinfl_decompress(&_inflate->inflator, data, &inBytes, _inflate->dict, out, &outBytes,
+                                           last ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+    data += inBytes;
+    length -= (int)inBytes;
+    if (outBytes > 0 && !runOps(out, (int)outBytes)) return false;
+    _inflate->dictOffset = (_inflate->dictOffset + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status < TINFL_STATUS_DONE) { _failed = true; return false; }
+    if (status == TINFL_STATUS_DONE) { if (!last || length != 0) _failed = true; return !_failed; }
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT) { if (last) _failed = true; return !last; }
+    // TINFL_STATUS_HAS_MORE_OUTPUT: go round again
+  }
+#else
+  z_stream* zs = &_inflate->zs;
+  zs->next_in = (Bytef*)data;
+  zs->avail_in = length;
+  for (;;) {
+    zs->next_out = _inflate->out;
+    zs->avail_out = sizeof(_inflate->out);
+    int status = inflate(zs, Z_NO_FLUSH);
+    int produced = (int)(sizeof(_inflate->out) - zs->avail_out);
+    if (produced > 0 && !runOps(_inflate->out, produced)) return false;
+
+    if (status == Z_STREAM_END) { if (!last || zs->avail_in != 0) _failed = true; return !_failed; }
+    if (status != Z_OK && status != Z_BUF_ERROR) { _failed = true; return false; }
+    if (zs->avail_in == 0 && zs->avail_out > 0) { if (last) _failed = true; return !last; }
+  }
+#endif
+}
+
+DeltaStatus deltaFeed(const uint8_t* data, int length, int* used) {
+  *used = 0;
+  if (_inflate == NULL) return _chunk == _header.chunkCount ? DELTA_DONE : DELTA_BAD_DATA;
+  if (_failed) return DELTA_BAD_DATA;
+
+  uint32_t remaining = _header.chunkLength[_chunk] - _chunkIn;
+  int n = (uint32_t)length < remaining ? length : (int)remaining;
+  bool last = (uint32_t)n == remaining;
+
+  bool ok = inflateChunk(data, n, last);
+  *used = n;
+  _chunkIn += n;
+  if (!ok) return _failed ? DELTA_BAD_DATA : DELTA_IO_ERROR;
+  if (!last) return DELTA_MORE;
+
+  // The chunk's ops must have produced exactly its share of the target
+  if (_targetPos != _chunkEnd || _opState != OP_TYPE) { _failed = true; return DELTA_BAD_DATA; }
+
+  _chunk++;
+  if (_chunk == _header.chunkCount) {
+    deltaEnd();
+    return DELTA_DONE;
+  }
+  startChunk();
+  return _failed ? DELTA_NO_MEMORY : DELTA_CHUNK_END;
+}
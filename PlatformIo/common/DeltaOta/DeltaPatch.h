@@ -0,0 +1,93 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stdint.h>
+
+// Binary delta format for firmware updates, and a streaming patcher.
+// Shared by the firmware (DeltaOta) and the host generator (PlatformIo/tools/delta_make.cpp).
+//
+// A delta turns one exact source image into one target image. It is a header,
+// then the target in chunks of 2^chunkShift bytes (the last may be shorter).
+// Each chunk is a separate raw deflate stream of patch ops, so a download can
+// stop at any chunk boundary and carry on from there later.
+//
+// Header (little-endian):
+//   "DOTA", u8 version, u8 chunkShift, u16 chunk count
+//   u32 source size, source SHA-256 (32 bytes)
+//   u32 target size, target SHA-256 (32 bytes)
+//   u32 compressed length of each chunk
+//
+// Ops, once inflated: u8 type, varint length, then
+//   DELTA_OP_INSERT: 'length' bytes of target
+//   DELTA_OP_ADD:    zigzag varint source move, then 'length' bytes added (mod 256) to
+//                    source bytes from there. Code that only moved keeps most bytes
+//                    the same, so these are mostly zero and compress well.
+// The source position starts at zero in each chunk, and moves on with each ADD.
+// Ops never cross a chunk boundary.
+//
+// The patcher reads the source and writes the target through callbacks, in order.
+// While a patch runs it holds one inflate state (about 44 KB on the ESP32, from
+// the ROM inflater) whatever the image size. Only one patch can run at a time.
+//
+// No hardware dependencies: inflate is the ESP32 ROM's tinfl on the device, and zlib on the host.
+
+#define DELTA_VERSION 1
+#define DELTA_FIXED_HEADER_BYTES 80
+#define DELTA_MAX_CHUNKS 128
+#define DELTA_MAX_HEADER_BYTES (DELTA_FIXED_HEADER_BYTES + 4 * DELTA_MAX_CHUNKS)
+
+#define DELTA_OP_INSERT 0
+#define DELTA_OP_ADD 1
+
+typedef struct {
+  uint8_t chunkShift;
+  uint16_t chunkCount;
+  uint32_t sourceSize;
+  uint8_t sourceSha256[32];
+  uint32_t targetSize;
+  uint8_t targetSha256[32];
+  uint32_t chunkLength[DELTA_MAX_CHUNKS]; // compressed bytes
+  uint32_t headerBytes;
+} DeltaHeader;
+
+enum DeltaStatus {
+  DELTA_MORE = 0,        // fed everything; send more
+  DELTA_CHUNK_END = 1,   // a chunk is complete (a safe place to stop)
+  DELTA_DONE = 2,        // the whole target is written
+  DELTA_BAD_DATA = -1,   // not a valid delta, or ops that don't fit the images
+  DELTA_IO_ERROR = -2,   // a callback failed
+  DELTA_NO_MEMORY = -3
+};
+
+typedef struct {
+  // Read 'length' source bytes from 'offset'. Return false on failure.
+  bool (*readSource)(void* ctx, uint32_t offset, uint8_t* buf, int length);
+  // Write the next target bytes, which go at 'offset'. Return false on failure.
+  bool (*writeTarget)(void* ctx, uint32_t offset, const uint8_t* data, int length);
+  void* ctx;
+} DeltaIo;
+
+// Read a header. Returns its length, zero if more bytes are needed, or -1 if this isn't a valid delta.
+int deltaParseHeader(const uint8_t* data, int length, DeltaHeader* out);
+
+// Offset in the delta file where a chunk starts (chunkCount gives the file length)
+uint32_t deltaChunkOffset(const DeltaHeader* header, int chunk);
+
+// Target bytes before a chunk
+uint32_t deltaChunkTarget(const DeltaHeader* header, int chunk);
+
+// Start patching at 'firstChunk' (zero, or the chunk after the last completed one).
+// Feed the delta from deltaChunkOffset(header, firstChunk) on.
+DeltaStatus deltaBegin(const DeltaHeader* header, const DeltaIo* io, int firstChunk);
+
+// Feed delta bytes. Stops after the end of each chunk, so 'used' can be less than 'length';
+// feed the rest in the next call. Returns the state after these bytes.
+DeltaStatus deltaFeed(const uint8_t* data, int length, int* used);
+
+// Chunk being patched, or chunkCount when done
+int deltaCurrentChunk();
+
+// Free the inflate state. Safe to call at any time.
+void deltaEnd();
+
+#endif
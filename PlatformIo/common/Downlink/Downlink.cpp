@@ -0,0 +1,67 @@
+#include "Downlink.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DOWNLINK_MAGIC 0x444C // 'DL'
+
+// Survives deep sleep. Lost on power-on reset, which we detect with the magic number.
+RTC_DATA_ATTR static uint16_t _dlMagic;
+RTC_DATA_ATTR static uint16_t _dlLastApplied; // zero: nothing applied since power-on
+
+void downlinkInit(){
+  if (_dlMagic == DOWNLINK_MAGIC) return;
+  _dlMagic = DOWNLINK_MAGIC;
+  _dlLastApplied = 0;
+}
+
+// True if 'a' comes after 'b', allowing for the IDs wrapping round
+static bool idAfter(uint16_t a, uint16_t b){
+  return (int16_t)(uint16_t)(a - b) > 0;
+}
+
+int downlinkApply(const char* reply, DownlinkHandler handler){
+  if (reply == NULL || handler == NULL) return 0;
+
+  int applied = 0;
+  const char* line = reply;
+  while (*line != 0){
+    const char* end = strchr(line, '\n');
+    if (end == NULL) break; // cut short by the reply buffer. The server sends it again until we ack it
+
+    // Only whole "DL <id> <body>" lines. The reply also echoes our uplink, which we don't want to match.
+    unsigned int id = 0;
+    int bodyStart = 0;
+    if (strncmp(line, "DL ", 3) == 0 && sscanf(line + 3, "%u %n", &id, &bodyStart) == 1 && id > 0 && id <= 0xFFFF){
+      uint16_t id16 = (uint16_t)id;
+      if (_dlLastApplied == 0 || idAfter(id16, _dlLastApplied)){
+        const char* body = line + 3 + bodyStart;
+        if (body > end) body = end; // no body
+        int length = end - body;
+        if (length > 0 && body[length - 1] == '\r') length--;
+        if (length > DOWNLINK_MAX_BODY) length = DOWNLINK_MAX_BODY;
+
+        char text[DOWNLINK_MAX_BODY + 1];
+        memcpy(text, body, length);
+        text[length] = 0;
+
+        handler(id16, text);
+        _dlLastApplied = id16;
+        applied++;
+      }
+    }
+
+    line = end + 1;
+  }
+  return applied;
+}
+
+int downlinkFormatAck(char* buf, int length){
+  int n = snprintf(buf, length, " DLACK %u", (unsigned int)_dlLastApplied);
+  return (n > 0 && n < length) ? n : 0;
+}
+
+uint16_t downlinkLastApplied(){
+  return _dlLastApplied;
+}
@@ -0,0 +1,45 @@
+#ifndef DOWNLINK_H
+#define DOWNLINK_H
+
+#include <stdint.h>
+
+// Commands from the server's downlink mailbox, brought back on the reply to an uplink.
+//
+// The modem is off while we sleep, so the server can't reach us when it likes.
+// Instead it keeps commands for each device, and adds every one we have not
+// acknowledged to the reply to our next uplink, one line each:
+//   "DL <id> <body>\n"
+// IDs are 16 bit and count up (wrapping, zero is never used). A command is
+// applied once: anything at or before the last applied ID is skipped, so it
+// doesn't matter that the server sends it again until it sees our ack.
+// Each uplink carries " DLACK <id>" with the last ID applied (see downlinkFormatAck),
+// which clears those commands from the mailbox.
+//
+// The last applied ID lives in RTC memory, so it survives deep sleep.
+// After a power-on reset any ID is taken, as we can't know what was applied before.
+//
+// This has no hardware dependencies apart from RTC_DATA_ATTR.
+// Only one task should call these functions.
+
+#define DOWNLINK_MAX_BODY 200  // same limit as the server mailbox
+#define DOWNLINK_REPLY_MAX 512 // reply buffer. The server only attaches the lines that fit (DownlinkMailbox.MaxReplyBytes)
+
+// Called for each new command, oldest first. 'body' is the line after the ID, without the line ending.
+typedef void (*DownlinkHandler)(uint16_t id, const char* body);
+
+// Call once at boot. Clears the state after a power-on reset.
+void downlinkInit();
+
+// Find the "DL" lines in a server reply, and pass each new one to 'handler'.
+// Stops at a line with no '\n', as the reply was cut short; that command comes again on the next reply.
+// Returns the number of commands applied.
+int downlinkApply(const char* reply, DownlinkHandler handler);
+
+// Write " DLACK <id>" into buf, to go on the end of the next uplink.
+// Returns the length, or zero if buf is too small.
+int downlinkFormatAck(char* buf, int length);
+
+// ID of the last command applied, or zero if none since power-on
+uint16_t downlinkLastApplied();
+
+#endif
@@ -0,0 +1,129 @@
+#include "DutyScheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DUTY_LOG_VERSION 1
+
+DutyConfig dutyDefaultConfig() {
+  DutyConfig c;
+  c.baseSleepS = 60 * 60;
+  c.minSleepS = 60;
+  c.maxSleepS = 12 * 60 * 60;
+  c.lowBatteryMv = 3600;
+  c.criticalBatteryMv = 3400;
+  c.minTemperatureC = -20;
+  c.maxTemperatureC = 70;
+  c.goodCsq = 15;
+  c.poorCsq = 8;
+  c.batchSize = 8;
+  c.bulkThreshold = 16;
+  return c;
+}
+
+static uint32_t clampSleep(uint32_t s, const DutyConfig* config) {
+  if (s < config->minSleepS) return config->minSleepS;
+  if (s > config->maxSleepS) return config->maxSleepS;
+  return s;
+}
+
+// Use the lower of the voltages we know, so a sagging supply is not missed
+static uint16_t batteryMv(const DutyInputs* in) {
+  if (in->batteryMv == 0) return in->supplyMv;
+  if (in->supplyMv == 0) return in->batteryMv;
+  return in->batteryMv < in->supplyMv ? in->batteryMv : in->supplyMv;
+}
+
+DutyDecision dutyDecide(const DutyInputs* in, const DutyConfig* config) {
+  DutyDecision d;
+  d.send = 0;
+  d.batch = 0;
+  d.reason = DUTY_NOTHING_TO_SEND;
+
+  uint16_t bat = batteryMv(in);
+  bool knownBattery = bat > 0;
+  bool critical = knownBattery && bat < config->criticalBatteryMv;
+  bool low = knownBattery && bat < config->lowBatteryMv;
+  bool queueFull = in->queueCapacity > 0 && (uint32_t)in->queueDepth * 4 >= (uint32_t)in->queueCapacity * 3; // 3/4 full, without rounding down
+  bool tooHot = in->temperatureC != DUTY_TEMP_UNKNOWN
+                && (in->temperatureC > config->maxTemperatureC || in->temperatureC < config->minTemperatureC);
+  bool poorSignal = in->csq != DUTY_CSQ_UNKNOWN && in->csq < config->poorCsq;
+  bool goodSignal = in->csq != DUTY_CSQ_UNKNOWN && in->csq >= config->goodCsq;
+
+  // Sleep: stretch on low battery, shrink when the queue needs draining
+  uint32_t sleep = config->baseSleepS;
+  if (critical) sleep = config->maxSleepS;
+  else if (low) sleep = config->baseSleepS * 4;
+  else if (queueFull) sleep = config->baseSleepS / 2;
+
+  if (in->queueDepth == 0) {
+    d.sleepS = clampSleep(sleep, config);
+    return d;
+  }
+
+  if (in->urgent) { // always try, but keep it small on a weak battery
+    d.send = 1;
+    d.reason = DUTY_SEND_URGENT;
+    d.batch = critical || poorSignal ? 1 : in->queueDepth;
+  } else if (critical) {
+    d.reason = DUTY_DEFER_BATTERY;
+  } else if (tooHot) {
+    d.reason = DUTY_DEFER_TEMPERATURE;
+  } else if (queueFull) { // send what we can, even in poor coverage
+    d.send = 1;
+    d.reason = DUTY_SEND_QUEUE_FULL;
+    d.batch = goodSignal ? in->queueDepth : config->batchSize;
+  } else if (poorSignal) {
+    d.reason = DUTY_DEFER_SIGNAL;
+    sleep = config->baseSleepS / 2; // coverage may be better soon (or somewhere else)
+  } else if (low && in->queueDepth < config->bulkThreshold) {
+    d.reason = DUTY_DEFER_BATTERY; // wait until a batch is worth the radio start-up
+  } else if (goodSignal && in->queueDepth >= config->bulkThreshold) {
+    d.send = 1;
+    d.reason = DUTY_SEND_BULK;
+    d.batch = in->queueDepth;
+  } else {
+    d.send = 1;
+    d.reason = DUTY_SEND_NORMAL;
+    d.batch = config->batchSize;
+  }
+
+  if (d.batch > in->queueDepth) d.batch = in->queueDepth;
+  d.sleepS = clampSleep(sleep, config);
+  return d;
+}
+
+int dutyFormatLog(char* buf, int bufLength, const DutyInputs* in, const DutyDecision* d) {
+  int length = snprintf(buf, bufLength, "DUTY,%d,%u,%u,%d,%u,%u,%u,%u,%u,%u,%u,%lu",
+                        DUTY_LOG_VERSION,
+                        in->batteryMv, in->supplyMv, in->temperatureC, in->csq,
+                        in->queueDepth, in->queueCapacity, in->urgent,
+                        d->send, d->reason, d->batch, (unsigned long)d->sleepS);
+  if (length < 0 || length >= bufLength) return 0;
+  return length;
+}
+
+bool dutyParseLog(const char* line, DutyInputs* in, DutyDecision* d) {
+  const char* c = strstr(line, "DUTY,");
+  if (c == NULL) return false;
+
+  int version, temp;
+  unsigned bat, supply, csq, depth, capacity, urgent, send, reason, batch;
+  unsigned long sleep;
+  int got = sscanf(c, "DUTY,%d,%u,%u,%d,%u,%u,%u,%u,%u,%u,%u,%lu",
+                   &version, &bat, &supply, &temp, &csq, &depth, &capacity, &urgent, &send, &reason, &batch, &sleep);
+  if (got != 12 || version != DUTY_LOG_VERSION) return false;
+
+  in->batteryMv = (uint16_t)bat;
+  in->supplyMv = (uint16_t)supply;
+  in->temperatureC = (int8_t)temp;
+  in->csq = (uint8_t)csq;
+  in->queueDepth = (uint16_t)depth;
+  in->queueCapacity = (uint16_t)capacity;
+  in->urgent = (uint8_t)urgent;
+  d->send = (uint8_t)send;
+  d->reason = (uint8_t)reason;
+  d->batch = (uint16_t)batch;
+  d->sleepS = (uint32_t)sleep;
+  return true;
+}
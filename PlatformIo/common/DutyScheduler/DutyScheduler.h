@@ -0,0 +1,75 @@
+#ifndef DUTY_SCHEDULER_H
+#define DUTY_SCHEDULER_H
+
+#include <stdint.h>
+
+// Battery- and signal-aware duty cycle.
+// Given battery, temperature, signal and queue state, decide whether to send
+// on this wake, how many messages to batch, and how long to sleep after.
+//
+// dutyDecide() is a pure function, and every decision is logged as a CSV line
+// (see dutyFormatLog) so we can replay real logs against new tuning on the host
+// with PlatformIo/tools/duty_replay.cpp
+
+#define DUTY_CSQ_UNKNOWN 99       // as reported by 'AT+CSQ' when there is no signal reading
+#define DUTY_TEMP_UNKNOWN -128
+
+// What we know at decision time. Zero voltages mean 'not read yet'
+typedef struct {
+  uint16_t batteryMv;     // BAT_ADC reading
+  uint16_t supplyMv;      // 'AT+CBC' reading
+  int8_t temperatureC;    // 'AT+CPMUTEMP' reading, or DUTY_TEMP_UNKNOWN
+  uint8_t csq;            // 'AT+CSQ' RSSI (0..31), or DUTY_CSQ_UNKNOWN before the modem is up
+  uint16_t queueDepth;    // messages waiting to be sent
+  uint16_t queueCapacity; // most messages we can hold
+  uint8_t urgent;         // non-zero if any waiting message is urgent
+} DutyInputs;
+
+typedef struct {
+  uint32_t baseSleepS;       // normal sleep between wakes
+  uint32_t minSleepS;
+  uint32_t maxSleepS;
+  uint16_t lowBatteryMv;     // below this, sleep longer and only send full batches
+  uint16_t criticalBatteryMv;// below this, only send urgent messages
+  int8_t minTemperatureC;    // outside this range, the modem should not transmit
+  int8_t maxTemperatureC;
+  uint8_t goodCsq;           // at or above this, coverage is good enough for bulk uploads
+  uint8_t poorCsq;           // below this, defer non-urgent sends
+  uint16_t batchSize;        // messages per wake in fair coverage
+  uint16_t bulkThreshold;    // queue depth that makes a send worth the radio start-up on low battery
+} DutyConfig;
+
+// Why we decided as we did. Part of the log format, so only append.
+enum DutyReason {
+  DUTY_NOTHING_TO_SEND = 0,
+  DUTY_SEND_NORMAL = 1,
+  DUTY_SEND_BULK = 2,       // good coverage, sending the whole queue
+  DUTY_SEND_URGENT = 3,
+  DUTY_SEND_QUEUE_FULL = 4, // would lose data if we waited
+  DUTY_DEFER_BATTERY = 5,
+  DUTY_DEFER_TEMPERATURE = 6,
+  DUTY_DEFER_SIGNAL = 7
+};
+
+typedef struct {
+  uint8_t send;    // non-zero to send on this wake
+  uint8_t reason;  // DutyReason
+  uint16_t batch;  // messages to send on this wake
+  uint32_t sleepS; // how long to sleep after this wake
+} DutyDecision;
+
+// Default tuning (one hour wake cycle)
+DutyConfig dutyDefaultConfig();
+
+// Make a decision. Call once before powering the modem (with csq unknown) to see
+// if the modem is needed at all, and again once the signal has been read.
+DutyDecision dutyDecide(const DutyInputs* in, const DutyConfig* config);
+
+// Write a decision log line, like "DUTY,1,3912,3900,31,18,4,64,0,1,1,4,3600"
+// Returns the length written, or zero if buf is too small.
+int dutyFormatLog(char* buf, int bufLength, const DutyInputs* in, const DutyDecision* d);
+
+// Read a decision log line written by dutyFormatLog. Returns true if the line was valid.
+bool dutyParseLog(const char* line, DutyInputs* in, DutyDecision* d);
+
+#endif
@@ -0,0 +1,251 @@
+#include "EwcBridge.h"
+#include <string.h>
+#include <stdio.h>
+
+typedef struct {
+  EwcFrame frame;
+  uint8_t flags;
+} PendingFrame;
+
+static BridgeConfig _config;
+static PendingFrame _pending[BRIDGE_MAX_BATCH];
+static int _pendingCount = 0;
+
+// The datagram in flight (or waiting to be sent again)
+static PendingFrame _flight[BRIDGE_MAX_BATCH];
+static int _flightCount = 0;
+static uint16_t _flightSeq = 0;
+static bool _flightSent = false;  // built and handed to the modem
+static uint16_t _droppedInFlight = 0; // drop count carried in the datagram in flight
+
+static uint16_t _nextSeq = 1;
+static uint16_t _droppedSinceSend = 0;
+
+static uint16_t _latency[BRIDGE_LATENCY_BUCKETS];
+static uint32_t _windowAcked = 0;
+static uint32_t _windowMaxMs = 0;
+static uint32_t _windowOverTarget = 0;
+static uint32_t _windowStartMs = 0;
+static uint32_t _dropped = 0;
+static uint32_t _retries = 0;
+
+BridgeConfig bridgeDefaultConfig(){
+  BridgeConfig c;
+  memset(&c, 0, sizeof(c));
+  c.urgentCommands[0] = 0x4C; // top-up results: someone is standing at the charger
+  c.batchMaxAgeMs = 30000;
+  c.batchMaxFrames = BRIDGE_MAX_BATCH;
+  c.targetP99Ms = 3000;
+  c.reportPeriodMs = 60000;
+  return c;
+}
+
+void bridgeInit(const BridgeConfig* config){
+  _config = *config;
+  if (_config.batchMaxFrames < 1) _config.batchMaxFrames = 1;
+  if (_config.batchMaxFrames > BRIDGE_MAX_BATCH) _config.batchMaxFrames = BRIDGE_MAX_BATCH;
+
+  _pendingCount = 0;
+  _flightCount = 0;
+  _flightSent = false;
+  _nextSeq = 1;
+  _droppedSinceSend = 0;
+  _dropped = 0;
+  _retries = 0;
+  memset(_latency, 0, sizeof(_latency));
+  _windowAcked = 0;
+  _windowMaxMs = 0;
+  _windowOverTarget = 0;
+  _windowStartMs = 0;
+}
+
+bool bridgeIsUrgent(const EwcFrame* frame){
+  if (frame->lead >= frame->length) return false;
+  uint8_t command = frame->data[frame->lead];
+  for (int i = 0; i < BRIDGE_MAX_URGENT; i++){
+    if (_config.urgentCommands[i] != 0 && _config.urgentCommands[i] == command) return true;
+  }
+  return false;
+}
+
+// Remove one pending frame, keeping order
+static void removePending(int index){
+  for (int i = index; i < _pendingCount - 1; i++) _pending[i] = _pending[i + 1];
+  _pendingCount--;
+}
+
+void bridgeAdd(const EwcFrame* frame){
+  if (_pendingCount >= BRIDGE_MAX_BATCH){
+    // Make room by dropping the oldest routine frame (or the oldest frame, if all are urgent)
+    int victim = 0;
+    for (int i = 0; i < _pendingCount; i++){
+      if (!(_pending[i].flags & BRIDGE_FLAG_URGENT)) { victim = i; break; }
+    }
+    removePending(victim);
+    _dropped++;
+    _droppedSinceSend++;
+  }
+
+  PendingFrame* p = &_pending[_pendingCount++];
+  p->frame = *frame;
+  p->flags = bridgeIsUrgent(frame) ? BRIDGE_FLAG_URGENT : 0;
+}
+
+bool bridgeInFlight(){
+  return _flightCount > 0 && _flightSent;
+}
+
+bool bridgeSendDue(uint32_t nowMs){
+  if (_flightCount > 0) return !_flightSent; // waiting for an ack, or due to resend
+  if (_pendingCount == 0) return false;
+  if (_pendingCount >= _config.batchMaxFrames) return true;
+  for (int i = 0; i < _pendingCount; i++){
+    if (_pending[i].flags & BRIDGE_FLAG_URGENT) return true;
+  }
+  return nowMs - _pending[0].frame.receivedMs >= _config.batchMaxAgeMs;
+}
+
+static void put16(uint8_t* p, uint16_t v){ p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t* p, uint32_t v){ p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24; }
+
+int bridgeBuildDatagram(uint8_t* buf, int length, uint32_t nowMs){
+  if (!bridgeSendDue(nowMs)) return 0;
+
+  if (_flightCount == 0){ // new datagram: move pending frames into flight
+    _flightCount = _pendingCount;
+    memcpy(_flight, _pending, sizeof(PendingFrame) * _pendingCount);
+    _pendingCount = 0;
+    _flightSeq = _nextSeq++;
+    _droppedInFlight = _droppedSinceSend;
+    _droppedSinceSend = 0;
+  } else {
+    _retries++;
+  }
+
+  int needed = BRIDGE_HEADER_BYTES;
+  for (int i = 0; i < _flightCount; i++) needed += BRIDGE_FRAME_OVERHEAD + _flight[i].frame.length;
+  if (needed > length) return 0;
+
+  put16(buf, BRIDGE_MAGIC);
+  buf[2] = BRIDGE_VERSION;
+  buf[3] = (uint8_t)_flightCount;
+  put16(buf + 4, _flightSeq);
+  put16(buf + 6, _droppedInFlight);
+  put32(buf + 8, _config.bootId);
+
+  int o = BRIDGE_HEADER_BYTES;
+  for (int i = 0; i < _flightCount; i++){
+    const PendingFrame* p = &_flight[i];
+    put32(buf + o, nowMs - p->frame.receivedMs);
+    buf[o + 4] = p->flags;
+    buf[o + 5] = p->frame.length;
+    memcpy(buf + o + 6, p->frame.data, p->frame.length);
+    o += BRIDGE_FRAME_OVERHEAD + p->frame.length;
+  }
+
+  _flightSent = true;
+  return o;
+}
+
+void bridgeSendFailed(){
+  _flightSent = false; // bridgeSendDue() is now true, and the same datagram is built again
+}
+
+static void recordLatency(uint32_t ms){
+  int bucket = ms / BRIDGE_LATENCY_BUCKET_MS;
+  if (bucket >= BRIDGE_LATENCY_BUCKETS) bucket = BRIDGE_LATENCY_BUCKETS - 1;
+  if (_latency[bucket] < 0xFFFF) _latency[bucket]++;
+  _windowAcked++;
+  if (ms > _windowMaxMs) _windowMaxMs = ms;
+  if (ms > _config.targetP99Ms) _windowOverTarget++;
+}
+
+static int hexValue(char c){
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Read hex pairs into a frame, up to the end of the line. Returns false if there are none, or on a bad digit
+static bool parseHexFrame(const char* p, EwcFrame* out){
+  out->length = 0;
+  out->lead = 0;
+  while (*p && *p != '\n' && *p != '\r'){
+    if (*p == ' ') { p++; continue; }
+    int hi = hexValue(p[0]);
+    int lo = hexValue(p[1]);
+    if (hi < 0 || lo < 0 || out->length >= EWC_MAX_FRAME) return false;
+    out->data[out->length++] = (uint8_t)((hi << 4) | lo);
+    p += 2;
+  }
+  return out->length > 0;
+}
+
+int bridgeHandleReply(const char* reply, uint32_t nowMs, EwcFrame* commands, int maxCommands){
+  if (reply == NULL || !bridgeInFlight()) return -1;
+
+  const char* ack = strstr(reply, "ACK ");
+  if (ack == NULL) return -1;
+  unsigned int seq = 0;
+  if (sscanf(ack + 4, "%u", &seq) != 1 || seq != _flightSeq) return -1;
+
+  for (int i = 0; i < _flightCount; i++) recordLatency(nowMs - _flight[i].frame.receivedMs);
+  _flightCount = 0;
+  _flightSent = false;
+
+  int count = 0;
+  const char* p = reply;
+  while (count < maxCommands && (p = strstr(p, "CMD ")) != NULL){
+    p += 4;
+    if (parseHexFrame(p, &commands[count])){
+      commands[count].receivedMs = nowMs;
+      count++;
+    }
+  }
+  return count;
+}
+
+bool bridgeReportDue(uint32_t nowMs){
+  if (_windowStartMs == 0) _windowStartMs = nowMs;
+  return nowMs - _windowStartMs >= _config.reportPeriodMs;
+}
+
+// Latency (upper edge of the bucket) at or below which 'permille' of samples fall
+static uint32_t percentileMs(int permille){
+  if (_windowAcked == 0) return 0;
+  uint32_t rank = (_windowAcked * permille + 999) / 1000; // 1-based rank
+  uint32_t seen = 0;
+  for (int i = 0; i < BRIDGE_LATENCY_BUCKETS; i++){
+    seen += _latency[i];
+    if (seen >= rank) return (i + 1) * BRIDGE_LATENCY_BUCKET_MS;
+  }
+  return BRIDGE_LATENCY_BUCKETS * BRIDGE_LATENCY_BUCKET_MS;
+}
+
+BridgeStats bridgeStats(){
+  BridgeStats s;
+  s.acked = _windowAcked;
+  s.p50Ms = percentileMs(500);
+  s.p99Ms = percentileMs(990);
+  s.maxMs = _windowMaxMs;
+  s.overTarget = _windowOverTarget;
+  s.dropped = _dropped;
+  s.retries = _retries;
+  s.targetMissed = _windowAcked > 0 && s.p99Ms > _config.targetP99Ms;
+  return s;
+}
+
+int bridgeFormatReport(char* buf, int length, uint32_t nowMs){
+  BridgeStats s = bridgeStats();
+  int written = snprintf(buf, length, "BRIDGE,acked=%u,p50=%u,p99=%u,max=%u,target=%u,over=%u,dropped=%u,retries=%u,%s",
+    (unsigned)s.acked, (unsigned)s.p50Ms, (unsigned)s.p99Ms, (unsigned)s.maxMs, (unsigned)_config.targetP99Ms,
+    (unsigned)s.overTarget, (unsigned)s.dropped, (unsigned)s.retries, s.targetMissed ? "MISSED" : "ok");
+
+  memset(_latency, 0, sizeof(_latency));
+  _windowAcked = 0;
+  _windowMaxMs = 0;
+  _windowOverTarget = 0;
+  _windowStartMs = nowMs;
+  return written;
+}
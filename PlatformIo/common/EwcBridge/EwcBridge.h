@@ -0,0 +1,99 @@
+#ifndef EWC_BRIDGE_H
+#define EWC_BRIDGE_H
+
+#include <stdint.h>
+#include <EwcFramer.h>
+
+// Forwards EWC frames to the UdpHook server, and brings server commands back.
+//
+// Frames are added as they arrive (stamped with their arrival time by the EWC
+// link). Urgent frames make a datagram due straight away; routine frames wait
+// until a batch fills or the oldest reaches its age limit. One datagram is in
+// flight at a time: the server acknowledges it by sequence number, and that ack
+// closes the latency measurement for every frame in it (frame-in to server-ack).
+// If a send fails, the same datagram (and sequence number) goes again.
+// Sequence numbers start again at 1 when the device restarts, so each datagram
+// also carries a boot id, random for each bridgeInit(). The server only treats a
+// datagram as a repeat if both match.
+//
+// Latency goes into a histogram, and a report with p50/p99 against the target
+// is due every 'reportPeriodMs'.
+//
+// Datagram (little-endian, sent to SERVER_PORT_BRIDGE):
+//   u16 magic 0x4245, u8 version, u8 frame count, u16 sequence, u16 frames dropped since last datagram, u32 boot id
+//   per frame: u32 age in ms when the datagram was built, u8 flags (1 = urgent), u8 length, frame bytes
+// Reply (text): "ACK <seq>\n" then zero or more "CMD <hex>\n", each a whole EWC frame.
+//
+// This has no hardware dependencies, so it can be built on the host.
+// Only one task should call these functions.
+
+#define BRIDGE_MAGIC 0x4245
+#define BRIDGE_VERSION 2
+#define BRIDGE_HEADER_BYTES 12
+#define BRIDGE_FRAME_OVERHEAD 6
+#define BRIDGE_MAX_BATCH 8
+#define BRIDGE_MAX_DATAGRAM (BRIDGE_HEADER_BYTES + BRIDGE_MAX_BATCH * (BRIDGE_FRAME_OVERHEAD + EWC_MAX_FRAME))
+#define BRIDGE_MAX_URGENT 4         // command bytes that can be marked urgent
+#define BRIDGE_LATENCY_BUCKET_MS 50
+#define BRIDGE_LATENCY_BUCKETS 256  // up to 12.8 s; anything longer counts in the last bucket
+
+#define BRIDGE_FLAG_URGENT 0x01
+
+typedef struct {
+  uint8_t urgentCommands[BRIDGE_MAX_URGENT]; // frames with these command bytes are sent straight away. 0 = unused
+  uint32_t batchMaxAgeMs;   // routine frames wait at most this long
+  uint8_t batchMaxFrames;   // ... or until this many are waiting (1..BRIDGE_MAX_BATCH)
+  uint32_t targetP99Ms;     // frame-in to server-ack target
+  uint32_t reportPeriodMs;  // how often a latency report is due
+  uint32_t bootId;          // random for each boot (esp_random()), so the server can tell a restart from a resend
+} BridgeConfig;
+
+typedef struct {
+  uint32_t acked;       // frames acknowledged in this report window
+  uint32_t p50Ms;
+  uint32_t p99Ms;
+  uint32_t maxMs;
+  uint32_t overTarget;  // acked frames slower than the target
+  uint32_t dropped;     // frames lost because the pending list was full (since boot)
+  uint32_t retries;     // datagrams sent again after a failure (since boot)
+  bool targetMissed;    // p99 over the target
+} BridgeStats;
+
+BridgeConfig bridgeDefaultConfig();
+
+void bridgeInit(const BridgeConfig* config);
+
+// True if the frame's command byte is in the urgent list
+bool bridgeIsUrgent(const EwcFrame* frame);
+
+// Queue a frame for the server. If the pending list is full, the oldest routine frame is dropped.
+void bridgeAdd(const EwcFrame* frame);
+
+// True if a datagram should be built now
+bool bridgeSendDue(uint32_t nowMs);
+
+// Write the next datagram into buf. Returns its length, or zero if nothing is due or buf is too small.
+// The datagram stays in flight until bridgeHandleReply() or bridgeSendFailed().
+int bridgeBuildDatagram(uint8_t* buf, int length, uint32_t nowMs);
+
+// Read a server reply. If it acknowledges the datagram in flight, latency is recorded
+// and any commands are copied into 'commands'. Returns the number of commands, or -1 if
+// the reply does not acknowledge the datagram in flight.
+int bridgeHandleReply(const char* reply, uint32_t nowMs, EwcFrame* commands, int maxCommands);
+
+// The datagram in flight was not acknowledged. It will be sent again.
+void bridgeSendFailed();
+
+// True if a datagram has been built and not yet acknowledged or failed
+bool bridgeInFlight();
+
+// True when a latency report is due
+bool bridgeReportDue(uint32_t nowMs);
+
+// Latency for the current report window
+BridgeStats bridgeStats();
+
+// Write a "BRIDGE,..." report line, and start a new report window. Returns length written
+int bridgeFormatReport(char* buf, int length, uint32_t nowMs);
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef EWC_CODEC_H
+#define EWC_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <EwcFramer.h>
+
+// Table-driven codec for EWC messages.
+//
+// Every message is <command> <fields...> <ETX=0x03> <checksum>, where the
+// checksum is the XOR of all bytes before it. Replies from the EWC may have a
+// status byte in front, which is not covered by the checksum.
+//
+// Message layouts are constexpr tables (see 'messageTable' below). Each typed
+// message struct lists its members with a visit() function, and a static_assert
+// checks that list against the table at compile time, so a new message type is
+// a table entry plus a struct, with no hand-counted bytes.
+//
+// Encoding and decoding work on caller buffers and never allocate.
+// Multi-byte fields are big-endian.
+//
+// The ETX, the largest frame (EWC_MAX_FRAME) and the checksum (ewcChecksum) are
+// EwcFramer's, from EwcLink, so link EwcFramer.cpp with this.
+//
+// Needs C++17. Has no hardware dependencies, so it builds on the host.
+
+namespace ewc {
+
+enum class FieldType : uint8_t {
+  U8,
+  U16,
+  U32,
+  Rest // variable length bytes up to the ETX. Must be the last field
+};
+
+enum class Direction : uint8_t {
+  ToEwc,
+  FromEwc
+};
+
+struct Field {
+  const char* name;
+  FieldType type;
+};
+
+struct MessageDesc {
+  const char* name;
+  uint8_t command;
+  Direction direction;
+  const Field* fields;
+  uint8_t fieldCount;
+  uint8_t lead; // status bytes in front of the command (not checksummed)
+};
+
+// Result of a decode. Values are logged, so only append.
+enum class Status : uint8_t {
+  Ok = 0,
+  TooShort,      // fewer bytes than the layout needs
+  TooLong,       // more bytes than the layout allows
+  NoEtx,         // ETX not where the layout says it should be
+  BadChecksum,
+  WrongCommand,  // frame is a different message type
+  NoSpace        // output buffer too small (encode only)
+};
+
+constexpr int fieldSize(FieldType t) {
+  return t == FieldType::U8 ? 1 : t == FieldType::U16 ? 2 : t == FieldType::U32 ? 4 : 0;
+}
+
+// Bytes of fixed-size fields in a message
+constexpr int fixedLength(const MessageDesc& d) {
+  int n = 0;
+  for (int i = 0; i < d.fieldCount; i++) n += fieldSize(d.fields[i].type);
+  return n;
+}
+
+constexpr bool hasRest(const MessageDesc& d) {
+  return d.fieldCount > 0 && d.fields[d.fieldCount - 1].type == FieldType::Rest;
+}
+
+// Smallest whole frame for a message: lead + command + fields + ETX + checksum
+constexpr int minFrameLength(const MessageDesc& d) {
+  return d.lead + 1 + fixedLength(d) + 2;
+}
+
+// ---------------------------------------------------------------------------
+// Message table. Field names for the top-up come from the slot 0 example
+// (4C 00 D4 3D 46 A5 00 00 FF FF 03 45).
+
+inline constexpr Field topUpFields[] = {
+  {"slot", FieldType::U8},
+  {"cardId", FieldType::U32},
+  {"credit", FieldType::U16},
+  {"limit", FieldType::U16},
+};
+
+inline constexpr Field clockReplyFields[] = {
+  {"clock", FieldType::Rest},
+};
+
+inline constexpr MessageDesc clockRequestDesc = {"ClockRequest", 0x54, Direction::ToEwc, nullptr, 0, 0};
+inline constexpr MessageDesc clockReplyDesc = {"ClockReply", 0x54, Direction::FromEwc, clockReplyFields, 1, 1};
+inline constexpr MessageDesc topUpDesc = {"TopUp", 0x4C, Direction::ToEwc, topUpFields, 4, 0};
+
+inline constexpr const MessageDesc* messageTable[] = {
+  &clockRequestDesc,
+  &clockReplyDesc,
+  &topUpDesc,
+};
+inline constexpr int messageCount = sizeof(messageTable) / sizeof(messageTable[0]);
+
+// ---------------------------------------------------------------------------
+// Typed messages. visit() must list members in table order.
+
+// Variable length tail of a message
+struct Bytes {
+  uint8_t length;
+  uint8_t data[EWC_MAX_FRAME];
+};
+
+struct ClockRequest {
+  static constexpr const MessageDesc& desc = clockRequestDesc;
+  template <class V, class M> static constexpr void visit(V&, M&) {}
+};
+
+struct ClockReply {
+  static constexpr const MessageDesc& desc = clockReplyDesc;
+  uint8_t status; // lead byte, 0x80 in replies seen so far
+  Bytes clock;
+  template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.clock); }
+};
+
+struct TopUp {
+  static constexpr const MessageDesc& desc = topUpDesc;
+  uint8_t slot;
+  uint32_t cardId;
+  uint16_t credit;
+  uint16_t limit;
+  template <class V, class M> static constexpr void visit(V& v, M& m) { v(m.slot); v(m.cardId); v(m.credit); v(m.limit); }
+};
+
+// ---------------------------------------------------------------------------
+// Compile-time check of typed messages against the table
+
+namespace detail {
+
+template <class T> constexpr FieldType typeOf();
+template <> constexpr FieldType typeOf<uint8_t>() { return FieldType::U8; }
+template <> constexpr FieldType typeOf<uint16_t>() { return FieldType::U16; }
+template <> constexpr FieldType typeOf<uint32_t>() { return FieldType::U32; }
+template <> constexpr FieldType typeOf<Bytes>() { return FieldType::Rest; }
+
+struct LayoutCheck {
+  const MessageDesc& desc;
+  int index;
+  bool ok;
+  template <class F> constexpr void operator()(const F&) {
+    if (index >= desc.fieldCount || desc.fields[index].type != typeOf<F>()) ok = false;
+    index++;
+  }
+};
+
+template <class T> constexpr bool layoutMatches() {
+  T m{};
+  LayoutCheck check{T::desc, 0, true};
+  T::visit(check, m);
+  return check.ok && check.index == T::desc.fieldCount;
+}
+
+struct Writer {
+  uint8_t* p;
+  uint8_t* end;
+  bool ok;
+  void put(uint8_t b) { if (p < end) *p++ = b; else ok = false; }
+  void operator()(const uint8_t& v) { put(v); }
+  void operator()(const uint16_t& v) { put(v >> 8); put(v & 0xFF); }
+  void operator()(const uint32_t& v) { put(v >> 24); put((v >> 16) & 0xFF); put((v >> 8) & 0xFF); put(v & 0xFF); }
+  void operator()(const Bytes& v) { for (int i = 0; i < v.length; i++) put(v.data[i]); }
+};
+
+struct Reader {
+  const uint8_t* p;
+  const uint8_t* end; // first byte after the fields (the ETX)
+  uint8_t get() { return *p++; }
+  void operator()(uint8_t& v) { v = get(); }
+  void operator()(uint16_t& v) { v = get() << 8; v |= get(); }
+  void operator()(uint32_t& v) { v = (uint32_t)get() << 24; v |= (uint32_t)get() << 16; v |= (uint32_t)get() << 8; v |= get(); }
+  void operator()(Bytes& v) {
+    v.length = 0;
+    while (p < end && v.length < EWC_MAX_FRAME) v.data[v.length++] = get();
+  }
+};
+
+} // namespace detail
+
+static_assert(detail::layoutMatches<ClockRequest>(), "ClockRequest does not match its table entry");
+static_assert(detail::layoutMatches<ClockReply>(), "ClockReply does not match its table entry");
+static_assert(detail::layoutMatches<TopUp>(), "TopUp does not match its table entry");
+
+// ---------------------------------------------------------------------------
+// Encode and decode
+
+// Write a message into buf. Returns the frame length, or zero if buf is too small.
+// Lead bytes are only written by the EWC, so they are never encoded.
+template <class T>
+int encode(const T& msg, uint8_t* buf, int bufLength) {
+  detail::Writer w{buf, buf + bufLength, true};
+  w.put(T::desc.command);
+  T::visit(w, msg);
+  w.put(EWC_ETX);
+  if (!w.ok || w.p >= w.end) return 0;
+  int bodyLength = (int)(w.p - buf);
+  *w.p++ = ewcChecksum(buf, bodyLength);
+  return bodyLength + 1;
+}
+
+// Check the frame structure (length, ETX, checksum) against a layout, without reading fields
+inline Status validate(const MessageDesc& desc, const uint8_t* frame, int length) {
+  if (length < minFrameLength(desc)) return Status::TooShort;
+  if (!hasRest(desc) && length > minFrameLength(desc)) return Status::TooLong;
+  if (frame[desc.lead] != desc.command) return Status::WrongCommand;
+  if (frame[length - 2] != EWC_ETX) return Status::NoEtx;
+  if (ewcChecksum(frame + desc.lead, length - desc.lead - 1) != frame[length - 1]) return Status::BadChecksum;
+  return Status::Ok;
+}
+
+// Read a whole frame (including any lead bytes) into a typed message
+template <class T>
+Status decode(const uint8_t* frame, int length, T& out) {
+  Status s = validate(T::desc, frame, length);
+  if (s != Status::Ok) return s;
+
+  detail::Reader r{frame + T::desc.lead + 1, frame + length - 2};
+  T::visit(r, out);
+  if constexpr (T::desc.lead > 0) out.status = frame[0];
+  return Status::Ok;
+}
+
+// Find the table entry for a frame. 'lead' is the number of status bytes in front of the command.
+// Returns null if no message type matches.
+inline const MessageDesc* identify(const uint8_t* frame, int length, int lead, Direction direction) {
+  if (lead >= length) return nullptr;
+  for (int i = 0; i < messageCount; i++) {
+    const MessageDesc* d = messageTable[i];
+    if (d->direction == direction && d->lead == lead && d->command == frame[lead]) return d;
+  }
+  return nullptr;
+}
+
+} // namespace ewc
+
+#endif
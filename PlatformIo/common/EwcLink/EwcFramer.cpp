@@ -0,0 +1,49 @@
+#include "EwcFramer.h"
+
+#include <string.h>
+
+void ewcFramerReset(EwcFramer* f) {
+  f->length = 0;
+  f->runningXor = 0;
+  f->lastWasEtx = 0;
+  f->prefixXor[0] = 0;
+}
+
+bool ewcFramerHasPartial(const EwcFramer* f) {
+  return f->length > 0;
+}
+
+uint8_t ewcChecksum(const uint8_t* data, int length) {
+  uint8_t x = 0;
+  for (int i = 0; i < length; i++) x ^= data[i];
+  return x;
+}
+
+bool ewcFramerPush(EwcFramer* f, uint8_t b, EwcFrame* out) {
+  // Frame ends on ETX followed by the XOR of everything up to the ETX,
+  // counting from the start or from just after some lead bytes.
+  // A frame needs at least a command byte before the ETX.
+  if (f->lastWasEtx && f->length < EWC_MAX_FRAME) {
+    for (int lead = 0; lead <= EWC_MAX_LEAD && lead + 2 <= f->length; lead++) {
+      if ((uint8_t)(f->runningXor ^ f->prefixXor[lead]) != b) continue;
+
+      memcpy(out->data, f->data, f->length);
+      out->data[f->length] = b;
+      out->length = f->length + 1;
+      out->lead = (uint8_t)lead;
+      ewcFramerReset(f);
+      return true;
+    }
+  }
+
+  if (f->length >= EWC_MAX_FRAME - 1) { // no room for this byte and a checksum
+    f->overflows++;
+    ewcFramerReset(f);
+  }
+
+  f->data[f->length++] = b;
+  f->runningXor ^= b;
+  if (f->length <= EWC_MAX_LEAD) f->prefixXor[f->length] = f->runningXor;
+  f->lastWasEtx = (b == EWC_ETX);
+  return false;
+}
@@ -0,0 +1,52 @@
+#ifndef EWC_FRAMER_H
+#define EWC_FRAMER_H
+
+#include <stdint.h>
+
+// Splits the EWC byte stream into frames.
+// EWC frames are <command> <data...> <ETX=0x03> <checksum>, where the checksum
+// is the XOR of every byte before it (including the ETX). For example the clock
+// request is 54 03 57, and the super-tap top-up for slot 0 is
+// 4C 00 D4 3D 46 A5 00 00 FF FF 03 45.
+//
+// A 0x03 can turn up inside the data, so a frame only ends where an ETX is
+// followed by a matching checksum. Replies can have a status byte in front
+// (like 80 54 03 57), so the checksum may start up to EWC_MAX_LEAD bytes in;
+// those bytes are kept in the frame, and 'lead' says how many there are.
+// A gap in the byte stream should drop any partial frame (see ewcFramerReset).
+//
+// This has no hardware dependencies, so it can be built on the host.
+
+#define EWC_ETX 0x03
+#define EWC_MAX_FRAME 64
+#define EWC_MAX_LEAD 2
+
+typedef struct {
+  uint8_t length;
+  uint8_t lead;                // bytes before the checksummed part (status bytes)
+  uint8_t data[EWC_MAX_FRAME]; // whole frame, including lead bytes, ETX and checksum
+  uint32_t receivedMs;         // time the last byte arrived (set by the caller)
+} EwcFrame;
+
+typedef struct {
+  uint8_t length;
+  uint8_t data[EWC_MAX_FRAME];
+  uint8_t prefixXor[EWC_MAX_LEAD + 1]; // XOR of the first n bytes, for n = 0..EWC_MAX_LEAD
+  uint8_t runningXor;   // XOR of data[0..length-1]
+  uint8_t lastWasEtx;
+  uint32_t overflows;   // partial frames dropped because they were too long
+} EwcFramer;
+
+// Clear the framer, dropping any partial frame
+void ewcFramerReset(EwcFramer* f);
+
+// Add one byte. Returns true and fills 'out' if this byte completes a frame.
+bool ewcFramerPush(EwcFramer* f, uint8_t b, EwcFrame* out);
+
+// True if bytes of an incomplete frame are held
+bool ewcFramerHasPartial(const EwcFramer* f);
+
+// XOR checksum of a message body (including ETX)
+uint8_t ewcChecksum(const uint8_t* data, int length);
+
+#endif
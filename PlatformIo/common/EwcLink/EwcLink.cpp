@@ -0,0 +1,117 @@
+// The UART driver needs the ESP32. EwcFramer.cpp, the rest of this library, also builds
+// on the host (for the native tests and tools), so this is left out there.
+#ifdef ARDUINO
+
+#include "EwcLink.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+static HardwareSerial* _ewcPort = NULL;
+static int _ctsPin = -1;
+static QueueHandle_t _ewcQueue = NULL;
+static EwcFramer _framer;
+static uint32_t _lastByteMs = 0;
+static volatile bool _ctsActive = false;
+static EwcLinkStats _stats;          // written by the UART event task only
+static volatile uint32_t _ctsDrops = 0; // written by the CTS interrupt only, so the two never race
+
+// CTS edge. Runs in interrupt context
+static void IRAM_ATTR onCtsEdge() {
+  bool active = !digitalRead(_ctsPin); // active low
+  if (active == _ctsActive) return;    // bounce
+  _ctsActive = active;
+
+  EwcEvent event;
+  event.type = active ? EWC_EVENT_CTS_ON : EWC_EVENT_CTS_OFF;
+  event.frame.length = 0;
+
+  BaseType_t woken = pdFALSE;
+  if (xQueueSendFromISR(_ewcQueue, &event, &woken) != pdTRUE) _ctsDrops++;
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// UART receive event. Runs in the UART driver's event task, when the RX FIFO
+// fills or the line has been idle for EWC_RX_TIMEOUT_SYMBOLS characters.
+static void onUartReceive() {
+  static EwcEvent event; // only used from this task, and too big for its stack
+  uint8_t buf[64];
+
+  while (_ewcPort->available() > 0) {
+    int count = _ewcPort->read(buf, sizeof(buf));
+    if (count <= 0) break;
+
+    uint32_t now = millis();
+    if (ewcFramerHasPartial(&_framer) && now - _lastByteMs > EWC_FRAME_GAP_MS) {
+      ewcFramerReset(&_framer); // stale partial frame
+      _stats.gapResets++;
+    }
+    _lastByteMs = now;
+    _stats.bytes += count;
+
+    for (int i = 0; i < count; i++) {
+      if (!ewcFramerPush(&_framer, buf[i], &event.frame)) continue;
+
+      event.type = EWC_EVENT_FRAME;
+      event.frame.receivedMs = now;
+      if (xQueueSend(_ewcQueue, &event, 0) == pdTRUE) _stats.frames++;
+      else _stats.queueDrops++; // never block the UART task
+    }
+  }
+  _stats.overflows = _framer.overflows;
+}
+
+bool ewcLinkBegin(HardwareSerial* port, unsigned long baud, int rxPin, int txPin, int ctsPin, int queueDepth) {
+  _ewcQueue = xQueueCreate(queueDepth, sizeof(EwcEvent));
+  if (_ewcQueue == NULL) return false;
+
+  memset(&_stats, 0, sizeof(_stats));
+  _ctsDrops = 0;
+  memset(&_framer, 0, sizeof(_framer));
+  ewcFramerReset(&_framer);
+
+  _ewcPort = port;
+  _ctsPin = ctsPin;
+  pinMode(txPin, OUTPUT);
+  pinMode(rxPin, INPUT);
+  pinMode(ctsPin, INPUT);
+  _ctsActive = !digitalRead(ctsPin);
+
+  port->begin(baud, SERIAL_8N1, rxPin, txPin);
+  port->setRxTimeout(EWC_RX_TIMEOUT_SYMBOLS);
+  port->onReceive(onUartReceive, false);
+  attachInterrupt(digitalPinToInterrupt(ctsPin), onCtsEdge, CHANGE);
+  return true;
+}
+
+bool ewcLinkWait(EwcEvent* event, uint32_t timeoutMs) {
+  if (_ewcQueue == NULL) return false;
+  TickType_t ticks = timeoutMs == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+  return xQueueReceive(_ewcQueue, event, ticks) == pdTRUE;
+}
+
+bool ewcLinkWake() {
+  if (_ewcQueue == NULL) return false;
+  EwcEvent event;
+  event.type = EWC_EVENT_WAKE;
+  event.frame.length = 0;
+  return xQueueSend(_ewcQueue, &event, 0) == pdTRUE;
+}
+
+bool ewcCtsActive() {
+  return _ctsActive;
+}
+
+bool ewcLinkSend(const uint8_t* data, int length) {
+  if (_ewcPort == NULL || !_ctsActive) return false;
+  _ewcPort->write(data, length);
+  return true;
+}
+
+EwcLinkStats ewcLinkStats() {
+  EwcLinkStats stats = _stats;
+  stats.queueDrops += _ctsDrops;
+  return stats;
+}
+
+#endif
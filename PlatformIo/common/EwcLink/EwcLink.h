@@ -0,0 +1,56 @@
+#ifndef EWC_LINK_H
+#define EWC_LINK_H
+
+#include <Arduino.h>
+#include "EwcFramer.h"
+
+// Interrupt-driven link to the EWC over a UART with a CTS line.
+// Bytes are gathered by the UART driver's receive events (not by polling),
+// framed and checksum-checked, and complete frames are handed to a queue.
+// CTS edges come from a GPIO interrupt and go into the same queue, so the
+// consumer can block on ewcLinkWait() and the CPU idles between events.
+
+#define EWC_FRAME_GAP_MS 20     // a pause this long between bytes drops any partial frame
+#define EWC_RX_TIMEOUT_SYMBOLS 3 // UART idle time (in characters) before we are told about waiting bytes
+
+enum EwcEventType {
+  EWC_EVENT_FRAME = 0,  // a complete, checksum-verified frame
+  EWC_EVENT_CTS_ON = 1, // EWC is ready to receive
+  EWC_EVENT_CTS_OFF = 2,
+  EWC_EVENT_WAKE = 3    // posted by ewcLinkWake(), no data
+};
+
+typedef struct {
+  uint8_t type;   // EwcEventType
+  EwcFrame frame; // valid for EWC_EVENT_FRAME
+} EwcEvent;
+
+typedef struct {
+  uint32_t frames;      // frames delivered to the queue
+  uint32_t queueDrops;  // frames or edges lost because the queue was full
+  uint32_t gapResets;   // partial frames dropped after a gap
+  uint32_t overflows;   // partial frames dropped for being too long
+  uint32_t bytes;       // bytes received
+} EwcLinkStats;
+
+// Start the link. CTS is active low. queueDepth is the number of events that can wait for the consumer.
+// Returns false if the queue could not be created.
+bool ewcLinkBegin(HardwareSerial* port, unsigned long baud, int rxPin, int txPin, int ctsPin, int queueDepth);
+
+// Wait up to 'timeoutMs' for the next frame or CTS change. Returns false on timeout.
+bool ewcLinkWait(EwcEvent* event, uint32_t timeoutMs);
+
+// Wake the consumer from another task (for example, when there are messages for it to send).
+// Returns false if the queue is full; the consumer is busy anyway in that case.
+bool ewcLinkWake();
+
+// Current CTS state (true = EWC is ready to receive)
+bool ewcCtsActive();
+
+// Send a message to the EWC. Fails without sending if CTS is not active.
+bool ewcLinkSend(const uint8_t* data, int length);
+
+// Copy of the link counters
+EwcLinkStats ewcLinkStats();
+
+#endif
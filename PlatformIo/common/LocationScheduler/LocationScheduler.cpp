@@ -0,0 +1,260 @@
+#include "LocationScheduler.h"
+
+#include <string.h>
+
+#if defined(ARDUINO) || defined(ESP_PLATFORM) // Arduino or ESP-IDF
+#include <esp_attr.h>
+#else
+#define RTC_DATA_ATTR // host builds have no RTC memory
+#endif
+
+#define LOC_MAGIC 0x10CA
+#define METRES_PER_DEGREE_E6 111195 // millimetres per 1000 micro-degrees of latitude
+
+// Scheduler state survives deep sleep
+RTC_DATA_ATTR static uint16_t _locMagic;
+RTC_DATA_ATTR static uint8_t _locHaveReport;
+RTC_DATA_ATTR static int32_t _locReportLatE6;
+RTC_DATA_ATTR static int32_t _locReportLonE6;
+RTC_DATA_ATTR static int32_t _locReportCourseDd;
+RTC_DATA_ATTR static uint32_t _locReportTimeS;
+RTC_DATA_ATTR static uint32_t _locReportFenceMask;
+RTC_DATA_ATTR static uint32_t _locLastIntervalS;
+
+static const LocConfig* _locConfig = NULL;
+
+// cos() for 0..90 degrees in 5 degree steps, as Q15 fixed point
+static const uint16_t cosTableQ15[19] = {
+  32768, 32643, 32270, 31651, 30792, 29697, 28378, 26842, 25102, 23170,
+  21063, 18795, 16384, 13848, 11207, 8481, 5690, 2856, 0
+};
+
+static int32_t cosQ15(int32_t latE6) {
+  if (latE6 < 0) latE6 = -latE6;
+  if (latE6 >= 90000000) return 0;
+  int32_t step = latE6 / 5000000;
+  int32_t frac = latE6 % 5000000; // linear interpolation between table steps
+  int32_t a = cosTableQ15[step], b = cosTableQ15[step + 1];
+  return a - (int32_t)((int64_t)(a - b) * frac / 5000000);
+}
+
+static uint32_t isqrt64(uint64_t n) {
+  uint64_t result = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > n) bit >>= 2;
+  while (bit != 0) {
+    if (n >= result + bit) {
+      n -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)result;
+}
+
+int32_t locDistanceM(int32_t lat1E6, int32_t lon1E6, int32_t lat2E6, int32_t lon2E6) {
+  int64_t dLat = (int64_t)lat2E6 - lat1E6;
+  int64_t dLon = (int64_t)lon2E6 - lon1E6;
+  if (dLon > 180000000) dLon -= 360000000; // take the short way round
+  if (dLon < -180000000) dLon += 360000000;
+
+  int32_t meanLat = (int32_t)(((int64_t)lat1E6 + lat2E6) / 2);
+  int64_t dy = dLat * METRES_PER_DEGREE_E6 / 10000; // centimetres, so the squares fit in 64 bits
+  int64_t dx = dLon * METRES_PER_DEGREE_E6 / 10000 * cosQ15(meanLat) / 32768;
+  return (int32_t)(isqrt64((uint64_t)(dx * dx + dy * dy)) / 100);
+}
+
+bool locInFence(const Geofence* fence, int32_t latE6, int32_t lonE6) {
+  if (fence->pointCount == 0) {
+    return locDistanceM(fence->latE6, fence->lonE6, latE6, lonE6) <= fence->radiusM;
+  }
+
+  // Ray casting, with the division replaced by cross-multiplication.
+  // Treats lat/lon as a flat plane, which is fine for fences of a few km.
+  bool inside = false;
+  int n = fence->pointCount > GEOFENCE_MAX_POINTS ? GEOFENCE_MAX_POINTS : fence->pointCount;
+  for (int i = 0, j = n - 1; i < n; j = i++) {
+    int64_t yi = fence->pointsE6[i][0], xi = fence->pointsE6[i][1];
+    int64_t yj = fence->pointsE6[j][0], xj = fence->pointsE6[j][1];
+    if ((yi > latE6) == (yj > latE6)) continue; // edge doesn't cross our latitude
+
+    int64_t lhs = (lonE6 - xi) * (yj - yi);
+    int64_t rhs = (xj - xi) * (latE6 - yi);
+    if ((yj > yi) ? (lhs < rhs) : (lhs > rhs)) inside = !inside;
+  }
+  return inside;
+}
+
+static uint32_t fenceMask(int32_t latE6, int32_t lonE6) {
+  uint32_t mask = 0;
+  if (_locConfig == NULL || _locConfig->fences == NULL) return 0;
+  for (int i = 0; i < _locConfig->fenceCount && i < LOC_MAX_FENCES; i++) {
+    if (locInFence(&_locConfig->fences[i], latE6, lonE6)) mask |= 1UL << i;
+  }
+  return mask;
+}
+
+LocConfig locDefaultConfig() {
+  LocConfig config;
+  config.minIntervalS = 10;
+  config.maxIntervalS = 30 * 60;
+  config.heartbeatS = 6 * 60 * 60;
+  config.reportDistanceM = 250;
+  config.movingSpeedCmS = 100; // about walking pace
+  config.courseChangeDd = 450;
+  config.fences = NULL;
+  config.fenceCount = 0;
+  return config;
+}
+
+void locInit(const LocConfig* config) {
+  _locConfig = config;
+  if (_locMagic == LOC_MAGIC) return; // woke from deep sleep, state is good
+
+  _locMagic = LOC_MAGIC;
+  _locHaveReport = 0;
+  _locReportTimeS = 0;
+  _locReportFenceMask = 0;
+  _locReportCourseDd = -1;
+  _locLastIntervalS = 0;
+}
+
+static uint32_t clampInterval(uint32_t s) {
+  if (s < _locConfig->minIntervalS) return _locConfig->minIntervalS;
+  if (s > _locConfig->maxIntervalS) return _locConfig->maxIntervalS;
+  return s;
+}
+
+LocDecision locUpdate(const GpsFix* fix, uint32_t nowS) {
+  LocDecision d;
+  memset(&d, 0, sizeof(d));
+  if (_locConfig == NULL) return d;
+
+  d.moving = fix->speedCmS >= _locConfig->movingSpeedCmS;
+  d.fenceMask = fenceMask(fix->latE6, fix->lonE6);
+
+  if (!_locHaveReport) {
+    d.report = LOC_REASON_FIRST;
+  } else {
+    d.distanceM = locDistanceM(_locReportLatE6, _locReportLonE6, fix->latE6, fix->lonE6);
+
+    int32_t turn = 0;
+    if (d.moving && fix->courseDd >= 0 && _locReportCourseDd >= 0) {
+      turn = fix->courseDd - _locReportCourseDd;
+      if (turn < 0) turn = -turn;
+      if (turn > 1800) turn = 3600 - turn;
+    }
+
+    if (d.fenceMask != _locReportFenceMask) d.report = LOC_REASON_GEOFENCE;
+    else if (d.distanceM >= _locConfig->reportDistanceM) d.report = LOC_REASON_DISTANCE;
+    else if (turn >= _locConfig->courseChangeDd) d.report = LOC_REASON_COURSE;
+    else if (nowS - _locReportTimeS >= _locConfig->heartbeatS) d.report = LOC_REASON_HEARTBEAT;
+  }
+
+  // Moving: sample often enough to see half the report distance between fixes.
+  // Stationary: back off, doubling the interval each time.
+  uint32_t interval;
+  if (d.moving) {
+    interval = (uint32_t)((int64_t)_locConfig->reportDistanceM * 100 / 2 / fix->speedCmS);
+  } else {
+    interval = _locLastIntervalS < _locConfig->minIntervalS ? _locConfig->minIntervalS : _locLastIntervalS * 2;
+  }
+  interval = clampInterval(interval);
+
+  // Don't sleep through a heartbeat
+  if (_locHaveReport && !d.report) {
+    uint32_t sinceReport = nowS - _locReportTimeS;
+    uint32_t untilHeartbeat = sinceReport >= _locConfig->heartbeatS ? 0 : _locConfig->heartbeatS - sinceReport;
+    if (interval > untilHeartbeat) interval = clampInterval(untilHeartbeat);
+  }
+
+  _locLastIntervalS = interval;
+  d.nextFixS = interval;
+  return d;
+}
+
+void locReported(const GpsFix* fix, uint32_t nowS) {
+  _locHaveReport = 1;
+  _locReportLatE6 = fix->latE6;
+  _locReportLonE6 = fix->lonE6;
+  _locReportCourseDd = fix->courseDd;
+  _locReportTimeS = nowS;
+  _locReportFenceMask = fenceMask(fix->latE6, fix->lonE6);
+}
+
+// Read a decimal number into an integer scaled by 10^decimals. Moves *c past the number.
+static bool readFixed(const char** c, int decimals, int64_t* out) {
+  const char* p = *c;
+  int64_t value = 0;
+  bool negative = false, any = false;
+  int fractionDigits = -1;
+
+  if (*p == '-') { negative = true; p++; }
+  while ((*p >= '0' && *p <= '9') || (*p == '.' && fractionDigits < 0)) {
+    if (*p == '.') {
+      fractionDigits = 0;
+    } else if (fractionDigits < 0 || fractionDigits < decimals) {
+      value = value * 10 + (*p - '0');
+      if (fractionDigits >= 0) fractionDigits++;
+      any = true;
+    }
+    p++;
+  }
+  if (fractionDigits < 0) fractionDigits = 0;
+  while (fractionDigits < decimals) { value *= 10; fractionDigits++; }
+
+  *c = p;
+  *out = negative ? -value : value;
+  return any;
+}
+
+static bool skipComma(const char** c) {
+  if (**c != ',') return false;
+  (*c)++;
+  return true;
+}
+
+// NMEA style (d)ddmm.mmmmm to micro-degrees
+static int32_t nmeaToE6(int64_t ddmmE5) {
+  int64_t degrees = ddmmE5 / 10000000;
+  int64_t minutesE5 = ddmmE5 % 10000000;
+  return (int32_t)(degrees * 1000000 + minutesE5 * 10 / 60);
+}
+
+bool locParseCgpsInfo(const char* reply, GpsFix* fix) {
+  if (reply == NULL) return false;
+  const char* c = strstr(reply, "+CGPSINFO:");
+  if (c == NULL) return false;
+  c += 10;
+  while (*c == ' ') c++;
+
+  int64_t lat, lon, date, time, alt, speed, course;
+  if (!readFixed(&c, 5, &lat) || !skipComma(&c)) return false; // no fix gives ",,,,,,,,"
+  char ns = *c++;
+  if (!skipComma(&c) || !readFixed(&c, 5, &lon) || !skipComma(&c)) return false;
+  char ew = *c++;
+  if (!skipComma(&c) || !readFixed(&c, 0, &date) || !skipComma(&c)) return false;
+  if (!readFixed(&c, 0, &time)) return false;
+  while (*c != ',' && *c != 0) c++; // fractional seconds
+  if (!skipComma(&c)) return false;
+  if (!readFixed(&c, 1, &alt)) alt = 0;
+  skipComma(&c);
+  if (!readFixed(&c, 3, &speed)) speed = 0; // knots
+  skipComma(&c);
+  if (!readFixed(&c, 1, &course)) course = -1;
+
+  if (date <= 0) return false;
+
+  fix->latE6 = nmeaToE6(lat);
+  fix->lonE6 = nmeaToE6(lon);
+  if (ns == 'S') fix->latE6 = -fix->latE6;
+  if (ew == 'W') fix->lonE6 = -fix->lonE6;
+  fix->date = (long)date;
+  fix->time = (long)time;
+  fix->altitudeDm = (int32_t)alt;
+  fix->speedCmS = (int32_t)(speed * 5144 / 100000); // 1 knot = 51.44 cm/s
+  fix->courseDd = (int32_t)course;
+  return true;
+}
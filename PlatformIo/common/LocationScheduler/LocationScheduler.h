@@ -0,0 +1,92 @@
+#ifndef LOCATION_SCHEDULER_H
+#define LOCATION_SCHEDULER_H
+
+#include <stdint.h>
+
+// Motion- and geofence-adaptive GNSS sampling.
+// Each fix is fed to locUpdate(), which decides if the fix is worth uploading,
+// and how long to wait (with GNSS optionally powered off) before the next fix.
+// All maths is integer: positions are in micro-degrees, distances in metres.
+
+// One position fix. Latitude/longitude are in millionths of a degree, negative for S/W
+typedef struct {
+  int32_t latE6;
+  int32_t lonE6;
+  long date;          // ddmmyy, as from the GNSS
+  long time;          // hhmmss, as from the GNSS
+  int32_t altitudeDm; // altitude in decimetres
+  int32_t speedCmS;   // ground speed in cm/s
+  int32_t courseDd;   // course over ground in tenths of a degree (0..3599), or -1 if not known
+} GpsFix;
+
+#define GEOFENCE_MAX_POINTS 8
+
+// A circle (pointCount == 0) or polygon (3..GEOFENCE_MAX_POINTS points) of interest
+typedef struct {
+  int32_t latE6;      // centre, for circles
+  int32_t lonE6;
+  int32_t radiusM;
+  uint8_t pointCount; // polygon vertex count
+  int32_t pointsE6[GEOFENCE_MAX_POINTS][2]; // polygon vertices as {lat, lon}
+} Geofence;
+
+#define GEOFENCE_CIRCLE(lat, lon, radius) { (lat), (lon), (radius), 0, {{0, 0}} }
+
+#define LOC_MAX_FENCES 8
+
+// Tuning for the scheduler
+typedef struct {
+  uint32_t minIntervalS;    // fastest fix rate when moving quickly
+  uint32_t maxIntervalS;    // slowest fix rate when stationary
+  uint32_t heartbeatS;      // always report after this long, even if nothing changed
+  int32_t reportDistanceM;  // report if this far from the last reported point
+  int32_t movingSpeedCmS;   // speed above which we count as moving
+  int32_t courseChangeDd;   // report if moving and course changes by this much (tenths of a degree)
+  const Geofence* fences;   // optional geofences. Crossing any boundary causes a report
+  int fenceCount;
+} LocConfig;
+
+// Why a fix should be reported. Sent with uploads, so only append.
+enum LocReason {
+  LOC_REASON_NONE = 0,      // nothing interesting. Don't upload
+  LOC_REASON_FIRST = 1,     // first fix since power-on
+  LOC_REASON_DISTANCE = 2,  // moved far enough from last report
+  LOC_REASON_GEOFENCE = 3,  // entered or left a geofence
+  LOC_REASON_HEARTBEAT = 4, // long time since last report
+  LOC_REASON_COURSE = 5     // changed direction while moving
+};
+
+typedef struct {
+  uint8_t report;          // LocReason, zero if the fix should not be uploaded
+  uint8_t moving;          // non-zero if we think the device is moving
+  uint32_t fenceMask;      // bit set for each fence the fix is inside
+  uint32_t nextFixS;       // seconds to wait before the next fix
+  int32_t distanceM;       // distance from last reported point
+} LocDecision;
+
+// Set the scheduler tuning. Config is not copied, so it must stay valid.
+// Resets the scheduler state if the device has lost power.
+void locInit(const LocConfig* config);
+
+// Default tuning, with no geofences
+LocConfig locDefaultConfig();
+
+// Decide what to do with a new fix. nowS is any monotonic seconds counter (see ClockManager)
+LocDecision locUpdate(const GpsFix* fix, uint32_t nowS);
+
+// Tell the scheduler a reported fix was really uploaded. Until this is called,
+// the same change will keep being reported.
+void locReported(const GpsFix* fix, uint32_t nowS);
+
+// Read an 'AT+CGPSINFO' reply, like
+// "+CGPSINFO: 5149.48561,N,00301.87739,W,080223,125658.0,114.0,0.0,"
+// Returns true if it contains a valid fix.
+bool locParseCgpsInfo(const char* reply, GpsFix* fix);
+
+// Approximate ground distance in metres between two points (equirectangular, good for < 100km)
+int32_t locDistanceM(int32_t lat1E6, int32_t lon1E6, int32_t lat2E6, int32_t lon2E6);
+
+// Is the point inside the geofence?
+bool locInFence(const Geofence* fence, int32_t latE6, int32_t lonE6);
+
+#endif
@@ -0,0 +1,145 @@
+#include "ModemConfig.h"
+
+#include <Preferences.h>
+
+#define CONFIG_MAGIC 0xC0F1
+#define CONFIG_VERSION 1
+
+#define SETTING_APPLIED 1
+#define SETTING_REJECTED 2
+
+typedef struct {
+  uint32_t keyHash;
+  uint32_t commandHash;
+  uint8_t state;  // SETTING_APPLIED or SETTING_REJECTED
+} CachedSetting;
+
+typedef struct {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t count;
+  ModemIdentity identity;
+  CachedSetting settings[CONFIG_MAX_SETTINGS];
+  uint32_t hash;  // of everything above
+} ConfigCache;
+
+// FNV-1a
+static uint32_t hashBytes(const void* data, size_t length, uint32_t h = 2166136261u){
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static uint32_t hashString(const char* s){
+  return hashBytes(s, strlen(s));
+}
+
+static uint32_t cacheHash(const ConfigCache* cache){
+  return hashBytes(cache, offsetof(ConfigCache, hash));
+}
+
+static bool loadCache(ConfigCache* cache){
+  memset(cache, 0, sizeof(ConfigCache));
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, /*readOnly*/true)) return false;
+  size_t length = prefs.getBytes("cache", cache, sizeof(ConfigCache));
+  prefs.end();
+
+  bool ok = length == sizeof(ConfigCache) && cache->magic == CONFIG_MAGIC && cache->version == CONFIG_VERSION
+         && cache->count <= CONFIG_MAX_SETTINGS && cache->hash == cacheHash(cache);
+  if (!ok) memset(cache, 0, sizeof(ConfigCache));
+  return ok;
+}
+
+static void saveCache(ConfigCache* cache){
+  cache->magic = CONFIG_MAGIC;
+  cache->version = CONFIG_VERSION;
+  cache->hash = cacheHash(cache);
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, /*readOnly*/false)) return;
+  prefs.putBytes("cache", cache, sizeof(ConfigCache));
+  prefs.end();
+}
+
+// Cached entry for a key, or NULL
+static CachedSetting* findSetting(ConfigCache* cache, uint32_t keyHash){
+  for (int i = 0; i < cache->count; i++){
+    if (cache->settings[i].keyHash == keyHash) return &cache->settings[i];
+  }
+  return NULL;
+}
+
+ConfigReport configApply(const ModemIdentity* identity, int identityReads, const ModemSetting* settings, int count, ConfigSendFn send){
+  ConfigReport report = {0, 0, 0, 0, (uint8_t)identityReads, 0, false};
+  if (count > CONFIG_MAX_SETTINGS) count = CONFIG_MAX_SETTINGS;
+
+  report.uncached = count;
+  for (int i = 0; i < count; i++){
+    if (settings[i].persistent) { report.uncached++; break; } // and AT&W
+  }
+
+  ConfigCache cache;
+  bool loaded = loadCache(&cache);
+  if (!loaded || strcmp(cache.identity.imei, identity->imei) != 0 || strcmp(cache.identity.iccid, identity->iccid) != 0){
+    report.identityChanged = true;
+    memset(&cache, 0, sizeof(cache)); // nothing we know applies to this modem
+    snprintf(cache.identity.imei, sizeof(cache.identity.imei), "%s", identity->imei);
+    snprintf(cache.identity.iccid, sizeof(cache.identity.iccid), "%s", identity->iccid);
+  }
+
+  // The cache is rebuilt in the order of 'settings', so removed settings drop out
+  ConfigCache next = cache;
+  next.count = 0;
+
+  bool persistentSent = false;
+  for (int i = 0; i < count; i++){
+    CachedSetting entry = {hashString(settings[i].key), hashString(settings[i].command), 0};
+    const CachedSetting* old = findSetting(&cache, entry.keyHash);
+
+    if (settings[i].persistent && old != NULL && old->commandHash == entry.commandHash){
+      report.skipped++;
+      entry.state = old->state;
+    } else {
+      report.sent++;
+      ConfigSendResult result = send(settings[i].command);
+      if (result == CONFIG_SEND_OK){
+        entry.state = SETTING_APPLIED;
+        if (settings[i].persistent) persistentSent = true;
+      } else if (result == CONFIG_SEND_ERROR){
+        entry.state = SETTING_REJECTED;
+        report.failed++;
+      } else {
+        report.noReply++;
+        continue; // left out of the cache, so it's sent again next time
+      }
+    }
+    if (settings[i].persistent) next.settings[next.count++] = entry; // volatile settings are never skipped, so not cached
+  }
+
+  if (persistentSent){
+    report.sent++;
+    ConfigSendResult result = send("AT&W");
+    if (result != CONFIG_SEND_OK){ // not saved, so send them again next time
+      if (result == CONFIG_SEND_ERROR) report.failed++;
+      else report.noReply++;
+      next.count = 0;
+    }
+  }
+
+  if (report.identityChanged || report.sent > 0) saveCache(&next);
+  return report;
+}
+
+void configForget(){
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, /*readOnly*/false)) return;
+  prefs.remove("cache");
+  prefs.end();
+}
+
+int configFormatReport(char* buf, int bufLength, const ConfigReport* report){
+  int saved = (int)report->uncached - (int)report->sent - (int)report->identityReads;
+  return snprintf(buf, bufLength, "CONFIG,sent=%u,skipped=%u,failed=%u,noreply=%u,identity=%u,saved=%d%s",
+                  (unsigned)report->sent, (unsigned)report->skipped, (unsigned)report->failed, (unsigned)report->noReply,
+                  (unsigned)report->identityReads, saved, report->identityChanged ? ",new-modem-or-sim" : "");
+}
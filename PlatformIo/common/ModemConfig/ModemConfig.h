@@ -0,0 +1,66 @@
+#ifndef MODEM_CONFIG_H
+#define MODEM_CONFIG_H
+
+#include <Arduino.h>
+
+// Cache of the settings we have applied to the modem, kept in ESP32 NVS.
+//
+// Most modem configuration survives a power cycle (saved with AT&W, or in the
+// modem's own storage, like the APN), so sending it on every boot just costs
+// AT round-trips. configApply() compares each wanted setting with what the
+// cache says was applied to this modem and SIM (by IMEI and ICCID), and only
+// sends the ones that differ. Settings the modem rejected with ERROR are
+// remembered too, so a command that always fails isn't retried on every boot.
+// One that got no reply (modem busy, or a timeout) is not cached, so it is
+// sent again next boot.
+//
+// The cache is one NVS blob with a hash over its contents; a torn or old
+// blob, or a different modem or SIM, means everything is sent again.
+
+#define CONFIG_MAX_SETTINGS 8
+#define CONFIG_NVS_NAMESPACE "modemcfg"
+
+// One setting we want the modem to have
+typedef struct {
+  const char* key;      // short unique name, like "ctzu"
+  const char* command;  // full command that applies it, like "AT+CTZU=1". A changed command is sent again
+  bool persistent;      // modem keeps it across power cycles. If false, it's sent every time
+} ModemSetting;
+
+// Which modem and SIM the cache is for
+typedef struct {
+  char imei[20];
+  char iccid[24];
+} ModemIdentity;
+
+typedef struct {
+  uint8_t sent;           // setting commands sent (including AT&W)
+  uint8_t skipped;        // settings already applied, per the cache
+  uint8_t failed;         // sent, and the modem said ERROR (not retried until the command changes)
+  uint8_t noReply;        // sent, with no OK or ERROR back (sent again next boot)
+  uint8_t identityReads;  // round-trips spent reading IMEI and ICCID
+  uint8_t uncached;       // round-trips it would take to send everything, without the cache
+  bool identityChanged;   // different modem or SIM from the cached one (or no cache)
+} ConfigReport;
+
+typedef enum {
+  CONFIG_SEND_OK,
+  CONFIG_SEND_ERROR,     // the modem answered ERROR
+  CONFIG_SEND_NO_REPLY   // no answer in time. Not cached, as it may work next time
+} ConfigSendResult;
+
+// Send a command and wait for OK or ERROR. Supplied by the sketch, so its own logging is used
+typedef ConfigSendResult (*ConfigSendFn)(const char* command);
+
+// Apply the settings that the cache doesn't already have, then save the cache.
+// If any persistent setting was sent, 'AT&W' is sent after them.
+ConfigReport configApply(const ModemIdentity* identity, int identityReads, const ModemSetting* settings, int count, ConfigSendFn send);
+
+// Clear the cache, so everything is sent on the next boot
+void configForget();
+
+// Write a report as one line, like "CONFIG,sent=0,skipped=2,failed=0,noreply=0,identity=2,saved=0".
+// 'saved' is round-trips saved against sending everything (after paying for the identity reads).
+int configFormatReport(char* buf, int bufLength, const ConfigReport* report);
+
+#endif
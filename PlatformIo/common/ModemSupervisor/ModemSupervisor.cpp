@@ -0,0 +1,193 @@
+#include "ModemSupervisor.h"
+
+#include <esp_idf_version.h>
+#include <esp_task_wdt.h>
+
+static SupervisorConfig _config = {NULL, -1, -1, -1, 0};
+static bool _watching = false;
+static RecoveryStats _stats[RECOVERY_TIER_COUNT];
+
+bool supervisorBegin(const SupervisorConfig* config){
+  _config = *config;
+  memset(_stats, 0, sizeof(_stats));
+  if (_config.watchdogS == 0) return true;
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_task_wdt_config_t wdt = {_config.watchdogS * 1000, 1 << 0, true}; // timeout, idle task of core 0 (as Arduino does), panic
+  esp_err_t err = esp_task_wdt_reconfigure(&wdt);
+#else
+  esp_err_t err = esp_task_wdt_init(_config.watchdogS, true); // panic, so a hang resets the ESP32
+#endif
+  if (err == ESP_OK) err = esp_task_wdt_add(NULL);
+  _watching = err == ESP_OK;
+  if (!_watching) Serial.printf("Supervisor: could not start task watchdog (%d)\r\n", (int)err);
+  return _watching;
+}
+
+void supervisorFeed(){
+  if (_watching) esp_task_wdt_reset();
+}
+
+// Throw away anything waiting, so a late reply isn't taken as the answer to the next command
+static void flushInput(){
+  while (_config.at->available()) _config.at->read();
+}
+
+// Wait for 'OK' or 'ERROR'. Returns true on 'OK'
+static bool waitForOk(uint32_t timeoutMs){
+  char last[2] = {0, 0};
+  uint32_t start = millis();
+  while (millis() - start < timeoutMs){
+    while (_config.at->available()){
+      char c = (char)_config.at->read();
+      if (last[1] == 'O' && c == 'K') return true;
+      if (last[0] == 'R' && last[1] == 'O' && c == 'R') return false; // end of "ERROR"
+      last[0] = last[1];
+      last[1] = c;
+    }
+    delay(5);
+  }
+  return false;
+}
+
+// Send a command and wait for 'OK'
+static bool command(const char* cmd, uint32_t timeoutMs){
+  flushInput();
+  _config.at->print(cmd);
+  _config.at->print("\r");
+  return waitForOk(timeoutMs);
+}
+
+bool modemProbe(){
+  if (_config.at == NULL) return false;
+  for (int i = 0; i < 2; i++){
+    if (command("AT", SUPERVISOR_PROBE_MS)) return true;
+  }
+  return false;
+}
+
+// Keep probing while the modem boots
+static bool waitForBoot(){
+  uint32_t start = millis();
+  while (millis() - start < SUPERVISOR_BOOT_WAIT_MS){
+    supervisorFeed();
+    if (modemProbe()) return true;
+    delay(500);
+  }
+  return false;
+}
+
+// Do the recovery step for one tier. Returns true if the modem answers afterwards
+static bool runTier(RecoveryTier tier){
+  switch (tier){
+    case RECOVERY_RESYNC:
+      for (int i = 0; i < 5; i++){
+        flushInput();
+        if (modemProbe()) return true;
+        delay(100);
+      }
+      return false;
+
+    case RECOVERY_ESCAPE: // needs a second of silence either side of '+++'
+      delay(1100);
+      _config.at->print("+++");
+      delay(1100);
+      return modemProbe();
+
+    case RECOVERY_CFUN:
+      command("AT+CFUN=0", 10000); // minimum functionality: radio off
+      supervisorFeed();
+      command("AT+CFUN=1", 10000);
+      supervisorFeed();
+      return modemProbe();
+
+    case RECOVERY_SOFT_RESET:
+      command("AT+CRESET", 2000);
+      delay(2000); // modem goes quiet while it restarts
+      return waitForBoot();
+
+    case RECOVERY_POWER_CYCLE:
+      if (_config.enablePin >= 0){
+        pinMode(_config.enablePin, OUTPUT);
+        digitalWrite(_config.enablePin, HIGH);
+      }
+      if (_config.resetPin >= 0){ // same pulse as a cold start
+        pinMode(_config.resetPin, OUTPUT);
+        digitalWrite(_config.resetPin, HIGH);
+        delay(3000);
+        digitalWrite(_config.resetPin, LOW);
+        supervisorFeed();
+      }
+      if (_config.powerPin >= 0){
+        pinMode(_config.powerPin, OUTPUT);
+        digitalWrite(_config.powerPin, LOW);
+        delay(100);
+        digitalWrite(_config.powerPin, HIGH);
+        delay(1000);
+        digitalWrite(_config.powerPin, LOW);
+      }
+      return waitForBoot();
+
+    default:
+      return false;
+  }
+}
+
+RecoveryTier modemRecover(RecoveryTier firstTier){
+  if (_config.at == NULL) return RECOVERY_FAILED;
+  if (firstTier <= RECOVERY_NONE){
+    if (modemProbe()) return RECOVERY_NONE;
+    firstTier = RECOVERY_RESYNC;
+  }
+
+  uint32_t start = millis();
+  for (int t = firstTier; t < RECOVERY_FAILED; t++){
+    RecoveryTier tier = (RecoveryTier)t;
+    supervisorFeed();
+    Serial.printf("Supervisor: trying %s\r\n", recoveryTierName(tier));
+    _stats[tier].attempts++;
+
+    if (runTier(tier)){
+      uint32_t took = millis() - start;
+      _stats[tier].fixed++;
+      _stats[tier].lastMs = took;
+      _stats[tier].totalMs += took;
+      if (took > _stats[tier].worstMs) _stats[tier].worstMs = took;
+      Serial.printf("Supervisor: modem recovered by %s after %ums\r\n", recoveryTierName(tier), (unsigned)took);
+      flushInput();
+      return tier;
+    }
+  }
+
+  _stats[RECOVERY_FAILED].attempts++;
+  Serial.printf("Supervisor: modem did not recover after %ums\r\n", (unsigned)(millis() - start));
+  return RECOVERY_FAILED;
+}
+
+const char* recoveryTierName(RecoveryTier tier){
+  switch (tier){
+    case RECOVERY_NONE: return "none";
+    case RECOVERY_RESYNC: return "resync";
+    case RECOVERY_ESCAPE: return "escape";
+    case RECOVERY_CFUN: return "cfun";
+    case RECOVERY_SOFT_RESET: return "soft-reset";
+    case RECOVERY_POWER_CYCLE: return "power-cycle";
+    case RECOVERY_FAILED: return "failed";
+    default: return "?";
+  }
+}
+
+const RecoveryStats* recoveryStats(RecoveryTier tier){
+  if (tier < 0 || tier >= RECOVERY_TIER_COUNT) return NULL;
+  return &_stats[tier];
+}
+
+void supervisorPrintStats(){
+  for (int t = RECOVERY_RESYNC; t < RECOVERY_TIER_COUNT; t++){
+    const RecoveryStats* s = &_stats[t];
+    if (s->attempts == 0) continue;
+    Serial.printf("RECOVERY,%s,attempts=%u,fixed=%u,lastMs=%u,avgMs=%u,worstMs=%u\r\n", recoveryTierName((RecoveryTier)t),
+                  (unsigned)s->attempts, (unsigned)s->fixed, (unsigned)s->lastMs,
+                  (unsigned)(s->fixed > 0 ? s->totalMs / s->fixed : 0), (unsigned)s->worstMs);
+  }
+}
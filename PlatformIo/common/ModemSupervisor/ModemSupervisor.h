@@ -0,0 +1,81 @@
+#ifndef MODEM_SUPERVISOR_H
+#define MODEM_SUPERVISOR_H
+
+#include <Arduino.h>
+
+// Hung-modem detection and tiered recovery for the SIMCOM module.
+//
+// modemProbe() sends a bare 'AT' and waits a short time for 'OK', so a stuck
+// modem is found in well under a second instead of after a full command retry
+// loop. modemRecover() then works up the tiers, cheapest first, and stops as
+// soon as a probe is answered:
+//
+//   1 re-sync      flush the UART and repeat 'AT' (lost baud sync, half-read replies)
+//   2 escape       '+++' with guard times (stuck in data/transparent mode)
+//   3 CFUN cycle   'AT+CFUN=0' then 'AT+CFUN=1' (radio stack wedged, AT still alive)
+//   4 soft reset   'AT+CRESET', then wait for boot
+//   5 power cycle  RESET and PWRKEY pins, then wait for boot
+//
+// Each tier's attempts and time-to-recover are kept, and printed as
+// 'RECOVERY,...' lines. The calling task is added to the task watchdog, so if
+// recovery (or anything else) blocks for longer than the watchdog period the
+// ESP32 is reset as a last resort. Call supervisorFeed() in long waits.
+
+// Recovery steps, cheapest first. Values are logged, so only append.
+enum RecoveryTier {
+  RECOVERY_NONE = 0,         // modem answered the first probe; nothing done
+  RECOVERY_RESYNC = 1,
+  RECOVERY_ESCAPE = 2,
+  RECOVERY_CFUN = 3,
+  RECOVERY_SOFT_RESET = 4,
+  RECOVERY_POWER_CYCLE = 5,
+  RECOVERY_FAILED = 6        // nothing worked. The caller decides what next (like ESP.restart)
+};
+#define RECOVERY_TIER_COUNT 7
+
+#define SUPERVISOR_PROBE_MS 300       // 'AT' is answered in a few ms by a healthy modem
+#define SUPERVISOR_BOOT_WAIT_MS 20000 // after a reset or power cycle, keep probing this long
+#define SUPERVISOR_WATCHDOG_S 60      // default task watchdog period
+
+typedef struct {
+  HardwareSerial* at;  // SIMCOM UART, already started
+  int powerPin;        // PWRKEY
+  int resetPin;        // RESET, or -1 to skip the reset pulse (if the pin is shared)
+  int enablePin;       // modem enable line, or -1
+  uint32_t watchdogS;  // task watchdog period, or 0 to not use the watchdog
+} SupervisorConfig;
+
+typedef struct {
+  uint32_t attempts;  // times this tier was tried
+  uint32_t fixed;     // times the modem answered after this tier
+  uint32_t lastMs;    // time from the start of recovery to the answer, the last time this tier worked
+  uint32_t worstMs;
+  uint32_t totalMs;   // sum of time-to-recover when this tier worked, for the average
+} RecoveryStats;
+
+// Remember the modem wiring, and add the calling task to the task watchdog.
+// Config is copied.
+bool supervisorBegin(const SupervisorConfig* config);
+
+// Feed the task watchdog. Call in any wait loop that might take a while
+void supervisorFeed();
+
+// Send 'AT' and wait up to SUPERVISOR_PROBE_MS for 'OK'. Tries twice.
+bool modemProbe();
+
+// Work up the tiers from 'firstTier' until the modem answers a probe.
+// Returns the tier that worked, RECOVERY_NONE if the modem answered straight
+// away, or RECOVERY_FAILED. Tiers from RECOVERY_CFUN up lose modem state (open
+// sessions, GNSS power), so the caller must set those up again.
+RecoveryTier modemRecover(RecoveryTier firstTier);
+
+// Name of a tier, like "cfun"
+const char* recoveryTierName(RecoveryTier tier);
+
+// Counters for one tier
+const RecoveryStats* recoveryStats(RecoveryTier tier);
+
+// Print one 'RECOVERY,...' line per tier that has been tried
+void supervisorPrintStats();
+
+#endif
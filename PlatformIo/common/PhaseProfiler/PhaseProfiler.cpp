@@ -0,0 +1,146 @@
+#include "PhaseProfiler.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#define PROFILE_MAGIC 0x5046 // 'PF'
+#define PROFILE_VERSION 1
+
+// Ring buffer state lives in RTC slow memory, so it survives deep sleep.
+// It is lost on power-on reset, which we detect with the magic number.
+RTC_DATA_ATTR static uint16_t _profMagic;
+RTC_DATA_ATTR static uint16_t _profCycle;
+RTC_DATA_ATTR static uint16_t _profHead;     // next slot to write
+RTC_DATA_ATTR static uint16_t _profPending;  // records not yet uploaded
+RTC_DATA_ATTR static uint16_t _profDropped;  // records overwritten before upload
+RTC_DATA_ATTR static ProfileRecord _profRing[PROFILE_RING_SIZE];
+
+// Open spans only matter within a single wake, so these are normal RAM
+static int _batPin = -1;
+static uint16_t _modemMv = 0;
+static int64_t _openStartUs[PHASE_COUNT];
+static uint16_t _openBatMv[PHASE_COUNT];
+
+// Battery sense is behind a 1:1 divider on the T-SIM board
+static uint16_t readBatteryMv() {
+  if (_batPin < 0) return 0;
+  return (uint16_t)(analogReadMilliVolts(_batPin) * 2);
+}
+
+static void storeRecord(ProfilePhase phase, uint8_t flags, int64_t startUs, int64_t endUs, uint16_t batStart, uint16_t batEnd) {
+  ProfileRecord* r = &_profRing[_profHead];
+  r->cycle = _profCycle;
+  r->phase = (uint8_t)phase;
+  r->flags = flags;
+  r->startMs = (uint32_t)(startUs / 1000);
+  r->durationUs = (uint32_t)(endUs - startUs);
+  r->batStartMv = batStart;
+  r->batEndMv = batEnd;
+  r->modemMv = _modemMv;
+
+  _profHead = (_profHead + 1) % PROFILE_RING_SIZE;
+  if (_profPending < PROFILE_RING_SIZE) _profPending++;
+  else _profDropped++; // oldest un-sent record was overwritten
+}
+
+void profilerInit(int batAdcPin) {
+  int64_t now = esp_timer_get_time(); // time since reset is our boot span
+
+  if (_profMagic != PROFILE_MAGIC) { // cold start, RTC memory is not valid
+    _profMagic = PROFILE_MAGIC;
+    _profCycle = 0;
+    _profHead = 0;
+    _profPending = 0;
+    _profDropped = 0;
+  }
+  _profCycle++;
+
+  _batPin = batAdcPin;
+  _modemMv = 0;
+  for (int i = 0; i < PHASE_COUNT; i++) _openStartUs[i] = -1;
+
+  uint16_t bat = readBatteryMv();
+  storeRecord(PHASE_BOOT, PROFILE_FLAG_OK, 0, now, bat, bat);
+}
+
+void profileStart(ProfilePhase phase) {
+  if (phase >= PHASE_COUNT) return;
+  _openBatMv[phase] = readBatteryMv();
+  _openStartUs[phase] = esp_timer_get_time();
+}
+
+void profileEnd(ProfilePhase phase, bool ok) {
+  if (phase >= PHASE_COUNT || _openStartUs[phase] < 0) return;
+  int64_t now = esp_timer_get_time();
+  storeRecord(phase, ok ? PROFILE_FLAG_OK : 0, _openStartUs[phase], now, _openBatMv[phase], readBatteryMv());
+  _openStartUs[phase] = -1;
+}
+
+void profileMark(ProfilePhase phase) {
+  if (phase >= PHASE_COUNT) return;
+  int64_t now = esp_timer_get_time();
+  uint16_t bat = readBatteryMv();
+  storeRecord(phase, PROFILE_FLAG_OK | PROFILE_FLAG_MARK, now, now, bat, bat);
+}
+
+void profileSetModemMv(int millivolts) {
+  if (millivolts < 0 || millivolts > 0xFFFF) millivolts = 0;
+  _modemMv = (uint16_t)millivolts;
+}
+
+int profilePending() {
+  return _profPending;
+}
+
+bool profileUploadDue() {
+  return _profPending >= PROFILE_UPLOAD_AT;
+}
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t* p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+
+int profileWriteSummary(uint8_t* buf, int bufLength) {
+  int fit = (bufLength - PROFILE_HEADER_BYTES) / PROFILE_RECORD_BYTES;
+  if (fit < 1 || _profPending < 1) return 0;
+  int count = _profPending < fit ? _profPending : fit;
+
+  // Header: magic, version, record size, current cycle, dropped count, record count
+  put16(buf, PROFILE_MAGIC);
+  buf[2] = PROFILE_VERSION;
+  buf[3] = PROFILE_RECORD_BYTES;
+  put16(buf + 4, _profCycle);
+  put16(buf + 6, _profDropped);
+  put16(buf + 8, (uint16_t)count);
+
+  // Oldest waiting record first
+  int idx = (_profHead + PROFILE_RING_SIZE - _profPending) % PROFILE_RING_SIZE;
+  uint8_t* p = buf + PROFILE_HEADER_BYTES;
+  for (int i = 0; i < count; i++) {
+    ProfileRecord* r = &_profRing[idx];
+    put16(p, r->cycle);
+    p[2] = r->phase;
+    p[3] = r->flags;
+    put32(p + 4, r->startMs);
+    put32(p + 8, r->durationUs);
+    put16(p + 12, r->batStartMv);
+    put16(p + 14, r->batEndMv);
+    put16(p + 16, r->modemMv);
+    put16(p + 18, 0); // reserved
+    p += PROFILE_RECORD_BYTES;
+    idx = (idx + 1) % PROFILE_RING_SIZE;
+  }
+
+  return PROFILE_HEADER_BYTES + count * PROFILE_RECORD_BYTES;
+}
+
+void profileMarkUploaded(int recordsSent) {
+  if (recordsSent <= 0) return;
+  if (recordsSent > _profPending) recordsSent = _profPending;
+  _profPending -= recordsSent; // sent records were the oldest, so just stop counting them
+  _profDropped = 0;
+}
+
+int profileRecordsInSummary(int summaryLength) {
+  if (summaryLength < PROFILE_HEADER_BYTES) return 0;
+  return (summaryLength - PROFILE_HEADER_BYTES) / PROFILE_RECORD_BYTES;
+}
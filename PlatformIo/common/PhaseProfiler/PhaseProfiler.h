@@ -0,0 +1,79 @@
+#ifndef PHASE_PROFILER_H
+#define PHASE_PROFILER_H
+
+#include <stdint.h>
+
+// Per-phase latency and energy profiler.
+// Spans are timed with esp_timer, tagged with battery voltage samples,
+// and stored in a small ring buffer in RTC memory so they survive deep sleep.
+// The ring is uploaded as a compact binary summary (see profileWriteSummary)
+// and decoded on the server side by UdpHook's ProfileDecoder.
+
+// Phases of a wake cycle. Values are part of the upload format, so only append.
+enum ProfilePhase {
+  PHASE_BOOT = 0,        // reset to start of setup()
+  PHASE_MODEM_POWER = 1, // enable/reset/power pin sequence and boot delay
+  PHASE_PB_DONE = 2,     // waiting for the modem 'PB DONE' message
+  PHASE_NET_ATTACH = 3,  // waiting for packet domain attach
+  PHASE_NET_OPEN = 4,    // AT+NETOPEN and socket open
+  PHASE_SEND = 5,        // pushing a message to the modem
+  PHASE_ACK = 6,         // waiting for the server reply
+  PHASE_GNSS_FIX = 7,    // GNSS power-on to first valid fix
+  PHASE_SLEEP_ENTRY = 8, // instant mark just before deep sleep
+  PHASE_COUNT
+};
+
+#define PROFILE_RING_SIZE 64      // records held in RTC memory (20 bytes each)
+#define PROFILE_RECORD_BYTES 20   // size of one record in the upload format
+#define PROFILE_HEADER_BYTES 10   // size of the upload header
+#define PROFILE_UPLOAD_AT 32      // upload once this many records are waiting
+
+#define PROFILE_FLAG_OK 0x01      // span completed successfully
+#define PROFILE_FLAG_MARK 0x02    // instant mark rather than a span
+
+// One completed span
+typedef struct {
+  uint16_t cycle;       // wake cycle counter (increments each boot)
+  uint8_t phase;        // ProfilePhase
+  uint8_t flags;        // PROFILE_FLAG_*
+  uint32_t startMs;     // span start, ms since this boot
+  uint32_t durationUs;  // span length in microseconds
+  uint16_t batStartMv;  // BAT_ADC voltage at span start
+  uint16_t batEndMv;    // BAT_ADC voltage at span end
+  uint16_t modemMv;     // last AT+CBC reading (0 if not known)
+} ProfileRecord;
+
+// Call first thing in setup(). Records the boot span, and bumps the cycle counter.
+// batAdcPin is the battery sense pin (BAT_ADC, pin 35 on the T-SIM)
+void profilerInit(int batAdcPin);
+
+// Start timing a phase. Starting an already open phase restarts it.
+void profileStart(ProfilePhase phase);
+
+// Stop timing a phase, and store the span in the ring. Ignored if the phase was not started.
+void profileEnd(ProfilePhase phase, bool ok);
+
+// Store an instant mark for a phase (used for sleep entry, where nothing runs after)
+void profileMark(ProfilePhase phase);
+
+// Supply voltage as reported by the modem. Attached to spans stored after this call.
+void profileSetModemMv(int millivolts);
+
+// Number of records waiting to be uploaded
+int profilePending();
+
+// True if enough records are waiting that we should spend data uploading them
+bool profileUploadDue();
+
+// Write the binary summary of all waiting records into buf.
+// Returns bytes written, or zero if buf is too small for the header and at least one record.
+// Records that don't fit are left for the next upload.
+int profileWriteSummary(uint8_t* buf, int bufLength);
+
+// Call once the server has acknowledged a summary. Drops the records that were sent.
+void profileMarkUploaded(int recordsSent);
+
+// Number of records in a summary of the given length
+int profileRecordsInSummary(int summaryLength);
+
+#endif
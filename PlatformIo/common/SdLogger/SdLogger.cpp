@@ -0,0 +1,470 @@
+#include "SdLogger.h"
+
+#include <SD.h>
+#include <SPI.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SDLOG_MOUNT "/sd"
+#define SDLOG_BUFFER_BYTES (SDLOG_BUFFER_SECTORS * SDLOG_SECTOR_BYTES)
+#define SDLOG_PAYLOAD_BYTES (SDLOG_SECTOR_BYTES - SDLOG_SECTOR_HEADER)
+#define SDLOG_MAX_FILES 1000
+
+typedef struct {
+  uint8_t* data;            // DMA capable, so the SPI driver sends it without a copy
+  volatile uint16_t sectors; // sectors sealed
+  volatile bool pending;    // full (or checkpointed), waiting for the writer task
+} SdBuffer;
+
+// Producers fill _buffers[_active] a record at a time, under the lock. The writer
+// task sends pending buffers to the card, oldest first, without the lock.
+static SdBuffer _buffers[2] = {{NULL, 0, false}, {NULL, 0, false}};
+static int _active = 0;
+static uint16_t _sectorUsed = 0;  // payload bytes in the active buffer's open sector
+static uint32_t _sequence = 0;
+static uint32_t _session = 0;
+static SdLogStats _stats;
+static portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Writer task only
+static TaskHandle_t _task = NULL;
+static int _nextWrite = 0;
+static FILE* _file = NULL;
+static char _path[24];
+static uint32_t _filePos = 0;
+static volatile bool _checkpointRequested = false;
+static volatile bool _stopRequested = false;
+
+// ---------------------------------------------------------------------------
+// Producers (under the lock)
+
+// Give the active buffer to the writer, and fill the other one if it is free.
+// Otherwise producers drop records until the writer frees one.
+static void handOver(){
+  _buffers[_active].pending = true;
+  int other = _active ^ 1;
+  if (!_buffers[other].pending) _active = other;
+}
+
+// Finish the open sector: fill in its header and zero the unused payload.
+// Returns true if that filled the buffer, so the writer needs waking.
+static bool sealSector(){
+  SdBuffer* buffer = &_buffers[_active];
+  uint8_t* sector = buffer->data + buffer->sectors * SDLOG_SECTOR_BYTES;
+  sector[0] = 'S';
+  sector[1] = 'L';
+  sector[2] = (uint8_t)_sectorUsed;
+  sector[3] = (uint8_t)(_sectorUsed >> 8);
+  memcpy(sector + 4, &_sequence, 4); // ESP32 and hosts are little-endian
+  memcpy(sector + 8, &_session, 4);
+  memset(sector + SDLOG_SECTOR_HEADER + _sectorUsed, 0, SDLOG_PAYLOAD_BYTES - _sectorUsed);
+  _sequence++;
+  _sectorUsed = 0;
+  buffer->sectors = buffer->sectors + 1;
+  if (buffer->sectors < SDLOG_BUFFER_SECTORS) return false;
+  handOver();
+  return true;
+}
+
+static bool putRecord(uint8_t source, const uint8_t* data, int length){
+  uint32_t start = micros();
+  bool wake = false;
+
+  portENTER_CRITICAL(&_lock);
+  SdBuffer* buffer = &_buffers[_active];
+  if (!buffer->pending && _sectorUsed + SDLOG_RECORD_HEADER + length > SDLOG_PAYLOAD_BYTES){
+    wake = sealSector(); // records never cross a sector
+    buffer = &_buffers[_active];
+  }
+  bool ok = !buffer->pending && buffer->data != NULL;
+  if (ok){
+    uint8_t* p = buffer->data + buffer->sectors * SDLOG_SECTOR_BYTES + SDLOG_SECTOR_HEADER + _sectorUsed;
+    p[0] = source;
+    p[1] = (uint8_t)length;
+    memcpy(p + 2, &start, 4);
+    memcpy(p + SDLOG_RECORD_HEADER, data, length);
+    _sectorUsed += SDLOG_RECORD_HEADER + length;
+    _stats.records++;
+  } else {
+    _stats.dropped++;
+  }
+  uint32_t held = micros() - start;
+  if (held > _stats.worstProducerUs) _stats.worstProducerUs = held;
+  portEXIT_CRITICAL(&_lock);
+
+  if (wake && _task != NULL) xTaskNotifyGive(_task);
+  return ok;
+}
+
+bool sdLogWrite(uint8_t source, const void* data, int length){
+  if (_task == NULL || _stopRequested) return false;
+  const uint8_t* p = (const uint8_t*)data;
+  bool ok = true;
+  do {
+    int n = length > SDLOG_MAX_DATA ? SDLOG_MAX_DATA : length;
+    if (!putRecord(source, p, n)) ok = false;
+    p += n;
+    length -= n;
+  } while (length > 0);
+  return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Writer task
+
+// Open the next free /log_NNN.slg, and allocate all of its clusters now.
+// FatFS grows a file opened for writing when it is seeked past the end.
+// Is sector 'index' of the file part of the capture that starts with 'session' and 'sequence'?
+static bool isLogSector(FILE* f, uint32_t index, uint32_t session, uint32_t sequence){
+  uint8_t header[SDLOG_SECTOR_HEADER];
+  if (fseek(f, index * SDLOG_SECTOR_BYTES, SEEK_SET) != 0 || fread(header, 1, sizeof(header), f) != sizeof(header)) return false;
+  uint32_t s, q;
+  memcpy(&q, header + 4, 4);
+  memcpy(&s, header + 8, 4);
+  return header[0] == 'S' && header[1] == 'L' && s == session && q == sequence + index;
+}
+
+// Bytes of log at the start of a file still at its preallocated size: one whose
+// capture ended without sdLogEnd() (a reset, or power cut). Its sectors run on
+// in sequence up to the end of the log, and nothing after that can continue
+// them, so a binary search finds the end in a few reads.
+static uint32_t usedLength(const char* path){
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return 0;
+  uint32_t used = 0;
+  uint8_t header[SDLOG_SECTOR_HEADER];
+  if (fread(header, 1, sizeof(header), f) == sizeof(header) && header[0] == 'S' && header[1] == 'L'){
+    uint32_t session, sequence;
+    memcpy(&sequence, header + 4, 4);
+    memcpy(&session, header + 8, 4);
+    uint32_t low = 1, high = SDLOG_FILE_BYTES / SDLOG_SECTOR_BYTES; // sectors [0, low) are log; [high, ...) are not
+    while (low < high){
+      uint32_t mid = low + (high - low) / 2;
+      if (isLogSector(f, mid, session, sequence)) low = mid + 1;
+      else high = mid;
+    }
+    used = low * SDLOG_SECTOR_BYTES;
+  }
+  fclose(f);
+  return used;
+}
+
+static bool openNextFile(){
+  for (int i = _stats.file; i < SDLOG_MAX_FILES; i++){
+    struct stat st;
+    snprintf(_path, sizeof(_path), SDLOG_MOUNT "/log_%03d.slg", i);
+    if (stat(_path, &st) == 0){
+      if (st.st_size != SDLOG_FILE_BYTES) continue; // closed properly
+      // Left at full size by the last boot: cut it down to its log, so each boot
+      // doesn't leave another 32 MB behind. If there is no log in it, reuse it.
+      uint32_t used = usedLength(_path);
+      if (used > 0){
+        if (used < SDLOG_FILE_BYTES) truncate(_path, used);
+        continue;
+      }
+    }
+
+    _file = fopen(_path, "wb");
+    if (_file == NULL) break;
+    setvbuf(_file, NULL, _IONBF, 0); // buffers are already whole sectors; don't copy them again
+    if (fseek(_file, SDLOG_FILE_BYTES, SEEK_SET) != 0 || fsync(fileno(_file)) != 0 || fseek(_file, 0, SEEK_SET) != 0){
+      fclose(_file);
+      _file = NULL;
+      remove(_path);
+      break; // card full
+    }
+    _filePos = 0;
+    _stats.file = i;
+    return true;
+  }
+  _stats.errors++;
+  return false;
+}
+
+// Close the file, cutting off the preallocated space that wasn't used
+static void closeFile(){
+  if (_file == NULL) return;
+  fclose(_file);
+  _file = NULL;
+  truncate(_path, _filePos);
+}
+
+static void writeBuffer(const uint8_t* data, uint32_t length){
+  if (_file != NULL && _filePos + length > SDLOG_FILE_BYTES){
+    closeFile();
+    _stats.file++;
+    openNextFile();
+  }
+  if (_file == NULL) return;
+
+  uint32_t start = micros();
+  bool ok = fwrite(data, 1, length, _file) == length;
+  uint32_t us = micros() - start;
+  _filePos += length;
+
+  portENTER_CRITICAL(&_lock);
+  if (ok){
+    _stats.bytes += length;
+    _stats.writes++;
+    _stats.writeUs += us;
+    if (us > _stats.worstWriteUs) _stats.worstWriteUs = us;
+  } else {
+    _stats.errors++;
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+static void writePending(){
+  while (_buffers[_nextWrite].pending){
+    SdBuffer* buffer = &_buffers[_nextWrite];
+    writeBuffer(buffer->data, buffer->sectors * SDLOG_SECTOR_BYTES);
+
+    portENTER_CRITICAL(&_lock);
+    buffer->sectors = 0;
+    buffer->pending = false;
+    if (_buffers[_active].pending) _active = _nextWrite; // producers were dropping; let them in again
+    portEXIT_CRITICAL(&_lock);
+    _nextWrite ^= 1;
+  }
+}
+
+// Send everything buffered, padded to whole sectors, then update the FAT and directory entry
+static void checkpoint(){
+  portENTER_CRITICAL(&_lock);
+  SdBuffer* buffer = &_buffers[_active];
+  if (!buffer->pending){
+    if (_sectorUsed > 0) sealSector();
+    buffer = &_buffers[_active];
+    if (!buffer->pending && buffer->sectors > 0) handOver();
+  }
+  portEXIT_CRITICAL(&_lock);
+  writePending();
+  if (_file == NULL) return;
+
+  uint32_t start = micros();
+  bool ok = fsync(fileno(_file)) == 0;
+  uint32_t us = micros() - start;
+  portENTER_CRITICAL(&_lock);
+  _stats.checkpoints++;
+  if (us > _stats.worstSyncUs) _stats.worstSyncUs = us;
+  if (!ok) _stats.errors++;
+  portEXIT_CRITICAL(&_lock);
+}
+
+static void writerTaskMain(void* arg){
+  uint32_t lastCheckpointMs = millis();
+  for (;;){
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SDLOG_CHECKPOINT_MS));
+    writePending();
+
+    bool stopping = _stopRequested;
+    if (stopping || _checkpointRequested || millis() - lastCheckpointMs >= SDLOG_CHECKPOINT_MS){
+      _checkpointRequested = false;
+      checkpoint();
+      lastCheckpointMs = millis();
+    }
+    if (stopping){
+      closeFile();
+      _task = NULL;
+      vTaskDelete(NULL);
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Start and stop
+
+// Write a test pattern through both buffers and read it back, at one clock
+static bool probeClock(uint32_t hz, int csPin){
+  if (!SD.begin(csPin, SPI, hz, SDLOG_MOUNT, 2, false)) return false;
+
+  const char* path = SDLOG_MOUNT "/probe.slg";
+  uint8_t* out = _buffers[0].data;
+  uint8_t* in = _buffers[1].data;
+  for (int i = 0; i < SDLOG_BUFFER_BYTES; i++) out[i] = (uint8_t)(i * 7 + (i >> 9) + (hz >> 20));
+  memset(in, 0, SDLOG_BUFFER_BYTES);
+
+  bool ok = false;
+  FILE* f = fopen(path, "wb");
+  if (f != NULL){
+    ok = fwrite(out, 1, SDLOG_BUFFER_BYTES, f) == SDLOG_BUFFER_BYTES;
+    ok = fclose(f) == 0 && ok;
+  }
+  if (ok && (f = fopen(path, "rb")) != NULL){
+    ok = fread(in, 1, SDLOG_BUFFER_BYTES, f) == SDLOG_BUFFER_BYTES && memcmp(in, out, SDLOG_BUFFER_BYTES) == 0;
+    fclose(f);
+  }
+  remove(path);
+  if (!ok) SD.end();
+  return ok;
+}
+
+static void freeBuffers(){
+  for (int i = 0; i < 2; i++){
+    portENTER_CRITICAL(&_lock); // a late sdLogWrite() may still be on its way in
+    uint8_t* data = _buffers[i].data;
+    _buffers[i].data = NULL;
+    portEXIT_CRITICAL(&_lock);
+    heap_caps_free(data);
+  }
+}
+
+bool sdLogBegin(int sclkPin, int misoPin, int mosiPin, int csPin, int core){
+  if (_task != NULL) return true;
+  for (int i = 0; i < 2; i++){
+    _buffers[i].data = (uint8_t*)heap_caps_malloc(SDLOG_BUFFER_BYTES, MALLOC_CAP_DMA);
+    _buffers[i].sectors = 0;
+    _buffers[i].pending = false;
+  }
+  if (_buffers[0].data == NULL || _buffers[1].data == NULL){
+    freeBuffers();
+    return false;
+  }
+
+  // Fastest clock that works. The slot's pins go through the GPIO matrix, which
+  // limits how fast the card can be read back, so 40MHz often fails.
+  memset(&_stats, 0, sizeof(_stats));
+  SPI.begin(sclkPin, misoPin, mosiPin, csPin);
+  static const uint32_t clocks[] = SDLOG_CLOCKS_HZ;
+  for (uint32_t hz : clocks){
+    if (probeClock(hz, csPin)){ _stats.clockHz = hz; break; }
+  }
+  if (_stats.clockHz == 0 || !openNextFile()){
+    if (_stats.clockHz != 0) SD.end();
+    freeBuffers();
+    return false;
+  }
+
+  _active = 0;
+  _nextWrite = 0;
+  _sectorUsed = 0;
+  _sequence = 0;
+  _session = esp_random();
+  _checkpointRequested = false;
+  _stopRequested = false;
+  if (xTaskCreatePinnedToCore(writerTaskMain, "sdlog", SDLOG_TASK_STACK, NULL, SDLOG_TASK_PRIORITY, &_task, core) != pdPASS){
+    _task = NULL;
+    closeFile();
+    SD.end();
+    freeBuffers();
+    return false;
+  }
+  return true;
+}
+
+void sdLogCheckpoint(){
+  if (_task == NULL) return;
+  _checkpointRequested = true;
+  xTaskNotifyGive(_task);
+}
+
+void sdLogEnd(){
+  if (_task == NULL) return;
+  _stopRequested = true;
+  xTaskNotifyGive(_task);
+  while (_task != NULL) delay(10); // the task writes what is left, then closes the file
+  SD.end();
+  freeBuffers();
+}
+
+SdLogStats sdLogStats(){
+  portENTER_CRITICAL(&_lock);
+  SdLogStats stats = _stats;
+  portEXIT_CRITICAL(&_lock);
+  return stats;
+}
+
+void sdLogPrintStats(){
+  SdLogStats s = sdLogStats();
+  double mbps = s.writeUs > 0 ? (double)s.bytes / (double)s.writeUs : 0; // bytes per us is MB/s
+  Serial.printf("SDLOG,file=%u,clockMHz=%u,records=%lu,dropped=%lu,MB=%.2f,cardMBps=%.2f,worstWriteMs=%.1f,avgWriteMs=%.1f,worstSyncMs=%.1f,worstProducerUs=%lu,errors=%lu\r\n",
+    (unsigned)s.file, (unsigned)(s.clockHz / 1000000), (unsigned long)s.records, (unsigned long)s.dropped, s.bytes / 1e6, mbps,
+    s.worstWriteUs / 1000.0, s.writes > 0 ? s.writeUs / 1000.0 / s.writes : 0.0, s.worstSyncUs / 1000.0,
+    (unsigned long)s.worstProducerUs, (unsigned long)s.errors);
+}
+
+void sdLogBench(uint32_t ms){
+  if (_task == NULL) return;
+  uint8_t filler[SDLOG_MAX_DATA];
+  for (int i = 0; i < SDLOG_MAX_DATA; i++) filler[i] = (uint8_t)i;
+
+  SdLogStats before = sdLogStats();
+  uint32_t startUs = micros();
+  uint32_t startMs = millis();
+  while (millis() - startMs < ms){
+    if (!sdLogWrite(SDLOG_SOURCE_BENCH, filler, sizeof(filler))) vTaskDelay(1); // let the writer catch up
+  }
+
+  // Wait for the checkpoint, so the figures include getting it all onto the card
+  uint32_t checkpoints = sdLogStats().checkpoints;
+  sdLogCheckpoint();
+  while (sdLogStats().checkpoints == checkpoints && millis() - startMs < ms + 2000) delay(1);
+
+  SdLogStats after = sdLogStats();
+  uint32_t us = micros() - startUs;
+  Serial.printf("SDLOG,bench,ms=%lu,records=%lu,dropped=%lu,MBps=%.2f\r\n", (unsigned long)ms,
+    (unsigned long)(after.records - before.records), (unsigned long)(after.dropped - before.dropped),
+    (double)(after.bytes - before.bytes) / us);
+  sdLogPrintStats();
+}
+
+// ---------------------------------------------------------------------------
+// Print and Stream adapters
+
+size_t SdLogPrint::write(uint8_t b){
+  sdLogWrite(_source, &b, 1);
+  return 1; // drops are counted, and never hold up the writer
+}
+
+size_t SdLogPrint::write(const uint8_t* data, size_t length){
+  sdLogWrite(_source, data, (int)length);
+  return length;
+}
+
+void SdLogStream::emit(){
+  if (_pendingLength > 0) sdLogWrite(_pendingSource, _pending, _pendingLength);
+  _pendingLength = 0;
+}
+
+// Gather a byte into the record for its direction. AT commands end in '\r', replies in "\r\n".
+void SdLogStream::gather(uint8_t source, uint8_t b){
+  if (source != _pendingSource){
+    emit();
+    _pendingSource = source;
+  }
+  _pending[_pendingLength++] = b;
+  if (b == '\n' || (b == '\r' && source == _txSource) || _pendingLength == SDLOG_MAX_DATA) emit();
+}
+
+int SdLogStream::available(){
+  return _inner.available();
+}
+
+int SdLogStream::read(){
+  int c = _inner.read();
+  if (c >= 0) gather(_rxSource, (uint8_t)c);
+  return c;
+}
+
+int SdLogStream::peek(){
+  return _inner.peek();
+}
+
+void SdLogStream::flush(){
+  emit();
+  _inner.flush();
+}
+
+size_t SdLogStream::write(uint8_t b){
+  gather(_txSource, b);
+  return _inner.write(b);
+}
+
+size_t SdLogStream::write(const uint8_t* data, size_t length){
+  for (size_t i = 0; i < length; i++) gather(_txSource, data[i]);
+  return _inner.write(data, length);
+}
@@ -0,0 +1,124 @@
+#ifndef SD_LOGGER_H
+#define SD_LOGGER_H
+
+#include <Arduino.h>
+
+// High-rate logging to the SD card slot, for long captures of GNSS fixes, EWC
+// frames, AT traffic and BinLog records.
+//
+// sdLogWrite() copies a record into one of two sector-aligned RAM buffers, under
+// a spinlock for a few microseconds; it never waits on the card. A writer task
+// sends each full buffer to the card in a single multi-sector write, while
+// producers fill the other one. If both buffers are full, the record is dropped
+// and counted.
+//
+// Each log file is preallocated at SDLOG_FILE_BYTES when it is opened, so writes
+// never grow it and the FAT and directory entry only change at a checkpoint
+// (every SDLOG_CHECKPOINT_MS, or sdLogCheckpoint()). Buffers are only sent as
+// whole 512 byte sectors; a checkpoint pads the last one. A power cut loses at
+// most the data since the last checkpoint. A file left at full size that way is
+// cut down to its log by the next sdLogBegin().
+//
+// The SPI clock is the fastest of SDLOG_CLOCKS_HZ that passes a write and
+// read-back test, as cards and wiring differ.
+//
+// File format (/log_NNN.slg), read by PlatformIo/tools/sdlog_dump.cpp:
+//   512 byte sectors of: 'S','L', u16 payload bytes used, u32 sequence, u32 session,
+//   then records of u8 source, u8 data length, u32 micros(), data.
+// Records never cross a sector. Sequence counts up from zero at sdLogBegin() and
+// carries on into the next file. Session is random for each sdLogBegin(), so stale
+// sectors in preallocated space after the end of the log are easy to tell apart.
+
+#define SDLOG_SECTOR_BYTES 512
+#define SDLOG_SECTOR_HEADER 12
+#define SDLOG_RECORD_HEADER 6
+#define SDLOG_MAX_DATA 255                // longer writes are split over several records
+#define SDLOG_BUFFER_SECTORS 32           // 16 KB per buffer, and two buffers
+#define SDLOG_FILE_BYTES (32UL * 1024 * 1024) // preallocated size of each log file
+#define SDLOG_CHECKPOINT_MS 5000
+#define SDLOG_CLOCKS_HZ {40000000, 26000000, 20000000, 16000000, 10000000, 4000000}
+#define SDLOG_TASK_STACK 4096
+#define SDLOG_TASK_PRIORITY 2             // above BinLog's drain task, below the pipeline tasks
+
+// Record sources
+#define SDLOG_SOURCE_GNSS 1    // GpsFix structs
+#define SDLOG_SOURCE_EWC 2     // raw EWC frames
+#define SDLOG_SOURCE_AT_TX 3   // AT text, ESP32 to modem
+#define SDLOG_SOURCE_AT_RX 4   // AT text, modem to ESP32
+#define SDLOG_SOURCE_BINLOG 5  // BinLog output (binary frames for binlog_decode, or text)
+#define SDLOG_SOURCE_BENCH 6   // sdLogBench() filler
+
+typedef struct {
+  uint32_t records;         // records accepted
+  uint32_t dropped;         // records lost because both buffers were full
+  uint64_t bytes;           // written to the card, including sector headers and padding
+  uint32_t writes;          // buffer writes
+  uint64_t writeUs;         // time spent in buffer writes
+  uint32_t worstWriteUs;
+  uint32_t checkpoints;
+  uint32_t worstSyncUs;     // longest checkpoint metadata update
+  uint32_t worstProducerUs; // longest an sdLogWrite() call held the lock
+  uint32_t errors;          // failed writes or file opens
+  uint32_t clockHz;
+  uint16_t file;            // NNN of the file being written
+} SdLogStats;
+
+// Mount the card, pick the SPI clock, and open the next free /log_NNN.slg.
+// The writer task runs on 'core'. Returns false if there is no usable card.
+bool sdLogBegin(int sclkPin, int misoPin, int mosiPin, int csPin, int core);
+
+// Copy a record into the buffer. Safe from any task. Returns false if it was dropped.
+bool sdLogWrite(uint8_t source, const void* data, int length);
+
+// Ask the writer task to send what is buffered and update the file's metadata now
+void sdLogCheckpoint();
+
+// Write everything buffered, close the file and unmount the card
+void sdLogEnd();
+
+SdLogStats sdLogStats();
+
+// One line: SDLOG,file=..,clock=..,records=..,dropped=..,MB=..,cardMBps=..,...
+void sdLogPrintStats();
+
+// Log filler records as fast as this task can for 'ms', then checkpoint and print the stats.
+// For measuring the card; the capture gets the filler too.
+void sdLogBench(uint32_t ms);
+
+// A Print that logs everything written to it as records of one source.
+// Give it to binlogBegin() to send log records to the card.
+class SdLogPrint : public Print {
+public:
+  explicit SdLogPrint(uint8_t source) : _source(source) {}
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t length) override;
+private:
+  uint8_t _source;
+};
+
+// A Stream that passes everything through to another (the modem UART), and logs
+// the traffic both ways. Bytes are gathered into a record per line, or per
+// change of direction. For use from one task at a time, like the UART itself.
+class SdLogStream : public Stream {
+public:
+  SdLogStream(Stream& inner, uint8_t txSource, uint8_t rxSource)
+    : _inner(inner), _txSource(txSource), _rxSource(rxSource) {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush() override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t length) override;
+  using Print::write;
+private:
+  void gather(uint8_t source, uint8_t b);
+  void emit();
+  Stream& _inner;
+  uint8_t _txSource;
+  uint8_t _rxSource;
+  uint8_t _pendingSource = 0;
+  uint8_t _pendingLength = 0;
+  uint8_t _pending[SDLOG_MAX_DATA];
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// Lock-free single-producer, single-consumer rings and queues.
+//
+//   SpscByteRing<N>          a byte stream
+//   SpscFrameRing<N, Max>    variable length frames (up to Max bytes each), never split across the wrap
+//   SpscQueue<T, N>          fixed-size items, copied in and out (work passed between tasks)
+//
+// The two rings hand out spans into their own storage, so data can be read from a UART
+// straight into the ring (writeSpan/commitWrite) and written out straight from
+// it (readSpan/commitRead), with no copies in between. The producer can be an
+// ISR or driver callback and the consumer a task, or two tasks on different
+// cores; only one of each is allowed.
+//
+// Capacities must be powers of two. Indices run freely and wrap at 2^32; the
+// constructors that take a start index are there so tests can begin just short of the wrap.
+// Each index has its own cache line on the host (no false sharing between
+// threads), and is a plain aligned word on the ESP32, which has no data cache.
+//
+// Everything is forced inline, so calls from an IRAM ISR don't land in flash.
+// No hardware dependencies, so this builds on the host.
+
+#ifdef ARDUINO
+#define SPSC_INDEX_ALIGN 4
+#else
+#define SPSC_INDEX_ALIGN 64
+#endif
+
+#define SPSC_INLINE inline __attribute__((always_inline))
+
+// A contiguous piece of ring storage
+struct SpscSpan {
+  uint8_t* data;
+  uint32_t length;
+};
+
+template <uint32_t Capacity>
+class SpscByteRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscByteRing capacity must be a power of two");
+
+public:
+  SpscByteRing() = default;
+  explicit SpscByteRing(uint32_t startIndex) : _head(startIndex), _tail(startIndex) {}
+
+  // ---- Producer side ----
+
+  // Free space, in bytes
+  SPSC_INLINE uint32_t space() const {
+    return Capacity - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire));
+  }
+
+  // Contiguous free space after the head. May be shorter than space() when the free area wraps.
+  SPSC_INLINE SpscSpan writeSpan() {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t free = Capacity - (head - _tail.load(std::memory_order_acquire));
+    uint32_t offset = head & (Capacity - 1);
+    uint32_t toEnd = Capacity - offset;
+    return SpscSpan{&_data[offset], free < toEnd ? free : toEnd};
+  }
+
+  // Publish 'count' bytes written into the last writeSpan()
+  SPSC_INLINE void commitWrite(uint32_t count) {
+    _head.store(_head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // Copy in as much as fits. Returns bytes written; the rest is counted as dropped.
+  SPSC_INLINE uint32_t write(const uint8_t* src, uint32_t count) {
+    uint32_t written = 0;
+    while (written < count) {
+      SpscSpan span = writeSpan();
+      if (span.length == 0) break;
+      uint32_t n = count - written < span.length ? count - written : span.length;
+      memcpy(span.data, src + written, n);
+      commitWrite(n);
+      written += n;
+    }
+    if (written < count) _dropped.fetch_add(count - written, std::memory_order_relaxed);
+    return written;
+  }
+
+  // ---- Consumer side ----
+
+  // Bytes waiting
+  SPSC_INLINE uint32_t available() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+  }
+
+  // Contiguous waiting bytes after the tail. May be shorter than available() when the data wraps.
+  SPSC_INLINE SpscSpan readSpan() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t used = _head.load(std::memory_order_acquire) - tail;
+    uint32_t offset = tail & (Capacity - 1);
+    uint32_t toEnd = Capacity - offset;
+    return SpscSpan{&_data[offset], used < toEnd ? used : toEnd};
+  }
+
+  // Release 'count' bytes from the last readSpan()
+  SPSC_INLINE void commitRead(uint32_t count) {
+    _tail.store(_tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // Copy out up to 'count' bytes. Returns bytes read
+  SPSC_INLINE uint32_t read(uint8_t* dst, uint32_t count) {
+    uint32_t got = 0;
+    while (got < count) {
+      SpscSpan span = readSpan();
+      if (span.length == 0) break;
+      uint32_t n = count - got < span.length ? count - got : span.length;
+      memcpy(dst + got, span.data, n);
+      commitRead(n);
+      got += n;
+    }
+    return got;
+  }
+
+  // ---- Either side ----
+
+  constexpr uint32_t capacity() const { return Capacity; }
+
+  // Bytes that write() could not fit
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _head{0}; // written by producer
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _tail{0}; // written by consumer
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _dropped{0};
+  alignas(SPSC_INDEX_ALIGN) uint8_t _data[Capacity];
+};
+
+// Frames are stored as a 16-bit length then the bytes, padded to 4-byte boundaries.
+// A frame that won't fit before the end of the storage goes at the start, behind a
+// pad marker, so every frame the consumer sees is one contiguous span.
+template <uint32_t Capacity, uint32_t MaxFrame>
+class SpscFrameRing {
+  static constexpr uint32_t HeaderBytes = 4; // u16 length, u16 spare (keeps frame data word aligned)
+  static constexpr uint16_t PadMarker = 0xFFFF;
+
+  static_assert(Capacity >= 16 && (Capacity & (Capacity - 1)) == 0, "SpscFrameRing capacity must be a power of two");
+  static_assert(MaxFrame > 0 && MaxFrame + HeaderBytes <= Capacity / 2, "SpscFrameRing must hold at least two of the largest frame");
+
+  static constexpr uint32_t slotBytes(uint32_t length) { return (HeaderBytes + length + 3) & ~3u; }
+
+public:
+  SpscFrameRing() = default;
+  // 'startIndex' is rounded down to a 4-byte slot boundary
+  explicit SpscFrameRing(uint32_t startIndex) : _head(startIndex & ~3u), _tail(startIndex & ~3u) {}
+
+  // ---- Producer side ----
+
+  // Get space for a frame of up to 'maxLength' bytes. Returns nullptr (and counts a drop)
+  // if there is no room. Fill it, then call commitFrame() with the real length.
+  SPSC_INLINE uint8_t* beginFrame(uint32_t maxLength) {
+    if (maxLength > MaxFrame) { _dropped.fetch_add(1, std::memory_order_relaxed); return nullptr; }
+
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t free = Capacity - (head - _tail.load(std::memory_order_acquire));
+    uint32_t offset = head & (Capacity - 1);
+    uint32_t toEnd = Capacity - offset;
+    uint32_t need = slotBytes(maxLength);
+
+    if (need > toEnd) { // won't fit before the wrap: pad out the end and start again at zero
+      if (toEnd + need > free) { _dropped.fetch_add(1, std::memory_order_relaxed); return nullptr; }
+      _pendingPad = toEnd;
+      offset = 0;
+    } else {
+      if (need > free) { _dropped.fetch_add(1, std::memory_order_relaxed); return nullptr; }
+      _pendingPad = 0;
+    }
+    return &_data[offset + HeaderBytes];
+  }
+
+  // Publish the frame started by beginFrame(). 'length' must not exceed the maxLength given there.
+  SPSC_INLINE void commitFrame(uint32_t length) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (_pendingPad > 0) {
+      setLength(head & (Capacity - 1), PadMarker);
+      head += _pendingPad;
+    }
+    setLength(head & (Capacity - 1), (uint16_t)length);
+    _frames.fetch_add(1, std::memory_order_relaxed);
+    _head.store(head + slotBytes(length), std::memory_order_release);
+  }
+
+  // Copy a whole frame in. Returns false (counted as a drop) if there's no room
+  SPSC_INLINE bool push(const uint8_t* src, uint32_t length) {
+    uint8_t* dst = beginFrame(length);
+    if (dst == nullptr) return false;
+    memcpy(dst, src, length);
+    commitFrame(length);
+    return true;
+  }
+
+  // Count a frame the producer had to give up on before beginFrame() (it could never fit)
+  SPSC_INLINE void countDrop() { _dropped.fetch_add(1, std::memory_order_relaxed); }
+
+  // ---- Consumer side ----
+
+  // The next frame, without removing it. 'data' is nullptr if there are no frames.
+  SPSC_INLINE SpscSpan peek() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t head = _head.load(std::memory_order_acquire);
+    if (tail == head) return SpscSpan{nullptr, 0};
+
+    uint32_t offset = tail & (Capacity - 1);
+    if (getLength(offset) == PadMarker) { // skip the pad; the frame is at the start
+      tail += Capacity - offset;
+      _tail.store(tail, std::memory_order_release);
+      offset = 0;
+    }
+    return SpscSpan{&_data[offset + HeaderBytes], getLength(offset)};
+  }
+
+  // Remove the frame returned by peek()
+  SPSC_INLINE void pop() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t length = getLength(tail & (Capacity - 1));
+    _tail.store(tail + slotBytes(length), std::memory_order_release);
+    _frames.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Copy the next frame out and remove it. Returns its length, or -1 if there is none or it is
+  // longer than 'maxLength' (in which case it is left in place).
+  SPSC_INLINE int read(uint8_t* dst, uint32_t maxLength) {
+    SpscSpan span = peek();
+    if (span.data == nullptr || span.length > maxLength) return -1;
+    memcpy(dst, span.data, span.length);
+    pop();
+    return (int)span.length;
+  }
+
+  // ---- Either side ----
+
+  // Frames waiting (approximate from outside the producer and consumer)
+  uint32_t count() const { return _frames.load(std::memory_order_relaxed); }
+
+  // Frames that would not fit
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+  SPSC_INLINE void setLength(uint32_t offset, uint16_t length) { memcpy(&_data[offset], &length, 2); }
+  SPSC_INLINE uint16_t getLength(uint32_t offset) const { uint16_t length; memcpy(&length, &_data[offset], 2); return length; }
+
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _head{0}; // written by producer
+  uint32_t _pendingPad = 0;                                  // producer only
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _tail{0}; // written by consumer
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _frames{0};
+  std::atomic<uint32_t> _dropped{0};
+  alignas(SPSC_INDEX_ALIGN) uint8_t _data[Capacity];
+};
+
+// Bounded queue of fixed-size items. The producer only writes 'head', the consumer
+// only writes 'tail', and each side reads the other's index with acquire ordering.
+// Exactly one task may push, and exactly one task may pop.
+template <class T, uint32_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+  SpscQueue() = default;
+  explicit SpscQueue(uint32_t startIndex) : _head(startIndex), _tail(startIndex) {}
+
+  // Producer side. Returns false (and counts a rejection) if the queue is full.
+  bool push(const T& item) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t used = head - _tail.load(std::memory_order_acquire);
+    if (used >= Capacity) {
+      _rejected.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    _items[head & (Capacity - 1)] = item;
+    _head.store(head + 1, std::memory_order_release);
+    if (used + 1 > _highWater.load(std::memory_order_relaxed)) _highWater.store(used + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer side. Returns false if the queue is empty.
+  bool pop(T& out) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) return false;
+    out = _items[tail & (Capacity - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Items waiting. Exact from either side, approximate from anywhere else.
+  uint32_t count() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+  bool full() const { return count() >= Capacity; }
+  uint32_t capacity() const { return Capacity; }
+
+  // Pushes that failed because the queue was full
+  uint32_t rejected() const { return _rejected.load(std::memory_order_relaxed); }
+
+  // Most items ever waiting at once
+  uint32_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+
+private:
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _head{0}; // written by producer
+  alignas(SPSC_INDEX_ALIGN) std::atomic<uint32_t> _tail{0}; // written by consumer
+  std::atomic<uint32_t> _rejected{0};
+  std::atomic<uint32_t> _highWater{0};
+  T _items[Capacity];
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "TaskPipeline.h"
+#include <esp_timer.h>
+
+bool pipelineStart(PipelineTask* task, void* arg){
+  task->handle = NULL;
+  task->activeUs = 0;
+  task->wakes = 0;
+  task->activeSinceUs = esp_timer_get_time();
+  task->reportedActiveUs = 0;
+  task->reportedRunTime = 0;
+
+  BaseType_t ok = xTaskCreatePinnedToCore(task->entry, task->name, task->stackBytes, arg, task->priority, &task->handle, task->core);
+  if (ok != pdPASS){
+    Serial.printf("Failed to start task %s (%u bytes stack)\r\n", task->name, (unsigned)task->stackBytes);
+    return false;
+  }
+  return true;
+}
+
+void pipelineIdleBegin(PipelineTask* task){
+  task->activeUs += (uint32_t)(esp_timer_get_time() - task->activeSinceUs);
+}
+
+void pipelineIdleEnd(PipelineTask* task){
+  task->activeSinceUs = esp_timer_get_time();
+  task->wakes++;
+}
+
+bool pipelineWait(PipelineTask* task, uint32_t timeoutMs){
+  pipelineIdleBegin(task);
+  uint32_t notified = ulTaskNotifyTake(pdTRUE, timeoutMs == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs));
+  pipelineIdleEnd(task);
+  return notified > 0;
+}
+
+void pipelineWake(PipelineTask* task){
+  if (task->handle != NULL) xTaskNotifyGive(task->handle);
+}
+
+// Percent of 'part' in 'whole', without dividing by zero
+static int percentOf(uint64_t part, uint64_t whole){
+  if (whole == 0) return 0;
+  return (int)((part * 100) / whole);
+}
+
+void pipelinePrintStats(PipelineTask** tasks, int count){
+  static int64_t lastReportUs = 0;
+  int64_t now = esp_timer_get_time();
+  uint64_t intervalUs = lastReportUs == 0 ? now : now - lastReportUs;
+  lastReportUs = now;
+
+#if configGENERATE_RUN_TIME_STATS
+  static uint32_t lastTotalRunTime = 0;
+  uint32_t totalRunTime = portGET_RUN_TIME_COUNTER_VALUE(); // the same clock as the tasks' counters
+  uint32_t runTimeInterval = (totalRunTime - lastTotalRunTime) * portNUM_PROCESSORS; // counter is per core
+  lastTotalRunTime = totalRunTime;
+#endif
+
+  for (int i = 0; i < count; i++){
+    PipelineTask* task = tasks[i];
+    if (task->handle == NULL) continue;
+
+    uint32_t active = task->activeUs;
+    int activePercent = percentOf((uint32_t)(active - task->reportedActiveUs), intervalUs);
+    task->reportedActiveUs = active;
+
+    int cpuPercent = -1; // unknown
+#if configGENERATE_RUN_TIME_STATS
+    TaskStatus_t status;
+    vTaskGetInfo(task->handle, &status, pdFALSE, eRunning);
+    cpuPercent = percentOf(status.ulRunTimeCounter - task->reportedRunTime, runTimeInterval);
+    task->reportedRunTime = status.ulRunTimeCounter;
+#endif
+
+    uint32_t freeStack = uxTaskGetStackHighWaterMark(task->handle); // bytes on ESP32
+    uint32_t usedStack = task->stackBytes - freeStack;
+    Serial.printf("TASK,%s,core=%d,prio=%u,active=%d%%,cpu=%d%%,wakes=%u,stack=%u/%u\r\n",
+      task->name, (int)task->core, (unsigned)task->priority, activePercent, cpuPercent,
+      (unsigned)task->wakes, (unsigned)usedStack, (unsigned)task->stackBytes);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef TASK_PIPELINE_H
+#define TASK_PIPELINE_H
+
+#include <Arduino.h>
+#include <SpscRing.h>
+
+// Pinned FreeRTOS tasks that pass work to each other through SpscQueue.
+// A task that empties its queue blocks in pipelineWait(), and the producer
+// wakes it with pipelineWake() after a push (a direct-to-task notification,
+// so no extra queue or semaphore is needed).
+//
+// Each task keeps its own counters: time 'active' (between waits), number of
+// wake-ups, and its stack budget. pipelinePrintStats() reports these with the
+// stack high-water mark, and the CPU share if FreeRTOS run time stats are on.
+
+#define PIPELINE_CORE_PRO 0 // 'protocol' CPU. Free here, as we don't use Wi-Fi or Bluetooth
+#define PIPELINE_CORE_APP 1 // Arduino loop() runs here
+
+typedef struct {
+  // Set by the caller before pipelineStart()
+  const char* name;
+  TaskFunction_t entry;
+  uint32_t stackBytes;   // stack budget
+  UBaseType_t priority;  // higher runs first. Arduino loop() is 1
+  BaseType_t core;       // PIPELINE_CORE_PRO or PIPELINE_CORE_APP
+
+  // Managed by the pipeline
+  TaskHandle_t handle;
+  volatile uint32_t activeUs;  // time spent outside pipelineWait(). 32 bits so other tasks read it whole; wraps harmlessly
+  volatile uint32_t wakes;     // returns from pipelineWait()
+  int64_t activeSinceUs;       // when the task last left pipelineWait()
+  uint32_t reportedActiveUs;   // activeUs at the last stats report
+  uint32_t reportedRunTime;    // FreeRTOS run time counter at the last stats report
+} PipelineTask;
+
+// Create and start the task, passing 'arg' to its entry function.
+// Returns false if the task could not be created (usually not enough heap for the stack)
+bool pipelineStart(PipelineTask* task, void* arg);
+
+// Block until woken or 'timeoutMs' passes. Returns true if woken.
+// Must only be called by the task itself.
+bool pipelineWait(PipelineTask* task, uint32_t timeoutMs);
+
+// Mark the start and end of any other blocking call (like a FreeRTOS queue wait),
+// so that it is not counted as active time.
+void pipelineIdleBegin(PipelineTask* task);
+void pipelineIdleEnd(PipelineTask* task);
+
+// Wake a task blocked in pipelineWait(). Safe to call if it's not waiting; the wake is kept.
+void pipelineWake(PipelineTask* task);
+
+// Print one line per task: active %, CPU % (if available), wakes, stack used of budget
+void pipelinePrintStats(PipelineTask** tasks, int count);
+
+#endif
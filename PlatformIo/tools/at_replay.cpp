@@ -0,0 +1,322 @@
+// Read an AT transcript from the ATDebug bridge (05_at_debug), and replay it through the host-built AT layer.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=gnu++17 -I../common/AtCatalogue -I../common/AtTranscript at_replay.cpp ../common/AtTranscript/AtTranscript.cpp -o at_replay
+//   ./at_replay at_000.atr               modem latency per command, and AtCatalogue parse cost
+//   ./at_replay --speed 1 at_000.atr     the same, fed at the recorded pace (--speed 10 is ten times faster)
+//   ./at_replay --dump at_000.atr        the transcript as timestamped text
+//   ./at_replay --check testdata/at_sample.expected testdata/at_sample.atr
+//                                        compare the LATENCY and PARSE counts with known numbers
+//
+// The file can be straight from the SD card, or a capture of the USB port in CAPTURE_USB
+// mode; anything before the transcript header (boot messages) is skipped.
+//
+// Commands are the host's lines starting "AT". Each is named from the AtCatalogue
+// table (or by its text up to '=' or '?' if it isn't catalogued). A command's latency
+// is from the end of its line to the modem's first byte after the echo of the
+// command (if echo is on), and to its final reply:
+// OK, ERROR or +CME ERROR, or for commands whose result comes after the OK, the
+// result line itself. The whole reply then goes through at::parse for that command,
+// as the firmware would, and the parse is timed.
+//
+// Output lines:
+//   LATENCY,<command>,<count>,<first byte p50 ms>,<final p50 ms>,<p90>,<p99>,<max>,<unfinished>
+//   PARSE,<command>,<parsed>,<failed>,<ns per parse>
+//   REPLAY,<records>,<bytes>,<transcript ms>,<wall ms>,<most late record us>
+//
+// --check reads a file of LATENCY lines and PARSE lines without the time (which
+// depends on the machine), and fails if the replay's lines differ from them.
+// testdata/at_sample.atr is a short hand-made session (echo on and off, split
+// replies, +CME ERROR, a late result, and a command with no reply) for this.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AtCatalogue.h"
+#include "AtTranscript.h"
+
+// ---------------------------------------------------------------------------
+// Parsers for catalogued commands with an information reply
+
+template <class C> static at::Status parseAs(const char* reply, int length) {
+  typename C::Reply out;
+  return at::parse<C>(reply, length, out);
+}
+
+typedef struct {
+  const at::CommandDesc* desc;
+  at::Status (*parse)(const char* reply, int length);
+} Parser;
+
+static const Parser _parsers[] = {
+  {&at::SignalQuality::desc, parseAs<at::SignalQuality>},
+  {&at::BatteryCharge::desc, parseAs<at::BatteryCharge>},
+  {&at::ModuleTemperature::desc, parseAs<at::ModuleTemperature>},
+  {&at::ClockRead::desc, parseAs<at::ClockRead>},
+  {&at::Attached::desc, parseAs<at::Attached>},
+  {&at::NetOpen::desc, parseAs<at::NetOpen>},
+  {&at::NetClose::desc, parseAs<at::NetClose>},
+  {&at::IpOpen::desc, parseAs<at::IpOpen>},
+  {&at::IpClose::desc, parseAs<at::IpClose>},
+  {&at::IpSend::desc, parseAs<at::IpSend>},
+  {&at::HttpAction::desc, parseAs<at::HttpAction>},
+  {&at::Imei::desc, parseAs<at::Imei>},
+  {&at::Iccid::desc, parseAs<at::Iccid>},
+};
+
+static const Parser* parserFor(const at::CommandDesc* desc) {
+  for (const Parser& p : _parsers) if (p.desc == desc) return &p;
+  return NULL;
+}
+
+// Catalogue entry for a command line, longest match first (so "AT+CIPOPEN" isn't taken for "AT")
+static const at::CommandDesc* identify(const std::string& line) {
+  const at::CommandDesc* best = NULL;
+  size_t bestLength = 0;
+  for (int i = 0; i < at::commandCount; i++) {
+    const at::CommandDesc* d = at::commandTable[i];
+    size_t n = strlen(d->text);
+    if (n <= bestLength || line.size() < n || strncasecmp(line.c_str(), d->text, n) != 0) continue;
+    char next = line.size() > n ? line[n] : 0;
+    if (next != 0 && next != '=' && next != '?' && d->text[n - 1] != '?') continue;
+    best = d;
+    bestLength = n;
+  }
+  return best;
+}
+
+// ---------------------------------------------------------------------------
+// Command tracking
+
+typedef struct {
+  std::vector<double> firstMs;
+  std::vector<double> finalMs;
+  int unfinished = 0;
+  int parsed = 0;
+  int failed = 0;
+  double parseNs = 0;
+} CommandStats;
+
+static std::map<std::string, CommandStats> _stats;
+
+static struct {
+  bool active = false;
+  std::string name;
+  const at::CommandDesc* desc = NULL;
+  uint64_t sentUs = 0;
+  bool gotFirst = false;
+  std::string echo;  // the command line and its '\r', as the modem echoes it
+  size_t echoed = 0; // bytes of the echo seen so far
+  std::string reply; // everything the modem sent since the command
+  std::string line;  // modem line being assembled
+} _cmd;
+
+static std::string _hostLine; // host line being assembled
+
+static void finishCommand(uint64_t timeUs) {
+  CommandStats& s = _stats[_cmd.name];
+  s.finalMs.push_back((timeUs - _cmd.sentUs) / 1000.0);
+
+  const Parser* parser = parserFor(_cmd.desc);
+  if (parser != NULL) {
+    auto start = std::chrono::steady_clock::now();
+    at::Status status = parser->parse(_cmd.reply.data(), (int)_cmd.reply.size());
+    auto end = std::chrono::steady_clock::now();
+    s.parseNs += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    if (status == at::Status::Ok || status == at::Status::Error) s.parsed++; // an ERROR reply was still read correctly
+    else s.failed++;
+  }
+  _cmd.active = false;
+}
+
+static void startCommand(const std::string& line, uint64_t timeUs) {
+  if (_cmd.active) _stats[_cmd.name].unfinished++;
+
+  _cmd.desc = identify(line);
+  if (_cmd.desc != NULL) {
+    _cmd.name = _cmd.desc->name;
+  } else {
+    size_t end = line.find_first_of("=?");
+    _cmd.name = line.substr(0, end);
+    for (char& c : _cmd.name) c = (char)toupper((unsigned char)c);
+  }
+  _cmd.active = true;
+  _cmd.sentUs = timeUs;
+  _cmd.gotFirst = false;
+  _cmd.echo = line + '\r';
+  _cmd.echoed = 0;
+  _cmd.reply.clear();
+  _cmd.line.clear();
+}
+
+// Is this modem line the end of the command's reply?
+static bool isFinal(const std::string& line) {
+  if (line.compare(0, 5, "ERROR") == 0 || line.compare(0, 10, "+CME ERROR") == 0) return true;
+  if (_cmd.desc != NULL && (_cmd.desc->effects & at::effect::LateReply) && _cmd.desc->prefix != NULL) {
+    return line.compare(0, strlen(_cmd.desc->prefix), _cmd.desc->prefix) == 0;
+  }
+  return line == "OK";
+}
+
+static void fromHost(const AtTranscriptRecord* r) {
+  for (int i = 0; i < r->length; i++) {
+    char c = (char)r->data[i];
+    if (c != '\r' && c != '\n') { _hostLine += c; continue; }
+    if (_hostLine.size() >= 2 && strncasecmp(_hostLine.c_str(), "AT", 2) == 0) startCommand(_hostLine, r->timeUs);
+    _hostLine.clear(); // anything else is data after a prompt
+  }
+}
+
+static void fromModem(const AtTranscriptRecord* r) {
+  if (!_cmd.active) return; // unsolicited reports
+
+  for (int i = 0; i < r->length && _cmd.active; i++) {
+    char c = (char)r->data[i];
+    _cmd.reply += c;
+    if (!_cmd.gotFirst) {
+      if (_cmd.echoed < _cmd.echo.size() && c == _cmd.echo[_cmd.echoed]) { _cmd.echoed++; continue; }
+      _stats[_cmd.name].firstMs.push_back((r->timeUs - _cmd.sentUs) / 1000.0);
+      _cmd.gotFirst = true;
+    }
+    if (c == '\r') continue;
+    if (c != '\n') { _cmd.line += c; continue; }
+    if (isFinal(_cmd.line)) finishCommand(r->timeUs);
+    _cmd.line.clear();
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+static double percentile(std::vector<double>& v, int permille) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  size_t rank = (v.size() * permille + 999) / 1000; // 1-based
+  return v[rank > 0 ? rank - 1 : 0];
+}
+
+static void dumpRecord(const AtTranscriptRecord* r) {
+  printf("[%10.6f] %s ", r->timeUs / 1e6, r->direction == AT_FROM_MODEM ? "<-" : "->");
+  for (int i = 0; i < r->length; i++) {
+    uint8_t c = r->data[i];
+    if (c == '\r') printf("\\r");
+    else if (c == '\n') printf("\\n");
+    else if (c >= 0x20 && c < 0x7F) putchar(c);
+    else printf("\\x%02X", c);
+  }
+  putchar('\n');
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+  std::vector<uint8_t> data;
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return data;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return data;
+}
+
+// Compare the replay's LATENCY and PARSE (less the time) lines with a file of the expected ones.
+// Returns the number of differences
+static int check(const char* path, const std::vector<std::string>& lines) {
+  std::vector<uint8_t> data = readFile(path);
+  std::vector<std::string> expected;
+  std::string line;
+  for (uint8_t c : data) {
+    if (c == '\r') continue;
+    if (c != '\n') { line += (char)c; continue; }
+    if (!line.empty() && line[0] != '#') expected.push_back(line);
+    line.clear();
+  }
+  if (!line.empty() && line[0] != '#') expected.push_back(line);
+
+  int differences = 0;
+  for (const std::string& e : expected) {
+    if (std::find(lines.begin(), lines.end(), e) == lines.end()) { printf("CHECK,missing,%s\n", e.c_str()); differences++; }
+  }
+  for (const std::string& l : lines) {
+    if (std::find(expected.begin(), expected.end(), l) == expected.end()) { printf("CHECK,unexpected,%s\n", l.c_str()); differences++; }
+  }
+  if (expected.empty()) { printf("CHECK,no expected lines in '%s'\n", path); differences++; }
+  printf("CHECK,%s,%d\n", differences == 0 ? "pass" : "fail", differences);
+  return differences;
+}
+
+int main(int argc, char** argv) {
+  const char* path = NULL;
+  const char* expectedPath = NULL;
+  double speed = 0; // 0: as fast as possible
+  bool dump = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) speed = atof(argv[++i]);
+    else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) expectedPath = argv[++i];
+    else if (strcmp(argv[i], "--dump") == 0) dump = true;
+    else if (path == NULL && argv[i][0] != '-') path = argv[i];
+    else path = NULL, i = argc;
+  }
+  if (path == NULL) {
+    fprintf(stderr, "Usage: %s [--dump] [--speed N] [--check expected.txt] transcript.atr\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<uint8_t> data = readFile(path);
+  AtTranscriptReader reader;
+  bool found = false;
+  for (size_t start = 0; start + AT_TRANSCRIPT_HEADER_BYTES <= data.size() && !found; start++) {
+    if (data[start] == 'A') found = atTranscriptOpen(&reader, data.data() + start, (int)(data.size() - start));
+  }
+  if (!found) {
+    fprintf(stderr, "No transcript in '%s'\n", path);
+    return 1;
+  }
+
+  AtTranscriptRecord r;
+  long records = 0, bytes = 0;
+  uint64_t lastUs = 0;
+  double mostLateUs = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (atTranscriptNext(&reader, &r)) {
+    if (speed > 0) { // hold each record until its time comes round
+      auto due = start + std::chrono::microseconds((int64_t)(r.timeUs / speed));
+      std::this_thread::sleep_until(due);
+      double late = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - due).count();
+      if (late > mostLateUs) mostLateUs = late;
+    }
+
+    if (dump) dumpRecord(&r);
+    else if (r.direction == AT_FROM_MODEM) fromModem(&r);
+    else fromHost(&r);
+    records++;
+    bytes += r.length;
+    lastUs = r.timeUs;
+  }
+  if (reader.p != reader.end) fprintf(stderr, "Transcript is cut short; %ld bytes at the end were not read\n", (long)(reader.end - reader.p));
+  if (dump) return 0;
+
+  std::vector<std::string> lines; // for --check
+  char line[160];
+  for (auto& [name, s] : _stats) {
+    snprintf(line, sizeof(line), "LATENCY,%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%d", name.c_str(), (int)s.finalMs.size(), percentile(s.firstMs, 500),
+             percentile(s.finalMs, 500), percentile(s.finalMs, 900), percentile(s.finalMs, 990), percentile(s.finalMs, 1000), s.unfinished);
+    printf("%s\n", line);
+    lines.push_back(line);
+  }
+  for (auto& [name, s] : _stats) {
+    if (s.parsed + s.failed == 0) continue;
+    printf("PARSE,%s,%d,%d,%.0f\n", name.c_str(), s.parsed, s.failed, s.parseNs / (s.parsed + s.failed));
+    snprintf(line, sizeof(line), "PARSE,%s,%d,%d", name.c_str(), s.parsed, s.failed);
+    lines.push_back(line);
+  }
+  double wallMs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+  printf("REPLAY,%ld,%ld,%.1f,%.1f,%.0f\n", records, bytes, lastUs / 1000.0, wallMs, mostLateUs);
+  if (expectedPath != NULL && check(expectedPath, lines) > 0) return 1;
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Decode BinLog binary output (BINLOG_OUTPUT_BINARY) from a serial capture or SD log file.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=c++17 -I../common/BinLog binlog_decode.cpp ../common/BinLog/BinLogFormat.cpp -o binlog_decode
+//   ./binlog_decode < capture.bin
+//   ./binlog_decode --src ../06_udp_duplex/06_udp_duplex/src < capture.bin
+//
+// Format strings are announced in the stream the first time each is used. If the
+// capture starts late, '--src <dir>' also reads LOG_x("...") calls from source
+// files to fill in formats that were announced before the capture began.
+// Bytes outside valid frames (like boot messages) are skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+
+#include "BinLogFormat.h"
+
+static std::unordered_map<uint32_t, std::string> _formats;
+
+// FNV-1a, as binlogHash() does at compile time
+static uint32_t hashOf(const std::string& s) {
+  uint32_t h = 2166136261u;
+  for (unsigned char c : s) h = (h ^ c) * 16777619u;
+  return h;
+}
+
+// Read a C string literal starting at the opening quote. Returns false on anything we don't handle
+static bool readLiteral(const std::string& text, size_t& i, std::string& out) {
+  if (text[i] != '"') return false;
+  i++;
+  while (i < text.size() && text[i] != '"') {
+    char c = text[i++];
+    if (c != '\\') { out += c; continue; }
+    if (i >= text.size()) return false;
+    char e = text[i++];
+    switch (e) {
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case '0': out += '\0'; break;
+      case '\\': out += '\\'; break;
+      case '"': out += '"'; break;
+      case '\'': out += '\''; break;
+      default: return false;
+    }
+  }
+  i++; // closing quote
+  return true;
+}
+
+// Find LOG_E/W/I/D("...") calls in a source tree. Adjacent literals are joined; macros in the format are not supported.
+static void scanSources(const char* dir) {
+  int found = 0;
+  for (auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+    auto ext = entry.path().extension().string();
+    if (ext != ".cpp" && ext != ".h" && ext != ".ino") continue;
+
+    std::ifstream file(entry.path());
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while ((pos = text.find("LOG_", pos)) != std::string::npos) {
+      pos += 4;
+      if (pos + 1 >= text.size() || !strchr("EWID", text[pos]) || text[pos + 1] != '(') continue;
+      size_t i = pos + 2;
+      std::string format;
+      bool ok = true;
+      for (;;) {
+        while (i < text.size() && isspace((unsigned char)text[i])) i++;
+        if (i >= text.size() || text[i] != '"') break;
+        if (!readLiteral(text, i, format)) { ok = false; break; }
+      }
+      if (ok && !format.empty()) { _formats[hashOf(format)] = format; found++; }
+    }
+  }
+  fprintf(stderr, "Read %d format strings from %s\n", found, dir);
+}
+
+static uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static void printRecord(const uint8_t* payload, int length) {
+  if (length < BINLOG_HEADER_BYTES) return;
+  uint32_t id = get32(payload);
+  uint32_t us = get32(payload + 4);
+  printf("[%5u.%06u] %c ", us / 1000000, us % 1000000, binlogLevelChar(payload[8]));
+
+  char text[1024];
+  if (id == BINLOG_ID_DROPPED) {
+    binlogFormat(text, sizeof(text), "[%u log records dropped]", payload + BINLOG_HEADER_BYTES, length - BINLOG_HEADER_BYTES);
+  } else {
+    auto known = _formats.find(id);
+    if (known == _formats.end()) snprintf(text, sizeof(text), "(format %08x, %d bytes of arguments)", id, length - BINLOG_HEADER_BYTES);
+    else binlogFormat(text, sizeof(text), known->second.c_str(), payload + BINLOG_HEADER_BYTES, length - BINLOG_HEADER_BYTES);
+  }
+  printf("%s\n", text);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--src") == 0 && i + 1 < argc) scanSources(argv[++i]);
+    else { fprintf(stderr, "Unknown argument %s\n", argv[i]); return 1; }
+  }
+
+  // Read everything; captures are small
+  std::string data;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) data.append(buf, n);
+  const uint8_t* d = (const uint8_t*)data.data();
+  size_t size = data.size();
+
+  int records = 0, announcements = 0, bad = 0;
+  size_t i = 0;
+  while (i + BINLOG_WIRE_OVERHEAD <= size) {
+    if (d[i] != BINLOG_SYNC1 || d[i + 1] != BINLOG_SYNC2) { i++; continue; }
+    uint8_t type = d[i + 2];
+    int length = d[i + 3];
+    if (i + 4 + length + 1 > size) break;
+
+    const uint8_t* payload = d + i + 4;
+    uint8_t x = 0;
+    for (int k = 0; k < length; k++) x ^= payload[k];
+    if (x != payload[length] || type > BINLOG_WIRE_FORMAT) { bad++; i++; continue; } // not a frame; resync
+
+    if (type == BINLOG_WIRE_FORMAT && length >= 4) {
+      _formats[get32(payload)] = std::string((const char*)payload + 4, length - 4);
+      announcements++;
+    } else if (type == BINLOG_WIRE_RECORD) {
+      printRecord(payload, length);
+      records++;
+    }
+    i += 4 + length + 1;
+  }
+
+  fprintf(stderr, "%d records, %d format announcements, %d false syncs skipped\n", records, announcements, bad);
+  return 0;
+}
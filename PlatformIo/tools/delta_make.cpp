@@ -0,0 +1,393 @@
+// Make a firmware delta (PlatformIo/common/DeltaOta/DeltaPatch.h) from the running image to a new one.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=gnu++17 -I../common/DeltaOta delta_make.cpp ../common/DeltaOta/DeltaPatch.cpp -lz -o delta_make
+//   ./delta_make old.bin new.bin                 writes <old build id>.delta, the name the device asks for
+//   ./delta_make old.bin new.bin -o out.delta
+//   ./delta_make --check old.bin new.bin out.delta
+//
+// The images are the application .bin files as flashed (.pio/build/<env>/firmware.bin).
+// The device names the delta it wants from the first 8 bytes of the running image's
+// build id (app_elf_sha256 in esp_app_desc_t), so keep the old .bin of every build
+// that is out in the field.
+//
+// Matching works like bsdiff: each run of target bytes is taken from the place in
+// the source it most looks like, and stored as the bytewise difference. When code
+// moves, most bytes are the same and only addresses change, so the difference is
+// mostly zeros and deflates to very little. Anything without a good match is inserted.
+//
+// --check applies a delta with the same patcher as the firmware, from the start and
+// again as if it had been cut off half way and resumed, and compares the result.
+// A new delta is always checked.
+//
+// Output line:
+//   DELTA,<source bytes>,<target bytes>,<delta bytes>,<% of target>,<chunks>,<added bytes>,<inserted bytes>,<ms>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "DeltaPatch.h"
+
+#define DEFAULT_CHUNK_SHIFT 16
+#define BLOCK 8           // bytes hashed to find match candidates
+#define HASH_BITS 22
+#define CHAIN_DEPTH 64    // match candidates tried at each position
+#define RANK_WINDOW 256   // target bytes a candidate is scored over
+#define MIN_SCORE 24      // weaker matches are inserted instead
+#define FUZZ_GIVE_UP 64   // stop extending once the score is this far under its best
+
+typedef std::vector<uint8_t> Bytes;
+
+// ---------------------------------------------------------------------------
+// SHA-256 (FIPS 180-4), for the header hashes
+
+static const uint32_t _k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void sha256Block(uint32_t* h, const uint8_t* p) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = k + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + _k[i] + w[i];
+    uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    k = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256(const uint8_t* data, size_t length, uint8_t* out) {
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) sha256Block(h, data + i);
+
+  uint8_t last[128] = {0};
+  size_t rest = length - i;
+  memcpy(last, data + i, rest);
+  last[rest] = 0x80;
+  size_t blocks = rest + 9 > 64 ? 2 : 1;
+  uint64_t bits = (uint64_t)length * 8;
+  for (int j = 0; j < 8; j++) last[blocks * 64 - 1 - j] = (uint8_t)(bits >> (8 * j));
+  for (size_t j = 0; j < blocks; j++) sha256Block(h, last + 64 * j);
+
+  for (int j = 0; j < 8; j++) {
+    out[4 * j] = (uint8_t)(h[j] >> 24); out[4 * j + 1] = (uint8_t)(h[j] >> 16);
+    out[4 * j + 2] = (uint8_t)(h[j] >> 8); out[4 * j + 3] = (uint8_t)h[j];
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Source index: a hash of BLOCK bytes at every source position, chained like zlib's
+
+static std::vector<int32_t> _head;
+static std::vector<int32_t> _chain;
+
+static uint32_t blockHash(const uint8_t* p) {
+  uint64_t a;
+  memcpy(&a, p, BLOCK);
+  return (uint32_t)((a * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+}
+
+static void buildIndex(const Bytes& source) {
+  _head.assign((size_t)1 << HASH_BITS, -1);
+  _chain.assign(source.size(), -1);
+  for (size_t p = 0; p + BLOCK <= source.size(); p++) {
+    uint32_t h = blockHash(&source[p]);
+    _chain[p] = _head[h];
+    _head[h] = (int32_t)p;
+  }
+}
+
+// Extend an alignment forward while it's mostly the same. Scores +1 per equal byte and -1 per
+// different one, and returns the length where the score peaked (and the peak, in 'score')
+static size_t extendFuzzy(const Bytes& source, size_t s, const Bytes& target, size_t t, size_t limit, long* score) {
+  long running = 0, best = 0;
+  size_t bestLength = 0;
+  for (size_t i = 0; i < limit && s + i < source.size(); i++) {
+    running += source[s + i] == target[t + i] ? 1 : -1;
+    if (running > best) { best = running; bestLength = i + 1; }
+    else if (running < best - FUZZ_GIVE_UP) break;
+  }
+  *score = best;
+  return bestLength;
+}
+
+// Source position that best fits target[t...], scored over the next RANK_WINDOW bytes.
+// Returns false if nothing scores MIN_SCORE
+static bool findMatch(const Bytes& source, const Bytes& target, size_t t, size_t limit, size_t* matchAt) {
+  if (limit < BLOCK) return false;
+  long best = MIN_SCORE - 1;
+  int depth = 0;
+  for (int32_t s = _head[blockHash(&target[t])]; s >= 0 && depth < CHAIN_DEPTH; s = _chain[s], depth++) {
+    if (memcmp(&source[s], &target[t], BLOCK) != 0) continue; // hash collision
+    long score;
+    extendFuzzy(source, s, target, t, std::min(limit, (size_t)RANK_WINDOW), &score);
+    if (score > best) { best = score; *matchAt = s; }
+  }
+  return best >= MIN_SCORE;
+}
+
+// ---------------------------------------------------------------------------
+// Ops for one chunk
+
+static size_t _addedBytes = 0;
+static size_t _insertedBytes = 0;
+
+static void putVarint(Bytes& out, uint32_t v) {
+  while (v >= 0x80) { out.push_back((uint8_t)(v | 0x80)); v >>= 7; }
+  out.push_back((uint8_t)v);
+}
+
+static void putInsert(Bytes& out, const Bytes& target, size_t t, size_t length) {
+  if (length == 0) return;
+  out.push_back(DELTA_OP_INSERT);
+  putVarint(out, (uint32_t)length);
+  out.insert(out.end(), target.begin() + t, target.begin() + t + length);
+  _insertedBytes += length;
+}
+
+static void putAdd(Bytes& out, const Bytes& source, size_t s, const Bytes& target, size_t t, size_t length, size_t* sourcePos) {
+  int32_t move = (int32_t)(s - *sourcePos);
+  out.push_back(DELTA_OP_ADD);
+  putVarint(out, (uint32_t)length);
+  putVarint(out, ((uint32_t)move << 1) ^ (uint32_t)(move >> 31)); // zigzag
+  for (size_t i = 0; i < length; i++) out.push_back((uint8_t)(target[t + i] - source[s + i]));
+  *sourcePos = s + length;
+  _addedBytes += length;
+}
+
+static Bytes chunkOps(const Bytes& source, const Bytes& target, size_t start, size_t end) {
+  Bytes ops;
+  size_t sourcePos = 0;     // the patcher's source position, which starts at zero in each chunk
+  size_t insertFrom = start;
+  size_t t = start;
+  while (t < end) {
+    // Carry on with the last alignment if it still mostly fits
+    size_t s = sourcePos;
+    size_t length = 0;
+    long score = 0;
+    if (t == insertFrom && sourcePos > 0) length = extendFuzzy(source, s, target, t, end - t, &score);
+
+    if (score < MIN_SCORE) {
+      if (!findMatch(source, target, t, end - t, &s)) { t++; continue; }
+      length = extendFuzzy(source, s, target, t, end - t, &score);
+
+      // Take inserted bytes just before the match into it too, if they fit as well
+      size_t back = 0;
+      long running = 0, best = 0;
+      for (size_t i = 1; i <= t - insertFrom && i <= s; i++) {
+        running += source[s - i] == target[t - i] ? 1 : -1;
+        if (running > best) { best = running; back = i; }
+        else if (running < best - FUZZ_GIVE_UP) break;
+      }
+      s -= back;
+      t -= back;
+      length += back;
+    }
+
+    putInsert(ops, target, insertFrom, t - insertFrom);
+    putAdd(ops, source, s, target, t, length, &sourcePos);
+    t += length;
+    insertFrom = t;
+  }
+  putInsert(ops, target, insertFrom, end - insertFrom);
+  return ops;
+}
+
+static Bytes deflateRaw(const Bytes& in) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY); // 32 KB window: what the ESP32 ROM inflater holds
+  Bytes out(deflateBound(&zs, in.size()));
+  zs.next_in = (Bytef*)in.data();
+  zs.avail_in = (uInt)in.size();
+  zs.next_out = out.data();
+  zs.avail_out = (uInt)out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static void putU32(Bytes& out, uint32_t v) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static Bytes makeDelta(const Bytes& source, const Bytes& target, int* chunkCount) {
+  int shift = DEFAULT_CHUNK_SHIFT;
+  while (((size_t)DELTA_MAX_CHUNKS << shift) < target.size()) shift++;
+  size_t chunkBytes = (size_t)1 << shift;
+  *chunkCount = (int)((target.size() + chunkBytes - 1) / chunkBytes);
+
+  buildIndex(source);
+  std::vector<Bytes> chunks;
+  for (size_t start = 0; start < target.size(); start += chunkBytes) {
+    chunks.push_back(deflateRaw(chunkOps(source, target, start, std::min(start + chunkBytes, target.size()))));
+  }
+
+  Bytes out = {'D', 'O', 'T', 'A', DELTA_VERSION, (uint8_t)shift, (uint8_t)*chunkCount, (uint8_t)(*chunkCount >> 8)};
+  uint8_t hash[32];
+  putU32(out, (uint32_t)source.size());
+  sha256(source.data(), source.size(), hash);
+  out.insert(out.end(), hash, hash + 32);
+  putU32(out, (uint32_t)target.size());
+  sha256(target.data(), target.size(), hash);
+  out.insert(out.end(), hash, hash + 32);
+  for (const Bytes& c : chunks) putU32(out, (uint32_t)c.size());
+  for (const Bytes& c : chunks) out.insert(out.end(), c.begin(), c.end());
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+// Check: apply with the firmware's patcher
+
+typedef struct {
+  const Bytes* source;
+  Bytes* target;
+} CheckIo;
+
+static bool readSource(void* ctx, uint32_t offset, uint8_t* buf, int length) {
+  const Bytes* source = ((CheckIo*)ctx)->source;
+  if (offset + length > source->size()) return false;
+  memcpy(buf, source->data() + offset, length);
+  return true;
+}
+
+static bool writeTarget(void* ctx, uint32_t offset, const uint8_t* data, int length) {
+  Bytes* target = ((CheckIo*)ctx)->target;
+  if (offset + length > target->size()) return false;
+  memcpy(target->data() + offset, data, length);
+  return true;
+}
+
+// Patch chunks [first, stop) from the delta, fed in pieces of varying size like modem reads
+static DeltaStatus applyChunks(const DeltaHeader* header, const Bytes& delta, CheckIo* io, int first, int stop) {
+  DeltaIo dio = {readSource, writeTarget, io};
+  DeltaStatus status = deltaBegin(header, &dio, first);
+  size_t p = deltaChunkOffset(header, first);
+  size_t end = deltaChunkOffset(header, stop);
+  int piece = 1;
+  while (status >= 0 && status != DELTA_DONE && p < end) {
+    int n = (int)std::min(end - p, (size_t)piece);
+    while (n > 0 && status >= 0 && status != DELTA_DONE) {
+      int used;
+      status = deltaFeed(&delta[p], n, &used);
+      p += used;
+      n -= used;
+    }
+    piece = piece * 7 % 1531 + 1; // 1 to about 1.5 KB
+  }
+  deltaEnd();
+  return status;
+}
+
+static int check(const Bytes& source, const Bytes& target, const Bytes& delta) {
+  DeltaHeader header;
+  if (deltaParseHeader(delta.data(), (int)delta.size(), &header) <= 0) { fprintf(stderr, "Not a delta\n"); return 1; }
+  uint8_t hash[32];
+  sha256(source.data(), source.size(), hash);
+  if (header.sourceSize != source.size() || memcmp(hash, header.sourceSha256, 32) != 0) { fprintf(stderr, "Delta is for a different source image\n"); return 1; }
+  if (deltaChunkOffset(&header, header.chunkCount) != delta.size()) { fprintf(stderr, "Delta is %zu bytes; header says %u\n", delta.size(), deltaChunkOffset(&header, header.chunkCount)); return 1; }
+
+  int failures = 0;
+  int resumeAt = header.chunkCount / 2;
+  for (int pass = 0; pass < 2; pass++) {
+    Bytes out(header.targetSize, 0xFF);
+    CheckIo io = {&source, &out};
+    DeltaStatus status;
+    if (pass == 0) {
+      status = applyChunks(&header, delta, &io, 0, header.chunkCount);
+    } else { // cut off while writing a chunk, before its checkpoint: resume from the start of that chunk
+      applyChunks(&header, delta, &io, 0, resumeAt + 1);
+      status = applyChunks(&header, delta, &io, resumeAt, header.chunkCount);
+    }
+    sha256(out.data(), out.size(), hash);
+    bool ok = status == DELTA_DONE && out == target && memcmp(hash, header.targetSha256, 32) == 0;
+    printf("CHECK,%s,%d,%s\n", pass == 0 ? "full" : "resumed", pass == 0 ? 0 : resumeAt, ok ? "ok" : "FAILED");
+    if (!ok) failures++;
+  }
+  return failures > 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static bool readFile(const char* path, Bytes& out) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+// "<first 8 bytes of the build id>.delta", from the image's app description, or empty if it has none
+static std::string deltaName(const Bytes& image) {
+  const size_t desc = 0x20; // after the image header and the first segment header
+  if (image.size() < desc + 0xB0 || image[desc] != 0x32 || image[desc + 1] != 0x54 || image[desc + 2] != 0xCD || image[desc + 3] != 0xAB) return "";
+  char name[24];
+  int n = 0;
+  for (int i = 0; i < 8; i++) n += snprintf(name + n, sizeof(name) - n, "%02x", image[desc + 0x90 + i]);
+  snprintf(name + n, sizeof(name) - n, ".delta");
+  return name;
+}
+
+int main(int argc, char** argv) {
+  bool checkOnly = false;
+  const char* out = NULL;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--check") == 0) checkOnly = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+    else files.push_back(argv[i]);
+  }
+  if (files.size() != (checkOnly ? 3u : 2u)) {
+    fprintf(stderr, "Usage: %s old.bin new.bin [-o out.delta]\n       %s --check old.bin new.bin out.delta\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  Bytes source, target, delta;
+  for (int i = 0; i < (int)files.size(); i++) {
+    if (!readFile(files[i], i == 0 ? source : i == 1 ? target : delta)) { fprintf(stderr, "Can't read '%s'\n", files[i]); return 1; }
+  }
+  if (source.empty() || target.empty()) { fprintf(stderr, "Empty image\n"); return 1; }
+  if (checkOnly) return check(source, target, delta);
+
+  std::string name = out != NULL ? out : deltaName(source);
+  if (name.empty()) { fprintf(stderr, "'%s' has no ESP32 app description to name the delta from. Use -o\n", files[0]); return 1; }
+
+  auto start = std::chrono::steady_clock::now();
+  int chunks;
+  delta = makeDelta(source, target, &chunks);
+  long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+  FILE* f = fopen(name.c_str(), "wb");
+  if (f == NULL || fwrite(delta.data(), 1, delta.size(), f) != delta.size()) { fprintf(stderr, "Can't write '%s'\n", name.c_str()); return 1; }
+  fclose(f);
+
+  printf("DELTA,%zu,%zu,%zu,%.1f,%d,%zu,%zu,%ld\n", source.size(), target.size(), delta.size(), 100.0 * delta.size() / target.size(),
+         chunks, _addedBytes, _insertedBytes, ms);
+  fprintf(stderr, "Wrote %s\n", name.c_str());
+  return check(source, target, delta);
+}
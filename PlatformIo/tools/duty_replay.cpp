@@ -0,0 +1,75 @@
+// Replay duty scheduler decisions from a device log against new tuning.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -I../common/DutyScheduler duty_replay.cpp ../common/DutyScheduler/DutyScheduler.cpp -o duty_replay
+//   ./duty_replay lowBatteryMv=3700 goodCsq=18 < console_capture.txt
+//
+// Any line containing "DUTY," is read; everything else in the capture is ignored.
+// Prints each decision that would change, and a summary of sends and sleep time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DutyScheduler.h"
+
+static bool applySetting(DutyConfig* c, const char* arg) {
+  const char* eq = strchr(arg, '=');
+  if (eq == NULL) return false;
+  long v = atol(eq + 1);
+  int n = (int)(eq - arg);
+
+#define SETTING(name) if (n == (int)strlen(#name) && strncmp(arg, #name, n) == 0) { c->name = v; return true; }
+  SETTING(baseSleepS)
+  SETTING(minSleepS)
+  SETTING(maxSleepS)
+  SETTING(lowBatteryMv)
+  SETTING(criticalBatteryMv)
+  SETTING(minTemperatureC)
+  SETTING(maxTemperatureC)
+  SETTING(goodCsq)
+  SETTING(poorCsq)
+  SETTING(batchSize)
+  SETTING(bulkThreshold)
+#undef SETTING
+  return false;
+}
+
+int main(int argc, char** argv) {
+  DutyConfig config = dutyDefaultConfig();
+  for (int i = 1; i < argc; i++) {
+    if (!applySetting(&config, argv[i])) {
+      fprintf(stderr, "Unknown setting '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  char line[256];
+  long lines = 0, changed = 0;
+  long oldSends = 0, newSends = 0, oldBatch = 0, newBatch = 0;
+  unsigned long long oldSleep = 0, newSleep = 0;
+
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    DutyInputs in;
+    DutyDecision logged;
+    if (!dutyParseLog(line, &in, &logged)) continue;
+    lines++;
+
+    DutyDecision replay = dutyDecide(&in, &config);
+    oldSends += logged.send;  newSends += replay.send;
+    oldBatch += logged.batch; newBatch += replay.batch;
+    oldSleep += logged.sleepS; newSleep += replay.sleepS;
+
+    if (replay.send != logged.send || replay.batch != logged.batch || replay.sleepS != logged.sleepS || replay.reason != logged.reason) {
+      changed++;
+      char buf[128];
+      dutyFormatLog(buf, sizeof(buf), &in, &replay);
+      printf("was %u/%u/%u/%lu now %s\n", logged.send, logged.reason, logged.batch, (unsigned long)logged.sleepS, buf);
+    }
+  }
+
+  printf("%ld decisions, %ld changed\n", lines, changed);
+  printf("sends: %ld -> %ld; messages: %ld -> %ld; sleep: %llus -> %llus\n",
+         oldSends, newSends, oldBatch, newBatch, oldSleep, newSleep);
+  return 0;
+}
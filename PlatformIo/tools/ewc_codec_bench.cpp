@@ -0,0 +1,159 @@
+// Host benchmark for EwcCodec (PlatformIo/common/EwcCodec): decode throughput, per
+// message type and for a byte stream taken through EwcFramer the way 06_udp_duplex does
+// (frame, identify, validate, decode).
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=gnu++17 -I../common/EwcLink -I../common/EwcCodec ewc_codec_bench.cpp ../common/EwcLink/EwcFramer.cpp -o ewc_codec_bench
+//   ./ewc_codec_bench > before.txt
+//   (change EwcCodec.h or EwcFramer.cpp and rebuild)
+//   ./ewc_codec_bench --compare before.txt
+//
+// Each result is a line "BENCH,<name>,<ns/frame>,<frames/s>,<MB/s>". The fastest of
+// BENCH_RUNS runs is reported. At 9600 baud the EWC sends at most ~1000 bytes/s, so
+// these are for comparing one change against another, not for headroom.
+// Correctness is checked by the test_ewc_codec host test (tools/test), not here.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "EwcFramer.h"
+#include "EwcCodec.h"
+
+#define BENCH_FRAMES (4L * 1024 * 1024) // per run
+#define BENCH_RUNS 5
+
+static const uint8_t _topUpFrame[] = {0x4C, 0x00, 0xD4, 0x3D, 0x46, 0xA5, 0x00, 0x00, 0xFF, 0xFF, 0x03, 0x45};
+static const uint8_t _clockReplyFrame[] = {0x80, 0x54, 0x12, 0x34, 0x56, 0x03, 0x27}; // status byte, three clock bytes
+
+// Clock request, clock reply with its status byte, and a top-up: three frames, 19 bytes
+static const uint8_t _stream[] = {
+  0x54, 0x03, 0x57,
+  0x80, 0x54, 0x03, 0x57,
+  0x4C, 0x00, 0xD4, 0x3D, 0x46, 0xA5, 0x00, 0x00, 0xFF, 0xFF, 0x03, 0x45,
+};
+#define STREAM_FRAMES 3
+
+static volatile long _sink; // results go here so the work isn't optimised away
+
+typedef long (*BenchFn)(long frames);
+
+typedef struct {
+  const char* name;
+  BenchFn fn;
+  double bytesPerFrame;
+} Bench;
+
+static long benchDecodeTopUp(long n) {
+  long sum = 0;
+  ewc::TopUp topUp;
+  for (long i = 0; i < n; i++) {
+    if (ewc::decode(_topUpFrame, sizeof(_topUpFrame), topUp) == ewc::Status::Ok) sum += topUp.cardId + topUp.credit;
+  }
+  return sum;
+}
+
+static long benchDecodeClockReply(long n) {
+  long sum = 0;
+  ewc::ClockReply reply;
+  for (long i = 0; i < n; i++) {
+    if (ewc::decode(_clockReplyFrame, sizeof(_clockReplyFrame), reply) == ewc::Status::Ok) sum += reply.clock.length + reply.status;
+  }
+  return sum;
+}
+
+// A frame of unknown type: identify, then validate against the table entry found
+static long benchIdentifyValidate(long n) {
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    const ewc::MessageDesc* desc = ewc::identify(_topUpFrame, sizeof(_topUpFrame), 0, ewc::Direction::ToEwc);
+    if (desc != nullptr && ewc::validate(*desc, _topUpFrame, sizeof(_topUpFrame)) == ewc::Status::Ok) sum += desc->command;
+  }
+  return sum;
+}
+
+// Bytes to typed messages: every byte through the framer, then identify and decode each frame
+static long benchStream(long n) {
+  long sum = 0;
+  EwcFramer framer;
+  EwcFrame frame;
+  ewcFramerReset(&framer);
+  ewc::ClockReply reply;
+  ewc::TopUp topUp;
+  for (long i = 0; i < n; i += STREAM_FRAMES) {
+    for (unsigned int j = 0; j < sizeof(_stream); j++) {
+      if (!ewcFramerPush(&framer, _stream[j], &frame)) continue;
+      ewc::Direction direction = frame.lead > 0 ? ewc::Direction::FromEwc : ewc::Direction::ToEwc;
+      const ewc::MessageDesc* desc = ewc::identify(frame.data, frame.length, frame.lead, direction);
+      if (desc == &ewc::topUpDesc && ewc::decode(frame.data, frame.length, topUp) == ewc::Status::Ok) sum += topUp.cardId;
+      else if (desc == &ewc::clockReplyDesc && ewc::decode(frame.data, frame.length, reply) == ewc::Status::Ok) sum += reply.status;
+      else if (desc != nullptr) sum += ewc::validate(*desc, frame.data, frame.length) == ewc::Status::Ok;
+    }
+  }
+  return sum;
+}
+
+static const Bench _benches[] = {
+  {"ewc::decode/topup", benchDecodeTopUp, sizeof(_topUpFrame)},
+  {"ewc::decode/clockreply", benchDecodeClockReply, sizeof(_clockReplyFrame)},
+  {"ewc::identify+validate/topup", benchIdentifyValidate, sizeof(_topUpFrame)},
+  {"framer+decode/stream", benchStream, (double)sizeof(_stream) / STREAM_FRAMES},
+};
+
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  char name[64];
+  double nsPerFrame;
+} Previous;
+
+// Read BENCH lines from an earlier run
+static int loadPrevious(const char* path, Previous* out, int max) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  char line[256];
+  int count = 0;
+  while (count < max && fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "BENCH,%63[^,],%lf", out[count].name, &out[count].nsPerFrame) == 2) count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(int argc, char** argv) {
+  const char* compare = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) compare = argv[++i];
+    else {
+      fprintf(stderr, "Usage: %s [--compare previous.txt]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Previous previous[16];
+  int previousCount = 0;
+  if (compare != NULL) {
+    previousCount = loadPrevious(compare, previous, 16);
+    if (previousCount < 0) { fprintf(stderr, "Can't read '%s'\n", compare); return 1; }
+  }
+
+  for (const Bench& b : _benches) {
+    double best = 0;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+      auto start = std::chrono::steady_clock::now();
+      _sink = b.fn(BENCH_FRAMES);
+      double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      if (i == 0 || ns < best) best = ns;
+    }
+    double nsPerFrame = best / BENCH_FRAMES;
+    printf("BENCH,%s,%.1f,%.0f,%.1f", b.name, nsPerFrame, 1e9 / nsPerFrame, b.bytesPerFrame * 1000.0 / nsPerFrame);
+    for (int i = 0; i < previousCount; i++) {
+      if (strcmp(previous[i].name, b.name) != 0 || previous[i].nsPerFrame <= 0) continue;
+      printf(",%+.1f%%", (nsPerFrame - previous[i].nsPerFrame) * 100.0 / previous[i].nsPerFrame);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,517 @@
+// Host benchmarks for the firmware's parsers, GPS maths and EWC byte handling.
+// Reports time and heap allocations per operation, so a parser change shows
+// its cost before it is flashed.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=gnu++17 -I../common/AtCatalogue -I../common/LocationScheduler -I../common/EwcLink -I../common/EwcCodec -I../common/SpscRing
+//       parser_bench.cpp ../common/AtCatalogue/NumberSet.cpp ../common/LocationScheduler/LocationScheduler.cpp ../common/EwcLink/EwcFramer.cpp -o parser_bench
+//   ./parser_bench > before.txt
+//   (change a parser and rebuild)
+//   ./parser_bench --compare before.txt
+//
+// Inputs are modem replies and EWC frames in the formats the devices see (from
+// the examples in the firmware). Add a console capture with --capture; any
+// "+CGPSINFO:", "+HTTPACTION:", "+CSQ:" or "+CBC:" lines in it are added to the inputs.
+//
+// Each result is a line "BENCH,<name>,<ns/op>,<allocations/op>,<bytes allocated/op>".
+// Allocations are counted through operator new, and on glibc through malloc too.
+// Old routines that have been replaced in the firmware are kept here as
+// baselines, so the replacement can be compared against them.
+//
+// Before timing anything, every input is run through both the new routine and its
+// baseline, and the results compared (at::parse against readNumberSet, and so on).
+// A difference is a "CHECK,<name>,<input>" line on stderr and exit code 1, so a
+// parser change that reads a reply differently is caught before it is timed.
+// The unit tests for these libraries are in tools/test (pio test -e native, from
+// 04_pio_hello_world).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "AtCatalogue.h"
+#include "NumberSet.h"
+#include "LocationScheduler.h"
+#include "EwcFramer.h"
+#include "EwcCodec.h"
+#include "SpscRing.h"
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+
+static unsigned long long _allocCount = 0;
+static unsigned long long _allocBytes = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) { _allocCount++; _allocBytes += size; return __libc_malloc(size); }
+void* calloc(size_t count, size_t size) { _allocCount++; _allocBytes += count * size; return __libc_calloc(count, size); }
+void* realloc(void* p, size_t size) { _allocCount++; _allocBytes += size; return __libc_realloc(p, size); }
+void free(void* p) { __libc_free(p); }
+}
+
+// operator new goes through malloc, which is counted above
+#else
+void* operator new(size_t size) {
+  _allocCount++;
+  _allocBytes += size;
+  void* p = malloc(size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+// ---------------------------------------------------------------------------
+// Inputs
+
+static std::vector<std::string> _httpAction = {
+  "AT+HTTPACTION=1\r\r\nOK\r\n\r\n+HTTPACTION: 1,200,68\r\n",
+  "\r\n+HTTPACTION: 0,200,104220\r\n",
+  "\r\n+HTTPACTION: 1,404,0\r\n",
+  "\r\n+HTTPACTION: 1,713,0\r\n", // modem network error
+};
+
+static std::vector<std::string> _csq = {
+  "AT+CSQ\r\r\n+CSQ: 19,99\r\n\r\nOK\r\n",
+  "\r\n+CSQ: 7,99\r\n\r\nOK\r\n",
+  "\r\n+CSQ: 99,99\r\n\r\nOK\r\n", // no signal
+};
+
+static std::vector<std::string> _cbc = {
+  "AT+CBC\r\r\n+CBC: 4.120V\r\n\r\nOK\r\n",
+  "\r\n+CBC: 3.702V\r\n\r\nOK\r\n",
+};
+
+static std::vector<std::string> _cgpsInfo = {
+  "AT+CGPSINFO\r\r\n+CGPSINFO: 5149.48561,N,00301.87739,W,080223,125658.0,114.0,0.0,\r\n\r\nOK\r\n",
+  "\r\n+CGPSINFO: 5149.48602,N,00301.87655,W,080223,125702.0,113.6,1.2,84.3\r\n\r\nOK\r\n",
+  "\r\n+CGPSINFO: 3352.12873,S,15112.55190,E,150623,031502.0,42.1,12.8,270.5\r\n\r\nOK\r\n",
+  "\r\n+CGPSINFO: ,,,,,,,,\r\n\r\nOK\r\n", // no fix yet
+};
+
+// EWC byte stream: clock request, a clock reply with its status byte, and a super-tap top-up for slot 0
+static const uint8_t _ewcStream[] = {
+  0x54, 0x03, 0x57,
+  0x80, 0x54, 0x03, 0x57,
+  0x4C, 0x00, 0xD4, 0x3D, 0x46, 0xA5, 0x00, 0x00, 0xFF, 0xFF, 0x03, 0x45,
+};
+static const uint8_t _topUpFrame[] = {0x4C, 0x00, 0xD4, 0x3D, 0x46, 0xA5, 0x00, 0x00, 0xFF, 0xFF, 0x03, 0x45};
+
+// Add matching lines from a console capture
+static int loadCapture(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+
+  struct { const char* prefix; std::vector<std::string>* inputs; } kinds[] = {
+    {"+HTTPACTION:", &_httpAction}, {"+CSQ:", &_csq}, {"+CBC:", &_cbc}, {"+CGPSINFO:", &_cgpsInfo},
+  };
+
+  char line[512];
+  int added = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    for (auto& k : kinds) {
+      const char* p = strstr(line, k.prefix);
+      if (p == NULL) continue;
+      k.inputs->push_back(std::string("\r\n") + p);
+      added++;
+    }
+  }
+  fclose(f);
+  return added;
+}
+
+// ---------------------------------------------------------------------------
+// Baselines: earlier firmware routines, kept to measure their replacements against
+
+// readNumberSet() (NumberSet.h) is the reader 04_pio_hello_world used before AtCatalogue
+
+// Position maths from 04_pio_hello_world before LocationScheduler: the reply read
+// as a number set, then degrees and minutes split by hand (hemisphere ignored)
+static bool legacyGpsPosition(const char* reply, long* lat, long* lon){
+  int gpsData[36];
+  int got = readNumberSet(reply, 36, gpsData);
+  if (got < 4) return false;
+
+  long lat_a = gpsData[0];
+  long lat_b = gpsData[1];
+  long lon_a = gpsData[2];
+  long lon_b = gpsData[3];
+  long lat_deg = lat_a / 100;
+  long lon_deg = lon_a / 100;
+  lat_b += (lat_a % 100) * 100000;
+  lon_b += (lon_a % 100) * 100000;
+  lat_b /= 60;
+  lon_b /= 60;
+  *lat = lat_deg * 100000 + lat_b;
+  *lon = -(lon_deg * 100000 + lon_b);
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Checks: each new routine against its baseline, on every input
+
+static int _checkFailures = 0;
+
+static void checkFailed(const char* name, const std::string& input) {
+  std::string shown;
+  for (char c : input) shown += c == '\r' ? "\\r" : c == '\n' ? "\\n" : std::string(1, c);
+  fprintf(stderr, "CHECK,%s,%s\n", name, shown.c_str());
+  _checkFailures++;
+}
+
+static void checkHttpAction() {
+  for (const std::string& s : _httpAction) {
+    int numbers[8];
+    int got = readNumberSet(s.c_str(), 8, numbers);
+    at::HttpAction::Reply action;
+    bool ok = at::parse<at::HttpAction>(s.c_str(), (int)s.size(), action) == at::Status::Ok;
+    if (got < 3 || !ok || action.method != numbers[got - 3] || action.status != numbers[got - 2] || action.length != numbers[got - 1]) {
+      checkFailed("at::parse/httpaction", s);
+    }
+  }
+}
+
+static void checkCsq() {
+  for (const std::string& s : _csq) {
+    int numbers[4];
+    int got = readNumberSet(s.c_str(), 4, numbers);
+    at::SignalQuality::Reply csq;
+    bool ok = at::parse<at::SignalQuality>(s.c_str(), (int)s.size(), csq) == at::Status::Ok;
+    if (got < 2 || !ok || csq.rssi != numbers[got - 2] || csq.ber != numbers[got - 1]) checkFailed("at::parse/csq", s);
+  }
+}
+
+// readNumberSet reads "4.120V" as 4 and 120; at::parse as 4120 millivolts
+static void checkCbc() {
+  for (const std::string& s : _cbc) {
+    int numbers[4];
+    int got = readNumberSet(s.c_str(), 4, numbers);
+    at::BatteryCharge::Reply cbc;
+    bool ok = at::parse<at::BatteryCharge>(s.c_str(), (int)s.size(), cbc) == at::Status::Ok;
+    if (got < 2 || !ok || cbc.volts.value != numbers[got - 2] * 1000 + numbers[got - 1]) checkFailed("at::parse/cbc", s);
+  }
+}
+
+// The legacy maths works in 1e-5 degrees and assumes north and west, so only those fixes
+// are compared, to within its rounding. Both must agree on whether there is a fix at all.
+static void checkCgpsInfo() {
+  for (const std::string& s : _cgpsInfo) {
+    long lat, lon;
+    GpsFix fix;
+    bool legacy = legacyGpsPosition(s.c_str(), &lat, &lon);
+    bool parsed = locParseCgpsInfo(s.c_str(), &fix);
+    if (legacy != parsed) { checkFailed("locParseCgpsInfo/cgpsinfo", s); continue; }
+    if (!parsed || strstr(s.c_str(), ",N,") == NULL || strstr(s.c_str(), ",W,") == NULL) continue;
+    if (labs(fix.latE6 - lat * 10) > 10 || labs(fix.lonE6 - lon * 10) > 10) checkFailed("locParseCgpsInfo/cgpsinfo", s);
+  }
+}
+
+// The recorded stream is three frames, and the top-up decodes to the values it was encoded from
+static void checkEwc() {
+  EwcFramer framer;
+  EwcFrame frame;
+  ewcFramerReset(&framer);
+  int frames = 0;
+  for (unsigned int j = 0; j < sizeof(_ewcStream); j++) frames += ewcFramerPush(&framer, _ewcStream[j], &frame) ? 1 : 0;
+  if (frames != 3) checkFailed("ewcFramerPush/3frames", "recorded stream");
+
+  ewc::TopUp expected = {0, 0xD43D46A5, 0, 0xFFFF}, topUp;
+  uint8_t buf[EWC_MAX_FRAME];
+  int length = ewc::encode(expected, buf, sizeof(buf));
+  if (length != (int)sizeof(_topUpFrame) || memcmp(buf, _topUpFrame, length) != 0) checkFailed("ewc::encode/topup", "slot 0 top-up");
+  if (ewc::decode(_topUpFrame, sizeof(_topUpFrame), topUp) != ewc::Status::Ok || topUp.slot != expected.slot ||
+      topUp.cardId != expected.cardId || topUp.credit != expected.credit || topUp.limit != expected.limit) {
+    checkFailed("ewc::decode/topup", "slot 0 top-up");
+  }
+}
+
+static void checkSpscByteRing() {
+  SpscByteRing<1024> ring;
+  uint8_t chunk[64], out[64];
+  for (int i = 0; i < 64; i++) chunk[i] = (uint8_t)i;
+  for (int i = 0; i < 100; i++) { // enough to go round the storage several times
+    if (ring.write(chunk, sizeof(chunk)) != sizeof(chunk) || ring.read(out, sizeof(out)) != sizeof(out) || memcmp(chunk, out, sizeof(out)) != 0) {
+      checkFailed("SpscByteRing/64B", "64 byte chunk");
+      return;
+    }
+  }
+}
+
+static int runChecks() {
+  checkHttpAction();
+  checkCsq();
+  checkCbc();
+  checkCgpsInfo();
+  checkEwc();
+  checkSpscByteRing();
+  return _checkFailures;
+}
+
+// ---------------------------------------------------------------------------
+// Harness
+
+static volatile long _sink; // results go here so the work isn't optimised away
+
+typedef long (*BenchFn)(long iterations);
+
+typedef struct {
+  const char* name;
+  BenchFn fn;
+} Bench;
+
+typedef struct {
+  double nsPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+} BenchResult;
+
+#define BENCH_MIN_RUN_NS 50000000.0 // calibrate until one run takes this long
+#define BENCH_RUNS 5                // the fastest run is reported
+
+static double runNs(BenchFn fn, long iterations) {
+  auto start = std::chrono::steady_clock::now();
+  _sink = fn(iterations);
+  auto end = std::chrono::steady_clock::now();
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+static BenchResult runBench(const Bench* b) {
+  long iterations = 1000;
+  while (runNs(b->fn, iterations) < BENCH_MIN_RUN_NS && iterations < (1L << 30)) iterations *= 2;
+
+  double best = 0;
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    double ns = runNs(b->fn, iterations);
+    if (i == 0 || ns < best) best = ns;
+  }
+
+  unsigned long long count = _allocCount, bytes = _allocBytes;
+  _sink = b->fn(iterations);
+  BenchResult r;
+  r.nsPerOp = best / iterations;
+  r.allocsPerOp = (double)(_allocCount - count) / iterations;
+  r.bytesPerOp = (double)(_allocBytes - bytes) / iterations;
+  return r;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks. Each op takes the next input in turn, so the mix of replies is as recorded.
+
+static long benchReadNumberSetHttpAction(long n) {
+  long sum = 0;
+  int numbers[8];
+  for (long i = 0; i < n; i++) {
+    const std::string& s = _httpAction[i % _httpAction.size()];
+    int got = readNumberSet(s.c_str(), 8, numbers); // like 04 did: method, status, length are the last three
+    if (got >= 3) sum += numbers[got - 2] + numbers[got - 1];
+  }
+  return sum;
+}
+
+static long benchAtParseHttpAction(long n) {
+  long sum = 0;
+  at::HttpAction::Reply action;
+  for (long i = 0; i < n; i++) {
+    const std::string& s = _httpAction[i % _httpAction.size()];
+    if (at::parse<at::HttpAction>(s.c_str(), (int)s.size(), action) == at::Status::Ok) sum += action.status + action.length;
+  }
+  return sum;
+}
+
+static long benchReadNumberSetCsq(long n) {
+  long sum = 0;
+  int numbers[4];
+  for (long i = 0; i < n; i++) {
+    const std::string& s = _csq[i % _csq.size()];
+    if (readNumberSet(s.c_str(), 4, numbers) >= 2) sum += numbers[0];
+  }
+  return sum;
+}
+
+static long benchAtParseCsq(long n) {
+  long sum = 0;
+  at::SignalQuality::Reply csq;
+  for (long i = 0; i < n; i++) {
+    const std::string& s = _csq[i % _csq.size()];
+    if (at::parse<at::SignalQuality>(s.c_str(), (int)s.size(), csq) == at::Status::Ok) sum += csq.rssi;
+  }
+  return sum;
+}
+
+static long benchAtParseCbc(long n) {
+  long sum = 0;
+  at::BatteryCharge::Reply cbc;
+  for (long i = 0; i < n; i++) {
+    const std::string& s = _cbc[i % _cbc.size()];
+    if (at::parse<at::BatteryCharge>(s.c_str(), (int)s.size(), cbc) == at::Status::Ok) sum += cbc.volts.value;
+  }
+  return sum;
+}
+
+static long benchLegacyGps(long n) {
+  long sum = 0, lat, lon;
+  for (long i = 0; i < n; i++) {
+    if (legacyGpsPosition(_cgpsInfo[i % _cgpsInfo.size()].c_str(), &lat, &lon)) sum += lat + lon;
+  }
+  return sum;
+}
+
+static long benchLocParseCgpsInfo(long n) {
+  long sum = 0;
+  GpsFix fix;
+  for (long i = 0; i < n; i++) {
+    if (locParseCgpsInfo(_cgpsInfo[i % _cgpsInfo.size()].c_str(), &fix)) sum += fix.latE6 + fix.lonE6;
+  }
+  return sum;
+}
+
+static long benchLocDistance(long n) {
+  long sum = 0;
+  for (long i = 0; i < n; i++) sum += locDistanceM(51824760, -3031289, 51824760 + (int32_t)(i & 1023) * 17, -3031289 - (int32_t)(i & 511) * 23);
+  return sum;
+}
+
+static long benchLocInFence(long n) {
+  static Geofence fence;
+  fence.radiusM = 0;
+  fence.pointCount = 5;
+  const int32_t points[5][2] = {{51820000, -3040000}, {51830000, -3040000}, {51832000, -3030000}, {51825000, -3020000}, {51818000, -3028000}};
+  memcpy(fence.pointsE6, points, sizeof(points));
+
+  long sum = 0;
+  for (long i = 0; i < n; i++) sum += locInFence(&fence, 51815000 + (int32_t)(i & 4095) * 5, -3045000 + (int32_t)(i & 8191) * 3);
+  return sum;
+}
+
+// One op: every byte of the recorded stream through the framer (three frames)
+static long benchEwcFramer(long n) {
+  long sum = 0;
+  EwcFramer framer;
+  EwcFrame frame;
+  ewcFramerReset(&framer);
+  for (long i = 0; i < n; i++) {
+    for (unsigned int j = 0; j < sizeof(_ewcStream); j++) {
+      if (ewcFramerPush(&framer, _ewcStream[j], &frame)) sum += frame.length;
+    }
+  }
+  return sum;
+}
+
+static long benchEwcDecodeTopUp(long n) {
+  long sum = 0;
+  ewc::TopUp topUp;
+  for (long i = 0; i < n; i++) {
+    if (ewc::decode(_topUpFrame, sizeof(_topUpFrame), topUp) == ewc::Status::Ok) sum += topUp.cardId + topUp.credit;
+  }
+  return sum;
+}
+
+static long benchEwcEncodeTopUp(long n) {
+  long sum = 0;
+  uint8_t buf[EWC_MAX_FRAME];
+  ewc::TopUp topUp = {0, 0xD43D46A5, 0, 0xFFFF};
+  for (long i = 0; i < n; i++) {
+    topUp.credit = (uint16_t)i;
+    sum += ewc::encode(topUp, buf, sizeof(buf)) + buf[3];
+  }
+  return sum;
+}
+
+// One op: a 64 byte UART read into the ring and back out, as on the EWC path
+static long benchSpscByteRing(long n) {
+  static SpscByteRing<1024> ring;
+  uint8_t chunk[64], out[64];
+  for (int i = 0; i < 64; i++) chunk[i] = (uint8_t)i;
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    ring.write(chunk, sizeof(chunk));
+    sum += ring.read(out, sizeof(out)) + out[i & 63];
+  }
+  return sum;
+}
+
+static const Bench _benches[] = {
+  {"readNumberSet/httpaction", benchReadNumberSetHttpAction},
+  {"at::parse/httpaction", benchAtParseHttpAction},
+  {"readNumberSet/csq", benchReadNumberSetCsq},
+  {"at::parse/csq", benchAtParseCsq},
+  {"at::parse/cbc", benchAtParseCbc},
+  {"legacyGps/cgpsinfo", benchLegacyGps},
+  {"locParseCgpsInfo/cgpsinfo", benchLocParseCgpsInfo},
+  {"locDistanceM", benchLocDistance},
+  {"locInFence/polygon", benchLocInFence},
+  {"ewcFramerPush/3frames", benchEwcFramer},
+  {"ewc::decode/topup", benchEwcDecodeTopUp},
+  {"ewc::encode/topup", benchEwcEncodeTopUp},
+  {"SpscByteRing/64B", benchSpscByteRing},
+};
+
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  char name[64];
+  double nsPerOp;
+} Previous;
+
+// Read BENCH lines from an earlier run
+static int loadPrevious(const char* path, Previous* out, int max) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  char line[256];
+  int count = 0;
+  while (count < max && fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "BENCH,%63[^,],%lf", out[count].name, &out[count].nsPerOp) == 2) count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(int argc, char** argv) {
+  const char* compare = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) compare = argv[++i];
+    else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      int added = loadCapture(argv[++i]);
+      if (added < 0) { fprintf(stderr, "Can't read capture '%s'\n", argv[i]); return 1; }
+      fprintf(stderr, "Added %d replies from %s\n", added, argv[i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--capture console.txt] [--compare previous.txt]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Previous previous[64];
+  int previousCount = 0;
+  if (compare != NULL) {
+    previousCount = loadPrevious(compare, previous, 64);
+    if (previousCount < 0) { fprintf(stderr, "Can't read '%s'\n", compare); return 1; }
+  }
+
+  if (runChecks() > 0) {
+    fprintf(stderr, "%d checks failed: the routines and their baselines disagree. Not timing them.\n", _checkFailures);
+    return 1;
+  }
+
+  for (const Bench& b : _benches) {
+    BenchResult r = runBench(&b);
+    printf("BENCH,%s,%.1f,%.2f,%.1f", b.name, r.nsPerOp, r.allocsPerOp, r.bytesPerOp);
+    for (int i = 0; i < previousCount; i++) {
+      if (strcmp(previous[i].name, b.name) != 0 || previous[i].nsPerOp <= 0) continue;
+      printf(",%+.1f%%", (r.nsPerOp - previous[i].nsPerOp) * 100.0 / previous[i].nsPerOp);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  return 0;
+}
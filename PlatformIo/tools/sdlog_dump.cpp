@@ -0,0 +1,143 @@
+// Read SD card captures from SdLogger (PlatformIo/common/SdLogger): /log_NNN.slg files.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=c++17 sdlog_dump.cpp -o sdlog_dump
+//   ./sdlog_dump log_000.slg log_001.slg        every record, in order, as text
+//   ./sdlog_dump --summary log_000.slg          record counts and bytes per source
+//   ./sdlog_dump --source BINLOG --raw log_000.slg | ./binlog_decode
+//                                               one source's data, joined up, for other tools
+//
+// Files of one capture (one sdLogBegin()) are read in the order given. Reading stops
+// at the first sector that is not the next of that capture: the end of the log,
+// or what is left in the preallocated space from an older one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// As in SdLogger.h
+#define SDLOG_SECTOR_BYTES 512
+#define SDLOG_SECTOR_HEADER 12
+#define SDLOG_RECORD_HEADER 6
+
+static const char* _sourceNames[] = {"?", "GNSS", "EWC", "AT_TX", "AT_RX", "BINLOG", "BENCH"};
+#define SOURCE_COUNT (int)(sizeof(_sourceNames) / sizeof(_sourceNames[0]))
+
+typedef struct {
+  uint32_t records;
+  uint64_t bytes;
+} SourceTotal;
+
+static uint32_t get32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int sourceFromName(const char* name) {
+  for (int i = 1; i < SOURCE_COUNT; i++) if (strcmp(name, _sourceNames[i]) == 0) return i;
+  return atoi(name);
+}
+
+static const char* sourceName(int source) {
+  return source < SOURCE_COUNT ? _sourceNames[source] : "?";
+}
+
+// AT text with line endings and other control bytes escaped
+static void printText(const uint8_t* data, int length) {
+  for (int i = 0; i < length; i++) {
+    uint8_t c = data[i];
+    if (c == '\r') fputs("\\r", stdout);
+    else if (c == '\n') fputs("\\n", stdout);
+    else if (c < 0x20 || c >= 0x7F) printf("\\x%02x", c);
+    else putchar(c);
+  }
+}
+
+static void printHex(const uint8_t* data, int length) {
+  for (int i = 0; i < length; i++) printf("%02x", data[i]);
+}
+
+static void printRecord(int source, uint32_t us, const uint8_t* data, int length) {
+  printf("[%5u.%06u] %-6s ", us / 1000000, us % 1000000, sourceName(source));
+  if (source == 1 && length == 28) { // GpsFix, as the ESP32 lays it out (long is 32 bits)
+    printf("lat=%.6f lon=%.6f date=%06u time=%06u alt=%.1fm speed=%dcm/s course=%d",
+           (int32_t)get32(data) / 1e6, (int32_t)get32(data + 4) / 1e6, get32(data + 8), get32(data + 12),
+           (int32_t)get32(data + 16) / 10.0, (int32_t)get32(data + 20), (int32_t)get32(data + 24));
+  } else if (source == 3 || source == 4) {
+    printText(data, length);
+  } else {
+    printHex(data, length);
+  }
+  putchar('\n');
+}
+
+int main(int argc, char** argv) {
+  bool summary = false, raw = false;
+  int only = -1;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--summary") == 0) summary = true;
+    else if (strcmp(argv[i], "--raw") == 0) raw = true;
+    else if (strcmp(argv[i], "--source") == 0 && i + 1 < argc) only = sourceFromName(argv[++i]);
+    else if (argv[i][0] == '-') { fprintf(stderr, "Unknown argument %s\n", argv[i]); return 1; }
+    else files.push_back(argv[i]);
+  }
+  if (files.empty() || (raw && only < 0)) {
+    fprintf(stderr, "Usage: sdlog_dump [--summary] [--source <name or number> [--raw]] log_000.slg [log_001.slg ...]\n");
+    return 1;
+  }
+
+  SourceTotal totals[256] = {};
+  uint32_t session = 0, sequence = 0, sectors = 0, badRecords = 0;
+  uint32_t firstUs = 0, lastUs = 0;
+  bool started = false, ended = false, haveUs = false;
+  const char* endReason = "end of files";
+
+  for (const char* path : files) {
+    if (ended) break;
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) { fprintf(stderr, "Can't open %s\n", path); return 1; }
+
+    uint8_t sector[SDLOG_SECTOR_BYTES];
+    while (fread(sector, 1, SDLOG_SECTOR_BYTES, f) == SDLOG_SECTOR_BYTES) {
+      int used = sector[2] | (sector[3] << 8);
+      if (sector[0] != 'S' || sector[1] != 'L' || used > SDLOG_SECTOR_BYTES - SDLOG_SECTOR_HEADER) { ended = true; endReason = "not a log sector"; break; }
+      if (!started) { session = get32(sector + 8); sequence = get32(sector + 4); started = true; }
+      if (get32(sector + 8) != session) { ended = true; endReason = "sector from another capture"; break; }
+      if (get32(sector + 4) != sequence) { ended = true; endReason = "sequence gap"; break; }
+      sequence++;
+      sectors++;
+
+      const uint8_t* p = sector + SDLOG_SECTOR_HEADER;
+      const uint8_t* end = p + used;
+      while (p < end) {
+        if (end - p < SDLOG_RECORD_HEADER || end - p < SDLOG_RECORD_HEADER + p[1]) { badRecords++; break; }
+        int source = p[0], length = p[1];
+        uint32_t us = get32(p + 2);
+        const uint8_t* data = p + SDLOG_RECORD_HEADER;
+        p += SDLOG_RECORD_HEADER + length;
+
+        if (!haveUs) { firstUs = us; haveUs = true; }
+        lastUs = us;
+        totals[source].records++;
+        totals[source].bytes += length;
+        if (only >= 0 && source != only) continue;
+        if (raw) fwrite(data, 1, length, stdout);
+        else if (!summary) printRecord(source, us, data, length);
+      }
+    }
+    fclose(f);
+  }
+
+  FILE* report = raw ? stderr : stdout; // keep raw output clean for the next tool
+  if (summary) {
+    fprintf(report, "source,records,bytes\n");
+    for (int s = 0; s < 256; s++) {
+      if (totals[s].records > 0) fprintf(report, "%s,%u,%llu\n", sourceName(s), totals[s].records, (unsigned long long)totals[s].bytes);
+    }
+  }
+  fprintf(stderr, "Session %08x: %u sectors (%.2f MB), %.1fs of records, %u bad records. Stopped at: %s\n",
+          session, sectors, sectors * (double)SDLOG_SECTOR_BYTES / 1e6, (lastUs - firstUs) / 1e6, badRecords, endReason);
+  return 0;
+}
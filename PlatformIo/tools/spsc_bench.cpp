@@ -0,0 +1,215 @@
+// Host benchmark for SpscRing (PlatformIo/common/SpscRing): throughput of each ring and
+// queue with the producer and consumer on two threads, as they run on the two ESP32 cores.
+//
+// Build and run on the host (from PlatformIo/tools):
+//   g++ -O2 -std=gnu++17 -pthread -I../common/SpscRing spsc_bench.cpp -o spsc_bench
+//   ./spsc_bench > before.txt
+//   (change SpscRing.h and rebuild)
+//   ./spsc_bench --compare before.txt
+//
+// Each result is a line "BENCH,<name>,<ns/op>,<MB/s>", where an op is one chunk, frame
+// or item, sized like the firmware's: 64 byte UART reads, 12 byte EWC frames and
+// 16 byte work items. The fastest of BENCH_RUNS runs is reported. Numbers are for
+// comparing one change against another on the same machine, not for the ESP32.
+// Correctness is checked by the test_spsc host test (tools/test), not here.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "SpscRing.h"
+
+#define BENCH_OPS (4L * 1024 * 1024) // per run
+#define BENCH_RUNS 5
+
+#define CHUNK_BYTES 64
+#define FRAME_BYTES 12
+#define ITEM_BYTES 16
+
+static volatile long _sink; // results go here so the work isn't optimised away
+
+typedef double (*BenchFn)(); // returns ns for BENCH_OPS ops
+
+typedef struct {
+  const char* name;
+  BenchFn fn;
+  int bytesPerOp;
+} Bench;
+
+static double nsSince(std::chrono::steady_clock::time_point start) {
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One op: a UART-sized chunk copied in by write() and out by read()
+static double benchByteRingCopy() {
+  static SpscByteRing<1024> ring;
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([]() {
+    uint8_t chunk[CHUNK_BYTES];
+    memset(chunk, 0x55, sizeof(chunk));
+    for (long i = 0; i < BENCH_OPS;) {
+      if (ring.space() < CHUNK_BYTES) { std::this_thread::yield(); continue; }
+      ring.write(chunk, CHUNK_BYTES);
+      i++;
+    }
+  });
+
+  uint8_t out[CHUNK_BYTES];
+  long sum = 0;
+  for (long got = 0; got < BENCH_OPS * CHUNK_BYTES;) {
+    uint32_t n = ring.read(out, sizeof(out));
+    if (n == 0) { std::this_thread::yield(); continue; }
+    sum += out[0];
+    got += n;
+  }
+  producer.join();
+  _sink = sum;
+  return nsSince(start);
+}
+
+// One op: a chunk filled in place through writeSpan() and consumed in place through readSpan()
+static double benchByteRingSpan() {
+  static SpscByteRing<1024> ring;
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([]() {
+    for (long sent = 0; sent < BENCH_OPS * CHUNK_BYTES;) {
+      SpscSpan span = ring.writeSpan();
+      if (span.length == 0) { std::this_thread::yield(); continue; }
+      uint32_t n = span.length < CHUNK_BYTES ? span.length : CHUNK_BYTES;
+      memset(span.data, 0x55, n);
+      ring.commitWrite(n);
+      sent += n;
+    }
+  });
+
+  long sum = 0;
+  for (long got = 0; got < BENCH_OPS * CHUNK_BYTES;) {
+    SpscSpan span = ring.readSpan();
+    if (span.length == 0) { std::this_thread::yield(); continue; }
+    sum += span.data[0];
+    ring.commitRead(span.length);
+    got += span.length;
+  }
+  producer.join();
+  _sink = sum;
+  return nsSince(start);
+}
+
+// One op: an EWC-sized frame pushed and read back out
+static double benchFrameRing() {
+  static SpscFrameRing<1024, 64> ring;
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([]() {
+    uint8_t frame[FRAME_BYTES];
+    memset(frame, 0x4C, sizeof(frame));
+    for (long i = 0; i < BENCH_OPS;) {
+      if (ring.push(frame, FRAME_BYTES)) i++;
+      else std::this_thread::yield();
+    }
+  });
+
+  uint8_t out[64];
+  long sum = 0;
+  for (long i = 0; i < BENCH_OPS;) {
+    int n = ring.read(out, sizeof(out));
+    if (n < 0) { std::this_thread::yield(); continue; }
+    sum += n;
+    i++;
+  }
+  producer.join();
+  _sink = sum;
+  return nsSince(start);
+}
+
+typedef struct {
+  uint32_t words[ITEM_BYTES / 4];
+} Item;
+
+// One op: a work item through the queue, as between TaskPipeline tasks
+static double benchQueue() {
+  static SpscQueue<Item, 32> queue;
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([]() {
+    Item item = {};
+    for (long i = 0; i < BENCH_OPS;) {
+      item.words[0] = (uint32_t)i;
+      if (queue.push(item)) i++;
+      else std::this_thread::yield();
+    }
+  });
+
+  Item item;
+  long sum = 0;
+  for (long i = 0; i < BENCH_OPS;) {
+    if (!queue.pop(item)) { std::this_thread::yield(); continue; }
+    sum += item.words[0];
+    i++;
+  }
+  producer.join();
+  _sink = sum;
+  return nsSince(start);
+}
+
+static const Bench _benches[] = {
+  {"SpscByteRing/write+read/64B", benchByteRingCopy, CHUNK_BYTES},
+  {"SpscByteRing/span/64B", benchByteRingSpan, CHUNK_BYTES},
+  {"SpscFrameRing/push+read/12B", benchFrameRing, FRAME_BYTES},
+  {"SpscQueue/push+pop/16B", benchQueue, ITEM_BYTES},
+};
+
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  char name[64];
+  double nsPerOp;
+} Previous;
+
+// Read BENCH lines from an earlier run
+static int loadPrevious(const char* path, Previous* out, int max) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  char line[256];
+  int count = 0;
+  while (count < max && fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "BENCH,%63[^,],%lf", out[count].name, &out[count].nsPerOp) == 2) count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(int argc, char** argv) {
+  const char* compare = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) compare = argv[++i];
+    else {
+      fprintf(stderr, "Usage: %s [--compare previous.txt]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Previous previous[16];
+  int previousCount = 0;
+  if (compare != NULL) {
+    previousCount = loadPrevious(compare, previous, 16);
+    if (previousCount < 0) { fprintf(stderr, "Can't read '%s'\n", compare); return 1; }
+  }
+
+  for (const Bench& b : _benches) {
+    double best = 0;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+      double ns = b.fn();
+      if (i == 0 || ns < best) best = ns;
+    }
+    double nsPerOp = best / BENCH_OPS;
+    printf("BENCH,%s,%.1f,%.1f", b.name, nsPerOp, b.bytesPerOp * 1000.0 / nsPerOp);
+    for (int i = 0; i < previousCount; i++) {
+      if (strcmp(previous[i].name, b.name) != 0 || previous[i].nsPerOp <= 0) continue;
+      printf(",%+.1f%%", (nsPerOp - previous[i].nsPerOp) * 100.0 / previous[i].nsPerOp);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  return 0;
+}
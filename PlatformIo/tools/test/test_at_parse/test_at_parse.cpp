@@ -0,0 +1,92 @@
+// Tests for the AT reply readers (PlatformIo/common/AtCatalogue): at::parse must read
+// the same numbers out of a reply as readNumberSet(), the reader it replaced.
+//
+// Run on the host (from PlatformIo/04_pio_hello_world):
+//   pio test -e native -f test_at_parse
+
+#include <unity.h>
+#include <string.h>
+
+#include <AtCatalogue.h>
+#include <NumberSet.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void test_read_number_set() {
+  int numbers[4];
+  TEST_ASSERT_EQUAL_INT(0, readNumberSet("OK", 4, numbers));
+
+  TEST_ASSERT_EQUAL_INT(3, readNumberSet("+CBC: 12.345V,-7", 4, numbers));
+  int expected[] = {12, 345, 7}; // decimals split, signs dropped
+  TEST_ASSERT_EQUAL_INT_ARRAY(expected, numbers, 3);
+
+  // More numbers than fit: the last maxCount are kept
+  TEST_ASSERT_EQUAL_INT(4, readNumberSet("1,2,3,4,5,6", 4, numbers));
+  int last[] = {3, 4, 5, 6};
+  TEST_ASSERT_EQUAL_INT_ARRAY(last, numbers, 4);
+}
+
+// HTTPACTION replies, with and without the command echo, and a modem network error
+static void test_http_action_matches() {
+  const char* replies[] = {
+    "AT+HTTPACTION=1\r\r\nOK\r\n\r\n+HTTPACTION: 1,200,68\r\n",
+    "\r\n+HTTPACTION: 0,200,104220\r\n",
+    "\r\n+HTTPACTION: 1,404,0\r\n",
+    "\r\n+HTTPACTION: 1,713,0\r\n",
+  };
+  for (const char* reply : replies) {
+    int numbers[8];
+    int got = readNumberSet(reply, 8, numbers); // method, status, length are the last three
+    TEST_ASSERT_TRUE_MESSAGE(got >= 3, reply);
+
+    at::HttpAction::Reply action;
+    TEST_ASSERT_TRUE_MESSAGE(at::parse<at::HttpAction>(reply, (int)strlen(reply), action) == at::Status::Ok, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[got - 3], action.method, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[got - 2], action.status, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[got - 1], action.length, reply);
+  }
+}
+
+static void test_signal_quality_matches() {
+  const char* replies[] = {
+    "AT+CSQ\r\r\n+CSQ: 19,99\r\n\r\nOK\r\n",
+    "\r\n+CSQ: 7,99\r\n\r\nOK\r\n",
+    "\r\n+CSQ: 99,99\r\n\r\nOK\r\n", // no signal
+  };
+  for (const char* reply : replies) {
+    int numbers[4];
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, readNumberSet(reply, 4, numbers), reply);
+
+    at::SignalQuality::Reply csq;
+    TEST_ASSERT_TRUE_MESSAGE(at::parse<at::SignalQuality>(reply, (int)strlen(reply), csq) == at::Status::Ok, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[0], csq.rssi, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[1], csq.ber, reply);
+  }
+}
+
+// readNumberSet gives volts and thousandths as two numbers; at::parse gives millivolts
+static void test_battery_charge_matches() {
+  const char* replies[] = {
+    "AT+CBC\r\r\n+CBC: 4.120V\r\n\r\nOK\r\n",
+    "\r\n+CBC: 3.702V\r\n\r\nOK\r\n",
+    "\r\n+CBC: 3.050V\r\n\r\nOK\r\n",
+  };
+  for (const char* reply : replies) {
+    int numbers[4];
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, readNumberSet(reply, 4, numbers), reply);
+
+    at::BatteryCharge::Reply cbc;
+    TEST_ASSERT_TRUE_MESSAGE(at::parse<at::BatteryCharge>(reply, (int)strlen(reply), cbc) == at::Status::Ok, reply);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(numbers[0] * 1000 + numbers[1], cbc.volts.value, reply);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_read_number_set);
+  RUN_TEST(test_http_action_matches);
+  RUN_TEST(test_signal_quality_matches);
+  RUN_TEST(test_battery_charge_matches);
+  return UNITY_END();
+}
@@ -0,0 +1,236 @@
+// Tests for SpscRing (PlatformIo/common/SpscRing): every ring and queue across two
+// threads, with the indices starting just short of the 2^32 wrap, so each run crosses it.
+//
+// Run on the host (from PlatformIo/04_pio_hello_world):
+//   pio test -e native -f test_spsc
+//
+// The producer writes a known sequence, and the consumer checks every byte, frame
+// and item arrives once and in order. Lengths vary, so the spans and frames land
+// at every offset and split (or pad) at the end of the storage. A consumer that
+// finds a mismatch stops the producer first, then fails the test.
+
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#include <SpscRing.h>
+
+#define WRAP_START(n) (0xFFFFFFFFu - (n)) // start index this far short of the wrap
+#define NO_FAULT 0xFFFFFFFFu
+
+#define STRESS_BYTES (64u * 1024 * 1024)
+#define STRESS_FRAMES (4u * 1024 * 1024)
+#define STRESS_ITEMS (16u * 1024 * 1024)
+
+static std::atomic<bool> _stop{false}; // set by a consumer that has seen a fault
+
+// Byte 'i' of the test stream
+static inline uint8_t streamByte(uint32_t i) { return (uint8_t)(i * 7 + (i >> 8)); }
+
+// Small xorshift, so both threads agree on the lengths without sharing state
+static inline uint32_t nextRandom(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+void setUp() { _stop = false; }
+void tearDown() {}
+
+// ---------------------------------------------------------------------------
+// Single thread: levels and spans either side of the wrap
+
+static void test_byte_ring_at_wrap() {
+  SpscByteRing<16> ring(WRAP_START(5)); // head and tail 6 short of 2^32
+  uint8_t in[16], out[16];
+  for (int i = 0; i < 16; i++) in[i] = (uint8_t)(i + 1);
+
+  TEST_ASSERT_EQUAL_UINT32(0, ring.available());
+  TEST_ASSERT_EQUAL_UINT32(16, ring.space());
+  TEST_ASSERT_EQUAL_UINT32(10, ring.write(in, 10));
+  TEST_ASSERT_EQUAL_UINT32(10, ring.available());
+  TEST_ASSERT_EQUAL_UINT32(6, ring.space());
+  TEST_ASSERT_EQUAL_UINT32(10, ring.read(out, 10));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(in, out, 10);
+
+  // Indices have now passed 2^32
+  TEST_ASSERT_EQUAL_UINT32(0, ring.available());
+  TEST_ASSERT_EQUAL_UINT32(16, ring.space());
+  TEST_ASSERT_EQUAL_UINT32(16, ring.write(in, 16));
+  TEST_ASSERT_EQUAL_UINT32(0, ring.space());
+  TEST_ASSERT_EQUAL_UINT32(16, ring.available());
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, ring.write(in, 3), "write to a full ring");
+  TEST_ASSERT_EQUAL_UINT32(3, ring.dropped());
+
+  SpscSpan span = ring.readSpan();
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(16 - ((WRAP_START(5) + 10) & 15), span.length, "readSpan stops at the end of the storage");
+  TEST_ASSERT_EQUAL_UINT32(16, ring.read(out, 16));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(in, out, 16);
+}
+
+static void test_frame_ring_at_wrap() {
+  SpscFrameRing<64, 16> ring(WRAP_START(23)); // rounded down to a slot: 24 bytes short of 2^32
+  uint8_t frame[16], out[16];
+  for (int i = 0; i < 16; i++) frame[i] = (uint8_t)(0xA0 + i);
+
+  // 20 byte slots. The second doesn't fit before the end of the storage, so it is padded to the start.
+  for (int i = 0; i < 3; i++) TEST_ASSERT_TRUE(ring.push(frame, 16));
+  TEST_ASSERT_EQUAL_UINT32(3, ring.count());
+  TEST_ASSERT_FALSE_MESSAGE(ring.push(frame, 16), "fourth frame should not fit");
+  TEST_ASSERT_EQUAL_UINT32(1, ring.dropped());
+
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_INT(16, ring.read(out, sizeof(out)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(frame, out, 16);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, ring.count());
+  TEST_ASSERT_NULL(ring.peek().data);
+  TEST_ASSERT_FALSE_MESSAGE(ring.push(frame, 17), "frames over MaxFrame are dropped");
+  TEST_ASSERT_EQUAL_UINT32(2, ring.dropped());
+  TEST_ASSERT_EQUAL_INT(-1, ring.read(out, sizeof(out)));
+}
+
+static void test_queue_at_wrap() {
+  SpscQueue<uint32_t, 4> queue(WRAP_START(1));
+  uint32_t item = 0;
+  for (uint32_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(queue.push(i));
+  TEST_ASSERT_TRUE(queue.full());
+  TEST_ASSERT_FALSE(queue.push(99));
+  TEST_ASSERT_EQUAL_UINT32(1, queue.rejected());
+  TEST_ASSERT_EQUAL_UINT32(4, queue.count());
+  TEST_ASSERT_EQUAL_UINT32(4, queue.highWater());
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL_UINT32(i, item);
+  }
+  TEST_ASSERT_FALSE(queue.pop(item));
+  TEST_ASSERT_EQUAL_UINT32(0, queue.count());
+}
+
+// ---------------------------------------------------------------------------
+// Two threads
+
+static void test_byte_ring_stress() {
+  static SpscByteRing<1024> ring(WRAP_START(300));
+
+  std::thread producer([]() {
+    uint32_t sent = 0, seed = 0x1234567;
+    while (sent < STRESS_BYTES && !_stop) {
+      SpscSpan span = ring.writeSpan();
+      if (span.length == 0) { std::this_thread::yield(); continue; }
+      uint32_t n = 1 + nextRandom(&seed) % 200;
+      if (n > span.length) n = span.length;
+      if (n > STRESS_BYTES - sent) n = STRESS_BYTES - sent;
+      for (uint32_t i = 0; i < n; i++) span.data[i] = streamByte(sent + i);
+      ring.commitWrite(n);
+      sent += n;
+    }
+  });
+
+  uint32_t got = 0, seed = 0x7654321, fault = NO_FAULT;
+  uint8_t buf[256];
+  while (got < STRESS_BYTES && fault == NO_FAULT) {
+    uint32_t n;
+    if (got & 1) { // alternate between reading in place and copying out
+      SpscSpan span = ring.readSpan();
+      n = span.length;
+      for (uint32_t i = 0; i < n && fault == NO_FAULT; i++) if (span.data[i] != streamByte(got + i)) fault = got + i;
+      ring.commitRead(n);
+    } else {
+      n = ring.read(buf, 1 + nextRandom(&seed) % sizeof(buf));
+      for (uint32_t i = 0; i < n && fault == NO_FAULT; i++) if (buf[i] != streamByte(got + i)) fault = got + i;
+    }
+    if (n == 0) std::this_thread::yield();
+    got += n;
+  }
+  _stop = true;
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(NO_FAULT, fault, "first wrong byte");
+  TEST_ASSERT_EQUAL_UINT32(0, ring.available());
+  TEST_ASSERT_EQUAL_UINT32(0, ring.dropped());
+}
+
+static void test_frame_ring_stress() {
+  static SpscFrameRing<1024, 64> ring(WRAP_START(500));
+
+  std::thread producer([]() {
+    uint32_t seed = 0xBEEF;
+    for (uint32_t seq = 0; seq < STRESS_FRAMES && !_stop; seq++) {
+      uint32_t length = 4 + nextRandom(&seed) % 61; // 4..64
+      uint8_t* dst;
+      while ((dst = ring.beginFrame(length)) == nullptr) {
+        if (_stop) return;
+        std::this_thread::yield();
+      }
+      memcpy(dst, &seq, 4);
+      for (uint32_t i = 4; i < length; i++) dst[i] = (uint8_t)(seq + i);
+      ring.commitFrame(length);
+    }
+  });
+
+  uint32_t seed = 0xBEEF, fault = NO_FAULT;
+  for (uint32_t seq = 0; seq < STRESS_FRAMES && fault == NO_FAULT; seq++) {
+    uint32_t length = 4 + nextRandom(&seed) % 61;
+    SpscSpan span;
+    while ((span = ring.peek()).data == nullptr) std::this_thread::yield();
+
+    uint32_t got;
+    memcpy(&got, span.data, 4);
+    if (got != seq || span.length != length || ((uintptr_t)span.data & 3) != 0) fault = seq; // out of order, wrong length or not word aligned
+    for (uint32_t i = 4; i < length && fault == NO_FAULT; i++) if (span.data[i] != (uint8_t)(seq + i)) fault = seq;
+    ring.pop();
+  }
+  _stop = true;
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(NO_FAULT, fault, "first wrong frame");
+  TEST_ASSERT_EQUAL_UINT32(0, ring.count());
+  TEST_ASSERT_NULL(ring.peek().data);
+}
+
+typedef struct {
+  uint32_t seq;
+  uint32_t check;
+} Item;
+
+static void test_queue_stress() {
+  static SpscQueue<Item, 32> queue(WRAP_START(10));
+
+  std::thread producer([]() {
+    for (uint32_t seq = 0; seq < STRESS_ITEMS; seq++) {
+      Item item = {seq, ~seq};
+      while (!queue.push(item)) {
+        if (_stop) return;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  Item item;
+  uint32_t fault = NO_FAULT;
+  for (uint32_t seq = 0; seq < STRESS_ITEMS && fault == NO_FAULT; seq++) {
+    while (!queue.pop(item)) std::this_thread::yield();
+    if (item.seq != seq || item.check != ~seq) fault = seq;
+  }
+  _stop = true;
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(NO_FAULT, fault, "first wrong item");
+  TEST_ASSERT_EQUAL_UINT32(0, queue.count());
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(32, queue.highWater());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_byte_ring_at_wrap);
+  RUN_TEST(test_frame_ring_at_wrap);
+  RUN_TEST(test_queue_at_wrap);
+  RUN_TEST(test_byte_ring_stress);
+  RUN_TEST(test_frame_ring_stress);
+  RUN_TEST(test_queue_stress);
+  return UNITY_END();
+}
@@ -0,0 +1,81 @@
+﻿using System.Numerics;
+
+namespace FleetLoad;
+
+/// <summary>
+/// Log-linear histogram of round trip times in microseconds. Every power of two
+/// is split into 64 buckets, so values are kept to within 1%, and memory stays
+/// fixed however many samples are added. Safe to add to from many threads.
+/// </summary>
+public class LatencyHistogram
+{
+    private const int SubBuckets = 64;
+    private const int MaxShift = 40; // covers far longer than any timeout
+
+    private readonly long[] _counts = new long[(MaxShift + 2) * SubBuckets];
+    private long _total;
+    private long _sumUs;
+    private long _maxUs;
+
+    public long Count => Interlocked.Read(ref _total);
+
+    public void Add(long us)
+    {
+        if (us < 0) us = 0;
+        Interlocked.Increment(ref _counts[Math.Min(Index(us), _counts.Length - 1)]);
+        Interlocked.Increment(ref _total);
+        Interlocked.Add(ref _sumUs, us);
+
+        var max = Interlocked.Read(ref _maxUs);
+        while (us > max)
+        {
+            var seen = Interlocked.CompareExchange(ref _maxUs, us, max);
+            if (seen == max) break;
+            max = seen;
+        }
+    }
+
+    public double MeanMs => Count > 0 ? Interlocked.Read(ref _sumUs) / (double)Count / 1000.0 : 0;
+
+    public double MaxMs => Interlocked.Read(ref _maxUs) / 1000.0;
+
+    /// <summary>
+    /// Value at fraction 'p' (0..1) of samples, in milliseconds. Zero if there are no samples.
+    /// </summary>
+    public double PercentileMs(double p)
+    {
+        var total = Count;
+        if (total < 1) return 0;
+
+        var rank = (long)Math.Ceiling(p * total);
+        long seen = 0;
+        for (var i = 0; i < _counts.Length; i++)
+        {
+            seen += Interlocked.Read(ref _counts[i]);
+            if (seen >= Math.Max(1, rank)) return Math.Min(Value(i), Interlocked.Read(ref _maxUs)) / 1000.0;
+        }
+        return MaxMs;
+    }
+
+    /// <summary>
+    /// Values under 128us get a bucket each. Above that, 'shift' drops the value
+    /// to 64..127, and each shift has its own run of 64 buckets.
+    /// </summary>
+    private static int Index(long us)
+    {
+        if (us < 2 * SubBuckets) return (int)us;
+        var shift = 63 - BitOperations.LeadingZeroCount((ulong)us) - 6;
+        return shift * SubBuckets + (int)(us >> shift);
+    }
+
+    /// <summary>
+    /// Middle of bucket 'index', in microseconds
+    /// </summary>
+    private static long Value(int index)
+    {
+        if (index < 2 * SubBuckets) return index;
+        var shift = index / SubBuckets - 1;
+        var sub = index - shift * SubBuckets;
+        return ((long)sub << shift) + ((1L << shift) >> 1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+﻿using System.Globalization;
+
+namespace FleetLoad;
+
+/// <summary>
+/// Settings for one load run, read from the command line
+/// </summary>
+public record LoadOptions
+{
+    public string Host { get; init; } = "127.0.0.1";
+    public int Devices { get; init; } = 1000;
+    public double DurationS { get; init; } = 30;
+
+    /// <summary> Devices start at random times across this many seconds </summary>
+    public double RampS { get; init; } = 2;
+
+    /// <summary> Services to talk to. Devices are shared out between them in turn. </summary>
+    public Mode[] Modes { get; init; } = { Mode.Test };
+
+    /// <summary> Messages per second from each device </summary>
+    public double Rate { get; init; } = 1;
+
+    /// <summary> Messages sent back-to-back each time a device wakes. The wake interval is Burst / Rate. </summary>
+    public int Burst { get; init; } = 1;
+
+    /// <summary> Random spread of the wake interval, as a fraction of it (0..1) </summary>
+    public double Jitter { get; init; } = 0.1;
+
+    /// <summary> Rough content size of each message in bytes </summary>
+    public int Payload { get; init; } = 32;
+
+    /// <summary> Wait for and time replies. Without this, messages are fire-and-forget. </summary>
+    public bool ExpectReply { get; init; } = true;
+
+    /// <summary> Messages not answered within this are counted as lost </summary>
+    public int TimeoutMs { get; init; } = 5000;
+
+    /// <summary> Give each device its own 127.x.y.z address, so the server sees separate devices </summary>
+    public bool SpreadAddresses { get; init; } = true;
+
+    /// <summary> UdpHook's loopback stats port. Zero to skip server measurements. </summary>
+    public int StatsPort { get; init; } = 425;
+
+    /// <summary> Where to write the JSON results </summary>
+    public string Out { get; init; } = "fleetload.json";
+
+    /// <summary> Exit with failure if more than this fraction of messages are lost </summary>
+    public double? MaxLoss { get; init; }
+
+    /// <summary> Exit with failure if p99 round trip is over this </summary>
+    public double? MaxP99Ms { get; init; }
+
+    public const string Usage = @"FleetLoad: simulate a fleet of devices against UdpHook
+
+    --host <address>      Server address (127.0.0.1)
+    --devices <n>         Simulated devices (1000)
+    --duration <s>        Seconds of sending (30)
+    --ramp <s>            Spread device start times over this (2)
+    --mode <list>         test, profile, bridge, tcp; comma separated (test)
+    --rate <n>            Messages per second per device (1)
+    --burst <n>           Messages sent together at each wake (1)
+    --jitter <f>          Random spread of wake interval, 0..1 (0.1)
+    --payload <bytes>     Message content size (32)
+    --no-reply            Don't wait for replies
+    --timeout <ms>        Count a message lost after this (5000)
+    --no-spread           All devices send from 127.0.0.1
+    --stats-port <n>      UdpHook stats port, 0 to skip (425)
+    --out <file>          JSON results file (fleetload.json)
+    --max-loss <f>        Fail if lost fraction is over this
+    --max-p99 <ms>        Fail if p99 round trip is over this";
+
+    /// <summary>
+    /// Read options from the command line. Throws ArgumentException for anything not understood.
+    /// </summary>
+    public static LoadOptions Parse(string[] args)
+    {
+        var options = new LoadOptions();
+        for (var i = 0; i < args.Length; i++)
+        {
+            var arg = args[i];
+            string Next() => i + 1 < args.Length ? args[++i] : throw new ArgumentException($"{arg} needs a value");
+            double Number() => double.TryParse(Next(), NumberStyles.Float, CultureInfo.InvariantCulture, out var v) ? v : throw new ArgumentException($"{arg} needs a number");
+
+            options = arg switch
+            {
+                "--host" => options with { Host = Next() },
+                "--devices" => options with { Devices = (int)Number() },
+                "--duration" => options with { DurationS = Number() },
+                "--ramp" => options with { RampS = Number() },
+                "--mode" => options with { Modes = Next().Split(',').Select(ParseMode).ToArray() },
+                "--rate" => options with { Rate = Number() },
+                "--burst" => options with { Burst = (int)Number() },
+                "--jitter" => options with { Jitter = Number() },
+                "--payload" => options with { Payload = (int)Number() },
+                "--no-reply" => options with { ExpectReply = false },
+                "--timeout" => options with { TimeoutMs = (int)Number() },
+                "--no-spread" => options with { SpreadAddresses = false },
+                "--stats-port" => options with { StatsPort = (int)Number() },
+                "--out" => options with { Out = Next() },
+                "--max-loss" => options with { MaxLoss = Number() },
+                "--max-p99" => options with { MaxP99Ms = Number() },
+                _ => throw new ArgumentException($"Unknown option '{arg}'")
+            };
+        }
+
+        if (options.Devices < 1) throw new ArgumentException("--devices must be at least 1");
+        if (options.Rate <= 0) throw new ArgumentException("--rate must be more than zero");
+        if (options.Burst < 1) throw new ArgumentException("--burst must be at least 1");
+        if (options.Jitter is < 0 or > 1) throw new ArgumentException("--jitter must be 0..1");
+        return options;
+    }
+
+    private static Mode ParseMode(string name)
+    {
+        return Enum.TryParse<Mode>(name.Trim(), ignoreCase: true, out var mode) ? mode : throw new ArgumentException($"Unknown mode '{name}'");
+    }
+}
\ No newline at end of file
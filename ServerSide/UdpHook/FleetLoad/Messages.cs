@@ -0,0 +1,145 @@
+﻿using System.Text;
+
+namespace FleetLoad;
+
+/// <summary>
+/// Which UdpHook service a simulated device talks to
+/// </summary>
+public enum Mode
+{
+    /// <summary> UDP 420 text echo </summary>
+    Test,
+
+    /// <summary> UDP 422 PhaseProfiler summaries </summary>
+    Profile,
+
+    /// <summary> UDP 423 EwcBridge datagrams </summary>
+    Bridge,
+
+    /// <summary> TCP 424 length-prefixed text echo </summary>
+    Tcp
+}
+
+/// <summary>
+/// Builds messages in the firmware's formats, and reads the sequence number back out of replies
+/// </summary>
+public static class Messages
+{
+    private const ushort ProfileMagic = 0x5046;
+    private const int ProfileHeaderBytes = 10;
+    private const int ProfileRecordBytes = 18;
+
+    private const ushort BridgeMagic = 0x4245;
+    private const int BridgeHeaderBytes = 12;
+    private const int BridgeFrameOverhead = 6;
+    private static readonly uint BridgeBootId = (uint)Random.Shared.Next(); // one boot per run
+
+    public static int Port(Mode mode) => mode switch
+    {
+        Mode.Test => 420,
+        Mode.Profile => 422,
+        Mode.Bridge => 423,
+        Mode.Tcp => 424,
+        _ => throw new ArgumentOutOfRangeException(nameof(mode))
+    };
+
+    /// <summary>
+    /// Build one message. 'payload' is roughly how many bytes of content to carry.
+    /// </summary>
+    public static byte[] Build(Mode mode, int device, ushort seq, int payload)
+    {
+        return mode switch
+        {
+            Mode.Test or Mode.Tcp => Text(device, seq, payload),
+            Mode.Profile => Profile(seq, payload),
+            Mode.Bridge => Bridge(seq, payload),
+            _ => throw new ArgumentOutOfRangeException(nameof(mode))
+        };
+    }
+
+    /// <summary>
+    /// Sequence number a reply answers, or -1 if the reply doesn't say (then it answers the oldest message)
+    /// </summary>
+    public static int ReplySeq(Mode mode, ReadOnlySpan<byte> reply)
+    {
+        var text = Encoding.UTF8.GetString(reply);
+        var marker = mode switch
+        {
+            Mode.Test or Mode.Tcp => "#",
+            Mode.Bridge => "ACK ",
+            _ => null
+        };
+        if (marker is null) return -1;
+
+        var start = text.IndexOf(marker, StringComparison.Ordinal);
+        if (start < 0) return -1;
+        start += marker.Length;
+
+        var end = start;
+        while (end < text.Length && char.IsDigit(text[end])) end++;
+        return int.TryParse(text.AsSpan(start, end - start), out var seq) ? seq : -1;
+    }
+
+    /// <summary>
+    /// "dev 12 #345 xxxx..." -- the echo services send this back inside their reply
+    /// </summary>
+    private static byte[] Text(int device, ushort seq, int payload)
+    {
+        var text = $"dev {device} #{seq} ";
+        if (text.Length < payload) text += new string('x', payload - text.Length);
+        return Encoding.UTF8.GetBytes(text);
+    }
+
+    /// <summary>
+    /// Same layout as PhaseProfiler's summary, with enough records to fill the payload
+    /// </summary>
+    private static byte[] Profile(ushort cycle, int payload)
+    {
+        var count = Math.Clamp(payload / ProfileRecordBytes, 1, 64);
+        var data = new byte[ProfileHeaderBytes + count * ProfileRecordBytes];
+
+        BitConverter.TryWriteBytes(data.AsSpan(0), ProfileMagic);
+        data[2] = 1; // version
+        data[3] = ProfileRecordBytes;
+        BitConverter.TryWriteBytes(data.AsSpan(4), cycle);
+        BitConverter.TryWriteBytes(data.AsSpan(6), (ushort)0); // dropped
+        BitConverter.TryWriteBytes(data.AsSpan(8), (ushort)count);
+
+        for (var i = 0; i < count; i++)
+        {
+            var o = ProfileHeaderBytes + i * ProfileRecordBytes;
+            BitConverter.TryWriteBytes(data.AsSpan(o), cycle);
+            data[o + 2] = (byte)(i % 9); // phase
+            data[o + 3] = 0x01; // ok
+            BitConverter.TryWriteBytes(data.AsSpan(o + 4), (uint)(i * 100)); // start ms
+            BitConverter.TryWriteBytes(data.AsSpan(o + 8), (uint)50_000); // duration us
+            BitConverter.TryWriteBytes(data.AsSpan(o + 12), (ushort)4100);
+            BitConverter.TryWriteBytes(data.AsSpan(o + 14), (ushort)4080);
+            BitConverter.TryWriteBytes(data.AsSpan(o + 16), (ushort)3900);
+        }
+        return data;
+    }
+
+    /// <summary>
+    /// Same layout as the firmware's EwcBridge datagram, with one frame holding the payload
+    /// </summary>
+    private static byte[] Bridge(ushort seq, int payload)
+    {
+        var length = Math.Clamp(payload, 3, 255);
+        var data = new byte[BridgeHeaderBytes + BridgeFrameOverhead + length];
+
+        BitConverter.TryWriteBytes(data.AsSpan(0), BridgeMagic);
+        data[2] = 2; // version
+        data[3] = 1; // frame count
+        BitConverter.TryWriteBytes(data.AsSpan(4), seq);
+        BitConverter.TryWriteBytes(data.AsSpan(6), (ushort)0); // dropped
+        BitConverter.TryWriteBytes(data.AsSpan(8), BridgeBootId);
+
+        var o = BridgeHeaderBytes;
+        BitConverter.TryWriteBytes(data.AsSpan(o), (uint)0); // age ms
+        data[o + 4] = 0; // flags
+        data[o + 5] = (byte)length;
+        for (var i = 0; i < length; i++) data[o + BridgeFrameOverhead + i] = (byte)(0x40 + i % 32);
+        return data;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+﻿using System.Diagnostics;
+using System.Net;
+using System.Net.Sockets;
+using System.Text.Json;
+using System.Text.Json.Serialization;
+
+namespace FleetLoad;
+
+/// <summary>
+/// Server process counters, as sent by UdpHook's stats port
+/// </summary>
+public record ServerStats(
+    long UptimeMs, double CpuMs, long AllocatedBytes, long HeapBytes,
+    int Gen0Collections, int Gen1Collections, int Gen2Collections,
+    ulong UdpBytesIn, ulong UdpBytesOut, long UdpDropped, int Sessions,
+    int TcpConnections, long LogDropped, long LogSampledOut);
+
+/// <summary>
+/// Server cost over a run, from stats taken at the start and end
+/// </summary>
+public record ServerUsage(
+    double CpuPercent, double AllocatedBytesPerSecond, long HeapBytes,
+    int Gen0Collections, int Gen1Collections, int Gen2Collections,
+    long UdpDropped, int Sessions, long LogDropped, long LogSampledOut);
+
+public record LatencySummary(long Count, double MeanMs, double P50Ms, double P99Ms, double P999Ms, double MaxMs);
+
+/// <summary>
+/// Everything measured in one run. Written as JSON so runs can be compared over time.
+/// </summary>
+public record LoadResults(
+    int Format, DateTime StartedUtc, string Machine, int Processors, LoadOptions Options,
+    double ElapsedS, long Sent, long Replies, long Lost, long Unmatched, long SendErrors,
+    double SentPerSecond, double RepliesPerSecond, double LossFraction,
+    LatencySummary Rtt, ServerUsage? Server, double GeneratorCpuPercent, bool Passed);
+
+internal static class Program
+{
+    private static readonly JsonSerializerOptions JsonOptions = new()
+    {
+        WriteIndented = true,
+        PropertyNamingPolicy = JsonNamingPolicy.CamelCase,
+        Converters = { new JsonStringEnumConverter(JsonNamingPolicy.CamelCase) }
+    };
+
+    public static async Task<int> Main(string[] args)
+    {
+        LoadOptions options;
+        try
+        {
+            options = LoadOptions.Parse(args);
+        }
+        catch (ArgumentException ex)
+        {
+            Console.Error.WriteLine(ex.Message);
+            Console.Error.WriteLine(LoadOptions.Usage);
+            return 2;
+        }
+
+        var server = (await Dns.GetHostAddressesAsync(options.Host)).First(a => a.AddressFamily == AddressFamily.InterNetwork);
+        if (options.SpreadAddresses && !CanBind(DeviceAddress(1)))
+        {
+            Console.WriteLine("Can't bind 127.x.y.z addresses here; all devices will send from 127.0.0.1");
+            options = options with { SpreadAddresses = false };
+        }
+
+        // Every device keeps a socket open
+        ThreadPool.SetMinThreads(Math.Max(Environment.ProcessorCount * 4, 32), Environment.ProcessorCount * 4);
+
+        var counters = new FleetCounters();
+        var devices = Enumerable.Range(0, options.Devices)
+            .Select(i => new SimDevice(i, options.Modes[i % options.Modes.Length], options, counters, server,
+                options.SpreadAddresses ? DeviceAddress(i) : IPAddress.Loopback))
+            .ToList();
+
+        Console.WriteLine($"{options.Devices} devices, {string.Join(",", options.Modes)}, {options.Rate}/s each in bursts of {options.Burst}, {options.DurationS}s to {server}");
+
+        var startedUtc = DateTime.UtcNow;
+        var serverBefore = await QueryServer(server, options.StatsPort);
+        var cpuBefore = Process.GetCurrentProcess().TotalProcessorTime;
+        var clock = Stopwatch.StartNew();
+
+        using var stopSending = new CancellationTokenSource(TimeSpan.FromSeconds(options.DurationS + options.RampS));
+        using var progress = new Timer(_ => Console.WriteLine($"  {clock.Elapsed.TotalSeconds,6:0.0}s sent={Interlocked.Read(ref counters.Sent)} replies={Interlocked.Read(ref counters.Replies)} p99={counters.Rtt.PercentileMs(0.99):0.00}ms"), null, 5000, 5000);
+        await Task.WhenAll(devices.Select(d => Task.Run(() => d.Run(stopSending.Token))));
+
+        var sendingS = options.DurationS + options.RampS;
+        var elapsedS = clock.Elapsed.TotalSeconds;
+        var generatorCpu = (Process.GetCurrentProcess().TotalProcessorTime - cpuBefore).TotalMilliseconds / (elapsedS * 1000) / Environment.ProcessorCount * 100;
+        var serverAfter = await QueryServer(server, options.StatsPort);
+
+        var rtt = new LatencySummary(counters.Rtt.Count, counters.Rtt.MeanMs, counters.Rtt.PercentileMs(0.5), counters.Rtt.PercentileMs(0.99), counters.Rtt.PercentileMs(0.999), counters.Rtt.MaxMs);
+        var lossFraction = options.ExpectReply && counters.Sent > 0 ? counters.Lost / (double)counters.Sent : 0;
+        var passed = (options.MaxLoss is null || lossFraction <= options.MaxLoss) && (options.MaxP99Ms is null || rtt.P99Ms <= options.MaxP99Ms);
+
+        var results = new LoadResults(
+            Format: 1, StartedUtc: startedUtc, Machine: Environment.MachineName, Processors: Environment.ProcessorCount, Options: options,
+            ElapsedS: elapsedS, Sent: counters.Sent, Replies: counters.Replies, Lost: counters.Lost, Unmatched: counters.Unmatched, SendErrors: counters.SendErrors,
+            SentPerSecond: counters.Sent / sendingS, RepliesPerSecond: counters.Replies / sendingS, LossFraction: lossFraction,
+            Rtt: rtt, Server: Usage(serverBefore, serverAfter), GeneratorCpuPercent: generatorCpu, Passed: passed);
+
+        PrintSummary(results);
+        await File.WriteAllTextAsync(options.Out, JsonSerializer.Serialize(results, JsonOptions));
+        Console.WriteLine($"Results written to {options.Out}");
+
+        return passed ? 0 : 1;
+    }
+
+    /// <summary>
+    /// Loopback address for a device: 127.0.1.1, 127.0.1.2, ... avoiding .0 and .255
+    /// </summary>
+    private static IPAddress DeviceAddress(int index)
+    {
+        var host = index % 254 + 1;
+        var rest = index / 254 + 1;
+        return new IPAddress(new byte[] { 127, (byte)(rest >> 8), (byte)rest, (byte)host });
+    }
+
+    private static bool CanBind(IPAddress address)
+    {
+        try
+        {
+            using var socket = new Socket(AddressFamily.InterNetwork, SocketType.Dgram, ProtocolType.Udp);
+            socket.Bind(new IPEndPoint(address, 0));
+            return true;
+        }
+        catch (SocketException)
+        {
+            return false;
+        }
+    }
+
+    /// <summary>
+    /// Ask UdpHook for its process counters. Null if stats are off or the server doesn't answer.
+    /// </summary>
+    private static async Task<ServerStats?> QueryServer(IPAddress server, int port)
+    {
+        if (port < 1) return null;
+
+        using var socket = new Socket(AddressFamily.InterNetwork, SocketType.Dgram, ProtocolType.Udp);
+        using var timeout = new CancellationTokenSource(1000);
+        try
+        {
+            await socket.SendToAsync(new byte[] { 0 }, SocketFlags.None, new IPEndPoint(server, port));
+            var buffer = new byte[4096];
+            var result = await socket.ReceiveFromAsync(buffer, SocketFlags.None, new IPEndPoint(IPAddress.Any, 0), timeout.Token);
+            return JsonSerializer.Deserialize<ServerStats>(buffer.AsSpan(0, result.ReceivedBytes));
+        }
+        catch (Exception ex) when (ex is OperationCanceledException or SocketException or JsonException)
+        {
+            Console.WriteLine($"No stats from {server}:{port}; server usage will not be reported");
+            return null;
+        }
+    }
+
+    private static ServerUsage? Usage(ServerStats? before, ServerStats? after)
+    {
+        if (before is null || after is null) return null;
+
+        var wallMs = Math.Max(1, after.UptimeMs - before.UptimeMs);
+        return new ServerUsage(
+            CpuPercent: (after.CpuMs - before.CpuMs) / wallMs * 100,
+            AllocatedBytesPerSecond: (after.AllocatedBytes - before.AllocatedBytes) / (wallMs / 1000.0),
+            HeapBytes: after.HeapBytes,
+            Gen0Collections: after.Gen0Collections - before.Gen0Collections,
+            Gen1Collections: after.Gen1Collections - before.Gen1Collections,
+            Gen2Collections: after.Gen2Collections - before.Gen2Collections,
+            UdpDropped: after.UdpDropped - before.UdpDropped,
+            Sessions: after.Sessions,
+            LogDropped: after.LogDropped - before.LogDropped,
+            LogSampledOut: after.LogSampledOut - before.LogSampledOut);
+    }
+
+    private static void PrintSummary(LoadResults r)
+    {
+        Console.WriteLine($"Sent {r.Sent} ({r.SentPerSecond:0}/s), replies {r.Replies} ({r.RepliesPerSecond:0}/s), lost {r.Lost} ({r.LossFraction:P2}), unmatched {r.Unmatched}, send errors {r.SendErrors}");
+        Console.WriteLine($"Round trip ms: mean={r.Rtt.MeanMs:0.00} p50={r.Rtt.P50Ms:0.00} p99={r.Rtt.P99Ms:0.00} p999={r.Rtt.P999Ms:0.00} max={r.Rtt.MaxMs:0.00}");
+        if (r.Server is { } s)
+        {
+            Console.WriteLine($"Server: cpu={s.CpuPercent:0.0}% alloc={s.AllocatedBytesPerSecond / 1e6:0.00}MB/s gc={s.Gen0Collections}/{s.Gen1Collections}/{s.Gen2Collections} heap={s.HeapBytes / 1e6:0.0}MB udpDropped={s.UdpDropped} logDropped={s.LogDropped} sessions={s.Sessions}");
+        }
+        Console.WriteLine($"Generator cpu={r.GeneratorCpuPercent:0.0}% of all cores{(r.Passed ? "" : "; FAILED thresholds")}");
+    }
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+﻿using System.Buffers.Binary;
+using System.Diagnostics;
+using System.Net;
+using System.Net.Sockets;
+
+namespace FleetLoad;
+
+/// <summary>
+/// Counters shared by every simulated device
+/// </summary>
+public class FleetCounters
+{
+    public long Sent;
+    public long Replies;
+    public long Lost;
+    public long Unmatched;
+    public long SendErrors;
+    public readonly LatencyHistogram Rtt = new();
+}
+
+/// <summary>
+/// One simulated device. Wakes at its send rate, sends a burst of messages,
+/// and matches replies to what it sent to time round trips.
+/// <p></p>
+/// UdpHook handles each device's messages in order, so a reply for message N
+/// means anything older still waiting was lost.
+/// </summary>
+public class SimDevice
+{
+    private const int ReceiveBytes = 8192;
+
+    private readonly int _index;
+    private readonly Mode _mode;
+    private readonly LoadOptions _options;
+    private readonly FleetCounters _counters;
+    private readonly IPEndPoint _server;
+    private readonly IPAddress _local;
+    private readonly Queue<(ushort Seq, long SentTicks)> _waiting = new();
+    private readonly Random _random;
+    private ushort _seq;
+
+    public SimDevice(int index, Mode mode, LoadOptions options, FleetCounters counters, IPAddress server, IPAddress local)
+    {
+        _index = index;
+        _mode = mode;
+        _options = options;
+        _counters = counters;
+        _server = new IPEndPoint(server, Messages.Port(mode));
+        _local = local;
+        _random = new Random(index);
+    }
+
+    /// <summary>
+    /// Send until 'stopSending', then wait for outstanding replies (up to the timeout)
+    /// </summary>
+    public async Task Run(CancellationToken stopSending)
+    {
+        if (_mode == Mode.Tcp) await RunTcp(stopSending);
+        else await RunUdp(stopSending);
+    }
+
+    private async Task RunUdp(CancellationToken stopSending)
+    {
+        using var socket = new Socket(AddressFamily.InterNetwork, SocketType.Dgram, ProtocolType.Udp);
+        socket.Bind(new IPEndPoint(_local, 0));
+
+        using var stopReceiving = new CancellationTokenSource();
+        var receiving = _options.ExpectReply ? ReceiveUdp(socket, stopReceiving.Token) : Task.CompletedTask;
+
+        await SendLoop(stopSending, message => socket.SendToAsync(message, SocketFlags.None, _server));
+
+        await Drain();
+        stopReceiving.Cancel();
+        await receiving;
+    }
+
+    private async Task ReceiveUdp(Socket socket, CancellationToken token)
+    {
+        var buffer = new byte[ReceiveBytes];
+        var any = new IPEndPoint(IPAddress.Any, 0);
+        while (!token.IsCancellationRequested)
+        {
+            try
+            {
+                var result = await socket.ReceiveFromAsync(buffer, SocketFlags.None, any, token);
+                Answered(buffer.AsSpan(0, result.ReceivedBytes));
+            }
+            catch (OperationCanceledException)
+            {
+                return;
+            }
+            catch (SocketException)
+            {
+                // ICMP unreachable from an earlier send; the message is counted lost later
+            }
+        }
+    }
+
+    private async Task RunTcp(CancellationToken stopSending)
+    {
+        using var client = new TcpClient(new IPEndPoint(_local, 0));
+        try
+        {
+            await client.ConnectAsync(_server.Address, _server.Port, stopSending);
+        }
+        catch (Exception) when (!stopSending.IsCancellationRequested)
+        {
+            Interlocked.Increment(ref _counters.SendErrors);
+            return;
+        }
+        catch (OperationCanceledException)
+        {
+            return;
+        }
+
+        var stream = client.GetStream();
+        using var stopReceiving = new CancellationTokenSource();
+        var receiving = _options.ExpectReply ? ReceiveTcp(stream, stopReceiving.Token) : Task.CompletedTask;
+
+        var frame = new byte[2 + ushort.MaxValue];
+        await SendLoop(stopSending, async message =>
+        {
+            BinaryPrimitives.WriteUInt16LittleEndian(frame, (ushort)message.Length);
+            message.CopyTo(frame, 2);
+            await stream.WriteAsync(frame.AsMemory(0, 2 + message.Length));
+        });
+
+        await Drain();
+        stopReceiving.Cancel();
+        await receiving;
+    }
+
+    private async Task ReceiveTcp(NetworkStream stream, CancellationToken token)
+    {
+        var buffer = new byte[2 + ushort.MaxValue];
+        try
+        {
+            while (true)
+            {
+                if (!await ReadFully(stream, buffer.AsMemory(0, 2), token)) return;
+                var length = BinaryPrimitives.ReadUInt16LittleEndian(buffer);
+                if (!await ReadFully(stream, buffer.AsMemory(0, length), token)) return;
+                Answered(buffer.AsSpan(0, length));
+            }
+        }
+        catch (Exception) when (token.IsCancellationRequested)
+        {
+            // done
+        }
+        catch (IOException)
+        {
+            // server closed; waiting messages are counted lost
+        }
+    }
+
+    private static async Task<bool> ReadFully(Stream stream, Memory<byte> target, CancellationToken token)
+    {
+        while (target.Length > 0)
+        {
+            var read = await stream.ReadAsync(target, token);
+            if (read < 1) return false;
+            target = target[read..];
+        }
+        return true;
+    }
+
+    private async Task SendLoop(CancellationToken stopSending, Func<byte[], Task> send)
+    {
+        var interval = _options.Burst / _options.Rate;
+        try
+        {
+            await Task.Delay(TimeSpan.FromSeconds(_random.NextDouble() * _options.RampS), stopSending);
+            while (!stopSending.IsCancellationRequested)
+            {
+                for (var i = 0; i < _options.Burst; i++)
+                {
+                    var seq = _seq++;
+                    var message = Messages.Build(_mode, _index, seq, _options.Payload);
+                    if (_options.ExpectReply)
+                    {
+                        lock (_waiting) _waiting.Enqueue((seq, Stopwatch.GetTimestamp()));
+                    }
+
+                    try
+                    {
+                        await send(message);
+                        Interlocked.Increment(ref _counters.Sent);
+                    }
+                    catch (Exception) when (!stopSending.IsCancellationRequested)
+                    {
+                        Interlocked.Increment(ref _counters.SendErrors);
+                    }
+                }
+
+                var wait = interval * (1 + _options.Jitter * (_random.NextDouble() * 2 - 1));
+                await Task.Delay(TimeSpan.FromSeconds(wait), stopSending);
+            }
+        }
+        catch (OperationCanceledException)
+        {
+            // end of run
+        }
+    }
+
+    /// <summary>
+    /// Match a reply to the message it answers, and record the round trip
+    /// </summary>
+    private void Answered(ReadOnlySpan<byte> reply)
+    {
+        var now = Stopwatch.GetTimestamp();
+        var seq = Messages.ReplySeq(_mode, reply);
+
+        lock (_waiting)
+        {
+            if (seq >= 0 && !_waiting.Any(w => w.Seq == seq))
+            {
+                Interlocked.Increment(ref _counters.Unmatched); // repeat, or answered after we gave up
+                return;
+            }
+
+            while (_waiting.Count > 0)
+            {
+                var (sentSeq, sentTicks) = _waiting.Dequeue();
+                if (seq >= 0 && sentSeq != seq)
+                {
+                    Interlocked.Increment(ref _counters.Lost); // older than the one answered
+                    continue;
+                }
+
+                Interlocked.Increment(ref _counters.Replies);
+                _counters.Rtt.Add((now - sentTicks) * 1_000_000 / Stopwatch.Frequency);
+                return;
+            }
+        }
+
+        Interlocked.Increment(ref _counters.Unmatched);
+    }
+
+    /// <summary>
+    /// Wait for the last replies, then count anything still waiting as lost
+    /// </summary>
+    private async Task Drain()
+    {
+        var deadline = Stopwatch.GetTimestamp() + _options.TimeoutMs * Stopwatch.Frequency / 1000;
+        while (Stopwatch.GetTimestamp() < deadline)
+        {
+            lock (_waiting)
+            {
+                if (_waiting.Count < 1) return;
+            }
+            await Task.Delay(20);
+        }
+
+        lock (_waiting)
+        {
+            Interlocked.Add(ref _counters.Lost, _waiting.Count);
+            _waiting.Clear();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,172 @@
+﻿using System.Globalization;
+using System.Net;
+using System.Text.RegularExpressions;
+
+namespace OtaServer;
+
+/// <summary>
+/// Stand-in for the firmware update server. Serves delta files (made by PlatformIo/tools/delta_make)
+/// from a directory, with the HTTP byte ranges the devices ask for.
+/// <p></p>
+/// Devices GET '.../&lt;build id&gt;.delta' with a 'Range: bytes=a-b' header, and expect 206 Partial Content.
+/// Only the file name of the URL is used, so any OTA_URL_BASE path works. A missing file is 404,
+/// which devices take as 'no update'. To test resuming, --fail-every cuts off every Nth response part way.
+/// </summary>
+internal static class Program
+{
+    private const string Usage = @"OtaServer: serve firmware deltas over HTTP, with byte ranges
+
+    --port <n>            Port to listen on (8080)
+    --dir <path>          Directory of .delta files (.)
+    --fail-every <n>      Cut off every nth response half way, to test resuming (0: never)";
+
+    private static readonly Regex RangePattern = new(@"^bytes=(\d+)-(\d*)$", RegexOptions.Compiled);
+
+    private static string _directory = ".";
+    private static int _failEvery;
+    private static int _requests;
+    private static long _bytesSent;
+
+    public static async Task<int> Main(string[] args)
+    {
+        var port = 8080;
+        try
+        {
+            for (var i = 0; i < args.Length; i++)
+            {
+                var arg = args[i];
+                string Next() => i + 1 < args.Length ? args[++i] : throw new ArgumentException($"{arg} needs a value");
+                int Number() => int.TryParse(Next(), NumberStyles.Integer, CultureInfo.InvariantCulture, out var v) ? v : throw new ArgumentException($"{arg} needs a number");
+
+                switch (arg)
+                {
+                    case "--port": port = Number(); break;
+                    case "--dir": _directory = Next(); break;
+                    case "--fail-every": _failEvery = Number(); break;
+                    default: throw new ArgumentException($"Unknown option '{arg}'");
+                }
+            }
+            if (!Directory.Exists(_directory)) throw new ArgumentException($"No directory '{_directory}'");
+        }
+        catch (ArgumentException ex)
+        {
+            Console.Error.WriteLine(ex.Message);
+            Console.Error.WriteLine(Usage);
+            return 2;
+        }
+
+        using var listener = new HttpListener();
+        listener.Prefixes.Add($"http://*:{port}/");
+        listener.Start();
+        Console.WriteLine($"Serving {Path.GetFullPath(_directory)} on port {port}" + (_failEvery > 0 ? $", cutting off every {_failEvery} responses" : ""));
+
+        Console.CancelKeyPress += (_, e) =>
+        {
+            e.Cancel = true;
+            listener.Stop();
+        };
+
+        while (listener.IsListening)
+        {
+            HttpListenerContext context;
+            try
+            {
+                context = await listener.GetContextAsync();
+            }
+            catch (Exception ex) when (ex is HttpListenerException or ObjectDisposedException)
+            {
+                break; // stopped
+            }
+            _ = Task.Run(() => Serve(context));
+        }
+
+        Console.WriteLine($"{_requests} requests, {_bytesSent} bytes sent");
+        return 0;
+    }
+
+    private static async Task Serve(HttpListenerContext context)
+    {
+        var request = context.Request;
+        var response = context.Response;
+        var number = Interlocked.Increment(ref _requests);
+        var name = Path.GetFileName(request.Url?.AbsolutePath ?? "");
+        var range = request.Headers["Range"];
+        var remote = request.RemoteEndPoint;
+        var method = request.HttpMethod;
+        var status = 0;
+        var sent = 0L;
+
+        try
+        {
+            var path = Path.Combine(_directory, name);
+            if (method != "GET" && method != "HEAD")
+            {
+                status = 405;
+            }
+            else if (name.Length == 0 || !File.Exists(path))
+            {
+                status = 404;
+            }
+            else
+            {
+                var data = await File.ReadAllBytesAsync(path);
+                long start = 0, end = data.Length - 1;
+                status = 200;
+                if (range is not null)
+                {
+                    var match = RangePattern.Match(range.Trim());
+                    if (!match.Success || !long.TryParse(match.Groups[1].Value, out start) || start >= data.Length)
+                    {
+                        status = 416;
+                        response.AddHeader("Content-Range", $"bytes */{data.Length}");
+                    }
+                    else
+                    {
+                        if (match.Groups[2].Value.Length > 0 && long.TryParse(match.Groups[2].Value, out var last)) end = Math.Min(last, end);
+                        if (end < start) status = 416;
+                        else
+                        {
+                            status = 206;
+                            response.AddHeader("Content-Range", $"bytes {start}-{end}/{data.Length}");
+                        }
+                    }
+                }
+
+                if (status is 200 or 206)
+                {
+                    var length = (int)(end - start + 1);
+                    response.StatusCode = status;
+                    response.ContentType = "application/octet-stream";
+                    response.ContentLength64 = length;
+                    response.AddHeader("Accept-Ranges", "bytes");
+                    if (method == "GET")
+                    {
+                        // Pretend the connection dropped: send half, then reset
+                        if (_failEvery > 0 && number % _failEvery == 0)
+                        {
+                            await response.OutputStream.WriteAsync(data.AsMemory((int)start, length / 2));
+                            Interlocked.Add(ref _bytesSent, length / 2);
+                            response.Abort();
+                            Console.WriteLine($"{DateTime.Now:HH:mm:ss} {remote} GET {name} {range} -> cut off after {length / 2} bytes");
+                            return;
+                        }
+                        await response.OutputStream.WriteAsync(data.AsMemory((int)start, length));
+                        sent = length;
+                    }
+                }
+            }
+
+            if (status is not (200 or 206)) response.StatusCode = status;
+            response.Close();
+        }
+        catch (Exception ex)
+        {
+            Console.WriteLine($"{DateTime.Now:HH:mm:ss} {remote} {name}: {ex.Message}");
+            response.Abort();
+            return;
+        }
+
+        Interlocked.Add(ref _bytesSent, sent);
+        Console.WriteLine($"{DateTime.Now:HH:mm:ss} {remote} {method} {name} {range} -> {status} {sent} bytes");
+    }
+}
@@ -0,0 +1,233 @@
+﻿using System.Collections.Concurrent;
+using System.Net;
+
+namespace UdpHook;
+
+/// <summary>
+/// Traffic totals across all device sessions at one moment
+/// </summary>
+/// <param name="Devices">Sessions held</param>
+/// <param name="Active">Sessions seen within the active window</param>
+/// <param name="PacketsIn">Datagrams received from all devices</param>
+/// <param name="BytesIn">Bytes received from all devices</param>
+/// <param name="PacketsOut">Datagrams sent to all devices</param>
+/// <param name="BytesOut">Bytes sent to all devices</param>
+/// <param name="MeanRttMs">Mean of the RTT estimates of devices that have one, or zero</param>
+public readonly record struct SessionSnapshot(int Devices, int Active, long PacketsIn, long BytesIn, long PacketsOut, long BytesOut, double MeanRttMs);
+
+/// <summary>
+/// What the server knows about one device: traffic counters, when it was
+/// last heard from, a smoothed round trip time, and how to send to it.
+/// <p></p>
+/// Counters are updated with Interlocked, so any number of receive workers
+/// and senders can touch a session without locks.
+/// </summary>
+public class DeviceSession
+{
+    /// <summary> Probes older than this are not counted as a round trip </summary>
+    private static readonly long ProbeTimeoutTicks = TimeSpan.FromSeconds(30).Ticks;
+
+    private long _packetsIn, _bytesIn, _packetsOut, _bytesOut;
+    private long _lastSeenTicks;
+    private long _probeSentTicks;
+    private long _rttTicks; // smoothed, zero until the first sample
+    private volatile IPEndPoint _endpoint;
+    private volatile IUdpSender? _returnPath;
+
+    public DeviceSession(string id, IPEndPoint endpoint)
+    {
+        Id = id;
+        _endpoint = endpoint;
+        _lastSeenTicks = DateTime.UtcNow.Ticks;
+    }
+
+    public string Id { get; }
+
+    /// <summary> Address and port the device last sent from </summary>
+    public IPEndPoint Endpoint => _endpoint;
+
+    /// <summary> Sender for the socket the device last used, or null if it has not sent anything </summary>
+    public IUdpSender? ReturnPath => _returnPath;
+
+    public long PacketsIn => Interlocked.Read(ref _packetsIn);
+    public long BytesIn => Interlocked.Read(ref _bytesIn);
+    public long PacketsOut => Interlocked.Read(ref _packetsOut);
+    public long BytesOut => Interlocked.Read(ref _bytesOut);
+    public DateTime LastSeenUtc => new(Interlocked.Read(ref _lastSeenTicks), DateTimeKind.Utc);
+
+    /// <summary>
+    /// Smoothed time from a server-initiated send to the device's next datagram.
+    /// Zero until the device has answered a probe.
+    /// </summary>
+    public TimeSpan Rtt => TimeSpan.FromTicks(Interlocked.Read(ref _rttTicks));
+
+    /// <summary>
+    /// Record a datagram from the device
+    /// </summary>
+    public void Received(int bytes, IPEndPoint from, IUdpSender returnPath)
+    {
+        var now = DateTime.UtcNow.Ticks;
+        Interlocked.Increment(ref _packetsIn);
+        Interlocked.Add(ref _bytesIn, bytes);
+        Interlocked.Exchange(ref _lastSeenTicks, now);
+        _endpoint = from;
+        _returnPath = returnPath;
+
+        var probe = Interlocked.Exchange(ref _probeSentTicks, 0);
+        if (probe > 0 && now - probe < ProbeTimeoutTicks) AddRttSample(now - probe);
+    }
+
+    /// <summary>
+    /// Record a datagram sent to the device
+    /// </summary>
+    public void Sent(int bytes)
+    {
+        Interlocked.Increment(ref _packetsOut);
+        Interlocked.Add(ref _bytesOut, bytes);
+    }
+
+    /// <summary>
+    /// Send data the device did not ask for, and time how long until it next
+    /// sends to us. Returns false if we have no way to reach the device yet.
+    /// </summary>
+    public bool Probe(byte[] data)
+    {
+        var returnPath = _returnPath;
+        if (returnPath is null) return false;
+
+        Interlocked.CompareExchange(ref _probeSentTicks, DateTime.UtcNow.Ticks, 0);
+        returnPath.SendData(data);
+        return true;
+    }
+
+    /// <summary>
+    /// Same smoothing as TCP's SRTT: new = old + (sample - old) / 8
+    /// </summary>
+    private void AddRttSample(long sampleTicks)
+    {
+        while (true)
+        {
+            var old = Interlocked.Read(ref _rttTicks);
+            var next = old == 0 ? sampleTicks : old + (sampleTicks - old) / 8;
+            if (Interlocked.CompareExchange(ref _rttTicks, next, old) == old) return;
+        }
+    }
+}
+
+/// <summary>
+/// Every device that has sent to the UDP server, found by device ID or by the
+/// endpoint its last datagram came from. Sized up front for a large fleet, so
+/// the tables don't resize while devices first check in.
+/// </summary>
+public class DeviceSessions
+{
+    /// <summary> Devices we expect to hold without resizing </summary>
+    public const int ExpectedDevices = 100_000;
+
+    /// <summary> Sessions seen within this time count as active in a snapshot </summary>
+    public static readonly TimeSpan ActiveWindow = TimeSpan.FromMinutes(5);
+
+    private readonly ConcurrentDictionary<string, DeviceSession> _byId;
+    private readonly ConcurrentDictionary<IPEndPoint, DeviceSession> _byEndpoint;
+    private readonly Func<IPEndPoint, string> _deviceId;
+
+    /// <param name="deviceId">Gives the device ID for a sender. Devices don't send an ID yet, so by default this is the address.</param>
+    public DeviceSessions(Func<IPEndPoint, string>? deviceId = null)
+    {
+        _deviceId = deviceId ?? ProfileDecoder.DeviceKey;
+        _byId = new ConcurrentDictionary<string, DeviceSession>(Environment.ProcessorCount, ExpectedDevices);
+        _byEndpoint = new ConcurrentDictionary<IPEndPoint, DeviceSession>(Environment.ProcessorCount, ExpectedDevices);
+    }
+
+    public int Count => _byId.Count;
+
+    /// <summary>
+    /// Find or add the session for a sender
+    /// </summary>
+    public DeviceSession For(IPEndPoint from)
+    {
+        if (!_byEndpoint.TryGetValue(from, out var session))
+        {
+            session = _byId.GetOrAdd(_deviceId(from), id => new DeviceSession(id, from));
+
+            // Device came back from a new port (NAT rebinding); forget the old one
+            var old = session.Endpoint;
+            if (!old.Equals(from)) _byEndpoint.TryRemove(new KeyValuePair<IPEndPoint, DeviceSession>(old, session));
+            _byEndpoint[from] = session;
+        }
+
+        return session;
+    }
+
+    public DeviceSession? Find(string deviceId) => _byId.TryGetValue(deviceId, out var session) ? session : null;
+
+    public DeviceSession? Find(IPEndPoint endpoint) => _byEndpoint.TryGetValue(endpoint, out var session) ? session : null;
+
+    /// <summary>
+    /// The session that most recently sent anything, or null if there are none
+    /// </summary>
+    public DeviceSession? MostRecent()
+    {
+        DeviceSession? best = null;
+        foreach (var (_, session) in _byId) // enumerating the dictionary itself takes no locks and no copy
+        {
+            if (best is null || session.LastSeenUtc > best.LastSeenUtc) best = session;
+        }
+        return best;
+    }
+
+    /// <summary>
+    /// Sessions ordered by last seen, newest first
+    /// </summary>
+    public List<DeviceSession> Recent(int limit)
+    {
+        return _byId.Values.OrderByDescending(s => s.LastSeenUtc).Take(limit).ToList();
+    }
+
+    /// <summary>
+    /// Totals across all sessions. This walks the table without locking,
+    /// so it is a consistent-enough view rather than an exact instant.
+    /// </summary>
+    public SessionSnapshot Snapshot()
+    {
+        var activeSince = DateTime.UtcNow - ActiveWindow;
+        int devices = 0, active = 0, withRtt = 0;
+        long packetsIn = 0, bytesIn = 0, packetsOut = 0, bytesOut = 0;
+        double rttMs = 0;
+
+        foreach (var (_, session) in _byId)
+        {
+            devices++;
+            if (session.LastSeenUtc >= activeSince) active++;
+            packetsIn += session.PacketsIn;
+            bytesIn += session.BytesIn;
+            packetsOut += session.PacketsOut;
+            bytesOut += session.BytesOut;
+
+            var rtt = session.Rtt;
+            if (rtt <= TimeSpan.Zero) continue;
+            rttMs += rtt.TotalMilliseconds;
+            withRtt++;
+        }
+
+        return new SessionSnapshot(devices, active, packetsIn, bytesIn, packetsOut, bytesOut, withRtt > 0 ? rttMs / withRtt : 0);
+    }
+
+    /// <summary>
+    /// Drop sessions not seen for 'idle'. Returns the number removed.
+    /// </summary>
+    public int Evict(TimeSpan idle)
+    {
+        var cutoff = DateTime.UtcNow - idle;
+        var removed = 0;
+        foreach (var (_, session) in _byId)
+        {
+            if (session.LastSeenUtc >= cutoff) continue;
+            if (!_byId.TryRemove(new KeyValuePair<string, DeviceSession>(session.Id, session))) continue;
+
+            _byEndpoint.TryRemove(new KeyValuePair<IPEndPoint, DeviceSession>(session.Endpoint, session));
+            removed++;
+        }
+        return removed;
+    }
+}
@@ -0,0 +1,157 @@
+﻿using System.Text;
+
+namespace UdpHook;
+
+/// <summary>
+/// Commands and config changes waiting for a device, delivered on the reply to
+/// its next uplink. Devices sleep with the modem off, so anything sent to them
+/// unasked is lost; instead, whatever is queued here rides back on the reply to
+/// a datagram the device sent, while it is still listening.
+/// <p></p>
+/// Each item gets a 16 bit ID when it is first sent, and goes out as a
+/// "DL &lt;id&gt; &lt;body&gt;" line on every reply until the device acknowledges it.
+/// Devices put "DLACK &lt;id&gt;" (the last ID they applied) in every uplink, which
+/// clears everything up to that ID. IDs carry on from the device's last ack,
+/// so after a server restart a device never sees an old ID again and skips
+/// a new command. Mailboxes are kept in memory only.
+/// </summary>
+public class DownlinkMailbox
+{
+    /// <summary> Items a device can have waiting. Queue() refuses more </summary>
+    public const int MaxPending = 32;
+
+    /// <summary> Longest item body. Bodies go in a single text line </summary>
+    public const int MaxBodyLength = 200;
+
+    /// <summary>
+    /// Most bytes of reply a device reads (DOWNLINK_REPLY_MAX in the firmware,
+    /// less room for the modem's "+IPD" header). Lines past this are cut off,
+    /// so Attach() leaves them for a later reply.
+    /// </summary>
+    public const int MaxReplyBytes = 496;
+
+    private const string AckTag = "DLACK ";
+
+    private class Item
+    {
+        public ushort Id; // zero until first sent
+        public string Body = "";
+    }
+
+    private class Mailbox
+    {
+        public readonly List<Item> Items = new();
+        public ushort NextId = 1;
+    }
+
+    private readonly Dictionary<string, Mailbox> _boxes = new();
+    private readonly object _lock = new();
+
+    /// <summary>
+    /// Queue a command for a device. Returns false if the body can't go in a
+    /// line, or the device already has MaxPending items waiting.
+    /// </summary>
+    public bool Queue(string deviceKey, string body)
+    {
+        body = body.Trim();
+        if (body.Length == 0 || body.Length > MaxBodyLength || body.IndexOfAny(new[] { '\r', '\n' }) >= 0) return false;
+
+        lock (_lock)
+        {
+            if (!_boxes.TryGetValue(deviceKey, out var box))
+            {
+                box = new Mailbox();
+                _boxes.Add(deviceKey, box);
+            }
+            if (box.Items.Count >= MaxPending) return false;
+
+            box.Items.Add(new Item { Body = body });
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Items waiting for a device, sent or not
+    /// </summary>
+    public int Pending(string deviceKey)
+    {
+        lock (_lock)
+        {
+            return _boxes.TryGetValue(deviceKey, out var box) ? box.Items.Count : 0;
+        }
+    }
+
+    /// <summary>
+    /// Find the "DLACK &lt;id&gt;" in an uplink. Returns false if there isn't one
+    /// (firmware without a downlink handler).
+    /// </summary>
+    public static bool TryParseAck(string uplink, out ushort acked)
+    {
+        acked = 0;
+        var i = uplink.IndexOf(AckTag, StringComparison.Ordinal);
+        if (i < 0) return false;
+
+        var start = i + AckTag.Length;
+        var end = start;
+        while (end < uplink.Length && uplink[end] is >= '0' and <= '9') end++;
+        return ushort.TryParse(uplink.AsSpan(start, end - start), out acked);
+    }
+
+    /// <summary>
+    /// The device has applied everything up to and including 'acked'.
+    /// Drops those items; if nothing else is in flight, new IDs carry on from 'acked'.
+    /// </summary>
+    public void Acknowledge(string deviceKey, ushort acked)
+    {
+        lock (_lock)
+        {
+            if (!_boxes.TryGetValue(deviceKey, out var box)) return;
+            if (acked == 0) return; // nothing applied since the device's last power-on; it will take any ID
+
+            box.Items.RemoveAll(item => item.Id != 0 && !IsAfter(item.Id, acked));
+            if (box.Items.All(item => item.Id == 0)) box.NextId = Next(acked);
+            if (box.Items.Count == 0) _boxes.Remove(deviceKey);
+        }
+    }
+
+    /// <summary>
+    /// Lines to add to a reply for the device: one "DL &lt;id&gt; &lt;body&gt;\n" per
+    /// waiting item, oldest first, as many as fit in 'maxBytes'. The rest wait
+    /// for a later reply. Empty if nothing is waiting or nothing fits.
+    /// </summary>
+    public string Attach(string deviceKey, int maxBytes)
+    {
+        lock (_lock)
+        {
+            if (!_boxes.TryGetValue(deviceKey, out var box)) return "";
+
+            var lines = new StringBuilder();
+            var used = 0;
+            foreach (var item in box.Items)
+            {
+                var id = item.Id != 0 ? item.Id : box.NextId;
+                var line = $"DL {id} {item.Body}\n";
+                used += Encoding.UTF8.GetByteCount(line);
+                if (used > maxBytes) break; // stop rather than skip, so IDs still reach the device in order
+
+                if (item.Id == 0)
+                {
+                    item.Id = box.NextId;
+                    box.NextId = Next(box.NextId);
+                }
+                lines.Append(line);
+            }
+            return lines.ToString();
+        }
+    }
+
+    /// <summary>
+    /// Next ID after 'id'. Zero is skipped: devices use it for "nothing applied yet".
+    /// </summary>
+    private static ushort Next(ushort id) => id == ushort.MaxValue ? (ushort)1 : (ushort)(id + 1);
+
+    /// <summary>
+    /// True if 'a' comes after 'b', allowing for the IDs wrapping round
+    /// </summary>
+    private static bool IsAfter(ushort a, ushort b) => (short)(a - b) > 0;
+}
@@ -0,0 +1,190 @@
+﻿using System.Net;
+using System.Text;
+
+namespace UdpHook;
+
+/// <summary>
+/// One EWC frame from a bridge datagram
+/// </summary>
+/// <param name="ArrivedUtc">When the frame reached the device (server time less the frame's age)</param>
+/// <param name="Urgent">Device sent this without waiting for a batch</param>
+/// <param name="Data">Whole EWC frame, including any status byte, ETX and checksum</param>
+public readonly record struct BridgeFrame(DateTime ArrivedUtc, bool Urgent, byte[] Data);
+
+/// <summary>
+/// Server end of the firmware's EwcBridge. Decodes datagrams of EWC frames,
+/// and builds the text reply that acknowledges them and carries any commands
+/// queued for the device's EWC.
+/// </summary>
+public class EwcBridge
+{
+    private const ushort Magic = 0x4245;
+    private const int HeaderBytes = 12;
+    private const int FrameOverhead = 6;
+    private const byte Etx = 0x03;
+    private const byte FlagUrgent = 0x01;
+
+    /// <summary> Longest EWC frame, including ETX and checksum (EWC_MAX_FRAME in the firmware) </summary>
+    public const int MaxFrameBytes = 64;
+
+    /// <summary> Most commands the device takes from one reply (EWC_MAX_COMMANDS in the firmware) </summary>
+    public const int MaxCommandsPerReply = 4;
+
+    /// <summary>
+    /// Most bytes of reply the device reads (BRIDGE_REPLY_MAX in the firmware,
+    /// less room for the modem's "+IPD" header). A full-size command is 133 bytes.
+    /// </summary>
+    public const int MaxReplyBytes = 240;
+
+    private readonly Dictionary<string, Queue<byte[]>> _commands = new();
+    private readonly Dictionary<string, (uint Boot, ushort Seq, byte[] Reply)> _lastReply = new();
+    private readonly object _lock = new();
+
+    /// <summary>
+    /// The last device that sent a bridge datagram, or null if none yet
+    /// </summary>
+    public string? LastDevice { get; private set; }
+
+    /// <summary>
+    /// Read a bridge datagram. Returns null if the data is not a valid datagram.
+    /// 'boot' is random for each device start, as 'seq' starts again at 1.
+    /// </summary>
+    public static List<BridgeFrame>? Decode(byte[] data, DateTime receivedUtc, out uint boot, out ushort seq, out int droppedOnDevice)
+    {
+        boot = 0;
+        seq = 0;
+        droppedOnDevice = 0;
+        if (data.Length < HeaderBytes) return null;
+        if (BitConverter.ToUInt16(data, 0) != Magic) return null;
+        if (data[2] != 2) return null; // version
+
+        var count = data[3];
+        seq = BitConverter.ToUInt16(data, 4);
+        droppedOnDevice = BitConverter.ToUInt16(data, 6);
+        boot = BitConverter.ToUInt32(data, 8);
+
+        var result = new List<BridgeFrame>(count);
+        var o = HeaderBytes;
+        for (var i = 0; i < count; i++)
+        {
+            if (o + FrameOverhead > data.Length) return null;
+            var ageMs = BitConverter.ToUInt32(data, o);
+            var flags = data[o + 4];
+            var length = data[o + 5];
+            if (o + FrameOverhead + length > data.Length) return null;
+
+            result.Add(new BridgeFrame(receivedUtc.AddMilliseconds(-ageMs), (flags & FlagUrgent) != 0, data[(o + FrameOverhead)..(o + FrameOverhead + length)]));
+            o += FrameOverhead + length;
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// Queue a command for a device's EWC. 'body' is the command byte and data;
+    /// the ETX and checksum are added here. Returns false if the frame would be
+    /// longer than MaxFrameBytes.
+    /// </summary>
+    public bool QueueCommand(string deviceKey, byte[] body)
+    {
+        if (body.Length + 2 > MaxFrameBytes) return false;
+
+        lock (_lock)
+        {
+            if (!_commands.TryGetValue(deviceKey, out var queue))
+            {
+                queue = new Queue<byte[]>();
+                _commands.Add(deviceKey, queue);
+            }
+            queue.Enqueue(Frame(body));
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Decode a datagram, log its frames, and build the reply.
+    /// The reply takes as many queued commands as the device can read; the rest wait for the next datagram.
+    /// A repeated sequence number from the same boot (the device missed our reply) gets the same reply again.
+    /// Returns null if the data was not a valid datagram.
+    /// </summary>
+    public byte[]? Handle(string deviceKey, byte[] data)
+    {
+        var frames = Decode(data, DateTime.UtcNow, out var boot, out var seq, out var dropped);
+        if (frames is null) return null;
+
+        lock (_lock)
+        {
+            LastDevice = deviceKey;
+            if (_lastReply.TryGetValue(deviceKey, out var last) && last.Boot == boot && last.Seq == seq)
+            {
+                Log.Info($"Bridge {deviceKey}: repeat of datagram {seq}");
+                return last.Reply;
+            }
+
+            if (dropped > 0) Log.Warn($"Bridge {deviceKey}: device dropped {dropped} frames before datagram {seq}");
+            foreach (var frame in frames)
+            {
+                Log.Info($"Bridge {deviceKey}: {frame.ArrivedUtc:HH:mm:ss.fff} {(frame.Urgent ? "urgent " : "")}{Hex(frame.Data)}");
+            }
+
+            var reply = new StringBuilder();
+            reply.Append($"ACK {seq}\n");
+            if (_commands.TryGetValue(deviceKey, out var queue))
+            {
+                var sent = 0;
+                while (queue.Count > 0 && sent < MaxCommandsPerReply)
+                {
+                    var line = $"CMD {Hex(queue.Peek())}\n";
+                    if (reply.Length + line.Length > MaxReplyBytes) break; // all ASCII, so characters are bytes
+
+                    reply.Append(line);
+                    Log.Info($"Bridge {deviceKey}: sending command {Hex(queue.Dequeue())}");
+                    sent++;
+                }
+                if (queue.Count > 0) Log.Info($"Bridge {deviceKey}: {queue.Count} commands left for the next reply");
+            }
+
+            var bytes = Encoding.UTF8.GetBytes(reply.ToString());
+            _lastReply[deviceKey] = (boot, seq, bytes);
+            return bytes;
+        }
+    }
+
+    /// <summary>
+    /// Add ETX and XOR checksum to a command body
+    /// </summary>
+    public static byte[] Frame(byte[] body)
+    {
+        var frame = new byte[body.Length + 2];
+        body.CopyTo(frame, 0);
+        frame[body.Length] = Etx;
+
+        byte checksum = 0;
+        for (var i = 0; i <= body.Length; i++) checksum ^= frame[i];
+        frame[body.Length + 1] = checksum;
+        return frame;
+    }
+
+    /// <summary>
+    /// Read a hex string like "4C00D43D" (spaces allowed). Returns null if it is not valid hex.
+    /// </summary>
+    public static byte[]? ParseHex(string hex)
+    {
+        hex = hex.Replace(" ", "");
+        if (hex.Length < 2 || hex.Length % 2 != 0) return null;
+        try
+        {
+            return Convert.FromHexString(hex);
+        }
+        catch (FormatException)
+        {
+            return null;
+        }
+    }
+
+    private static string Hex(byte[] data) => Convert.ToHexString(data);
+
+    /// <summary>
+    /// Key used to group datagrams by device. Devices don't send an ID yet, so we use the address.
+    /// </summary>
+    public static string DeviceKey(IPEndPoint remoteCaller) => remoteCaller.Address.ToString();
+}
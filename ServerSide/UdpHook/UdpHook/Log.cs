@@ -1,4 +1,5 @@
-﻿using System.Diagnostics;
+﻿using System.Collections.Concurrent;
+using System.Diagnostics;
 using System.Diagnostics.CodeAnalysis;
 using System.Runtime.CompilerServices;
 using System.Text;
@@ -35,23 +36,85 @@ public enum LogLevel
     Everything = 255
 }
 
+/// <summary>
+/// Console logger. Calls format their message and queue it without locking;
+/// a background thread adds timestamps and writes queued entries to the console
+/// in batches, so busy network threads never wait on console I/O.
+/// <p></p>
+/// If the writer falls behind, Info and more verbose entries are sampled
+/// (one in <see cref="SampleEvery"/> kept) once the queue is three quarters full,
+/// and anything but Critical is dropped when it is full. Lost entries are counted
+/// in <see cref="Dropped"/> and <see cref="SampledOut"/>, and reported in the log.
+/// </summary>
 public static class Log
 {
-    private static LogLevel _level = LogLevel.Warning;
+    /// <summary> Entries waiting to be written before new ones are dropped </summary>
+    public const int QueueLimit = 65536;
+
+    /// <summary> When sampling, keep one verbose entry in this many </summary>
+    public const int SampleEvery = 8;
+
+    private const int SampleAbove = QueueLimit * 3 / 4;
+    private const int BatchLimit = 1024;
+    private const string BlankStamp = "                       "; // same spacing as timestamp
+
+    private static volatile LogLevel _level = LogLevel.Warning;
     
     public static bool IncludeCrypto => _level >= LogLevel.Crypto;
     public static bool IsTracing => _level >= LogLevel.Trace;
     public static bool IncludeInfo => _level >= LogLevel.Info;
     public static bool NotTraceOrDebug => _level <= LogLevel.Info;
 
-    private static readonly object _lock = new();
-    
+    private enum Stamp { Time, Blank, None }
+
+    /// <summary> One queued log write. Text is complete, including line ends, apart from the stamp </summary>
+    private readonly record struct Entry(long Ticks, Stamp Stamp, string Text);
+
+    private static readonly ConcurrentQueue<Entry> _queue = new();
+    private static readonly AutoResetEvent _wake = new(false);
+    private static int _queued;
+    private static int _writerIdle;
+    private static long _dropped;
+    private static long _sampledOut;
+    private static long _sampleCount;
+
+    static Log()
+    {
+        new Thread(WriteLoop) { IsBackground = true, Name = "LogWriter" }.Start();
+        AppDomain.CurrentDomain.ProcessExit += (_, _) => Flush();
+    }
+
+    /// <summary> Entries dropped because the queue was full </summary>
+    public static long Dropped => Interlocked.Read(ref _dropped);
+
+    /// <summary> Verbose entries skipped by sampling while the queue was nearly full </summary>
+    public static long SampledOut => Interlocked.Read(ref _sampledOut);
+
+    /// <summary> Entries waiting to be written </summary>
+    public static int Queued => Volatile.Read(ref _queued);
+
+    /// <summary>
+    /// True if messages at this level will be written.
+    /// Check this before building an expensive message.
+    /// </summary>
+    [MethodImpl(MethodImplOptions.AggressiveInlining)]
+    public static bool IsEnabled(LogLevel level) => _level >= level;
+
     public static void SetLevel(LogLevel level)
     {
-        Console.WriteLine($"Log level set to {(int)level} ({level.ToString()})");
+        Enqueue(LogLevel.Critical, Stamp.None, $"Log level set to {(int)level} ({level.ToString()}){Environment.NewLine}");
         _level = level;
     }
 
+    /// <summary>
+    /// Wait until everything queued so far is written, or the timeout passes
+    /// </summary>
+    public static void Flush(int timeoutMs = 2000)
+    {
+        _wake.Set();
+        SpinWait.SpinUntil(() => Volatile.Read(ref _queued) == 0, timeoutMs);
+    }
+
     /// <summary>
     /// Write cryptographically sensitive log.
     /// This is never sent to any remote log servers.
@@ -59,102 +122,73 @@ public static class Log
     public static void Crypto(string msg)
     {
         if (_level < LogLevel.Crypto) return;
-        lock (_lock)
-        {
-            Console.WriteLine(msg);
-        }
+        Enqueue(LogLevel.Crypto, Stamp.None, msg + Environment.NewLine);
     }
 
     public static void Trace(string msg)
     {
         if (_level < LogLevel.Trace) return;
-
-        lock (_lock)
-        {
-            BlankTimestamp();
-            Console.WriteLine(msg);
-        }
+        Enqueue(LogLevel.Trace, Stamp.Blank, msg + Environment.NewLine);
     }
     public static void Trace(string msg, Func<string> more)
     {
         if (_level < LogLevel.Trace) return;
 
-        lock (_lock)
-        {
-            BlankTimestamp();
-            var sb = new StringBuilder();
-            sb.Append(msg);
-            sb.AppendLine(more());
-            
-            Console.Write(sb.ToString());
-        }
+        var sb = new StringBuilder();
+        sb.Append(msg);
+        sb.AppendLine(more());
+        Enqueue(LogLevel.Trace, Stamp.Blank, sb.ToString());
     }
     public static void Trace(Func<string> msg)
     {
         if (_level < LogLevel.Trace) return;
-
-        lock (_lock)
-        {
-            BlankTimestamp();
-            var message = msg();
-            Console.Write(message);
-        }
+        Enqueue(LogLevel.Trace, Stamp.Blank, msg());
     }
     
     public static void TraceWithStack(string msg)
     {
         if (_level < LogLevel.Trace) return;
 
-        lock (_lock)
-        {
-            BlankTimestamp();
-            Console.WriteLine(msg);
-            WriteStack();
-        }
+        var sb = new StringBuilder();
+        sb.AppendLine(msg);
+        AppendStack(sb);
+        Enqueue(LogLevel.Trace, Stamp.Blank, sb.ToString());
     }
 
     public static void Debug(string msg, Func<IEnumerable<string>>? subLines = null)
     {
         if (_level < LogLevel.Debug) return;
 
-        lock (_lock)
+        var sb = new StringBuilder();
+        sb.AppendLine(msg);
+        if (subLines is not null)
         {
-            Timestamp();
-
-            var sb = new StringBuilder();
-            sb.AppendLine(msg);
-            if (subLines is not null)
+            var lines = subLines();
+            foreach (var line in lines)
             {
-                var lines = subLines();
-                foreach (var line in lines)
-                {
-                    sb.Append("    ");
-                    sb.AppendLine(line);
-                }
+                sb.Append("    ");
+                sb.AppendLine(line);
             }
-
-            Console.WriteLine(sb.ToString());
         }
+        sb.AppendLine();
+
+        Enqueue(LogLevel.Debug, Stamp.Time, sb.ToString());
     }
     
     public static void Debug(IEnumerable<string> messages)
     {
         if (_level < LogLevel.Debug) return;
 
-        lock (_lock)
+        var sb = new StringBuilder();
+        foreach (var msg in messages)
         {
-            Timestamp();
-            
-            var sb = new StringBuilder();
-            foreach (var msg in messages)
-            {
-                sb.Append(msg);
-                sb.Append(" ");
-            }
-            sb.AppendLine();
-
-            Console.WriteLine(sb.ToString());
+            sb.Append(msg);
+            sb.Append(" ");
         }
+        sb.AppendLine();
+        sb.AppendLine();
+
+        Enqueue(LogLevel.Debug, Stamp.Time, sb.ToString());
     }
 
     /// <summary>
@@ -164,46 +198,32 @@ public static class Log
     {
         if (_level < LogLevel.Debug) return;
 
-        lock (_lock)
-        {
-            Timestamp();
-
-            Console.WriteLine(msg);
-            WriteStack();
-        }
+        var sb = new StringBuilder();
+        sb.AppendLine(msg);
+        AppendStack(sb);
+        Enqueue(LogLevel.Debug, Stamp.Time, sb.ToString());
     }
 
     public static void Info(string msg)
     {
         if (_level < LogLevel.Info) return;
-        
-        lock (_lock)
-        {
-            Timestamp();
-            Console.WriteLine(msg);
-        }
+        Enqueue(LogLevel.Info, Stamp.Time, msg + Environment.NewLine);
     }
     
     public static void Warn(string msg)
     {
         if (_level < LogLevel.Warning) return;
-
-        lock (_lock)
-        {
-            Timestamp();
-            Console.WriteLine(msg);
-        }
+        Enqueue(LogLevel.Warning, Stamp.Time, msg + Environment.NewLine);
     }
 
     public static void WarnWithStack(string msg)
-    {        if (_level < LogLevel.Warning) return;
+    {
+        if (_level < LogLevel.Warning) return;
 
-        lock (_lock)
-        {
-            Timestamp();
-            Console.WriteLine(msg);
-            WriteStack();
-        }
+        var sb = new StringBuilder();
+        sb.AppendLine(msg);
+        AppendStack(sb);
+        Enqueue(LogLevel.Warning, Stamp.Time, sb.ToString());
     }
     
     public static void Error(string msg,
@@ -213,14 +233,11 @@ public static class Log
     {
         if (_level < LogLevel.Error) return;
 
-        lock (_lock)
-        {
-            Timestamp();
-            Console.WriteLine(msg);
-
-            BlankTimestamp();
-            Console.WriteLine($"In {memberName}, {sourceFilePath}::{sourceLineNumber}");
-        }
+        var sb = new StringBuilder();
+        sb.AppendLine(msg);
+        sb.Append(BlankStamp);
+        sb.AppendLine($"In {memberName}, {sourceFilePath}::{sourceLineNumber}");
+        Enqueue(LogLevel.Error, Stamp.Time, sb.ToString());
     }
     
 
@@ -228,18 +245,13 @@ public static class Log
     {
         if (_level < LogLevel.Error) return;
 
-        lock (_lock)
+        if (_level >= LogLevel.Debug)
         {
-            Timestamp();
-
-            if (_level >= LogLevel.Debug)
-            {
-                Console.WriteLine(message + ": " + ex); // full trace with debug
-            }
-            else
-            {
-                Console.WriteLine(message + ": " + ex.GetType().Name + " " + ex.Message); // just the top message if not debug
-            }
+            Enqueue(LogLevel.Error, Stamp.Time, message + ": " + ex + Environment.NewLine); // full trace with debug
+        }
+        else
+        {
+            Enqueue(LogLevel.Error, Stamp.Time, message + ": " + ex.GetType().Name + " " + ex.Message + Environment.NewLine); // just the top message if not debug
         }
     }
 
@@ -248,41 +260,117 @@ public static class Log
     /// </summary>
     public static void Critical(string msg)
     {
-        lock (_lock)
+        var sb = new StringBuilder();
+        sb.AppendLine();
+        sb.AppendLine("##################################################");
+        sb.AppendLine(msg);
+        sb.AppendLine("##################################################");
+        sb.AppendLine();
+        AppendStack(sb);
+        sb.AppendLine();
+        Enqueue(LogLevel.Critical, Stamp.Time, sb.ToString());
+    }
+
+    /// <summary>
+    /// Queue an entry, or count it as lost if the writer is too far behind.
+    /// Critical entries are always queued.
+    /// </summary>
+    private static void Enqueue(LogLevel level, Stamp stamp, string text)
+    {
+        var depth = Interlocked.Increment(ref _queued);
+        if (level != LogLevel.Critical)
         {
-            Timestamp();
-            Console.WriteLine();
-            Console.WriteLine("##################################################");
-            Console.WriteLine(msg);
-            Console.WriteLine("##################################################");
-            Console.WriteLine();
-            WriteStack();
-            Console.WriteLine();
+            if (depth > QueueLimit)
+            {
+                Interlocked.Decrement(ref _queued);
+                Interlocked.Increment(ref _dropped);
+                return;
+            }
+
+            if (depth > SampleAbove && level >= LogLevel.Info && Interlocked.Increment(ref _sampleCount) % SampleEvery != 0)
+            {
+                Interlocked.Decrement(ref _queued);
+                Interlocked.Increment(ref _sampledOut);
+                return;
+            }
         }
+
+        _queue.Enqueue(new Entry(DateTime.UtcNow.Ticks, stamp, text));
+        if (Volatile.Read(ref _writerIdle) == 1) _wake.Set();
     }
 
+    private static void WriteLoop()
+    {
+        var output = new StreamWriter(Console.OpenStandardOutput(), new UTF8Encoding(false), 65536) { AutoFlush = false };
+        var sb = new StringBuilder();
+        var stampMinute = -1L;
+        var stamp = "";
+        var lostReported = 0L;
 
-    private static void WriteStack()
+        while (true)
+        {
+            var count = 0;
+            while (count < BatchLimit && _queue.TryDequeue(out var entry))
+            {
+                count++;
+                switch (entry.Stamp)
+                {
+                    case Stamp.Time:
+                        var minute = entry.Ticks / TimeSpan.TicksPerMinute;
+                        if (minute != stampMinute)
+                        {
+                            stampMinute = minute;
+                            stamp = new DateTime(entry.Ticks, DateTimeKind.Utc).ToString("yyyy-MM-ddTHH:mm") + " (utc) ";
+                        }
+                        sb.Append(stamp);
+                        break;
+                    case Stamp.Blank:
+                        sb.Append(BlankStamp);
+                        break;
+                }
+                sb.Append(entry.Text);
+            }
+
+            var lost = Dropped + SampledOut;
+            if (lost != lostReported && sb.Length > 0)
+            {
+                lostReported = lost;
+                sb.Append(BlankStamp);
+                sb.AppendLine($"Log writer behind: {Dropped} entries dropped and {SampledOut} sampled out so far");
+            }
+
+            if (count > 0)
+            {
+                try
+                {
+                    output.Write(sb);
+                    output.Flush();
+                }
+                catch (IOException)
+                {
+                    // console gone; keep draining so callers never back up
+                }
+                sb.Clear();
+                Interlocked.Add(ref _queued, -count);
+                continue;
+            }
+
+            Interlocked.Exchange(ref _writerIdle, 1);
+            if (_queue.IsEmpty) _wake.WaitOne(100);
+            Interlocked.Exchange(ref _writerIdle, 0);
+        }
+    }
+
+    private static void AppendStack(StringBuilder sb)
     {
         var st = new StackTrace(0);
 
         var frames = st.GetFrames();
         foreach (var frame in frames)
         {
-            BlankTimestamp();
             var method = frame.GetMethod();
-            Console.WriteLine($"    {method?.DeclaringType?.Name??"?"}.{method?.Name ?? "unknown"}");
+            sb.Append(BlankStamp);
+            sb.AppendLine($"    {method?.DeclaringType?.Name??"?"}.{method?.Name ?? "unknown"}");
         }
     }
-    
-    private static void Timestamp()
-    {
-        Console.Write(DateTime.UtcNow.ToString("yyyy-MM-ddTHH:mm"));
-        Console.Write(" (utc) ");
-    }
-
-    private static void BlankTimestamp()
-    {
-        Console.Write("                       "); // same spacing as timestamp
-    }
 }
\ No newline at end of file
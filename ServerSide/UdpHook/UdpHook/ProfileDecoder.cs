@@ -0,0 +1,195 @@
+﻿using System.Net;
+
+namespace UdpHook;
+
+/// <summary>
+/// Phases of a device wake cycle. Must match <c>ProfilePhase</c> in PhaseProfiler.h
+/// </summary>
+public enum ProfilePhase
+{
+    Boot = 0,
+    ModemPower = 1,
+    PbDone = 2,
+    NetAttach = 3,
+    NetOpen = 4,
+    Send = 5,
+    Ack = 6,
+    GnssFix = 7,
+    SleepEntry = 8
+}
+
+/// <summary>
+/// One span from a device profile upload
+/// </summary>
+public readonly record struct ProfileRecord(
+    ushort Cycle, ProfilePhase Phase, bool Ok, bool IsMark,
+    uint StartMs, uint DurationUs,
+    ushort BatStartMv, ushort BatEndMv, ushort ModemMv);
+
+/// <summary>
+/// Decodes binary profile summaries sent by the firmware's PhaseProfiler,
+/// and keeps a rolling history per device for latency and energy statistics.
+/// </summary>
+public class ProfileDecoder
+{
+    private const ushort Magic = 0x5046;
+    private const int HeaderBytes = 10;
+    private const int MaxHistory = 10_000; // records kept per device
+
+    /// <summary>
+    /// Estimated current draw per phase in mA. These are nominal figures for the
+    /// ESP32 + A7670 board; tune them against a bench meter for better estimates.
+    /// </summary>
+    public Dictionary<ProfilePhase, double> PhaseCurrentMa { get; } = new()
+    {
+        { ProfilePhase.Boot, 50 },
+        { ProfilePhase.ModemPower, 120 },
+        { ProfilePhase.PbDone, 90 },
+        { ProfilePhase.NetAttach, 150 },
+        { ProfilePhase.NetOpen, 150 },
+        { ProfilePhase.Send, 250 },
+        { ProfilePhase.Ack, 120 },
+        { ProfilePhase.GnssFix, 110 },
+        { ProfilePhase.SleepEntry, 0 }
+    };
+
+    private readonly Dictionary<string, List<ProfileRecord>> _history = new();
+    private readonly object _lock = new();
+
+    /// <summary>
+    /// Read a summary upload. Returns null if the data is not a valid summary.
+    /// </summary>
+    public static List<ProfileRecord>? Decode(byte[] data, out int droppedOnDevice)
+    {
+        droppedOnDevice = 0;
+        if (data.Length < HeaderBytes) return null;
+        if (BitConverter.ToUInt16(data, 0) != Magic) return null;
+
+        var version = data[2];
+        var recordSize = data[3];
+        if (version != 1 || recordSize < 18) return null;
+
+        droppedOnDevice = BitConverter.ToUInt16(data, 6);
+        var count = BitConverter.ToUInt16(data, 8);
+        if (HeaderBytes + count * recordSize > data.Length) return null;
+
+        var result = new List<ProfileRecord>(count);
+        for (var i = 0; i < count; i++)
+        {
+            var o = HeaderBytes + i * recordSize;
+            var flags = data[o + 3];
+            result.Add(new ProfileRecord(
+                Cycle: BitConverter.ToUInt16(data, o),
+                Phase: (ProfilePhase)data[o + 2],
+                Ok: (flags & 0x01) != 0,
+                IsMark: (flags & 0x02) != 0,
+                StartMs: BitConverter.ToUInt32(data, o + 4),
+                DurationUs: BitConverter.ToUInt32(data, o + 8),
+                BatStartMv: BitConverter.ToUInt16(data, o + 12),
+                BatEndMv: BitConverter.ToUInt16(data, o + 14),
+                ModemMv: BitConverter.ToUInt16(data, o + 16)));
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// Decode an upload and add it to the device's history.
+    /// Returns false if the data was not a valid summary.
+    /// </summary>
+    public bool Add(string deviceKey, byte[] data)
+    {
+        var records = Decode(data, out var dropped);
+        if (records is null) return false;
+
+        if (dropped > 0) Log.Warn($"Device {deviceKey} dropped {dropped} profile records before upload");
+
+        lock (_lock)
+        {
+            if (!_history.TryGetValue(deviceKey, out var list))
+            {
+                list = new List<ProfileRecord>();
+                _history.Add(deviceKey, list);
+            }
+
+            list.AddRange(records);
+            if (list.Count > MaxHistory) list.RemoveRange(0, list.Count - MaxHistory);
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Latency percentiles for one phase, in milliseconds
+    /// </summary>
+    public readonly record struct PhaseStats(ProfilePhase Phase, int Count, int Failures, double P50Ms, double P99Ms, double MeanSagMv);
+
+    /// <summary>
+    /// Per-phase p50/p99 latency for a device
+    /// </summary>
+    public List<PhaseStats> Stats(string deviceKey)
+    {
+        var result = new List<PhaseStats>();
+        List<ProfileRecord> records;
+        lock (_lock)
+        {
+            if (!_history.TryGetValue(deviceKey, out var list)) return result;
+            records = list.ToList();
+        }
+
+        foreach (var group in records.Where(r => !r.IsMark).GroupBy(r => r.Phase).OrderBy(g => g.Key))
+        {
+            var durations = group.Select(r => r.DurationUs / 1000.0).OrderBy(d => d).ToArray();
+            var sag = group.Average(r => r.BatStartMv - (double)r.BatEndMv);
+            result.Add(new PhaseStats(group.Key, durations.Length, group.Count(r => !r.Ok),
+                Percentile(durations, 0.50), Percentile(durations, 0.99), sag));
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// Estimated charge used per successful message, in mAh.
+    /// This is the charge of all timed spans divided by the number of successful sends.
+    /// Returns zero if no messages have been sent.
+    /// </summary>
+    public double MilliAmpHoursPerMessage(string deviceKey)
+    {
+        List<ProfileRecord> records;
+        lock (_lock)
+        {
+            if (!_history.TryGetValue(deviceKey, out var list)) return 0;
+            records = list.ToList();
+        }
+
+        var messages = records.Count(r => r.Phase == ProfilePhase.Send && r.Ok);
+        if (messages < 1) return 0;
+
+        var mAh = records
+            .Where(r => !r.IsMark)
+            .Sum(r => PhaseCurrentMa.GetValueOrDefault(r.Phase) * (r.DurationUs / 3_600_000_000.0));
+        return mAh / messages;
+    }
+
+    /// <summary>
+    /// Write the current statistics for a device to the log
+    /// </summary>
+    public void LogStats(string deviceKey)
+    {
+        var stats = Stats(deviceKey);
+        Log.Info($"Profile for {deviceKey}: {MilliAmpHoursPerMessage(deviceKey):0.000} mAh per message (estimated)");
+        foreach (var s in stats)
+        {
+            Log.Info($"    {s.Phase,-11} n={s.Count,-5} fail={s.Failures,-4} p50={s.P50Ms,9:0.0}ms p99={s.P99Ms,9:0.0}ms sag={s.MeanSagMv:0}mV");
+        }
+    }
+
+    private static double Percentile(double[] sorted, double p)
+    {
+        if (sorted.Length < 1) return 0;
+        var idx = (int)Math.Ceiling(p * sorted.Length) - 1;
+        return sorted[Math.Clamp(idx, 0, sorted.Length - 1)];
+    }
+
+    /// <summary>
+    /// Key used to group uploads by device. Devices don't send an ID yet, so we use the address.
+    /// </summary>
+    public static string DeviceKey(IPEndPoint remoteCaller) => remoteCaller.Address.ToString();
+}
@@ -1,20 +1,43 @@
 ﻿using System.Net;
 using System.Net.Sockets;
 using System.Text;
+using System.Text.Json;
 
 namespace UdpHook;
 
 internal static class Program
 {
-    private static IUdpSender? _lastReturn;
+    private static readonly TimeSpan StatsInterval = TimeSpan.FromMinutes(1);
+    private static readonly TimeSpan SessionIdleLimit = TimeSpan.FromDays(2);
+
+    /// <summary> Loopback-only port that answers any datagram with <see cref="ServerStats"/> JSON </summary>
+    private const int StatsPort = 425;
+
     private static volatile bool _holdOpen;
+    private static readonly ProfileDecoder _profiles = new();
+    private static readonly EwcBridge _bridge = new();
+    private static readonly DownlinkMailbox _downlinks = new();
+    private static TelemetryStore? _store;
 
     public static void Main(string[]? args)
     {
-        Log.SetLevel(LogLevel.Info);
+        // '--quiet' keeps per-message logging out of load tests
+        Log.SetLevel(args?.Contains("--quiet") == true ? LogLevel.Warning : LogLevel.Info);
+        if (args?.FirstOrDefault() == "--bench-store")
+        {
+            TelemetryStoreBench.Run(args.Length > 1 ? long.Parse(args[1]) : 20_000_000, args.Length > 2 ? int.Parse(args[2]) : 10_000);
+            return;
+        }
+
         Log.Info("Starting UDP/TCP servers");
         Log.Info("Type 'quit' and [ENTER] to shutdown servers");
         Log.Info("Type 'close' and [ENTER] to close persistent TCP");
+        Log.Info("Type 'ping [device]' and [ENTER] to ping a device (default is the last one heard from)");
+        Log.Info("Type 'devices' and [ENTER] to list recent devices");
+        Log.Info("Type 'ewc <hex>' and [ENTER] to send a command to the last bridge device's EWC");
+        Log.Info("Type 'history <device> [hours]' and [ENTER] to list a device's stored uplinks");
+        using var store = new TelemetryStore("telemetry");
+        _store = store;
         using var udpServer = new UdpServer();
         using var tcpServer = new TcpServer();
 
@@ -22,22 +45,105 @@ internal static class Program
 
         udpServer.AddResponder(420, TestUdpHandler);
         tcpServer.AddResponder(421, TestTcpHandler);
+        udpServer.AddResponder(422, ProfileUploadHandler);
+        udpServer.AddResponder(423, BridgeHandler);
+        tcpServer.AddFrameResponder(424, TestFrameHandler);
+        udpServer.AddResponder(StatsPort, (_, _, returnPath) => returnPath.SendData(JsonSerializer.SerializeToUtf8Bytes(ServerStats.Capture(udpServer, tcpServer))), IPAddress.Loopback);
 
         udpServer.Start();
         tcpServer.Start();
 
+        using var statsTimer = new Timer(_ => LogSessionStats(udpServer), null, StatsInterval, StatsInterval);
+
         while (true)
         {
             var msg = Console.ReadLine();
+            if (msg is null)
+            {
+                Log.Warn("Console input closed. Running until the process is stopped.");
+                Thread.Sleep(Timeout.Infinite);
+            }
+            if (msg?.ToLowerInvariant().StartsWith("send ") == true || msg?.ToLowerInvariant().StartsWith("set ") == true)
+            {
+                QueueDownlink(msg!); // command text may contain anything, so don't look for other commands in it
+                continue;
+            }
             if (msg?.ToLowerInvariant().Contains("quit") == true) break;
             if (msg?.ToLowerInvariant().Contains("close") == true) _holdOpen = false;
-            if (msg?.ToLowerInvariant().Contains("ping") == true) _lastReturn?.SendData(Encoding.UTF8.GetBytes("Ping from server"));
+            if (msg?.ToLowerInvariant().StartsWith("ping") == true) PingDevice(udpServer.Sessions, msg[4..].Trim());
+            if (msg?.ToLowerInvariant().Contains("devices") == true) ListDevices(udpServer.Sessions);
+            if (msg?.ToLowerInvariant().StartsWith("ewc ") == true) QueueEwcCommand(msg[4..]);
+            if (msg?.ToLowerInvariant().StartsWith("history ") == true) ShowHistory(msg[8..]);
         }
 
         Log.Info("Stopping UDP/TCP servers");
         udpServer.Dispose();
     }
 
+    private static void ShowHistory(string request)
+    {
+        var parts = request.Split(' ', StringSplitOptions.RemoveEmptyEntries);
+        if (parts.Length < 1) return;
+        var hours = parts.Length > 1 && double.TryParse(parts[1], out var h) ? h : 24;
+
+        var now = DateTime.UtcNow;
+        var records = _store!.Query(parts[0], now.AddHours(-hours), now.AddMinutes(1), limit: 50);
+        Log.Info($"{parts[0]}: last {records.Count} uplinks in {hours} hours");
+        foreach (var record in records)
+        {
+            Log.Info($"    {record.ReceivedUtc:yyyy-MM-dd HH:mm:ss.fff} {record.Kind,-8} {Convert.ToHexString(record.Data)}");
+        }
+    }
+
+    /// <summary>
+    /// "send &lt;device&gt; &lt;command&gt;" queues the command as it is;
+    /// "set &lt;device&gt; &lt;key&gt; &lt;value&gt;" queues "SET &lt;key&gt; &lt;value&gt;".
+    /// </summary>
+    private static void QueueDownlink(string request)
+    {
+        var parts = request.Split(' ', 3, StringSplitOptions.RemoveEmptyEntries);
+        if (parts.Length < 3)
+        {
+            Log.Warn("Usage: send <device> <command>, or set <device> <key> <value>");
+            return;
+        }
+
+        var body = parts[0].ToLowerInvariant() == "set" ? $"SET {parts[2]}" : parts[2];
+        if (!_downlinks.Queue(parts[1], body))
+        {
+            Log.Warn($"Could not queue '{body}' for {parts[1]} ({_downlinks.Pending(parts[1])} waiting, at most {DownlinkMailbox.MaxPending})");
+            return;
+        }
+        Log.Info($"Queued '{body}' for {parts[1]}. It will go with the reply to the device's next uplink.");
+    }
+
+    private static void PingDevice(DeviceSessions sessions, string deviceId)
+    {
+        var session = deviceId.Length > 0 ? sessions.Find(deviceId) : sessions.MostRecent();
+        if (session is null)
+        {
+            Log.Warn(deviceId.Length > 0 ? $"No session for device '{deviceId}'" : "No device has connected yet");
+            return;
+        }
+
+        if (!session.Probe(Encoding.UTF8.GetBytes("Ping from server"))) Log.Warn($"No return path for {session.Id}");
+    }
+
+    private static void ListDevices(DeviceSessions sessions)
+    {
+        foreach (var s in sessions.Recent(20))
+        {
+            Log.Info($"    {s.Id,-16} {s.Endpoint,-22} seen={s.LastSeenUtc:HH:mm:ss} in={s.PacketsIn}/{s.BytesIn}B out={s.PacketsOut}/{s.BytesOut}B rtt={s.Rtt.TotalMilliseconds:0}ms dl={_downlinks.Pending(s.Id)}");
+        }
+    }
+
+    private static void LogSessionStats(UdpServer udpServer)
+    {
+        var evicted = udpServer.Sessions.Evict(SessionIdleLimit);
+        var stats = udpServer.Sessions.Snapshot();
+        Log.Info($"Sessions: devices={stats.Devices} active={stats.Active} evicted={evicted} in={stats.PacketsIn}/{stats.BytesIn}B out={stats.PacketsOut}/{stats.BytesOut}B rtt={stats.MeanRttMs:0}ms dropped={udpServer.Dropped}");
+    }
+
     private static void TestTcpHandler(TcpClient client, IPEndPoint remoteCaller)
     {
         Log.Info($"Received TCP message from {remoteCaller.Address}:{remoteCaller.Port}");
@@ -78,6 +184,7 @@ internal static class Program
                     }
 
                     Log.Info($"Remote message = '{Encoding.UTF8.GetString(buf.ToArray())}'");
+                    _store?.Append(ProfileDecoder.DeviceKey(remoteCaller), UplinkKind.TcpTest, DateTime.UtcNow, buf.ToArray());
                 }
                 else
                 {
@@ -96,13 +203,79 @@ internal static class Program
         }
     }
 
+    private static byte[] TestFrameHandler(byte[] frame, IPEndPoint remoteCaller)
+    {
+        var msgStr = Encoding.UTF8.GetString(frame);
+        Log.Info($"Got frame on port 424, from {remoteCaller.Address}:{remoteCaller.Port}: {msgStr}");
+        return Encoding.UTF8.GetBytes($"Reply from server. You are {remoteCaller.Address}:{remoteCaller.Port}; You said \"{msgStr}\"");
+    }
+
+    private static void ProfileUploadHandler(byte[] data, IPEndPoint remoteCaller, IUdpSender returnPath)
+    {
+        var device = ProfileDecoder.DeviceKey(remoteCaller);
+        if (!_profiles.Add(device, data))
+        {
+            Log.Warn($"Invalid profile upload from {remoteCaller.Address}:{remoteCaller.Port} ({data.Length} bytes)");
+            return; // no ack, so the device keeps the records
+        }
+        _store?.Append(device, UplinkKind.Profile, DateTime.UtcNow, data);
+
+        returnPath.SendData(Encoding.UTF8.GetBytes("ACK\n"));
+        _profiles.LogStats(device);
+    }
+
+    private static void BridgeHandler(byte[] data, IPEndPoint remoteCaller, IUdpSender returnPath)
+    {
+        var device = EwcBridge.DeviceKey(remoteCaller);
+        var reply = _bridge.Handle(device, data);
+        if (reply is null)
+        {
+            Log.Warn($"Invalid bridge datagram from {remoteCaller.Address}:{remoteCaller.Port} ({data.Length} bytes)");
+            return; // no ack, so the device sends it again
+        }
+        _store?.Append(device, UplinkKind.Bridge, DateTime.UtcNow, data);
+
+        returnPath.SendData(reply);
+    }
+
+    private static void QueueEwcCommand(string hex)
+    {
+        var device = _bridge.LastDevice;
+        if (device is null)
+        {
+            Log.Warn("No bridge device has connected yet");
+            return;
+        }
+
+        var body = EwcBridge.ParseHex(hex);
+        if (body is null)
+        {
+            Log.Warn($"Not a hex command: '{hex}'");
+            return;
+        }
+
+        if (!_bridge.QueueCommand(device, body))
+        {
+            Log.Warn($"Command too long: {body.Length} bytes, at most {EwcBridge.MaxFrameBytes - 2} before the ETX and checksum");
+            return;
+        }
+        Log.Info($"Command queued for {device}. It will go with the next bridge ack.");
+    }
+
     private static void TestUdpHandler(byte[] data, IPEndPoint remoteCaller, IUdpSender returnPath)
     {
         var msgStr = Encoding.UTF8.GetString(data);
         Log.Info($"Got message to port 420, from {remoteCaller.Address}:{remoteCaller.Port}");
         Log.Info(msgStr);
+        var device = ProfileDecoder.DeviceKey(remoteCaller);
+        _store?.Append(device, UplinkKind.Test, DateTime.UtcNow, data);
+
+        // Clear what the device has applied before attaching what is still waiting
+        if (DownlinkMailbox.TryParseAck(msgStr, out var acked)) _downlinks.Acknowledge(device, acked);
+        var reply = $"Reply from server. You are {remoteCaller.Address}:{remoteCaller.Port}; You said \"{msgStr}\"\n";
+        var downlinks = _downlinks.Attach(device, DownlinkMailbox.MaxReplyBytes - Encoding.UTF8.GetByteCount(reply));
+        if (downlinks.Length > 0) Log.Info($"Downlinks for {device}:\n{downlinks.TrimEnd()}");
 
-        _lastReturn = returnPath;
-        returnPath.SendData(Encoding.UTF8.GetBytes($"Reply from server. You are {remoteCaller.Address}:{remoteCaller.Port}; You said \"{msgStr}\"\n"));
+        returnPath.SendData(Encoding.UTF8.GetBytes(reply + downlinks));
     }
 }
\ No newline at end of file
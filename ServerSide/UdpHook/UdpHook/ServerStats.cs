@@ -0,0 +1,35 @@
+﻿using System.Diagnostics;
+
+namespace UdpHook;
+
+/// <summary>
+/// Process and traffic counters at one moment. Served as JSON on the
+/// loopback-only stats port, so load tests can measure the server's
+/// CPU and allocation rate from outside.
+/// </summary>
+internal record ServerStats(
+    long UptimeMs, double CpuMs, long AllocatedBytes, long HeapBytes,
+    int Gen0Collections, int Gen1Collections, int Gen2Collections,
+    ulong UdpBytesIn, ulong UdpBytesOut, long UdpDropped, int Sessions,
+    int TcpConnections, long LogDropped, long LogSampledOut)
+{
+    public static ServerStats Capture(UdpServer udp, TcpServer tcp)
+    {
+        using var process = Process.GetCurrentProcess();
+        return new ServerStats(
+            UptimeMs: (long)(DateTime.Now - process.StartTime).TotalMilliseconds,
+            CpuMs: process.TotalProcessorTime.TotalMilliseconds,
+            AllocatedBytes: GC.GetTotalAllocatedBytes(),
+            HeapBytes: GC.GetTotalMemory(false),
+            Gen0Collections: GC.CollectionCount(0),
+            Gen1Collections: GC.CollectionCount(1),
+            Gen2Collections: GC.CollectionCount(2),
+            UdpBytesIn: udp.TotalIn,
+            UdpBytesOut: udp.TotalOut,
+            UdpDropped: udp.Dropped,
+            Sessions: udp.Sessions.Count,
+            TcpConnections: tcp.OpenConnections,
+            LogDropped: Log.Dropped,
+            LogSampledOut: Log.SampledOut);
+    }
+}
\ No newline at end of file
@@ -1,8 +1,25 @@
-﻿using System.Net;
+﻿using System.Buffers;
+using System.Buffers.Binary;
+using System.Collections.Concurrent;
+using System.Net;
 using System.Net.Sockets;
 
 namespace UdpHook;
 
+/// <summary>
+/// TCP listener for any number of ports. Every connection is served on its
+/// own task, so a device holding a connection open doesn't stop others connecting.
+/// <p></p>
+/// Ports take either a raw responder, which gets the whole connection, or a
+/// frame responder. Frames are a 2-byte little-endian length then that many
+/// bytes; a zero length frame is a keep-alive. Frame connections use one pooled
+/// buffer each, read the next frame only after the last reply is written (so a
+/// slow client backs up its own socket, not the server), and are closed after
+/// <see cref="IdleTimeout"/> without a frame.
+/// <p></p>
+/// Past <see cref="MaxConnections"/> open connections we stop accepting, and new
+/// callers wait in the OS backlog until one closes.
+/// </summary>
 internal class TcpServer : IDisposable
 {
     /// <summary>
@@ -11,80 +28,231 @@ internal class TcpServer : IDisposable
     /// <param name="client">Connection client</param>
     /// <param name="remoteCaller">The address and port of remote side</param>
     public delegate void TcpResponder(TcpClient client, IPEndPoint remoteCaller);
-    
-    private volatile bool _running;
-    
+
+    /// <summary>
+    /// Pattern for a framed TCP responder
+    /// </summary>
+    /// <param name="frame">One frame from the remote caller, without its length</param>
+    /// <param name="remoteCaller">The address and port of remote side</param>
+    /// <returns>Frame to send back, or null for no reply</returns>
+    public delegate byte[]? TcpFrameResponder(byte[] frame, IPEndPoint remoteCaller);
+
+    /// <summary> Largest frame in either direction </summary>
+    public const int MaxFrame = 4096;
+
+    /// <summary> Open connections, across all ports, before we stop accepting </summary>
+    public const int MaxConnections = 10_000;
+
+    /// <summary> Frame connections with no frame for this long are closed </summary>
+    public static readonly TimeSpan IdleTimeout = TimeSpan.FromMinutes(5);
+
+    private const int LengthBytes = 2;
+
+    private readonly CancellationTokenSource _stop = new();
+    private readonly SemaphoreSlim _slots = new(MaxConnections, MaxConnections);
+    private readonly ConcurrentDictionary<TcpClient, byte> _clients = new();
     private readonly Dictionary<int, Responder> _responders = new();
-    
+    private readonly List<Task> _tasks = new();
+    private bool _disposed;
+
+    /// <summary>
+    /// Connections open right now, across all ports
+    /// </summary>
+    public int OpenConnections => _clients.Count;
+
     private class Responder
     {
-        public TcpResponder Action { get; }
-        public TcpListener Client { get; }
-        public Thread? WaitThread { get; set; }
+        public int Port { get; }
+        public TcpListener Listener { get; }
+        public TcpResponder? Raw { get; init; }
+        public TcpFrameResponder? Framed { get; init; }
 
-        public Responder(int port, TcpResponder action)
+        public Responder(int port)
         {
-            Action = action;
-            Client = new TcpListener(new IPEndPoint(IPAddress.Any, port));
+            Port = port;
+            Listener = new TcpListener(new IPEndPoint(IPAddress.Any, port));
         }
     }
 
     public void AddResponder(int port, TcpResponder action)
     {
         if (_responders.ContainsKey(port)) throw new Exception("This port is already bound");
-        var responder = new Responder(port, action);
-        _responders.Add(port, responder);
+        _responders.Add(port, new Responder(port) { Raw = action });
+    }
 
-        responder.WaitThread = new Thread(() => { ListenLoop(port); }) { IsBackground = true, Name = $"TcpWaitThread_Port_{port}" };
+    public void AddFrameResponder(int port, TcpFrameResponder action)
+    {
+        if (_responders.ContainsKey(port)) throw new Exception("This port is already bound");
+        _responders.Add(port, new Responder(port) { Framed = action });
     }
 
-    private void ListenLoop(int port)
+    private async Task AcceptLoop(Responder responder)
     {
-        var responder = _responders[port];
-        var sender = new IPEndPoint(IPAddress.Any, 0);
-        
-        responder.Client.Start();
-        Log.Info($"Listening for messages on port {port}...");
-        while (_running)
+        var token = _stop.Token;
+
+        responder.Listener.Start();
+        Log.Info($"Listening for messages on port {responder.Port}...");
+        while (!token.IsCancellationRequested)
         {
             try
             {
-                if (!responder.Client.Pending())
+                await _slots.WaitAsync(token);
+
+                TcpClient client;
+                try
+                {
+                    client = await responder.Listener.AcceptTcpClientAsync(token);
+                }
+                catch
                 {
-                    Thread.Sleep(100);
-                    continue; // check we are still running
+                    _slots.Release();
+                    throw;
                 }
 
-                using var client = responder.Client.AcceptTcpClient();
-                responder.Action(client, sender);
-                
-                Log.Info("TCP transaction complete");
+                _ = Serve(responder, client);
+            }
+            catch (OperationCanceledException)
+            {
+                break;
+            }
+            catch (Exception) when (token.IsCancellationRequested)
+            {
+                break; // listener stopped under us
             }
             catch (Exception ex)
             {
-                Log.Error($"Failure in ListenLoop loop for port {port}", ex);
+                Log.Error($"Failure in accept loop for port {responder.Port}", ex);
             }
         }
-        Log.Info($"Closing listener for port {port}...");
+        Log.Info($"Closing listener for port {responder.Port}...");
     }
 
-    public void Start()
+    private async Task Serve(Responder responder, TcpClient client)
+    {
+        var remote = (IPEndPoint)client.Client.RemoteEndPoint!;
+        _clients.TryAdd(client, 0);
+        try
+        {
+            using (client)
+            {
+                if (responder.Framed is not null)
+                {
+                    await ServeFrames(responder.Framed, client, remote);
+                }
+                else
+                {
+                    // Raw responders block, so give them their own thread rather than a pool one
+                    await Task.Factory.StartNew(() => responder.Raw!(client, remote), CancellationToken.None, TaskCreationOptions.LongRunning, TaskScheduler.Default);
+                }
+            }
+
+            Log.Info("TCP transaction complete");
+        }
+        catch (Exception) when (_stop.IsCancellationRequested)
+        {
+            // server stopping; connection closed under us
+        }
+        catch (Exception ex)
+        {
+            Log.Error($"Failure in connection from {remote.Address}:{remote.Port}", ex);
+        }
+        finally
+        {
+            _clients.TryRemove(client, out _);
+            _slots.Release();
+        }
+    }
+
+    private async Task ServeFrames(TcpFrameResponder action, TcpClient client, IPEndPoint remote)
     {
-        _running = true;
+        var stream = client.GetStream();
+        var buffer = ArrayPool<byte>.Shared.Rent(LengthBytes + MaxFrame);
+        using var idle = CancellationTokenSource.CreateLinkedTokenSource(_stop.Token);
+        try
+        {
+            while (true)
+            {
+                idle.CancelAfter(IdleTimeout);
+
+                if (!await ReadFully(stream, buffer.AsMemory(0, LengthBytes), idle.Token)) return; // remote closed
+                var length = BinaryPrimitives.ReadUInt16LittleEndian(buffer);
+                if (length == 0) continue; // keep-alive
+                if (length > MaxFrame)
+                {
+                    Log.Warn($"TCP {remote.Address}:{remote.Port} sent a {length} byte frame; closing");
+                    return;
+                }
+
+                if (!await ReadFully(stream, buffer.AsMemory(0, length), idle.Token))
+                {
+                    Log.Warn($"TCP {remote.Address}:{remote.Port} closed part way through a frame");
+                    return;
+                }
+
+                var reply = action(buffer.AsSpan(0, length).ToArray(), remote);
+                if (reply is null) continue;
+                if (reply.Length > MaxFrame) throw new Exception($"Reply of {reply.Length} bytes is over the frame limit");
 
+                BinaryPrimitives.WriteUInt16LittleEndian(buffer, (ushort)reply.Length);
+                reply.CopyTo(buffer, LengthBytes);
+                await stream.WriteAsync(buffer.AsMemory(0, LengthBytes + reply.Length), idle.Token);
+            }
+        }
+        catch (OperationCanceledException) when (!_stop.IsCancellationRequested)
+        {
+            Log.Info($"TCP {remote.Address}:{remote.Port} idle for {IdleTimeout.TotalSeconds:0}s; closing");
+        }
+        finally
+        {
+            ArrayPool<byte>.Shared.Return(buffer);
+        }
+    }
+
+    /// <summary>
+    /// Fill 'target' from the stream. Returns false if the stream ends first.
+    /// </summary>
+    private static async Task<bool> ReadFully(Stream stream, Memory<byte> target, CancellationToken token)
+    {
+        while (target.Length > 0)
+        {
+            var read = await stream.ReadAsync(target, token);
+            if (read < 1) return false;
+            target = target[read..];
+        }
+        return true;
+    }
+
+    public void Start()
+    {
         foreach (var responder in _responders.Values)
         {
-            responder.WaitThread?.Start();
+            _tasks.Add(Task.Run(() => AcceptLoop(responder)));
         }
     }
 
     public void Dispose()
     {
-        _running = false;
-       
+        if (_disposed) return;
+        _disposed = true;
+        _stop.Cancel();
+
         foreach (var responder in _responders.Values)
         {
-            responder.Client.Stop();
+            responder.Listener.Stop();
+        }
+
+        foreach (var client in _clients.Keys)
+        {
+            client.Close();
+        }
+
+        try
+        {
+            Task.WaitAll(_tasks.ToArray(), TimeSpan.FromSeconds(2));
+        }
+        catch (AggregateException)
+        {
+            // loops end with cancellation; nothing more to report
         }
         GC.SuppressFinalize(this);
     }
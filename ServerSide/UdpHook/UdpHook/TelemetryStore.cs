@@ -0,0 +1,569 @@
+﻿using System.Buffers;
+using System.Buffers.Binary;
+using System.Collections.Concurrent;
+using System.IO.MemoryMappedFiles;
+using System.Text;
+using System.Threading.Channels;
+using Microsoft.Win32.SafeHandles;
+
+namespace UdpHook;
+
+/// <summary>
+/// What a stored uplink was
+/// </summary>
+public enum UplinkKind : byte
+{
+    Test = 1,
+    TcpTest = 2,
+    Profile = 3,
+    Bridge = 4
+}
+
+/// <summary>
+/// One uplink read back from the store
+/// </summary>
+public readonly record struct TelemetryRecord(string Device, UplinkKind Kind, DateTime ReceivedUtc, byte[] Data);
+
+/// <summary>
+/// Append-only store for device uplinks.
+/// <p></p>
+/// Records go into numbered segment files (<c>seg-000001.tlm</c>, ...), each a short
+/// header then records of: CRC32, payload length, kind, device number, UTC ticks, payload.
+/// Device names are numbered in <c>devices.txt</c>, one per line.
+/// <p></p>
+/// <c>index.bin</c> is memory mapped, and holds a chain of fixed-size blocks per device.
+/// Each block lists (ticks, location) for up to 63 records in time order, and points
+/// back to the device's previous block, so "device X, last 24 h" walks back from the
+/// newest block and binary-searches the ends without reading any other device's data.
+/// <p></p>
+/// Appends are queued, and one writer thread writes everything waiting as a single
+/// batch with one flush to disk (group commit), then adds the batch to the index.
+/// If the store was not closed cleanly, the index is rebuilt from the segments on open,
+/// and a torn record at the end of the last segment is cut off.
+/// </summary>
+public sealed class TelemetryStore : IDisposable
+{
+    public const long DefaultSegmentBytes = 256L << 20;
+
+    private const uint SegmentMagic = 0x314D4C54; // "TLM1"
+    private const int SegmentHeaderBytes = 8;
+    private const int RecordHeaderBytes = 20;
+    private const int SegmentShift = 40; // location = segment number << 40 | offset
+
+    private const uint IndexMagic = 0x31584449; // "IDX1"
+    private const int IndexHeaderBytes = 1024;
+    private const int BlockBytes = 1024;
+    private const int BlockHeaderBytes = 16;
+    private const int EntryBytes = 16;
+    private const int EntriesPerBlock = (BlockBytes - BlockHeaderBytes) / EntryBytes;
+    private const long IndexGrowBytes = 64L << 20;
+
+    private const int BatchLimit = 8192;
+    private const int QueueDepth = 65536;
+
+    private readonly string _directory;
+    private readonly long _segmentBytes;
+    private readonly bool _flushToDisk;
+    private readonly Channel<Pending> _queue;
+    private readonly Task _writer;
+
+    private readonly ConcurrentDictionary<string, int> _deviceNumbers = new();
+    private readonly List<string> _deviceNames = new();
+    private readonly FileStream _devicesFile;
+    private bool _devicesDirty;
+
+    private FileStream _segment;
+    private int _segmentNo;
+    private readonly ConcurrentDictionary<int, SafeFileHandle> _readHandles = new();
+
+    private readonly ReaderWriterLockSlim _indexLock = new();
+    private MemoryMappedFile _indexFile = null!; // set by MapIndex
+    private MemoryMappedViewAccessor _index = null!;
+    private long _indexCapacity;
+    private int _blockCount;
+    private readonly Dictionary<int, int> _heads = new(); // device number -> newest block
+    private readonly Dictionary<int, long> _lastTicks = new(); // writer only
+
+    private long _appended;
+    private long _committed;
+    private long _lost; // taken off the queue by a batch that failed to write
+    private readonly object _commitLock = new();
+    private readonly List<(long Count, TaskCompletionSource Done)> _waiters = new();
+    private bool _disposed;
+
+    private readonly record struct Pending(string Device, UplinkKind Kind, long Ticks, byte[] Data);
+    private readonly record struct Written(int Device, long Ticks, long Location);
+
+    /// <param name="directory">Where segments and index live. Created if needed.</param>
+    /// <param name="segmentBytes">Start a new segment once the current one reaches this size</param>
+    /// <param name="flushToDisk">Flush each batch through to the disk, not just the OS cache</param>
+    public TelemetryStore(string directory, long segmentBytes = DefaultSegmentBytes, bool flushToDisk = true)
+    {
+        _directory = directory;
+        _segmentBytes = segmentBytes;
+        _flushToDisk = flushToDisk;
+        Directory.CreateDirectory(directory);
+
+        var devicesPath = Path.Combine(directory, "devices.txt");
+        if (File.Exists(devicesPath))
+        {
+            foreach (var name in File.ReadAllLines(devicesPath))
+            {
+                _deviceNumbers[name] = _deviceNames.Count;
+                _deviceNames.Add(name);
+            }
+        }
+        _devicesFile = new FileStream(devicesPath, FileMode.Append, FileAccess.Write, FileShare.Read);
+
+        _segmentNo = Directory.GetFiles(directory, "seg-*.tlm").Select(SegmentNumber).DefaultIfEmpty(1).Max();
+        var clean = OpenIndex();
+        var rebuilt = !clean && Directory.GetFiles(directory, "seg-*.tlm").Length > 0;
+        if (rebuilt) Rebuild();
+        _segment = OpenSegment(_segmentNo);
+
+        _appended = _committed;
+        _queue = Channel.CreateBounded<Pending>(new BoundedChannelOptions(QueueDepth) { SingleReader = true });
+        _writer = Task.Run(WriteLoop);
+
+        Log.Info($"Telemetry store at {directory}: {_committed} records, {_deviceNames.Count} devices, {_segmentNo} segments{(rebuilt ? " (index rebuilt)" : "")}");
+    }
+
+    /// <summary> Records stored and flushed </summary>
+    public long Count => Interlocked.Read(ref _committed);
+
+    /// <summary>
+    /// Queue an uplink to be stored. Waits only if the writer is a full queue behind.
+    /// </summary>
+    public void Append(string device, UplinkKind kind, DateTime receivedUtc, byte[] data)
+    {
+        if (_disposed) throw new ObjectDisposedException(nameof(TelemetryStore));
+        if (data.Length > ushort.MaxValue) throw new ArgumentException($"Uplink of {data.Length} bytes is too big to store");
+
+        var pending = new Pending(device, kind, receivedUtc.Ticks, data);
+        Interlocked.Increment(ref _appended);
+        if (!_queue.Writer.TryWrite(pending)) _queue.Writer.WriteAsync(pending).AsTask().GetAwaiter().GetResult();
+    }
+
+    /// <summary>
+    /// Completes when everything appended before this call is on disk and in the index.
+    /// Fails if a write of any of it failed.
+    /// </summary>
+    public Task CommitAsync()
+    {
+        var target = Interlocked.Read(ref _appended);
+        lock (_commitLock)
+        {
+            if (_committed + _lost >= target) return Task.CompletedTask;
+            var done = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            _waiters.Add((target, done));
+            return done.Task;
+        }
+    }
+
+    /// <summary>
+    /// Records for a device received in [fromUtc, toUtc), oldest first.
+    /// With a limit, the newest 'limit' records in the range are returned.
+    /// </summary>
+    public List<TelemetryRecord> Query(string device, DateTime fromUtc, DateTime toUtc, int limit = int.MaxValue)
+    {
+        var result = new List<TelemetryRecord>();
+        if (!_deviceNumbers.TryGetValue(device, out var number)) return result;
+
+        var locations = FindLocations(number, fromUtc.Ticks, toUtc.Ticks, limit);
+        for (var i = locations.Count - 1; i >= 0; i--) result.Add(ReadRecord(device, locations[i]));
+        return result;
+    }
+
+    /// <summary>
+    /// Index lookup: locations in the range, newest first
+    /// </summary>
+    private List<long> FindLocations(int device, long from, long to, int limit)
+    {
+        var locations = new List<long>();
+        _indexLock.EnterReadLock();
+        try
+        {
+            if (!_heads.TryGetValue(device, out var block)) return locations;
+
+            while (block >= 0 && locations.Count < limit)
+            {
+                var at = BlockOffset(block);
+                var prev = _index.ReadInt32(at + 4) - 1;
+                var count = _index.ReadInt32(at + 8);
+                if (count < 1 || EntryTicks(block, 0) >= to)
+                {
+                    block = prev; // block is all newer than the range
+                    continue;
+                }
+
+                var start = LowerBound(block, count, from);
+                var end = LowerBound(block, count, to);
+                for (var i = end - 1; i >= start && locations.Count < limit; i--)
+                {
+                    locations.Add(_index.ReadInt64(at + BlockHeaderBytes + i * EntryBytes + 8));
+                }
+
+                if (start > 0) break; // older entries are before the range
+                block = prev;
+            }
+        }
+        finally
+        {
+            _indexLock.ExitReadLock();
+        }
+        return locations;
+    }
+
+    /// <summary>
+    /// First entry in a block at or after 'ticks'
+    /// </summary>
+    private int LowerBound(int block, int count, long ticks)
+    {
+        int lo = 0, hi = count;
+        while (lo < hi)
+        {
+            var mid = (lo + hi) / 2;
+            if (EntryTicks(block, mid) < ticks) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    private long EntryTicks(int block, int entry) => _index.ReadInt64(BlockOffset(block) + BlockHeaderBytes + entry * EntryBytes);
+
+    private static long BlockOffset(int block) => IndexHeaderBytes + (long)block * BlockBytes;
+
+    private TelemetryRecord ReadRecord(string device, long location)
+    {
+        var segment = (int)(location >> SegmentShift);
+        var offset = location & ((1L << SegmentShift) - 1);
+        var handle = _readHandles.GetOrAdd(segment, n => File.OpenHandle(SegmentPath(n), FileMode.Open, FileAccess.Read, FileShare.ReadWrite));
+
+        Span<byte> header = stackalloc byte[RecordHeaderBytes];
+        RandomAccess.Read(handle, header, offset);
+        var length = BinaryPrimitives.ReadUInt16LittleEndian(header[4..]);
+        var data = new byte[length];
+        RandomAccess.Read(handle, data, offset + RecordHeaderBytes);
+
+        return new TelemetryRecord(device, (UplinkKind)header[6], new DateTime(BinaryPrimitives.ReadInt64LittleEndian(header[12..]), DateTimeKind.Utc), data);
+    }
+
+    private async Task WriteLoop()
+    {
+        var buffer = new ArrayBufferWriter<byte>(1 << 20);
+        var batch = new List<Written>(BatchLimit);
+        var reader = _queue.Reader;
+        var taken = Interlocked.Read(ref _committed); // records taken off the queue, counted like _appended
+
+        while (await reader.WaitToReadAsync())
+        {
+            try
+            {
+                var batchStart = _segment.Position;
+                while (batch.Count < BatchLimit && reader.TryRead(out var pending))
+                {
+                    taken++;
+                    var recordBytes = RecordHeaderBytes + pending.Data.Length;
+                    if (batchStart + buffer.WrittenCount + recordBytes > _segmentBytes && batchStart + buffer.WrittenCount > SegmentHeaderBytes)
+                    {
+                        Commit(buffer, batch);
+                        _segment.Dispose();
+                        _segment = OpenSegment(++_segmentNo);
+                        batchStart = _segment.Position;
+                    }
+
+                    var device = DeviceNumber(pending.Device);
+                    var ticks = Math.Max(pending.Ticks, _lastTicks.GetValueOrDefault(device)); // index needs time order per device
+                    _lastTicks[device] = ticks;
+
+                    batch.Add(new Written(device, ticks, ((long)_segmentNo << SegmentShift) | (batchStart + buffer.WrittenCount)));
+                    EncodeRecord(buffer, device, pending.Kind, ticks, pending.Data);
+                }
+                Commit(buffer, batch);
+            }
+            catch (Exception ex)
+            {
+                Log.Error("Telemetry store write failed", ex);
+
+                // Everything taken and not committed is lost. Every waiter was waiting on at least the
+                // first of those records, so fail them all. Later waits don't wait on the lost records
+                lock (_commitLock)
+                {
+                    _lost = taken - _committed;
+                    foreach (var waiter in _waiters) waiter.Done.SetException(ex);
+                    _waiters.Clear();
+                }
+                buffer.Clear();
+                batch.Clear();
+            }
+        }
+    }
+
+    /// <summary>
+    /// Write a batch with one flush, then index it and release anyone waiting for it
+    /// </summary>
+    private void Commit(ArrayBufferWriter<byte> buffer, List<Written> batch)
+    {
+        if (batch.Count < 1) return;
+
+        if (_devicesDirty)
+        {
+            _devicesFile.Flush(_flushToDisk); // names before the records that use them
+            _devicesDirty = false;
+        }
+        _segment.Write(buffer.WrittenSpan);
+        _segment.Flush(_flushToDisk);
+
+        _indexLock.EnterWriteLock();
+        try
+        {
+            foreach (var written in batch) AddToIndex(written.Device, written.Ticks, written.Location);
+        }
+        finally
+        {
+            _indexLock.ExitWriteLock();
+        }
+
+        lock (_commitLock)
+        {
+            _committed += batch.Count;
+            _waiters.RemoveAll(w =>
+            {
+                if (w.Count > _committed + _lost) return false;
+                w.Done.SetResult();
+                return true;
+            });
+        }
+
+        buffer.Clear();
+        batch.Clear();
+    }
+
+    private int DeviceNumber(string name)
+    {
+        if (_deviceNumbers.TryGetValue(name, out var number)) return number;
+
+        name = name.Replace('\n', ' ').Replace('\r', ' ');
+        number = _deviceNames.Count;
+        _deviceNames.Add(name);
+        _devicesFile.Write(Encoding.UTF8.GetBytes(name + "\n"));
+        _devicesDirty = true;
+        _deviceNumbers[name] = number;
+        return number;
+    }
+
+    private static void EncodeRecord(IBufferWriter<byte> buffer, int device, UplinkKind kind, long ticks, byte[] data)
+    {
+        var span = buffer.GetSpan(RecordHeaderBytes + data.Length);
+        BinaryPrimitives.WriteUInt16LittleEndian(span[4..], (ushort)data.Length);
+        span[6] = (byte)kind;
+        span[7] = 0;
+        BinaryPrimitives.WriteInt32LittleEndian(span[8..], device);
+        BinaryPrimitives.WriteInt64LittleEndian(span[12..], ticks);
+        data.CopyTo(span[RecordHeaderBytes..]);
+        BinaryPrimitives.WriteUInt32LittleEndian(span, Crc32.Compute(span[4..(RecordHeaderBytes + data.Length)]));
+        buffer.Advance(RecordHeaderBytes + data.Length);
+    }
+
+    /// <summary>
+    /// Add an entry to the device's newest block, starting a new block when it is full.
+    /// Caller holds the index write lock.
+    /// </summary>
+    private void AddToIndex(int device, long ticks, long location)
+    {
+        var hasHead = _heads.TryGetValue(device, out var block);
+        if (!hasHead || _index.ReadInt32(BlockOffset(block) + 8) >= EntriesPerBlock)
+        {
+            var prev = hasHead ? block : -1;
+            block = _blockCount++;
+            EnsureIndexCapacity(BlockOffset(block) + BlockBytes);
+
+            var header = BlockOffset(block);
+            _index.Write(header, device);
+            _index.Write(header + 4, prev + 1);
+            _index.Write(header + 8, 0);
+            _heads[device] = block;
+        }
+
+        var at = BlockOffset(block);
+        var count = _index.ReadInt32(at + 8);
+        _index.Write(at + BlockHeaderBytes + count * EntryBytes, ticks);
+        _index.Write(at + BlockHeaderBytes + count * EntryBytes + 8, location);
+        _index.Write(at + 8, count + 1);
+    }
+
+    /// <summary>
+    /// Map the index, and read its blocks if it was closed cleanly. Returns false if it must be rebuilt.
+    /// </summary>
+    private bool OpenIndex()
+    {
+        var path = Path.Combine(_directory, "index.bin");
+        var exists = File.Exists(path) && new FileInfo(path).Length >= IndexHeaderBytes;
+        MapIndex(Math.Max(IndexGrowBytes, exists ? new FileInfo(path).Length : 0));
+
+        var clean = exists && _index.ReadUInt32(0) == IndexMagic && _index.ReadInt32(12) == 1;
+        if (clean)
+        {
+            _blockCount = _index.ReadInt32(8);
+            _committed = _index.ReadInt64(16);
+            for (var block = 0; block < _blockCount; block++)
+            {
+                var at = BlockOffset(block);
+                var device = _index.ReadInt32(at);
+                _heads[device] = block; // later blocks replace earlier ones
+                var count = _index.ReadInt32(at + 8);
+                if (count > 0) _lastTicks[device] = EntryTicks(block, count - 1);
+            }
+        }
+        else
+        {
+            _blockCount = 0;
+            _committed = 0;
+            _index.Write(0, IndexMagic);
+            _index.Write(4, 1); // version
+        }
+
+        _index.Write(12, 0); // not clean until Dispose
+        _index.Flush();
+        return clean;
+    }
+
+    private void MapIndex(long capacity)
+    {
+        _index?.Dispose();
+        _indexFile?.Dispose();
+        _indexFile = MemoryMappedFile.CreateFromFile(Path.Combine(_directory, "index.bin"), FileMode.OpenOrCreate, null, capacity);
+        _index = _indexFile.CreateViewAccessor();
+        _indexCapacity = capacity;
+    }
+
+    private void EnsureIndexCapacity(long needed)
+    {
+        if (needed <= _indexCapacity) return;
+        _index.Flush();
+        MapIndex(_indexCapacity + IndexGrowBytes);
+    }
+
+    /// <summary>
+    /// Re-index every record in every segment. A bad record ends a segment; at the end
+    /// of the last segment it is a torn write, and is cut off.
+    /// </summary>
+    private void Rebuild()
+    {
+        Log.Warn($"Telemetry store at {_directory} was not closed cleanly; rebuilding index");
+        var segments = Directory.GetFiles(_directory, "seg-*.tlm").Select(SegmentNumber).OrderBy(n => n).ToList();
+        var header = new byte[RecordHeaderBytes];
+        var data = new byte[ushort.MaxValue];
+
+        foreach (var segment in segments)
+        {
+            using var file = new FileStream(SegmentPath(segment), FileMode.Open, FileAccess.ReadWrite, FileShare.Read, 1 << 16);
+            var offset = (long)SegmentHeaderBytes;
+            file.Position = offset;
+            while (true)
+            {
+                if (file.Read(header, 0, RecordHeaderBytes) < RecordHeaderBytes) break;
+                var length = BinaryPrimitives.ReadUInt16LittleEndian(header.AsSpan(4));
+                if (file.Read(data, 0, length) < length) break;
+
+                var crc = Crc32.Compute(header.AsSpan(4), data.AsSpan(0, length));
+                var device = BinaryPrimitives.ReadInt32LittleEndian(header.AsSpan(8));
+                if (crc != BinaryPrimitives.ReadUInt32LittleEndian(header) || device < 0 || device >= _deviceNames.Count) break;
+
+                var ticks = Math.Max(BinaryPrimitives.ReadInt64LittleEndian(header.AsSpan(12)), _lastTicks.GetValueOrDefault(device));
+                _lastTicks[device] = ticks;
+                AddToIndex(device, ticks, ((long)segment << SegmentShift) | offset);
+                _committed++;
+                offset += RecordHeaderBytes + length;
+            }
+
+            if (offset < file.Length)
+            {
+                var last = segment == segments[^1];
+                Log.Warn($"Telemetry segment {segment}: {file.Length - offset} bytes after offset {offset} are not valid records{(last ? "; cut off" : "")}");
+                if (last) file.SetLength(offset);
+            }
+        }
+        _index.Flush();
+    }
+
+    private FileStream OpenSegment(int number)
+    {
+        var file = new FileStream(SegmentPath(number), FileMode.OpenOrCreate, FileAccess.ReadWrite, FileShare.Read, 1 << 16);
+        if (file.Length < SegmentHeaderBytes)
+        {
+            var header = new byte[SegmentHeaderBytes];
+            BinaryPrimitives.WriteUInt32LittleEndian(header, SegmentMagic);
+            BinaryPrimitives.WriteInt32LittleEndian(header.AsSpan(4), number);
+            file.SetLength(0);
+            file.Write(header);
+            file.Flush(_flushToDisk);
+        }
+        file.Position = file.Length;
+        return file;
+    }
+
+    private string SegmentPath(int number) => Path.Combine(_directory, $"seg-{number:D6}.tlm");
+
+    private static int SegmentNumber(string path) => int.TryParse(Path.GetFileNameWithoutExtension(path)[4..], out var n) ? n : 0;
+
+    public void Dispose()
+    {
+        if (_disposed) return;
+        _disposed = true;
+
+        _queue.Writer.TryComplete();
+        _writer.Wait();
+
+        _indexLock.EnterWriteLock();
+        try
+        {
+            _index.Flush();
+            _index.Write(8, _blockCount);
+            _index.Write(16, _committed);
+            _index.Write(12, 1); // clean
+            _index.Flush();
+            _index.Dispose();
+            _indexFile.Dispose();
+        }
+        finally
+        {
+            _indexLock.ExitWriteLock();
+        }
+
+        _segment.Dispose();
+        _devicesFile.Dispose();
+        foreach (var handle in _readHandles.Values) handle.Dispose();
+        GC.SuppressFinalize(this);
+    }
+}
+
+/// <summary>
+/// CRC-32 (IEEE), for spotting torn or damaged records
+/// </summary>
+internal static class Crc32
+{
+    private static readonly uint[] Table = MakeTable();
+
+    public static uint Compute(ReadOnlySpan<byte> data) => Compute(data, ReadOnlySpan<byte>.Empty);
+
+    public static uint Compute(ReadOnlySpan<byte> first, ReadOnlySpan<byte> second)
+    {
+        var crc = 0xFFFFFFFFu;
+        foreach (var b in first) crc = Table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+        foreach (var b in second) crc = Table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    private static uint[] MakeTable()
+    {
+        var table = new uint[256];
+        for (var i = 0u; i < 256; i++)
+        {
+            var c = i;
+            for (var k = 0; k < 8; k++) c = (c & 1) != 0 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }
+}
\ No newline at end of file
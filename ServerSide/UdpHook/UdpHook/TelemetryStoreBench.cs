@@ -0,0 +1,61 @@
+﻿using System.Diagnostics;
+
+namespace UdpHook;
+
+/// <summary>
+/// Ingest and query timing for <see cref="TelemetryStore"/>.
+/// Run with <c>UdpHook --bench-store [records] [devices]</c>.
+/// </summary>
+internal static class TelemetryStoreBench
+{
+    private const int PayloadBytes = 48; // about one bridge datagram
+    private const int Queries = 2000;
+    private static readonly TimeSpan Span = TimeSpan.FromDays(7);
+
+    public static void Run(long records, int devices)
+    {
+        var directory = Path.Combine(Path.GetTempPath(), "udphook-store-bench");
+        if (Directory.Exists(directory)) Directory.Delete(directory, true);
+
+        var names = Enumerable.Range(0, devices).Select(i => $"10.{i >> 16 & 255}.{i >> 8 & 255}.{i & 255}").ToArray();
+        var payload = new byte[PayloadBytes];
+        new Random(1).NextBytes(payload);
+
+        var end = DateTime.UtcNow;
+        var start = end - Span;
+        var step = Span.Ticks / records;
+
+        Log.Info($"Store bench: {records} records of {PayloadBytes} bytes over {devices} devices and {Span.TotalDays} days");
+        var store = new TelemetryStore(directory);
+        var clock = Stopwatch.StartNew();
+        for (long i = 0; i < records; i++)
+        {
+            store.Append(names[i % devices], UplinkKind.Bridge, new DateTime(start.Ticks + i * step, DateTimeKind.Utc), payload);
+            if (i % 5_000_000 == 4_999_999) Log.Info($"    {i + 1} queued, {store.Count} committed, {clock.Elapsed.TotalSeconds:0.0}s");
+        }
+        store.CommitAsync().Wait();
+        var ingestS = clock.Elapsed.TotalSeconds;
+        Log.Info($"Ingest: {records / ingestS:0} records/s, {records * (PayloadBytes + 20) / ingestS / 1e6:0.0} MB/s, {ingestS:0.0}s");
+
+        clock.Restart();
+        store.Dispose();
+        store = new TelemetryStore(directory);
+        Log.Info($"Close and reopen: {clock.Elapsed.TotalMilliseconds:0}ms");
+
+        var random = new Random(2);
+        var timesUs = new double[Queries];
+        long found = 0;
+        for (var q = 0; q < Queries; q++)
+        {
+            var device = names[random.Next(devices)];
+            clock.Restart();
+            found += store.Query(device, end - TimeSpan.FromHours(24), end).Count;
+            timesUs[q] = clock.Elapsed.TotalMilliseconds * 1000;
+        }
+        Array.Sort(timesUs);
+        Log.Info($"Query 'device, last 24 h': {found / (double)Queries:0.0} records each, p50={timesUs[Queries / 2]:0}us p99={timesUs[Queries * 99 / 100]:0}us max={timesUs[^1]:0}us");
+
+        store.Dispose();
+        Directory.Delete(directory, true);
+    }
+}
\ No newline at end of file
@@ -1,25 +1,29 @@
 ﻿using System.Net;
 using System.Net.Sockets;
+using System.Threading.Channels;
 
 namespace UdpHook;
 
 public class UpdSender : IUdpSender
 {
-    private readonly UdpClient _connection;
+    private readonly Socket _connection;
     private readonly IPEndPoint _target;
     private readonly UdpServer _parent;
+    private readonly DeviceSession? _session;
 
-    public UpdSender(UdpClient connection, IPEndPoint target, UdpServer parent)
+    public UpdSender(Socket connection, IPEndPoint target, UdpServer parent, DeviceSession? session = null)
     {
         _connection = connection;
         _target = target;
         _parent = parent;
+        _session = session;
     }
-    
+
     public void SendData(byte[] data)
     {
-        _parent.TotalOut += (ulong)data.Length;
-        var bytes = _connection.Send(data, data.Length, _target);
+        var bytes = _connection.SendTo(data, _target);
+        _parent.CountOut(bytes);
+        _session?.Sent(bytes);
         Log.Info($"{bytes} bytes out of {data.Length} sent to {_target}");
     }
 }
@@ -29,6 +33,17 @@ public interface IUdpSender
     void SendData(byte[] data);
 }
 
+/// <summary>
+/// UDP listener for any number of ports.
+/// <p></p>
+/// Each port has async receive loops that each read into one reused buffer, and
+/// hand a copy of exactly the received bytes to worker tasks through bounded channels. A datagram goes to the
+/// worker picked by its sender's address, so each device's datagrams are handled
+/// in order while different devices are handled in parallel. A slow responder
+/// only holds up devices on its own worker. If a worker's channel is full, new
+/// datagrams for it are dropped and counted (the device will send again),
+/// so receiving never blocks.
+/// </summary>
 public class UdpServer : IDisposable
 {
     /// <summary>
@@ -38,91 +53,212 @@ public class UdpServer : IDisposable
     /// <param name="remoteCaller">The address and port of remote side</param>
     /// <param name="returnPath">Use this to send data back to the remote caller</param>
     public delegate void UdpResponder(byte[] data, IPEndPoint remoteCaller, IUdpSender returnPath);
-    
-    private volatile bool _running;
-    
+
+    /// <summary> Largest datagram we read. Anything longer is cut by the socket </summary>
+    private const int MaxDatagram = 65536;
+
+    /// <summary> Outstanding receives per port </summary>
+    private const int ReceivesPerPort = 2;
+
+    /// <summary> Datagrams waiting for each worker before new ones are dropped </summary>
+    private const int WorkerQueueDepth = 4096;
+
+    /// <summary> Windows: stop ICMP 'port unreachable' from failing the next receive </summary>
+    private const int SioUdpConnReset = -1744830452;
+
+    private readonly CancellationTokenSource _stop = new();
     private readonly Dictionary<int, Responder> _responders = new();
-    
-    public ulong TotalIn { get; set; }
-    public ulong TotalOut { get; set; }
+    private readonly Channel<Datagram>[] _workQueues;
+    private readonly List<Task> _tasks = new();
+    private long _dropped;
+    private long _totalIn;
+    private long _totalOut;
+    private bool _disposed;
+
+    public ulong TotalIn => (ulong)Interlocked.Read(ref _totalIn);
+    public ulong TotalOut => (ulong)Interlocked.Read(ref _totalOut);
 
-    public UdpServer()
+    /// <summary>
+    /// Every device that has sent to any of our ports
+    /// </summary>
+    public DeviceSessions Sessions { get; } = new();
+
+    /// <summary>
+    /// Datagrams dropped because their worker was too far behind
+    /// </summary>
+    public long Dropped => Interlocked.Read(ref _dropped);
+
+    public UdpServer() : this(Environment.ProcessorCount) { }
+
+    public UdpServer(int workerCount)
     {
-        TotalIn = 0;
-        TotalOut = 0;
+        _workQueues = new Channel<Datagram>[Math.Max(1, workerCount)];
+        for (var i = 0; i < _workQueues.Length; i++)
+        {
+            _workQueues[i] = Channel.CreateBounded<Datagram>(new BoundedChannelOptions(WorkerQueueDepth)
+            {
+                SingleReader = true,
+                SingleWriter = false,
+                FullMode = BoundedChannelFullMode.Wait // we use TryWrite, so a full queue fails instead of waiting
+            });
+        }
     }
 
     private class Responder
     {
+        public int Port { get; }
         public UdpResponder Action { get; }
-        public UdpClient Client { get; }
-        public Thread? WaitThread { get; set; }
+        public Socket Socket { get; }
 
-        public Responder(int port, UdpResponder action)
+        public Responder(int port, UdpResponder action, IPAddress bindTo)
         {
+            Port = port;
             Action = action;
-            Client = new UdpClient(new IPEndPoint(IPAddress.Any, port));
+            Socket = new Socket(AddressFamily.InterNetwork, SocketType.Dgram, ProtocolType.Udp);
+            if (OperatingSystem.IsWindows()) Socket.IOControl(SioUdpConnReset, new byte[] { 0, 0, 0, 0 }, null);
+            Socket.Bind(new IPEndPoint(bindTo, port));
         }
     }
 
-    public void AddResponder(int port, UdpResponder action)
+    /// <summary>
+    /// A received datagram. 'Data' is its own array, sized to the datagram, which the responder keeps.
+    /// </summary>
+    private readonly record struct Datagram(Responder Responder, byte[] Data, IPEndPoint Sender);
+
+    /// <summary>
+    /// Listen on a port, on all interfaces unless 'bindTo' is given
+    /// </summary>
+    public void AddResponder(int port, UdpResponder action, IPAddress? bindTo = null)
     {
         if (_responders.ContainsKey(port)) throw new Exception("This port is already bound");
-        var responder = new Responder(port, action);
-        _responders.Add(port, responder);
-
-        responder.WaitThread = new Thread(() => { ListenLoop(port); }) { IsBackground = true, Name = $"UdpWaitThread_Port_{port}" };
+        _responders.Add(port, new Responder(port, action, bindTo ?? IPAddress.Any));
     }
 
-    private void ListenLoop(int port)
+    private async Task ReceiveLoop(Responder responder)
     {
-        var responder = _responders[port];
-        var sender = new IPEndPoint(IPAddress.Any, 0);
-        
-        Log.Info($"Listening for messages on port {port}...");
-        while (_running)
+        var anyEndpoint = new IPEndPoint(IPAddress.Any, 0);
+        var token = _stop.Token;
+        var buffer = new byte[MaxDatagram]; // device datagrams are a few hundred bytes, so only what arrived is copied out
+
+        while (!token.IsCancellationRequested)
         {
             try
             {
-                if (responder.Client.Available <= 0)
+                var result = await responder.Socket.ReceiveFromAsync(buffer, SocketFlags.None, anyEndpoint, token);
+                var sender = (IPEndPoint)result.RemoteEndPoint;
+                Interlocked.Add(ref _totalIn, result.ReceivedBytes);
+
+                var queue = _workQueues[WorkerFor(sender)];
+                if (!queue.Writer.TryWrite(new Datagram(responder, buffer.AsSpan(0, result.ReceivedBytes).ToArray(), sender)))
                 {
-                    Thread.Sleep(500);
-                    continue; // check we are still running
+                    var dropped = Interlocked.Increment(ref _dropped);
+                    if ((dropped & (dropped - 1)) == 0) Log.Warn($"UDP worker queue full. {dropped} datagrams dropped so far");
                 }
-
-                var buffer = responder.Client.Receive(ref sender);
-                TotalIn += (ulong)buffer.Length;
-                var returnPath = new UpdSender(responder.Client, sender, this);
-                responder.Action(buffer, sender, returnPath);
-                
-                Log.Info($"Transaction complete. Total data in={TotalIn}, out={TotalOut};");
+            }
+            catch (OperationCanceledException)
+            {
+                break;
+            }
+            catch (ObjectDisposedException)
+            {
+                break;
+            }
+            catch (SocketException ex) when (ex.SocketErrorCode == SocketError.ConnectionReset)
+            {
+                // ICMP from an earlier send; nothing to do with this receive
             }
             catch (Exception ex)
             {
-                Log.Error($"Failure in ListenLoop loop for port {port}", ex);
+                Log.Error($"Failure in receive loop for port {responder.Port}", ex);
+            }
+        }
+        Log.Info($"Closing listener for port {responder.Port}...");
+    }
+
+    /// <summary>
+    /// Pick a worker by sender address, so one device always uses the same worker
+    /// </summary>
+    private int WorkerFor(IPEndPoint sender)
+    {
+        var hash = (uint)HashCode.Combine(sender.Address, sender.Port);
+        return (int)(hash % (uint)_workQueues.Length);
+    }
+
+    private async Task WorkerLoop(ChannelReader<Datagram> queue)
+    {
+        try
+        {
+            while (await queue.WaitToReadAsync(_stop.Token))
+            {
+                while (queue.TryRead(out var datagram))
+                {
+                    Handle(datagram);
+                }
             }
         }
-        Log.Info($"Closing listener for port {port}...");
+        catch (OperationCanceledException)
+        {
+            // stopping
+        }
+    }
+
+    private void Handle(Datagram datagram)
+    {
+        try
+        {
+            var session = Sessions.For(datagram.Sender);
+            var returnPath = new UpdSender(datagram.Responder.Socket, datagram.Sender, this, session);
+            session.Received(datagram.Data.Length, datagram.Sender, returnPath);
+            datagram.Responder.Action(datagram.Data, datagram.Sender, returnPath);
+
+            Log.Info($"Transaction complete. Total data in={TotalIn}, out={TotalOut};");
+        }
+        catch (Exception ex)
+        {
+            Log.Error($"Failure in responder for port {datagram.Responder.Port}", ex);
+        }
     }
 
+    internal void CountOut(int bytes) => Interlocked.Add(ref _totalOut, bytes);
+
     public void Start()
     {
-        _running = true;
+        foreach (var queue in _workQueues)
+        {
+            _tasks.Add(Task.Run(() => WorkerLoop(queue.Reader)));
+        }
 
         foreach (var responder in _responders.Values)
         {
-            responder.WaitThread?.Start();
+            Log.Info($"Listening for messages on port {responder.Port}...");
+            for (var i = 0; i < ReceivesPerPort; i++)
+            {
+                _tasks.Add(Task.Run(() => ReceiveLoop(responder)));
+            }
         }
     }
 
     public void Dispose()
     {
-        _running = false;
-       
+        if (_disposed) return;
+        _disposed = true;
+        _stop.Cancel();
+
         foreach (var responder in _responders.Values)
         {
-            responder.Client.Dispose();
+            responder.Socket.Dispose();
+        }
+
+        try
+        {
+            Task.WaitAll(_tasks.ToArray(), TimeSpan.FromSeconds(2));
+        }
+        catch (AggregateException)
+        {
+            // loops end with cancellation; nothing more to report
         }
+
+        _stop.Dispose();
         GC.SuppressFinalize(this);
     }
 }